@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cpu.h"
+#include "bank.h"
+#include "image.h"
+
+/*
+    Bank switched memory, the way MP/M and CP/M 3 machines did it: the low
+    part of the address space is switched between banks by an OUT, the top
+    is common to all of them so the code doing the switching (and the
+    stack it returns through) stays put.
+
+    A switch is nothing but page pointers. Every window of the banked
+    region is windowSize bytes (4K or 16K on most hardware) and selecting a
+    bank for it maps that window's slice of the bank with MemMapRam(),
+    which is windowSize / MEM_PAGE_SIZE table entries; no bytes move.
+    Bank 0 is memory[] itself, so a machine that is back in bank 0 is the
+    flat bus again and runs on the block cache or the JIT. Code in any
+    other bank runs in Run().
+
+    OUT port, n selects bank n for every window at once. OUT port + 1 + w,
+    n selects it for window w only. n is taken modulo the bank count.
+*/
+
+int BankInit(BankedMemory *bank, uint32_t windowSize, uint32_t windowCount, uint32_t bankCount, uint8_t port) {
+    uint32_t banked = windowSize * windowCount;
+
+    memset(bank, 0, sizeof(*bank));
+
+    if (windowSize == 0 || (windowSize & (MEM_PAGE_SIZE - 1)) || windowCount == 0 ||
+        windowCount > BANK_MAX_WINDOWS || banked > MEM_MAX || bankCount < 2 ||
+        (unsigned long)bankCount * banked > BANK_MAX_STORE || port + 1 + windowCount > NUM_IO_PORTS) {
+        return -1;
+    }
+
+    bank->store = (uint8_t *)calloc(bankCount - 1, banked);
+
+    if (!bank->store) {
+        return -1;
+    }
+
+    bank->windowSize = windowSize;
+    bank->windowCount = windowCount;
+    bank->bankCount = bankCount;
+    bank->port = port;
+
+    return 0;
+}
+
+void BankFree(BankedMemory *bank) {
+    free(bank->store);
+    bank->store = NULL;
+}
+
+/* After CpuInit(): takes the bank ports and maps the windows to whatever banks they had selected */
+void BankAttach(Cpu8080 *cpu, BankedMemory *bank) {
+    cpu->bank = bank;
+    IoRegister(cpu, bank->port, bank->windowCount + 1, NULL, BankPortWrite, bank);
+
+    for (uint32_t window = 0; window < bank->windowCount; window++) {
+        uint8_t number = bank->window[window];
+
+        /* Forces the remap, CpuInit() put memory[] there */
+        bank->window[window] = 0;
+        BankSelect(cpu, window, number);
+    }
+}
+
+/* Maps bank number into window; nothing to do if it is there already */
+void BankSelect(Cpu8080 *cpu, uint32_t window, uint8_t number) {
+    BankedMemory *bank = cpu->bank;
+    uint32_t offset = window * bank->windowSize;
+    uint8_t *host;
+
+    number = (uint8_t)(number % bank->bankCount);
+
+    if (window >= bank->windowCount || bank->window[window] == number) {
+        return;
+    }
+
+    if (number == 0) {
+        /* A machine sharing a program image needs its own bytes there first */
+        ImageUnshare(cpu, (uint16_t)offset, bank->windowSize);
+        host = &cpu->memory[offset];
+    } else {
+        host = bank->store + (size_t)(number - 1) * bank->windowSize * bank->windowCount + offset;
+    }
+
+    MemMapRam(cpu, (uint16_t)offset, bank->windowSize, host);
+    bank->window[window] = number;
+    bank->stats.switches++;
+}
+
+/* The write handler of the bank ports, see BankAttach() */
+void BankPortWrite(Cpu8080 *cpu, uint8_t port, uint8_t value, void *context) {
+    BankedMemory *bank = (BankedMemory *)context;
+
+    bank->stats.selects++;
+
+    if (port == bank->port) {
+        for (uint32_t window = 0; window < bank->windowCount; window++) {
+            BankSelect(cpu, window, value);
+        }
+
+        return;
+    }
+
+    BankSelect(cpu, (uint32_t)(port - bank->port - 1), value);
+}
+
+void BankPrintStats(const BankedMemory *bank) {
+    printf("[banks] %u banks of %u x %uK, %llu selects, %llu windows switched\n",
+        bank->bankCount, bank->windowCount, bank->windowSize >> 10,
+        bank->stats.selects, bank->stats.switches);
+}
@@ -0,0 +1,48 @@
+#ifndef BANK_H
+#define BANK_H
+
+#include <stdint.h>
+#include "cpu.h"
+
+/* Most backing store one BankedMemory can have, bank 0 (memory[]) included */
+#define BANK_MAX_STORE              (1UL << 20)
+
+/* The banked region is cut into at most this many windows */
+#define BANK_MAX_WINDOWS            16
+
+/* What main() sets up for --banks: 16K windows, 48K banked, 16K common */
+#define BANK_DEFAULT_WINDOW         0x4000
+#define BANK_DEFAULT_BANKED         0xC000
+#define BANK_DEFAULT_PORT           0x40
+
+typedef struct {
+    unsigned long long switches;        /* windows actually remapped */
+    unsigned long long selects;         /* OUTs to a bank port */
+} BankStats;
+
+/*
+    Bank switched memory, see bank.c. [0, windowSize * windowCount) is
+    banked, everything above it is common and always memory[]. Bank 0 is
+    memory[] itself, banks 1 and up live in store.
+*/
+struct BankedMemory {
+    uint8_t *store;
+    uint32_t windowSize;
+    uint32_t windowCount;
+    uint32_t bankCount;                 /* bank 0 included */
+    uint8_t port;                       /* OUT port selects every window, port + 1 + n window n */
+    uint8_t window[BANK_MAX_WINDOWS];   /* bank each window shows now */
+    BankStats stats;
+};
+
+int BankInit(BankedMemory *bank, uint32_t windowSize, uint32_t windowCount, uint32_t bankCount, uint8_t port);
+void BankFree(BankedMemory *bank);
+void BankAttach(Cpu8080 *cpu, BankedMemory *bank);
+void BankSelect(Cpu8080 *cpu, uint32_t window, uint8_t number);
+void BankPortWrite(Cpu8080 *cpu, uint8_t port, uint8_t value, void *context);
+void BankPrintStats(const BankedMemory *bank);
+
+/* Bank switching check against Step(), see selfcheck.c */
+int BankSelfCheck(void);
+
+#endif
@@ -1,40 +1,43 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <string.h>
 #include "bdos.h"
 #include "cpu.h"
+#include "replay.h"
 
 /*
     Senor please see here:
     http://cpmarchives.classiccmp.org/cpm/mirrors/electrickery.xs4all.nl/comp/divcomp/doc/TPCH05.pdf
 */
 
-#define MAX_OPEN_FILES 16
-
-typedef struct {
-    FILE *fp;
-    uint16_t fcb_addr;
-} OpenFile;
-
-static OpenFile openFiles[MAX_OPEN_FILES];
-static uint16_t dmaAddress = 0x0080;
-static uint8_t currentDisk = 0;
-
-void BDOS_Init(void) {
-    dmaAddress = 0x0080;
-    currentDisk = 0;
+void BDOS_Init(BdosState *bdos) {
+    bdos->dmaAddress = 0x0080;
+    bdos->currentDisk = 0;
     
     for (int idx = 0; idx < MAX_OPEN_FILES; idx++) {
-        openFiles[idx].fp = NULL;
-        openFiles[idx].fcb_addr = 0;
+        bdos->openFiles[idx].fp = NULL;
+        bdos->openFiles[idx].fcb_addr = 0;
+        bdos->openFiles[idx].name[0] = '\0';
     }
 }
 
-static void GetFilename(uint16_t fcb_addr, char *dest) {
+/* Closes whatever the program left open so the state can be reused for the next job */
+void BDOS_Shutdown(BdosState *bdos) {
+    for (int idx = 0; idx < MAX_OPEN_FILES; idx++) {
+        if (bdos->openFiles[idx].fp != NULL) {
+            fclose(bdos->openFiles[idx].fp);
+        }
+    }
+
+    BDOS_Init(bdos);
+}
+
+static void GetFilename(Cpu8080 *cpu, uint16_t fcb_addr, char *dest) {
     int pos = 0;
     
     for (int idx = 0; idx < 8; idx++) {
-        char c = (char)MemRead(fcb_addr + 1 + idx);
+        char c = (char)MemRead(cpu, fcb_addr + 1 + idx);
         
         if (c != ' ') {
             dest[pos++] = (char)tolower(c);
@@ -45,7 +48,7 @@ static void GetFilename(uint16_t fcb_addr, char *dest) {
     int extPos = 0;
     
     for (int idx = 0; idx < 3; idx++) {
-        char c = (char)MemRead(fcb_addr + 9 + idx);
+        char c = (char)MemRead(cpu, fcb_addr + 9 + idx);
         
         if (c != ' ') {
             ext[extPos++] = (char)tolower(c);
@@ -63,9 +66,38 @@ static void GetFilename(uint16_t fcb_addr, char *dest) {
     dest[pos] = '\0';
 }
 
-static int FindFileHandle(uint16_t fcb_addr) {
+/* Read-write if we may, read-only otherwise */
+static FILE *OpenExisting(const char *filename) {
+    FILE *file = fopen(filename, "rb+");
+
+    return file ? file : fopen(filename, "rb");
+}
+
+/*
+    For LoadState(): opens name again as handle for the FCB at fcbAddr,
+    at position. FALSE (and the handle stays closed) if it is gone.
+*/
+Bool BDOS_ReopenFile(BdosState *bdos, int handle, const char *name, uint16_t fcbAddr, long position) {
+    OpenFile *open = &bdos->openFiles[handle];
+    FILE *file = OpenExisting(name);
+
+    if (!file || fseek(file, position, SEEK_SET) != 0) {
+        if (file) {
+            fclose(file);
+        }
+
+        return FALSE;
+    }
+
+    open->fp = file;
+    open->fcb_addr = fcbAddr;
+    snprintf(open->name, sizeof(open->name), "%s", name);
+    return TRUE;
+}
+
+static int FindFileHandle(BdosState *bdos, uint16_t fcb_addr) {
     for (int idx = 0; idx < MAX_OPEN_FILES; idx++) {
-        if (openFiles[idx].fp != NULL && openFiles[idx].fcb_addr == fcb_addr) {
+        if (bdos->openFiles[idx].fp != NULL && bdos->openFiles[idx].fcb_addr == fcb_addr) {
             return idx;
         }
     }
@@ -73,9 +105,9 @@ static int FindFileHandle(uint16_t fcb_addr) {
     return -1;
 }
 
-static int GetFreeHandle(void) {
+static int GetFreeHandle(BdosState *bdos) {
     for (int idx = 0; idx < MAX_OPEN_FILES; idx++) {
-        if (openFiles[idx].fp == NULL) {
+        if (bdos->openFiles[idx].fp == NULL) {
             return idx;
         }
     }
@@ -83,34 +115,81 @@ static int GetFreeHandle(void) {
     return -1;
 }
 
-void BDOS_Call(void) {
-    uint8_t func = registers[REG_C];
-    uint16_t de = (registers[REG_D] << 8) | registers[REG_E];
+/* Console input, the one place a keystroke comes in; see replay.c */
+static int ConsoleIn(Cpu8080 *cpu) {
+    return cpu->replay ? ReplayConsoleIn(cpu) : getchar();
+}
+
+/* Console output, once: not again while a timeline runs over it (see ReplayRerun()) */
+static void ConsoleOut(Cpu8080 *cpu, int ch) {
+    if (!cpu->replay || !ReplayRerun(cpu)) {
+        putchar(ch);
+    }
+}
+
+/* The calls whose answer depends on the host file system */
+static Bool IsFileCall(uint8_t func) {
+    switch (func) {
+        case 15: case 16: case 17: case 19: case 20: case 21: case 22:
+        case 23: case 33: case 34: case 35: case 36: case 40:
+            return TRUE;
+
+        default:
+            return FALSE;
+    }
+}
+
+/* Logs what a file call answered: A, and the bytes it stored if it read something */
+static void RecordFileCall(Cpu8080 *cpu, BdosState *bdos, uint8_t func, uint16_t de) {
+    uint16_t addr = 0;
+    uint16_t size = 0;
+
+    if (cpu->registers[REG_A] == 0) {
+        if (func == 20 || func == 33) {
+            addr = bdos->dmaAddress;
+            size = 128;
+        } else if (func == 35 || func == 36) {
+            addr = (uint16_t)(de + 33);
+            size = 3;
+        }
+    }
+
+    ReplayFileRecord(cpu, func, addr, size);
+}
+
+void BDOS_Call(Cpu8080 *cpu, BdosState *bdos) {
+    uint8_t func = cpu->registers[REG_C];
+    uint16_t de = cpu->pairs[RP_DE];
+
+    /* Replaying, file calls are answered from the log and never reach the host */
+    if (cpu->replay && IsFileCall(func) && ReplayFilePlay(cpu, func)) {
+        return;
+    }
 
     switch (func) {
         case 0: {
-            halted = TRUE;
+            cpu->halted = TRUE;
             break;
         }
 
         case 1: {
-            int c = getchar();
+            int c = ConsoleIn(cpu);
             
-            registers[REG_A] = (c == EOF) ? 0x1A : (uint8_t)c;
-            registers[REG_L] = registers[REG_A];
+            cpu->registers[REG_A] = (c == EOF) ? 0x1A : (uint8_t)c;
+            cpu->registers[REG_L] = cpu->registers[REG_A];
             
             break;
         }
 
         case 2: {
-            putchar(registers[REG_E]);
+            ConsoleOut(cpu, cpu->registers[REG_E]);
             fflush(stdout);
             break;
         }
 
         case 3: {
-            registers[REG_A] = 0x1A;
-            registers[REG_L] = registers[REG_A];
+            cpu->registers[REG_A] = 0x1A;
+            cpu->registers[REG_L] = cpu->registers[REG_A];
             break;
         }
 
@@ -119,17 +198,17 @@ void BDOS_Call(void) {
         }
 
         case 5: {
-            putchar(registers[REG_E]);
+            ConsoleOut(cpu, cpu->registers[REG_E]);
             fflush(stdout);
             break;
         }
 
         case 6: {
-            if (registers[REG_E] == 0xFF) {
-                registers[REG_A] = 0;
-                registers[REG_L] = 0;
+            if (cpu->registers[REG_E] == 0xFF) {
+                cpu->registers[REG_A] = 0;
+                cpu->registers[REG_L] = 0;
             } else {
-                putchar(registers[REG_E]);
+                ConsoleOut(cpu, cpu->registers[REG_E]);
                 fflush(stdout);
             }
             
@@ -137,8 +216,8 @@ void BDOS_Call(void) {
         }
 
         case 7: {
-            registers[REG_A] = 0;
-            registers[REG_L] = 0;
+            cpu->registers[REG_A] = 0;
+            cpu->registers[REG_L] = 0;
             
             break;
         }
@@ -151,8 +230,8 @@ void BDOS_Call(void) {
             uint16_t addr = de;
             char c;
             
-            while ((c = MemRead(addr++)) != '$') {
-                putchar(c);
+            while ((c = MemRead(cpu, addr++)) != '$') {
+                ConsoleOut(cpu, c);
             }
             
             fflush(stdout);
@@ -161,113 +240,112 @@ void BDOS_Call(void) {
 
         case 10: {
             uint16_t addr = de;
-            uint8_t maxlen = MemRead(addr);
+            uint8_t maxlen = MemRead(cpu, addr);
             uint8_t len = 0;
             int ch;
             
             addr++;
             uint16_t bufStart = addr + 1;
             
-            while (len < maxlen && (ch = getchar()) != '\n' && ch != EOF) {
+            while (len < maxlen && (ch = ConsoleIn(cpu)) != '\n' && ch != EOF) {
                 if (ch == '\b' || ch == 127) {
                     if (len > 0) {
                         len--;
                         
-                        printf("\b \b");
+                        ConsoleOut(cpu, '\b');
+                        ConsoleOut(cpu, ' ');
+                        ConsoleOut(cpu, '\b');
                         fflush(stdout);
                     }
                 } else {
-                    MemWrite(bufStart + len, (uint8_t)ch);
+                    MemWrite(cpu, bufStart + len, (uint8_t)ch);
                     
-                    putchar(ch);
+                    ConsoleOut(cpu, ch);
                     fflush(stdout);
                     
                     len++;
                 }
             }
             
-            MemWrite(addr, len);
+            MemWrite(cpu, addr, len);
             
-            putchar('\n');
+            ConsoleOut(cpu, '\n');
             fflush(stdout);
             
             break;
         }
 
         case 11: {
-            registers[REG_A] = 0;
-            registers[REG_L] = 0;
+            cpu->registers[REG_A] = 0;
+            cpu->registers[REG_L] = 0;
             break;
         }
 
         case 12: {
-            registers[REG_H] = 0x00;
-            registers[REG_L] = 0x22;
-            registers[REG_B] = 0x00;
-            registers[REG_A] = 0x22;
+            cpu->registers[REG_H] = 0x00;
+            cpu->registers[REG_L] = 0x22;
+            cpu->registers[REG_B] = 0x00;
+            cpu->registers[REG_A] = 0x22;
             break;
         }
 
         case 13: {
-            currentDisk = 0;
-            dmaAddress = 0x0080;
+            bdos->currentDisk = 0;
+            bdos->dmaAddress = 0x0080;
             
-            registers[REG_A] = 0;
-            registers[REG_L] = 0;
+            cpu->registers[REG_A] = 0;
+            cpu->registers[REG_L] = 0;
             
             break;
         }
 
         case 14: {
-            currentDisk = registers[REG_E];
-            registers[REG_A] = 0;
-            registers[REG_L] = 0;
+            bdos->currentDisk = cpu->registers[REG_E];
+            cpu->registers[REG_A] = 0;
+            cpu->registers[REG_L] = 0;
             break;
         }
 
         case 15: {
             char filename[13];
-            GetFilename(de, filename);
+            GetFilename(cpu, de, filename);
             
-            int handle = GetFreeHandle();
+            int handle = GetFreeHandle(bdos);
             if (handle == -1) {
-                registers[REG_A] = 0xFF;
-                registers[REG_L] = 0xFF;
+                cpu->registers[REG_A] = 0xFF;
+                cpu->registers[REG_L] = 0xFF;
                 break;
             }
             
-            FILE *file = fopen(filename, "rb+");
-            
-            if (!file) {
-                file = fopen(filename, "rb");
-            }
+            FILE *file = OpenExisting(filename);
             
             if (file) {
-                openFiles[handle].fp = file;
-                openFiles[handle].fcb_addr = de;
-                registers[REG_A] = 0;
-                registers[REG_L] = 0;
+                bdos->openFiles[handle].fp = file;
+                bdos->openFiles[handle].fcb_addr = de;
+                strcpy(bdos->openFiles[handle].name, filename);
+                cpu->registers[REG_A] = 0;
+                cpu->registers[REG_L] = 0;
             } else {
-                registers[REG_A] = 0xFF;
-                registers[REG_L] = 0xFF;
+                cpu->registers[REG_A] = 0xFF;
+                cpu->registers[REG_L] = 0xFF;
             }
             
             break;
         }
 
         case 16: {
-            int handle = FindFileHandle(de);
+            int handle = FindFileHandle(bdos, de);
             
             if (handle != -1) {
-                fclose(openFiles[handle].fp);
+                fclose(bdos->openFiles[handle].fp);
                 
-                openFiles[handle].fp = NULL;
-                openFiles[handle].fcb_addr = 0;
-                registers[REG_A] = 0;
-                registers[REG_L] = 0;
+                bdos->openFiles[handle].fp = NULL;
+                bdos->openFiles[handle].fcb_addr = 0;
+                cpu->registers[REG_A] = 0;
+                cpu->registers[REG_L] = 0;
             } else {
-                registers[REG_A] = 0xFF;
-                registers[REG_L] = 0xFF;
+                cpu->registers[REG_A] = 0xFF;
+                cpu->registers[REG_L] = 0xFF;
             }
             
             break;
@@ -275,95 +353,95 @@ void BDOS_Call(void) {
 
         case 17: {
             char filename[13];
-            GetFilename(de, filename);
+            GetFilename(cpu, de, filename);
             
             FILE *file = fopen(filename, "rb");
             
             if (file) {
                 fclose(file);
-                registers[REG_A] = 0;
-                registers[REG_L] = 0;
+                cpu->registers[REG_A] = 0;
+                cpu->registers[REG_L] = 0;
             } else {
-                registers[REG_A] = 0xFF;
-                registers[REG_L] = 0xFF;
+                cpu->registers[REG_A] = 0xFF;
+                cpu->registers[REG_L] = 0xFF;
             }
             
             break;
         }
 
         case 18: {
-            registers[REG_A] = 0xFF;
-            registers[REG_L] = 0xFF;
+            cpu->registers[REG_A] = 0xFF;
+            cpu->registers[REG_L] = 0xFF;
             break;
         }
 
         case 19: {
             char filename[13];
-            GetFilename(de, filename);
+            GetFilename(cpu, de, filename);
             
             if (remove(filename) == 0) {
-                registers[REG_A] = 0;
-                registers[REG_L] = 0;
+                cpu->registers[REG_A] = 0;
+                cpu->registers[REG_L] = 0;
             } else {
-                registers[REG_A] = 0xFF;
-                registers[REG_L] = 0xFF;
+                cpu->registers[REG_A] = 0xFF;
+                cpu->registers[REG_L] = 0xFF;
             }
             
             break;
         }
 
         case 20: {
-            int handle = FindFileHandle(de);
+            int handle = FindFileHandle(bdos, de);
             
             if (handle != -1) {
                 uint8_t buffer[128];
-                size_t n = fread(buffer, 1, 128, openFiles[handle].fp);
+                size_t n = fread(buffer, 1, 128, bdos->openFiles[handle].fp);
             
                 if (n > 0) {
                     for (size_t idx = 0; idx < n; idx++) {
-                        MemWrite(dmaAddress + (uint16_t)idx, buffer[idx]);
+                        MemWrite(cpu, bdos->dmaAddress + (uint16_t)idx, buffer[idx]);
                     }
             
                     /* Pad rest with ^Z if needed */
                     for (size_t idx = n; idx < 128; idx++) {
-                        MemWrite(dmaAddress + (uint16_t)idx, 0x1A);
+                        MemWrite(cpu, bdos->dmaAddress + (uint16_t)idx, 0x1A);
                     }
             
-                    registers[REG_A] = 0;
-                    registers[REG_L] = 0;
+                    cpu->registers[REG_A] = 0;
+                    cpu->registers[REG_L] = 0;
                 } else {
                     /* EOF */
-                    registers[REG_A] = 1;
-                    registers[REG_L] = 1;
+                    cpu->registers[REG_A] = 1;
+                    cpu->registers[REG_L] = 1;
                 }
             } else {
-                registers[REG_A] = 0xFF;
-                registers[REG_L] = 0xFF;
+                cpu->registers[REG_A] = 0xFF;
+                cpu->registers[REG_L] = 0xFF;
             }
             
             break;
         }
 
         case 21: {
-            int handle = FindFileHandle(de);
+            int handle = FindFileHandle(bdos, de);
             
             if (handle != -1) {
                 uint8_t buffer[128];
             
                 for (int idx = 0; idx < 128; idx++) {
-                    buffer[idx] = MemRead(dmaAddress + (uint16_t)idx);
+                    buffer[idx] = MemRead(cpu, bdos->dmaAddress + (uint16_t)idx);
                 }
             
-                if (fwrite(buffer, 1, 128, openFiles[handle].fp) == 128) {
-                    registers[REG_A] = 0;
-                    registers[REG_L] = 0;
+                if (fwrite(buffer, 1, 128, bdos->openFiles[handle].fp) == 128) {
+                    cpu->registers[REG_A] = 0;
+                    cpu->registers[REG_L] = 0;
                 } else {
-                    registers[REG_A] = 0xFF;
-                    registers[REG_L] = 0xFF;
+                    cpu->registers[REG_A] = 0xFF;
+                    cpu->registers[REG_L] = 0xFF;
                 }
             } else {
-                registers[REG_A] = 0xFF;
-                registers[REG_L] = 0xFF;
+                cpu->registers[REG_A] = 0xFF;
+                cpu->registers[REG_L] = 0xFF;
             }
             
             break;
@@ -371,26 +449,27 @@ void BDOS_Call(void) {
 
         case 22: {
             char filename[13];
-            GetFilename(de, filename);
+            GetFilename(cpu, de, filename);
             
-            int handle = GetFreeHandle();
+            int handle = GetFreeHandle(bdos);
             
             if (handle == -1) {
-                registers[REG_A] = 0xFF;
-                registers[REG_L] = 0xFF;
+                cpu->registers[REG_A] = 0xFF;
+                cpu->registers[REG_L] = 0xFF;
                 break;
             }
             
             FILE *file = fopen(filename, "wb+");
             
             if (file) {
-                openFiles[handle].fp = file;
-                openFiles[handle].fcb_addr = de;
-                registers[REG_A] = 0;
-                registers[REG_L] = 0;
+                bdos->openFiles[handle].fp = file;
+                bdos->openFiles[handle].fcb_addr = de;
+                strcpy(bdos->openFiles[handle].name, filename);
+                cpu->registers[REG_A] = 0;
+                cpu->registers[REG_L] = 0;
             } else {
-                registers[REG_A] = 0xFF;
-                registers[REG_L] = 0xFF;
+                cpu->registers[REG_A] = 0xFF;
+                cpu->registers[REG_L] = 0xFF;
             }
             
             break;
@@ -398,41 +477,41 @@ void BDOS_Call(void) {
 
         case 23: {
             char oldname[13], newname[13];
-            GetFilename(de, oldname);
-            GetFilename(de + 16, newname);
+            GetFilename(cpu, de, oldname);
+            GetFilename(cpu, de + 16, newname);
             
             if (rename(oldname, newname) == 0) {
-                registers[REG_A] = 0;
-                registers[REG_L] = 0;
+                cpu->registers[REG_A] = 0;
+                cpu->registers[REG_L] = 0;
             } else {
-                registers[REG_A] = 0xFF;
-                registers[REG_L] = 0xFF;
+                cpu->registers[REG_A] = 0xFF;
+                cpu->registers[REG_L] = 0xFF;
             }
             
             break;
         }
 
         case 24: {
-            registers[REG_H] = 0x00;
-            registers[REG_L] = 0x01;
-            registers[REG_A] = 0x01;
+            cpu->registers[REG_H] = 0x00;
+            cpu->registers[REG_L] = 0x01;
+            cpu->registers[REG_A] = 0x01;
             break;
         }
 
         case 25: {
-            registers[REG_A] = currentDisk;
-            registers[REG_L] = currentDisk;
+            cpu->registers[REG_A] = bdos->currentDisk;
+            cpu->registers[REG_L] = bdos->currentDisk;
             break;
         }
 
         case 26: {
-            dmaAddress = de;
+            bdos->dmaAddress = de;
             break;
         }
 
         case 27: {
-            registers[REG_H] = 0x00;
-            registers[REG_L] = 0x00;
+            cpu->registers[REG_H] = 0x00;
+            cpu->registers[REG_L] = 0x00;
             break;
         }
 
@@ -441,92 +520,92 @@ void BDOS_Call(void) {
         }
 
         case 29: {
-            registers[REG_H] = 0x00;
-            registers[REG_L] = 0x00;
-            registers[REG_A] = 0x00;
+            cpu->registers[REG_H] = 0x00;
+            cpu->registers[REG_L] = 0x00;
+            cpu->registers[REG_A] = 0x00;
             break;
         }
 
         case 30: {
-            registers[REG_A] = 0xFF;
-            registers[REG_L] = 0xFF;
+            cpu->registers[REG_A] = 0xFF;
+            cpu->registers[REG_L] = 0xFF;
             break;
         }
 
         case 31: {
-            registers[REG_H] = 0x00;
-            registers[REG_L] = 0x00;
+            cpu->registers[REG_H] = 0x00;
+            cpu->registers[REG_L] = 0x00;
             break;
         }
 
         case 32: {
-            if (registers[REG_E] == 0xFF) {
-                registers[REG_A] = 0;
-                registers[REG_L] = 0;
+            if (cpu->registers[REG_E] == 0xFF) {
+                cpu->registers[REG_A] = 0;
+                cpu->registers[REG_L] = 0;
             } else {
-                registers[REG_A] = 0;
-                registers[REG_L] = 0;
+                cpu->registers[REG_A] = 0;
+                cpu->registers[REG_L] = 0;
             }
             
             break;
         }
 
         case 33: {
-            int handle = FindFileHandle(de);
+            int handle = FindFileHandle(bdos, de);
             
             if (handle != -1) {
-                uint32_t record = MemRead(de + 33) | (MemRead(de + 34) << 8) | (MemRead(de + 35) << 16);
-                fseek(openFiles[handle].fp, record * 128, SEEK_SET);
+                uint32_t record = MemRead(cpu, de + 33) | (MemRead(cpu, de + 34) << 8) | (MemRead(cpu, de + 35) << 16);
+                fseek(bdos->openFiles[handle].fp, record * 128, SEEK_SET);
                 
                 uint8_t buffer[128];
-                size_t n = fread(buffer, 1, 128, openFiles[handle].fp);
+                size_t n = fread(buffer, 1, 128, bdos->openFiles[handle].fp);
             
                 if (n > 0) {
                     for (size_t idx = 0; idx < n; idx++) {
-                        MemWrite(dmaAddress + (uint16_t)idx, buffer[idx]);
+                        MemWrite(cpu, bdos->dmaAddress + (uint16_t)idx, buffer[idx]);
                     }
 
                     for (size_t idx = n; idx < 128; idx++) {
-                        MemWrite(dmaAddress + (uint16_t)idx, 0x1A);
+                        MemWrite(cpu, bdos->dmaAddress + (uint16_t)idx, 0x1A);
                     }
             
-                    registers[REG_A] = 0;
-                    registers[REG_L] = 0;
+                    cpu->registers[REG_A] = 0;
+                    cpu->registers[REG_L] = 0;
                 } else {
-                    registers[REG_A] = 1;
-                    registers[REG_L] = 1;
+                    cpu->registers[REG_A] = 1;
+                    cpu->registers[REG_L] = 1;
                 }
             } else {
-                registers[REG_A] = 0xFF;
-                registers[REG_L] = 0xFF;
+                cpu->registers[REG_A] = 0xFF;
+                cpu->registers[REG_L] = 0xFF;
             }
             
             break;
         }
 
         case 34: {
-            int handle = FindFileHandle(de);
+            int handle = FindFileHandle(bdos, de);
             
             if (handle != -1) {
-                uint32_t record = MemRead(de + 33) | (MemRead(de + 34) << 8) | (MemRead(de + 35) << 16);
-                fseek(openFiles[handle].fp, record * 128, SEEK_SET);
+                uint32_t record = MemRead(cpu, de + 33) | (MemRead(cpu, de + 34) << 8) | (MemRead(cpu, de + 35) << 16);
+                fseek(bdos->openFiles[handle].fp, record * 128, SEEK_SET);
                 
                 uint8_t buffer[128];
 
                 for (int idx = 0; idx < 128; idx++) {
-                    buffer[idx] = MemRead(dmaAddress + (uint16_t)idx);
+                    buffer[idx] = MemRead(cpu, bdos->dmaAddress + (uint16_t)idx);
                 }
                 
-                if (fwrite(buffer, 1, 128, openFiles[handle].fp) == 128) {
-                    registers[REG_A] = 0;
-                    registers[REG_L] = 0;
+                if (fwrite(buffer, 1, 128, bdos->openFiles[handle].fp) == 128) {
+                    cpu->registers[REG_A] = 0;
+                    cpu->registers[REG_L] = 0;
                 } else {
-                    registers[REG_A] = 0xFF;
-                    registers[REG_L] = 0xFF;
+                    cpu->registers[REG_A] = 0xFF;
+                    cpu->registers[REG_L] = 0xFF;
                 }
             } else {
-                registers[REG_A] = 0xFF;
-                registers[REG_L] = 0xFF;
+                cpu->registers[REG_A] = 0xFF;
+                cpu->registers[REG_L] = 0xFF;
             }
             
             break;
@@ -534,7 +613,7 @@ void BDOS_Call(void) {
 
         case 35: {
             char filename[13];
-            GetFilename(de, filename);
+            GetFilename(cpu, de, filename);
             
             FILE *file = fopen(filename, "rb");
             
@@ -545,80 +624,105 @@ void BDOS_Call(void) {
                 
                 uint32_t records = (uint32_t)((size + 127) / 128);
                 
-                MemWrite(de + 33, records & 0xFF);
-                MemWrite(de + 34, (records >> 8) & 0xFF);
-                MemWrite(de + 35, (records >> 16) & 0xFF);
+                MemWrite(cpu, de + 33, records & 0xFF);
+                MemWrite(cpu, de + 34, (records >> 8) & 0xFF);
+                MemWrite(cpu, de + 35, (records >> 16) & 0xFF);
                 
-                registers[REG_A] = 0;
-                registers[REG_L] = 0;
+                cpu->registers[REG_A] = 0;
+                cpu->registers[REG_L] = 0;
             } else {
-                registers[REG_A] = 0xFF;
-                registers[REG_L] = 0xFF;
+                cpu->registers[REG_A] = 0xFF;
+                cpu->registers[REG_L] = 0xFF;
             }
             
             break;
         }
 
         case 36: {
-            int handle = FindFileHandle(de);
+            int handle = FindFileHandle(bdos, de);
             
             if (handle != -1) {
-                long pos = ftell(openFiles[handle].fp);
+                long pos = ftell(bdos->openFiles[handle].fp);
             
                 uint32_t records = (uint32_t)(pos / 128);
             
-                MemWrite(de + 33, records & 0xFF);
-                MemWrite(de + 34, (records >> 8) & 0xFF);
-                MemWrite(de + 35, (records >> 16) & 0xFF);
+                MemWrite(cpu, de + 33, records & 0xFF);
+                MemWrite(cpu, de + 34, (records >> 8) & 0xFF);
+                MemWrite(cpu, de + 35, (records >> 16) & 0xFF);
             
-                registers[REG_A] = 0;
-                registers[REG_L] = 0;
+                cpu->registers[REG_A] = 0;
+                cpu->registers[REG_L] = 0;
             } else {
-                registers[REG_A] = 0xFF;
-                registers[REG_L] = 0xFF;
+                cpu->registers[REG_A] = 0xFF;
+                cpu->registers[REG_L] = 0xFF;
             }
             
             break;
         }
 
         case 37: {
-            registers[REG_A] = 0;
-            registers[REG_L] = 0;
+            cpu->registers[REG_A] = 0;
+            cpu->registers[REG_L] = 0;
             break;
         }
 
         case 40: {
-            int handle = FindFileHandle(de);
+            int handle = FindFileHandle(bdos, de);
             
             if (handle != -1) {
-                uint32_t record = MemRead(de + 33) | (MemRead(de + 34) << 8) | (MemRead(de + 35) << 16);
-                fseek(openFiles[handle].fp, record * 128, SEEK_SET);
+                uint32_t record = MemRead(cpu, de + 33) | (MemRead(cpu, de + 34) << 8) | (MemRead(cpu, de + 35) << 16);
+                fseek(bdos->openFiles[handle].fp, record * 128, SEEK_SET);
                 
                 uint8_t buffer[128];
 
                 for (int idx = 0; idx < 128; idx++) {
-                    buffer[idx] = MemRead(dmaAddress + (uint16_t)idx);
+                    buffer[idx] = MemRead(cpu, bdos->dmaAddress + (uint16_t)idx);
                 }
                 
-                if (fwrite(buffer, 1, 128, openFiles[handle].fp) == 128) {
-                    registers[REG_A] = 0;
-                    registers[REG_L] = 0;
+                if (fwrite(buffer, 1, 128, bdos->openFiles[handle].fp) == 128) {
+                    cpu->registers[REG_A] = 0;
+                    cpu->registers[REG_L] = 0;
                 } else {
-                    registers[REG_A] = 0xFF;
-                    registers[REG_L] = 0xFF;
+                    cpu->registers[REG_A] = 0xFF;
+                    cpu->registers[REG_L] = 0xFF;
                 }
             } else {
-                registers[REG_A] = 0xFF;
-                registers[REG_L] = 0xFF;
+                cpu->registers[REG_A] = 0xFF;
+                cpu->registers[REG_L] = 0xFF;
             }
             
             break;
         }
 
         default: {
-            registers[REG_A] = 0xFF;
-            registers[REG_L] = 0xFF;
+            cpu->registers[REG_A] = 0xFF;
+            cpu->registers[REG_L] = 0xFF;
             break;
         }
     }
+
+    if (cpu->replay && IsFileCall(func)) {
+        RecordFileCall(cpu, bdos, func, de);
+    }
+}
+
+/* Trap at 0x0005: the call itself, then the RET a real BDOS ends with */
+void BDOS_Entry(Cpu8080 *cpu, uint16_t addr) {
+    (void)addr;
+
+    BDOS_Call(cpu, cpu->bdos);
+    RET(cpu);
+}
+
+/* Trap at 0x0000: there is no CCP to go back to, so the run is over */
+void BDOS_WarmBoot(Cpu8080 *cpu, uint16_t addr) {
+    cpu->PC = addr;
+    cpu->halted = TRUE;
+}
+
+/* Console status and direct console input with nothing typed only report, see TrapPoll */
+Bool BDOS_IsPoll(const Cpu8080 *cpu) {
+    uint8_t func = cpu->registers[REG_C];
+
+    return (Bool)(func == 11 || (func == 6 && cpu->registers[REG_E] == 0xFF));
 }
@@ -1,9 +1,35 @@
 #ifndef BDOS_H
 #define BDOS_H
 
+#include <stdio.h>
 #include <stdint.h>
+#include "cpu.h"
 
-void BDOS_Init(void);
-void BDOS_Call(void);
+#define MAX_OPEN_FILES 16
+
+/* Longest name GetFilename() makes: 8 + '.' + 3, and the NUL */
+#define BDOS_NAME_SIZE 13
+
+typedef struct {
+    FILE *fp;
+    uint16_t fcb_addr;
+    char name[BDOS_NAME_SIZE];          /* host file, so LoadState() can open it again */
+} OpenFile;
+
+struct BdosState {
+    OpenFile openFiles[MAX_OPEN_FILES];
+    uint16_t dmaAddress;
+    uint8_t currentDisk;
+};
+
+void BDOS_Init(BdosState *bdos);
+void BDOS_Shutdown(BdosState *bdos);
+void BDOS_Call(Cpu8080 *cpu, BdosState *bdos);
+Bool BDOS_ReopenFile(BdosState *bdos, int handle, const char *name, uint16_t fcbAddr, long position);
+
+/* Trap handlers for the CP/M entry points, see TrapRegister() */
+void BDOS_Entry(Cpu8080 *cpu, uint16_t addr);
+void BDOS_WarmBoot(Cpu8080 *cpu, uint16_t addr);
+Bool BDOS_IsPoll(const Cpu8080 *cpu);
 
 #endif
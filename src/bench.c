@@ -0,0 +1,475 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cpu.h"
+#include "block.h"
+#include "jit.h"
+#include "event.h"
+#include "bdos.h"
+#include "state.h"
+#include "image.h"
+#include "bench.h"
+
+/*
+    Register pair microbenchmark (--microbench). The loop below does nothing
+    but 16 bit pair work: DAD, INX, DCX, XCHG and a PUSH/POP, the
+    instructions that used to be two byte loads, a shift and two byte stores
+    each. Every engine runs it for the same instruction count through
+    Execute() and has to end in the same state as Step().
+*/
+
+#define MICRO_ORIGIN                0x0100
+#define MICRO_INSTRUCTIONS          50000000ULL
+
+static const uint8_t microProgram[] = {
+    0x31, 0x00, 0xF0,           /* 0100  LXI SP,0F000H */
+    0x01, 0x01, 0x00,           /* 0103  LXI B,1 */
+    0x11, 0x03, 0x00,           /* 0106  LXI D,3 */
+    0x21, 0x00, 0x00,           /* 0109  LXI H,0 */
+    0x09,                       /* 010C  DAD B */
+    0x03,                       /* 010D  INX B */
+    0x19,                       /* 010E  DAD D */
+    0x13,                       /* 010F  INX D */
+    0xEB,                       /* 0110  XCHG */
+    0x29,                       /* 0111  DAD H */
+    0x23,                       /* 0112  INX H */
+    0xEB,                       /* 0113  XCHG */
+    0xE5,                       /* 0114  PUSH H */
+    0x39,                       /* 0115  DAD SP */
+    0xC1,                       /* 0116  POP B */
+    0x1B,                       /* 0117  DCX D */
+    0xC3, 0x0C, 0x01,           /* 0118  JMP loop */
+};
+
+static const char *microEngineNames[] = {
+    "step", "run", "block", "jit"
+};
+
+int MicroBench(void) {
+    Cpu8080 *cpu = (Cpu8080 *)malloc(sizeof(Cpu8080));
+    BlockCache *blocks = (BlockCache *)malloc(sizeof(BlockCache));
+    JitCache *jit = (JitCache *)malloc(sizeof(JitCache));
+    uint8_t ref[REG_FILE_SIZE];
+    uint16_t refPC = 0;
+    int engines = ENGINE_JIT;
+    int mismatches = 0;
+
+    if (!cpu || !blocks || !jit) {
+        fprintf(stderr, "Error: Could not allocate machine state\n");
+        free(cpu);
+        free(blocks);
+        free(jit);
+        return -1;
+    }
+
+    BlockCacheInit(blocks);
+
+    if (JitCacheInit(jit) == 0) {
+        engines = ENGINE_JIT + 1;
+    }
+
+    for (int engine = ENGINE_STEP; engine < engines; engine++) {
+        BlockFlush(blocks);
+
+        if (engine == ENGINE_JIT) {
+            JitFlush(jit);
+        }
+
+        CpuInit(cpu);
+        cpu->engine = (Engine)engine;
+        cpu->blocks = engine == ENGINE_BLOCK ? blocks : NULL;
+        cpu->jit = engine == ENGINE_JIT ? jit : NULL;
+        memcpy(&cpu->memory[MICRO_ORIGIN], microProgram, sizeof(microProgram));
+        CodeRangeWritten(cpu, MICRO_ORIGIN, sizeof(microProgram));
+        cpu->PC = MICRO_ORIGIN;
+
+        clock_t startClock = clock();
+        Execute(cpu, 0, MICRO_INSTRUCTIONS, 0);
+        double seconds = (double)(clock() - startClock) / CLOCKS_PER_SEC;
+
+        if (engine == ENGINE_STEP) {
+            memcpy(ref, cpu->registers, sizeof(ref));
+            refPC = cpu->PC;
+        }
+
+        Bool same = (Bool)(cpu->instructions == MICRO_INSTRUCTIONS && cpu->PC == refPC &&
+            memcmp(cpu->registers, ref, sizeof(ref)) == 0);
+
+        printf("[microbench] engine=%s %llu instructions in %.3f s (%.1f MIPS)%s\n",
+            microEngineNames[engine], cpu->instructions, seconds,
+            seconds > 0 ? (double)cpu->instructions / seconds / 1e6 : 0.0,
+            same ? "" : ", state differs from Step()");
+
+        mismatches += !same;
+    }
+
+    JitCacheFree(jit);
+    free(jit);
+    free(blocks);
+    free(cpu);
+    return (int)(mismatches != 0);
+}
+
+/*
+    Timer interrupt benchmark (--timerbench). The same kind of pair loop
+    with interrupts on and a 60 Hz timer at CPU_CLOCK_HZ raising RST 7,
+    whose handler counts ticks in 0200H. Every engine runs it with the
+    timer and without, so the cost of the events and interrupts shows as
+    the difference, and has to end in the same state as Step().
+*/
+
+#define TIMER_HZ                    60
+#define TIMER_TICKS                 0x0200
+
+static const uint8_t timerHandler[] = {
+    0xF5,                       /* 0038  PUSH PSW */
+    0xE5,                       /* 0039  PUSH H */
+    0x2A, 0x00, 0x02,           /* 003A  LHLD 0200H */
+    0x23,                       /* 003D  INX H */
+    0x22, 0x00, 0x02,           /* 003E  SHLD 0200H */
+    0xE1,                       /* 0041  POP H */
+    0xF1,                       /* 0042  POP PSW */
+    0xFB,                       /* 0043  EI */
+    0xC9,                       /* 0044  RET */
+};
+
+static const uint8_t timerProgram[] = {
+    0x31, 0x00, 0xF0,           /* 0100  LXI SP,0F000H */
+    0xFB,                       /* 0103  EI */
+    0x01, 0x01, 0x00,           /* 0104  LXI B,1 */
+    0x11, 0x03, 0x00,           /* 0107  LXI D,3 */
+    0x21, 0x00, 0x00,           /* 010A  LXI H,0 */
+    0x09,                       /* 010D  DAD B */
+    0x03,                       /* 010E  INX B */
+    0x19,                       /* 010F  DAD D */
+    0x13,                       /* 0110  INX D */
+    0xEB,                       /* 0111  XCHG */
+    0x29,                       /* 0112  DAD H */
+    0x23,                       /* 0113  INX H */
+    0xEB,                       /* 0114  XCHG */
+    0xE5,                       /* 0115  PUSH H */
+    0x39,                       /* 0116  DAD SP */
+    0xC1,                       /* 0117  POP B */
+    0x1B,                       /* 0118  DCX D */
+    0xC3, 0x0D, 0x01,           /* 0119  JMP loop */
+};
+
+static double TimerRun(Cpu8080 *cpu, Engine engine, BlockCache *blocks, JitCache *jit, Timer *timer) {
+    BlockFlush(blocks);
+
+    if (engine == ENGINE_JIT) {
+        JitFlush(jit);
+    }
+
+    CpuInit(cpu);
+    cpu->engine = engine;
+    cpu->blocks = engine == ENGINE_BLOCK ? blocks : NULL;
+    cpu->jit = engine == ENGINE_JIT ? jit : NULL;
+    memcpy(&cpu->memory[0x0038], timerHandler, sizeof(timerHandler));
+    memcpy(&cpu->memory[MICRO_ORIGIN], timerProgram, sizeof(timerProgram));
+    CodeRangeWritten(cpu, 0, MEM_MAX);
+    cpu->PC = MICRO_ORIGIN;
+
+    if (timer) {
+        TimerStart(cpu, timer, CPU_CLOCK_HZ / TIMER_HZ, 7);
+    }
+
+    clock_t startClock = clock();
+    Execute(cpu, 0, MICRO_INSTRUCTIONS, 0);
+
+    return (double)(clock() - startClock) / CLOCKS_PER_SEC;
+}
+
+int TimerBench(void) {
+    Cpu8080 *cpu = (Cpu8080 *)malloc(sizeof(Cpu8080));
+    BlockCache *blocks = (BlockCache *)malloc(sizeof(BlockCache));
+    JitCache *jit = (JitCache *)malloc(sizeof(JitCache));
+    Timer timer;
+    uint8_t ref[REG_FILE_SIZE];
+    uint16_t refPC = 0;
+    unsigned long long refCycles = 0;
+    uint16_t refTicks = 0;
+    int engines = ENGINE_JIT;
+    int mismatches = 0;
+
+    if (!cpu || !blocks || !jit) {
+        fprintf(stderr, "Error: Could not allocate machine state\n");
+        free(cpu);
+        free(blocks);
+        free(jit);
+        return -1;
+    }
+
+    BlockCacheInit(blocks);
+
+    if (JitCacheInit(jit) == 0) {
+        engines = ENGINE_JIT + 1;
+    }
+
+    for (int engine = ENGINE_STEP; engine < engines; engine++) {
+        double off = TimerRun(cpu, (Engine)engine, blocks, jit, NULL);
+        double on = TimerRun(cpu, (Engine)engine, blocks, jit, &timer);
+        uint16_t ticks = (uint16_t)(cpu->memory[TIMER_TICKS] | (cpu->memory[TIMER_TICKS + 1] << 8));
+
+        if (engine == ENGINE_STEP) {
+            memcpy(ref, cpu->registers, sizeof(ref));
+            refPC = cpu->PC;
+            refCycles = cpu->cycles;
+            refTicks = ticks;
+        }
+
+        Bool same = (Bool)(cpu->instructions == MICRO_INSTRUCTIONS && cpu->PC == refPC &&
+            cpu->cycles == refCycles && ticks == refTicks && ticks == timer.ticks &&
+            memcmp(cpu->registers, ref, sizeof(ref)) == 0);
+
+        printf("[timerbench] engine=%s %d Hz, %llu interrupts in %llu cycles: %.1f MIPS, %.1f without the timer%s\n",
+            microEngineNames[engine], TIMER_HZ, cpu->interrupts, cpu->cycles,
+            on > 0 ? (double)cpu->instructions / on / 1e6 : 0.0,
+            off > 0 ? (double)MICRO_INSTRUCTIONS / off / 1e6 : 0.0,
+            same ? "" : ", state differs from Step()");
+
+        mismatches += !same;
+    }
+
+    JitCacheFree(jit);
+    free(jit);
+    free(blocks);
+    free(cpu);
+    return (int)(mismatches != 0);
+}
+
+/*
+    Save state benchmark (--statebench). A full 64K machine (the pair loop
+    in memory otherwise filled with noise, BDOS attached) runs on the JIT,
+    or the block cache without one, then SaveState() and LoadState() are
+    timed over many rounds, loading two states in turn so every load
+    really changes memory. Before that it checks that a loaded state runs
+    on exactly as the original did. Last, ResetRestore() is timed putting
+    back what one run of the loop dirties, next to LoadState() doing the
+    same job for the whole 64K.
+*/
+
+#define STATE_ROUNDS                20000
+#define STATE_RUN                   100000ULL
+
+int StateBench(void) {
+    Cpu8080 *cpu = (Cpu8080 *)malloc(sizeof(Cpu8080));
+    BdosState *bdos = (BdosState *)malloc(sizeof(BdosState));
+    BlockCache *blocks = (BlockCache *)malloc(sizeof(BlockCache));
+    JitCache *jit = (JitCache *)malloc(sizeof(JitCache));
+    uint8_t *first = NULL;
+    uint8_t *second = NULL;
+    uint8_t *check = NULL;
+    ResetImage *image = (ResetImage *)malloc(sizeof(ResetImage));
+    uint8_t dirty[MEM_PAGE_COUNT];
+    uint8_t pages[MEM_PAGE_COUNT];
+    size_t size = 0;
+    uint32_t noise = 0x12345678;
+    int failed = 0;
+
+    if (cpu && bdos && blocks && jit) {
+        CpuInit(cpu);
+        BDOS_Init(bdos);
+        cpu->bdos = bdos;
+        size = StateSize(cpu);
+        first = (uint8_t *)malloc(size);
+        second = (uint8_t *)malloc(size);
+        check = (uint8_t *)malloc(size);
+    }
+
+    if (!first || !second || !check || !image) {
+        fprintf(stderr, "Error: Could not allocate machine state\n");
+        free(image);
+        free(first);
+        free(second);
+        free(check);
+        free(cpu);
+        free(bdos);
+        free(blocks);
+        free(jit);
+        return -1;
+    }
+
+    BlockCacheInit(blocks);
+
+    if (JitCacheInit(jit) == 0) {
+        cpu->engine = ENGINE_JIT;
+        cpu->jit = jit;
+    } else {
+        cpu->engine = ENGINE_BLOCK;
+        cpu->blocks = blocks;
+    }
+
+    for (uint32_t addr = 0; addr < MEM_MAX; addr++) {
+        noise = noise * 1103515245 + 12345;
+        cpu->memory[addr] = (uint8_t)(noise >> 16);
+    }
+
+    memcpy(&cpu->memory[MICRO_ORIGIN], microProgram, sizeof(microProgram));
+    CodeRangeWritten(cpu, 0, MEM_MAX);
+    cpu->PC = MICRO_ORIGIN;
+
+    Execute(cpu, 0, STATE_RUN, 0);
+    SaveState(cpu, first, size);
+    Execute(cpu, 0, STATE_RUN, 0);
+    SaveState(cpu, second, size);
+
+    /* Back to the first state and on from there has to give the second one again */
+    LoadState(cpu, first, size);
+    SaveState(cpu, check, size);
+    failed |= memcmp(check, first, size) != 0;
+    Execute(cpu, 0, STATE_RUN, 0);
+    SaveState(cpu, check, size);
+    failed |= memcmp(check, second, size) != 0;
+
+    clock_t startClock = clock();
+
+    for (int round = 0; round < STATE_ROUNDS; round++) {
+        SaveState(cpu, check, size);
+    }
+
+    double saveSeconds = (double)(clock() - startClock) / CLOCKS_PER_SEC;
+
+    startClock = clock();
+
+    for (int round = 0; round < STATE_ROUNDS; round++) {
+        failed |= LoadState(cpu, (round & 1) ? second : first, size) != 0;
+    }
+
+    double loadSeconds = (double)(clock() - startClock) / CLOCKS_PER_SEC;
+
+    /* One run from the first state, then the same stores put back over and over */
+    LoadState(cpu, first, size);
+    ResetCapture(cpu, image);
+    Execute(cpu, 0, STATE_RUN, 0);
+    memcpy(dirty, cpu->dirtyPages, sizeof(dirty));
+
+    int dirtyCount = MemDirtyList(cpu, pages);
+
+    ResetRestore(cpu, image);
+    failed |= memcmp(cpu->memory, image->memory, MEM_MAX) != 0;
+    startClock = clock();
+
+    for (int round = 0; round < STATE_ROUNDS; round++) {
+        memcpy(cpu->dirtyPages, dirty, sizeof(dirty));
+        ResetRestore(cpu, image);
+    }
+
+    double resetSeconds = (double)(clock() - startClock) / CLOCKS_PER_SEC;
+
+    printf("[statebench] engine=%s %zu byte states: save %.2f us, load %.2f us, reset of %d dirty pages %.2f us%s\n",
+        microEngineNames[cpu->engine], size, saveSeconds * 1e6 / STATE_ROUNDS,
+        loadSeconds * 1e6 / STATE_ROUNDS, dirtyCount, resetSeconds * 1e6 / STATE_ROUNDS,
+        failed ? ", loaded state differs" : "");
+
+    BDOS_Shutdown(bdos);
+    JitCacheFree(jit);
+    free(image);
+    free(first);
+    free(second);
+    free(check);
+    free(jit);
+    free(blocks);
+    free(bdos);
+    free(cpu);
+    return failed;
+}
+
+/*
+    Shared image benchmark (--imagebench). The pair loop is set up once
+    and taken with ImageCreate(), then IMAGE_MACHINES machines are made
+    from it with CpuInitShared() and all of them are kept while each runs
+    IMAGE_RUN instructions. Every one has to end like a private machine
+    running the same program. Prints what they copied on write against a
+    private 64K each, how long making one takes and how fast they run.
+*/
+
+#define IMAGE_MACHINES              1000
+#define IMAGE_RUN                   100000ULL
+
+int ImageBench(void) {
+    Cpu8080 **machines = (Cpu8080 **)calloc(IMAGE_MACHINES, sizeof(Cpu8080 *));
+    Cpu8080 *ref = (Cpu8080 *)malloc(sizeof(Cpu8080));
+    SharedImage *image = NULL;
+    int failed = 0;
+
+    if (ref) {
+        CpuInit(ref);
+        memcpy(&ref->memory[MICRO_ORIGIN], microProgram, sizeof(microProgram));
+        ref->PC = MICRO_ORIGIN;
+        image = ImageCreate(ref);
+    }
+
+    if (!machines || !image) {
+        fprintf(stderr, "Error: Could not allocate machine state\n");
+        ImageRelease(image);
+        free(machines);
+        free(ref);
+        return -1;
+    }
+
+    Execute(ref, 0, IMAGE_RUN, 0);
+
+    clock_t startClock = clock();
+
+    for (int idx = 0; idx < IMAGE_MACHINES; idx++) {
+        machines[idx] = (Cpu8080 *)malloc(sizeof(Cpu8080));
+
+        if (!machines[idx]) {
+            failed = 1;
+            break;
+        }
+
+        CpuInitShared(machines[idx], image);
+        machines[idx]->PC = MICRO_ORIGIN;
+    }
+
+    double sharedSeconds = (double)(clock() - startClock) / CLOCKS_PER_SEC;
+    unsigned long long sharedPages = 0;
+
+    startClock = clock();
+
+    for (int idx = 0; idx < IMAGE_MACHINES && machines[idx]; idx++) {
+        Cpu8080 *cpu = machines[idx];
+
+        Execute(cpu, 0, IMAGE_RUN, 0);
+        sharedPages += (unsigned long long)ImageSharedPages(cpu);
+
+        Bool same = (Bool)(cpu->PC == ref->PC && memcmp(cpu->registers, ref->registers, sizeof(ref->registers)) == 0);
+
+        for (int page = 0; page < MEM_PAGE_COUNT; page++) {
+            same &= memcmp(MemOwnPage(cpu, page), &ref->memory[page << MEM_PAGE_SHIFT], MEM_PAGE_SIZE) == 0;
+        }
+
+        failed |= !same;
+    }
+
+    double runSeconds = (double)(clock() - startClock) / CLOCKS_PER_SEC;
+
+    /* A machine with its own copy of everything is the flat bus again */
+    if (machines[0]) {
+        ImageUnshare(machines[0], 0, MEM_MAX);
+        failed |= !machines[0]->flatBus || machines[0]->image->references != IMAGE_MACHINES + 1;
+    }
+
+    printf("[imagebench] %d machines made in %.2f us each, ran at %.1f MIPS\n",
+        IMAGE_MACHINES, sharedSeconds * 1e6 / IMAGE_MACHINES,
+        runSeconds > 0 ? (double)IMAGE_RUN * IMAGE_MACHINES / runSeconds / 1e6 : 0.0);
+    printf("[imagebench] %.1f pages still shared per machine: %uK of state each plus %lluK copied in all, "
+        "against %uK more each private%s\n",
+        (double)sharedPages / IMAGE_MACHINES, (unsigned)(offsetof(Cpu8080, memory) >> 10),
+        (image->stats.copies * MEM_PAGE_SIZE) >> 10, (unsigned)(MEM_MAX >> 10),
+        failed ? ", state differs from a private machine" : "");
+
+    for (int idx = 0; idx < IMAGE_MACHINES && machines[idx]; idx++) {
+        ImageDetach(machines[idx]);
+        free(machines[idx]);
+    }
+
+    ImageRelease(image);
+    free(machines);
+    free(ref);
+    return failed;
+}
@@ -0,0 +1,16 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+/* Built-in register pair loop on every engine, see bench.c */
+int MicroBench(void);
+
+/* The same kind of loop under a 60 Hz timer interrupt, see bench.c */
+int TimerBench(void);
+
+/* SaveState() and LoadState() of a full 64K machine, see bench.c */
+int StateBench(void);
+
+/* Many machines made from one copy-on-write program image, see bench.c */
+int ImageBench(void);
+
+#endif
@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <string.h>
+#include "block.h"
+
+/*
+    Decode side of the block cache. RunBlocks() in run.c does the executing,
+    this file only turns guest bytes into MicroOp arrays and keeps the cache
+    and codeMap consistent.
+*/
+
+/* Instruction length in bytes */
+const uint8_t opLength[256] = {
+    1, 3, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+    1, 3, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+    1, 3, 3, 1, 1, 1, 2, 1, 1, 1, 3, 1, 1, 1, 2, 1,
+    1, 3, 3, 1, 1, 1, 2, 1, 1, 1, 3, 1, 1, 1, 2, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 3, 3, 3, 2, 1,
+    1, 1, 3, 2, 3, 1, 2, 1, 1, 1, 3, 2, 3, 3, 2, 1,
+    1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 3, 2, 1,
+    1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 3, 2, 1
+};
+
+/* Worst case cycles (conditional CALL/RET taken), same numbers as run_ops.h */
+const uint8_t opMaxCycles[256] = {
+     4, 10,  7,  5,  5,  5,  7,  4,  4, 10,  7,  5,  5,  5,  7,  4,
+     4, 10,  7,  5,  5,  5,  7,  4,  4, 10,  7,  5,  5,  5,  7,  4,
+     4, 10, 16,  5,  5,  5,  7,  4,  4, 10, 16,  5,  5,  5,  7,  4,
+     4, 10, 13,  5, 10, 10, 10,  4,  4, 10, 13,  5,  5,  5,  7,  4,
+     5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5,
+     5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5,
+     5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5,
+     7,  7,  7,  7,  7,  7,  7,  7,  5,  5,  5,  5,  5,  5,  7,  5,
+     4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,
+     4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,
+     4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,
+     4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,
+    11, 10, 10, 10, 17, 11,  7, 11, 11, 10, 10, 10, 17, 17,  7, 11,
+    11, 10, 10, 10, 17, 11,  7, 11, 11, 10, 10, 10, 17, 17,  7, 11,
+    11, 10, 10, 18, 17, 11,  7, 11, 11,  5, 10,  5, 17, 17,  7, 11,
+    11, 10, 10,  4, 17, 11,  7, 11, 11,  5, 10,  4, 17, 17,  7, 11
+};
+
+/* HLT and every jump, call, return, RST and PCHL end a block */
+Bool EndsBlock(uint8_t opcode) {
+    /*
+        HLT, TRAP_OPCODE because a trap handler can send PC anywhere, IN
+        because IdlePoll() may run guest code behind the engine's back, OUT
+        because it may switch banks (see BankSelect()) and EI because a
+        waiting interrupt is taken right after it (see Execute()).
+    */
+    if (opcode == 0x76 || opcode == TRAP_OPCODE || opcode == 0xDB || opcode == 0xD3 || opcode == 0xFB) {
+        return TRUE;
+    }
+
+    if (opcode < 0xC0) {
+        return FALSE;
+    }
+
+    switch (opcode & 0x07) {
+        case 0x00:      /* Rcc */
+        case 0x02:      /* Jcc */
+        case 0x04:      /* Ccc */
+        case 0x07: {    /* RST */
+            return TRUE;
+        }
+
+        default: {
+            return opcode == 0xC3 || opcode == 0xCB || opcode == 0xC9 || opcode == 0xD9 ||
+                opcode == 0xCD || opcode == 0xDD || opcode == 0xED || opcode == 0xFD ||
+                opcode == 0xE9;
+        }
+    }
+}
+
+static void MarkCode(BlockCache *cache, const Block *blk, int delta) {
+    for (uint16_t idx = 0; idx < blk->size; idx++) {
+        cache->codeMap[(uint16_t)(blk->startPC + idx)] += (uint8_t)delta;
+    }
+}
+
+static void DropBlock(BlockCache *cache, Block *blk) {
+    MarkCode(cache, blk, -1);
+    blk->id = 0;
+}
+
+void BlockCacheInit(BlockCache *cache) {
+    memset(cache, 0, sizeof(*cache));
+    cache->nextId = 1;
+}
+
+static void BuildBlock(BlockCache *cache, Block *blk, Cpu8080 *cpu, uint16_t pc, const void *const *handlers) {
+    const uint8_t *memory = cpu->memory;
+    uint16_t start = pc;
+    uint16_t count = 0;
+    unsigned int cycles = 0;
+
+    /* Ids only ever grow so stale links can't match; start over if they run out */
+    if (cache->nextId == 0) {
+        BlockFlush(cache);
+        cache->nextId = 1;
+    }
+
+    for (;;) {
+        uint8_t opcode = memory[pc];
+        MicroOp *uop = &blk->ops[count++];
+
+        uop->opcode = opcode;
+        uop->handler = handlers ? handlers[opcode] : NULL;
+
+        switch (opLength[opcode]) {
+            case 2: {
+                uop->operand = memory[(uint16_t)(pc + 1)];
+                break;
+            }
+
+            case 3: {
+                uop->operand = (uint16_t)(memory[(uint16_t)(pc + 1)] | (memory[(uint16_t)(pc + 2)] << 8));
+                break;
+            }
+
+            default: {
+                uop->operand = 0;
+                break;
+            }
+        }
+
+        pc = (uint16_t)(pc + opLength[opcode]);
+        uop->nextPC = pc;
+        cycles += opMaxCycles[opcode];
+
+        /* A breakpoint is always the start of a block, see BreakpointSet() */
+        if (EndsBlock(opcode) || count == BLOCK_MAX_OPS || BreakpointAt(cpu, pc)) {
+            break;
+        }
+    }
+
+    blk->ops[count].opcode = BLOCK_OP_END;
+    blk->ops[count].handler = handlers ? handlers[BLOCK_OP_END] : NULL;
+    blk->ops[count].operand = 0;
+    blk->ops[count].nextPC = pc;
+
+    blk->id = cache->nextId++;
+    blk->startPC = start;
+    blk->size = (uint16_t)(pc - start);
+    blk->fallThrough = pc;
+    blk->count = count;
+    blk->maxCycles = (uint16_t)cycles;
+    blk->link[0] = blk->link[1] = NULL;
+    blk->linkId[0] = blk->linkId[1] = 0;
+
+    MarkCode(cache, blk, 1);
+    MarkCodePages(cpu, start, blk->size);
+    cache->stats.built++;
+}
+
+/* Returns the block starting at pc, decoding it first on a miss */
+Block *BlockLookup(BlockCache *cache, Cpu8080 *cpu, uint16_t pc, const void *const *handlers) {
+    Block *blk = &cache->slots[pc & (BLOCK_CACHE_SLOTS - 1)];
+
+    if (blk->id && blk->startPC == pc) {
+        cache->stats.hits++;
+        return blk;
+    }
+
+    if (blk->id) {
+        DropBlock(cache, blk);
+    }
+
+    BuildBlock(cache, blk, cpu, pc, handlers);
+
+    return blk;
+}
+
+/*
+    A guest store hit translated code at addr: drop every block decoded from
+    that byte. A block is at most BLOCK_MAX_BYTES long, so only that many
+    start addresses can cover it. Returns TRUE when current was one of them.
+*/
+Bool BlockInvalidate(BlockCache *cache, uint16_t addr, const Block *current) {
+    Bool hitCurrent = FALSE;
+
+    for (uint16_t back = 0; back < BLOCK_MAX_BYTES && cache->codeMap[addr]; back++) {
+        uint16_t start = (uint16_t)(addr - back);
+        Block *blk = &cache->slots[start & (BLOCK_CACHE_SLOTS - 1)];
+
+        if (!blk->id || blk->startPC != start || (uint16_t)(addr - start) >= blk->size) {
+            continue;
+        }
+
+        if (blk == current) {
+            hitCurrent = TRUE;
+        }
+
+        DropBlock(cache, blk);
+        cache->stats.invalidated++;
+    }
+
+    return hitCurrent;
+}
+
+void BlockFlush(BlockCache *cache) {
+    for (int idx = 0; idx < BLOCK_CACHE_SLOTS; idx++) {
+        cache->slots[idx].id = 0;
+    }
+
+    memset(cache->codeMap, 0, sizeof(cache->codeMap));
+    cache->stats.flushes++;
+}
+
+void BlockPrintStats(const BlockCache *cache) {
+    const BlockStats *stats = &cache->stats;
+    double entries = stats->entries ? (double)stats->entries : 1.0;
+
+    printf("[blocks] %llu entries, %.2f%% hit rate (%.2f%% chained), %llu built, %llu invalidated, %llu flushes\n",
+        stats->entries, 100.0 * (double)(stats->chained + stats->hits) / entries,
+        100.0 * (double)stats->chained / entries,
+        stats->built, stats->invalidated, stats->flushes);
+}
@@ -0,0 +1,85 @@
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include <stdint.h>
+#include "cpu.h"
+
+#define BLOCK_CACHE_SLOTS           4096
+#define BLOCK_MAX_OPS               32
+#define BLOCK_MAX_BYTES             (BLOCK_MAX_OPS * 3)
+
+/* Opcode value of the sentinel that ends every block, one past the real ones */
+#define BLOCK_OP_END                0x100
+
+/*
+    One pre-decoded instruction. The operand bytes are already fetched and
+    nextPC is where the guest PC points once the opcode and operands have been
+    read, so the handler never touches guest memory for decoding.
+    handler is the label RunBlocks() jumps to (computed goto builds only).
+*/
+typedef struct {
+    const void *handler;
+    uint16_t operand;
+    uint16_t nextPC;
+    uint16_t opcode;
+} MicroOp;
+
+/*
+    A straight-line run of guest code, from startPC up to and including the
+    first control transfer (or BLOCK_MAX_OPS instructions). link[0] caches
+    the block at the fall-through address, link[1] the last taken target.
+    A link is only followed while linkId still matches the target's id, so
+    dropping or rebuilding a block needs no back pointers.
+*/
+typedef struct Block {
+    uint32_t id;
+    uint16_t startPC;
+    uint16_t size;
+    uint16_t fallThrough;
+    uint16_t count;
+    uint16_t maxCycles;
+
+    struct Block *link[2];
+    uint32_t linkId[2];
+
+    MicroOp ops[BLOCK_MAX_OPS + 1];
+} Block;
+
+typedef struct {
+    unsigned long long entries;
+    unsigned long long chained;
+    unsigned long long hits;
+    unsigned long long built;
+    unsigned long long invalidated;
+    unsigned long long flushes;
+} BlockStats;
+
+/*
+    Direct mapped on startPC. codeMap counts, for every guest byte, how many
+    live blocks were decoded from it, so a guest store only has to test one
+    byte to know whether it hit translated code.
+*/
+struct BlockCache {
+    uint32_t nextId;
+    BlockStats stats;
+    uint8_t codeMap[MEM_MAX];
+    Block slots[BLOCK_CACHE_SLOTS];
+};
+
+/* Decode tables, also used by the JIT (jit.c) */
+extern const uint8_t opLength[256];
+extern const uint8_t opMaxCycles[256];
+Bool EndsBlock(uint8_t opcode);
+
+void BlockCacheInit(BlockCache *cache);
+Block *BlockLookup(BlockCache *cache, Cpu8080 *cpu, uint16_t pc, const void *const *handlers);
+Bool BlockInvalidate(BlockCache *cache, uint16_t addr, const Block *current);
+void BlockFlush(BlockCache *cache);
+void BlockPrintStats(const BlockCache *cache);
+
+unsigned long long RunBlocks(Cpu8080 *cpu, unsigned long long cycleBudget);
+
+/* Self-modifying code check against Step(), see selfcheck.c */
+int SmcSelfCheck(void);
+
+#endif
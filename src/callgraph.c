@@ -0,0 +1,336 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "callgraph.h"
+
+/*
+    Call graph profiler. CALL, Ccc and RST in cpu.c, and an interrupt being
+    taken, push a frame on a shadow stack; RET and Rcc pop it. Only Step()
+    goes through cpu.c, so Execute() runs every engine as Step() while a
+    call graph is attached (see RunSingle()), the way it does for a trace.
+
+    A frame is known by where its return address is on the guest stack
+    (its slot), not by what that address is, and it lasts as long as the
+    slot is at or above SP. So a routine that changes its return address
+    with XTHL to skip inline data still returns from its frame, and one
+    that pops its return address and jumps, returns for its caller too, or
+    moves SP with SPHL has the frames it went past closed at the next CALL
+    or RET, counted as unwound rather than returned. Frames are in slot
+    order, the newest lowest, so that is only ever the top of the stack.
+
+    The cycles since the last CALL or RET are charged to the function on
+    top, so a call's own cycles go to the callee and a RET's to the caller.
+    A frame's cycles from its call to when it goes are its edge's and,
+    unless the function is on the stack further down too, the function's.
+*/
+
+static void Charge(CallGraph *graph, const Cpu8080 *cpu) {
+    CallFunction *function = &graph->functions[graph->frames[graph->depth - 1].function];
+    unsigned long long cycles = cpu->cycles - graph->lastCycles;
+    unsigned long long instructions = cpu->instructions - graph->lastInstructions;
+
+    function->selfCycles += cycles;
+    function->selfInstructions += instructions;
+    graph->cycles += cycles;
+    graph->instructions += instructions;
+    graph->lastCycles = cpu->cycles;
+    graph->lastInstructions = cpu->instructions;
+}
+
+static uint64_t EdgeKey(uint16_t caller, uint16_t site, uint16_t callee) {
+    return CALLGRAPH_USED | (uint64_t)caller << 32 | (uint64_t)site << 16 | callee;
+}
+
+static CallEdge *EdgeSlot(CallEdge *edges, int capacity, uint64_t key) {
+    int idx = (int)((key * 0x9E3779B97F4A7C15ULL) >> 40) & (capacity - 1);
+
+    while (edges[idx].key && edges[idx].key != key) {
+        idx = (idx + 1) & (capacity - 1);
+    }
+
+    return &edges[idx];
+}
+
+/* The edge, added if it is new. NULL if the table is full and can't grow. */
+static CallEdge *FindEdge(CallGraph *graph, uint64_t key) {
+    CallEdge *edge = EdgeSlot(graph->edges, graph->edgeCapacity, key);
+
+    if (edge->key) {
+        return edge;
+    }
+
+    if (graph->edgeCount * 4 >= graph->edgeCapacity * 3) {
+        int capacity = graph->edgeCapacity * 2;
+        CallEdge *edges = (CallEdge *)calloc((size_t)capacity, sizeof(CallEdge));
+
+        if (!edges) {
+            return graph->edgeCount + 1 < graph->edgeCapacity ? edge : NULL;
+        }
+
+        for (int idx = 0; idx < graph->edgeCapacity; idx++) {
+            if (graph->edges[idx].key) {
+                *EdgeSlot(edges, capacity, graph->edges[idx].key) = graph->edges[idx];
+            }
+        }
+
+        free(graph->edges);
+        graph->edges = edges;
+        graph->edgeCapacity = capacity;
+        edge = EdgeSlot(edges, capacity, key);
+    }
+
+    edge->key = key;
+    graph->edgeCount++;
+
+    return edge;
+}
+
+/* The top frame goes, at the machine's counts now */
+static void Leave(CallGraph *graph, const Cpu8080 *cpu) {
+    const CallFrame *frame = &graph->frames[--graph->depth];
+    CallFunction *function = &graph->functions[frame->function];
+    unsigned long long cycles = cpu->cycles - frame->cycles;
+    unsigned long long instructions = cpu->instructions - frame->instructions;
+
+    if (--function->active == 0) {
+        function->cycles += cycles;
+        function->instructions += instructions;
+    }
+
+    if (graph->depth) {
+        CallEdge *edge = FindEdge(graph, EdgeKey(graph->frames[graph->depth - 1].function, frame->site,
+            frame->function));
+
+        if (edge) {
+            edge->cycles += cycles;
+            edge->instructions += instructions;
+        }
+    }
+}
+
+/* SP as a slot: 0 is past the top of memory, where a stack set to 0 is empty again */
+static uint32_t StackTop(const Cpu8080 *cpu) {
+    return cpu->SP ? cpu->SP : 0x10000u;
+}
+
+static void Enter(CallGraph *graph, const Cpu8080 *cpu, uint16_t function, uint16_t site, uint32_t slot) {
+    CallFrame *frame = &graph->frames[graph->depth++];
+
+    frame->function = function;
+    frame->site = site;
+    frame->slot = slot;
+    frame->cycles = cpu->cycles;
+    frame->instructions = cpu->instructions;
+    graph->functions[function].active++;
+}
+
+/* symbols may be NULL, then functions go by address. -1 with no memory left. */
+int CallGraphInit(CallGraph *graph, const SymbolTable *symbols) {
+    memset(graph, 0, sizeof(*graph));
+    graph->symbols = symbols;
+    graph->edgeCapacity = 256;
+    graph->functions = (CallFunction *)calloc(0x10000, sizeof(CallFunction));
+    graph->edges = (CallEdge *)calloc((size_t)graph->edgeCapacity, sizeof(CallEdge));
+
+    if (!graph->functions || !graph->edges) {
+        CallGraphFree(graph);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+    Attaches the graph, the code at PC the first frame. Adds to what earlier
+    runs found, so a reset only needs a CallGraphStop() and a start again.
+*/
+void CallGraphStart(Cpu8080 *cpu, CallGraph *graph) {
+    graph->depth = 0;
+    graph->lastCycles = cpu->cycles;
+    graph->lastInstructions = cpu->instructions;
+    Enter(graph, cpu, cpu->PC, cpu->PC, CALLGRAPH_ROOT_SLOT);
+    graph->functions[cpu->PC].calls++;
+    cpu->callGraph = graph;
+}
+
+/* Closes every frame at the machine's counts now and detaches the graph */
+void CallGraphStop(Cpu8080 *cpu) {
+    CallGraph *graph = cpu->callGraph;
+
+    if (!graph) {
+        return;
+    }
+
+    Charge(graph, cpu);
+
+    while (graph->depth) {
+        Leave(graph, cpu);
+    }
+
+    cpu->callGraph = NULL;
+}
+
+/* A call from site to target, with its return address just pushed at SP */
+void CallGraphCall(CallGraph *graph, const Cpu8080 *cpu, uint16_t site, uint16_t target) {
+    CallEdge *edge;
+
+    Charge(graph, cpu);
+
+    /* Frames whose return address is not above the one just pushed are gone */
+    while (graph->depth > 1 && graph->frames[graph->depth - 1].slot < (uint32_t)cpu->SP + 2) {
+        Leave(graph, cpu);
+        graph->stats.unwound++;
+    }
+
+    graph->stats.calls++;
+    graph->functions[target].calls++;
+    edge = FindEdge(graph, EdgeKey(graph->frames[graph->depth - 1].function, site, target));
+
+    if (edge) {
+        edge->calls++;
+    }
+
+    if (graph->depth == CALLGRAPH_MAX_DEPTH) {
+        graph->stats.overflows++;
+        return;
+    }
+
+    Enter(graph, cpu, target, site, cpu->SP);
+
+    if (graph->depth - 1 > graph->stats.maxDepth) {
+        graph->stats.maxDepth = graph->depth - 1;
+    }
+}
+
+/* A RET that just took its return address off the stack, SP already past it */
+void CallGraphReturn(CallGraph *graph, const Cpu8080 *cpu) {
+    uint32_t top = StackTop(cpu);
+
+    Charge(graph, cpu);
+
+    /* The frame whose slot the RET took returned, any below it were left behind */
+    while (graph->depth > 1 && graph->frames[graph->depth - 1].slot < top) {
+        Bool own = (Bool)(graph->frames[graph->depth - 1].slot == top - 2);
+
+        Leave(graph, cpu);
+
+        if (own) {
+            graph->stats.returns++;
+        } else {
+            graph->stats.unwound++;
+        }
+    }
+}
+
+static Bool Used(const CallFunction *function) {
+    return (Bool)(function->calls || function->selfCycles || function->cycles);
+}
+
+static int FunctionCount(const CallGraph *graph) {
+    int count = 0;
+
+    for (unsigned int addr = 0; addr < 0x10000; addr++) {
+        count += Used(&graph->functions[addr]);
+    }
+
+    return count;
+}
+
+void CallGraphPrint(const CallGraph *graph) {
+    printf("[callgraph] %d functions, %llu cycles, %llu calls, %llu returns, %llu frames unwound, max depth %d\n",
+        FunctionCount(graph), graph->cycles, graph->stats.calls, graph->stats.returns, graph->stats.unwound,
+        graph->stats.maxDepth);
+
+    if (graph->stats.overflows) {
+        printf("[callgraph] %llu calls deeper than %d were put down to their caller\n",
+            graph->stats.overflows, CALLGRAPH_MAX_DEPTH - 1);
+    }
+}
+
+static int CompareEdges(const void *left, const void *right) {
+    uint64_t a = ((const CallEdge *)left)->key;
+    uint64_t b = ((const CallEdge *)right)->key;
+
+    return a < b ? -1 : a > b;
+}
+
+/* "fn=(id) name" the first time, "fn=(id)" after that, as callgrind compresses names */
+static void WriteName(const CallGraph *graph, FILE *file, const char *kind, uint16_t addr, uint8_t *named) {
+    const Symbol *symbol = graph->symbols ? SymbolAt(graph->symbols, addr) : NULL;
+
+    if (named[addr >> 3] & (1 << (addr & 7))) {
+        fprintf(file, "%s=(%u)\n", kind, addr + 1u);
+        return;
+    }
+
+    named[addr >> 3] |= (uint8_t)(1 << (addr & 7));
+
+    if (symbol) {
+        fprintf(file, "%s=(%u) %s\n", kind, addr + 1u, symbol->name);
+    } else {
+        fprintf(file, "%s=(%u) %04X\n", kind, addr + 1u, addr);
+    }
+}
+
+/*
+    The graph in callgrind's format, for kcachegrind, qcachegrind and
+    callgrind_annotate. Positions are addresses: a function's own cost is
+    put at its first one, a call's at the call site.
+*/
+int CallGraphWrite(const CallGraph *graph, FILE *file) {
+    CallEdge *edges = (CallEdge *)malloc((size_t)(graph->edgeCount ? graph->edgeCount : 1) * sizeof(CallEdge));
+    uint8_t named[0x10000 / 8];
+    int count = 0;
+    int next = 0;
+
+    if (!edges) {
+        return -1;
+    }
+
+    memset(named, 0, sizeof(named));
+
+    for (int idx = 0; idx < graph->edgeCapacity; idx++) {
+        if (graph->edges[idx].key) {
+            edges[count++] = graph->edges[idx];
+        }
+    }
+
+    qsort(edges, (size_t)count, sizeof(CallEdge), CompareEdges);
+
+    fprintf(file, "# callgrind format\nversion: 1\ncreator: 8080Emu\npositions: instr\n"
+        "events: Cycles Instructions\nsummary: %llu %llu\n", graph->cycles, graph->instructions);
+
+    for (unsigned int addr = 0; addr < 0x10000; addr++) {
+        const CallFunction *function = &graph->functions[addr];
+
+        if (!Used(function)) {
+            continue;
+        }
+
+        fprintf(file, "\n");
+        WriteName(graph, file, "fn", (uint16_t)addr, named);
+        fprintf(file, "0x%04X %llu %llu\n", addr, function->selfCycles, function->selfInstructions);
+
+        while (next < count && (unsigned int)(edges[next].key >> 32 & 0xFFFF) == addr) {
+            uint16_t site = (uint16_t)(edges[next].key >> 16);
+            uint16_t callee = (uint16_t)edges[next].key;
+
+            WriteName(graph, file, "cfn", callee, named);
+            fprintf(file, "calls=%llu 0x%04X\n0x%04X %llu %llu\n", edges[next].calls, callee, site,
+                edges[next].cycles, edges[next].instructions);
+            next++;
+        }
+    }
+
+    free(edges);
+    return ferror(file) ? -1 : 0;
+}
+
+void CallGraphFree(CallGraph *graph) {
+    free(graph->functions);
+    free(graph->edges);
+    graph->functions = NULL;
+    graph->edges = NULL;
+    graph->edgeCount = 0;
+    graph->edgeCapacity = 0;
+}
@@ -0,0 +1,83 @@
+#ifndef CALLGRAPH_H
+#define CALLGRAPH_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "cpu.h"
+#include "symbols.h"
+
+/* Calls deeper than this are put down to their caller */
+#define CALLGRAPH_MAX_DEPTH         1024
+
+/* Where the stack's first frame has its return address: above all memory, so it never goes */
+#define CALLGRAPH_ROOT_SLOT         0x10000u
+
+/* Set in the key of every edge in use */
+#define CALLGRAPH_USED              (1ULL << 48)
+
+/* Everything about the code called at one address */
+typedef struct {
+    unsigned long long calls;
+    unsigned long long selfCycles;
+    unsigned long long selfInstructions;
+    unsigned long long cycles;          /* callees included, a recursive call counted once */
+    unsigned long long instructions;
+    int active;                         /* frames of it on the stack */
+} CallFunction;
+
+/* The calls from one call site in one function to one address */
+typedef struct {
+    uint64_t key;                       /* CALLGRAPH_USED | caller << 32 | site << 16 | callee, 0: free */
+    unsigned long long calls;
+    unsigned long long cycles;          /* from the call until its frame went */
+    unsigned long long instructions;
+} CallEdge;
+
+typedef struct {
+    uint16_t function;
+    uint16_t site;
+    uint32_t slot;                      /* where its return address is, see callgraph.c */
+    unsigned long long cycles;          /* the machine's counts when it was called */
+    unsigned long long instructions;
+} CallFrame;
+
+typedef struct {
+    unsigned long long calls;
+    unsigned long long returns;         /* a RET that took its own return address */
+    unsigned long long unwound;         /* frames the stack went past without a RET */
+    unsigned long long overflows;       /* calls deeper than CALLGRAPH_MAX_DEPTH */
+    int maxDepth;                       /* calls, the first frame not counted */
+} CallGraphStats;
+
+/*
+    A shadow call stack kept by CALL, RST, RET and interrupts, see
+    callgraph.c. Hung off cpu->callGraph; NULL there costs nothing.
+*/
+struct CallGraph {
+    const SymbolTable *symbols;
+    CallFunction *functions;            /* by address */
+    CallEdge *edges;                    /* open addressing, edgeCapacity a power of 2 */
+    int edgeCount;
+    int edgeCapacity;
+    CallFrame frames[CALLGRAPH_MAX_DEPTH];
+    int depth;                          /* frames, the first one included */
+    unsigned long long lastCycles;      /* the machine's counts when the top frame was last charged */
+    unsigned long long lastInstructions;
+    unsigned long long cycles;          /* all the runs together */
+    unsigned long long instructions;
+    CallGraphStats stats;
+};
+
+int CallGraphInit(CallGraph *graph, const SymbolTable *symbols);
+void CallGraphStart(Cpu8080 *cpu, CallGraph *graph);
+void CallGraphStop(Cpu8080 *cpu);
+void CallGraphCall(CallGraph *graph, const Cpu8080 *cpu, uint16_t site, uint16_t target);
+void CallGraphReturn(CallGraph *graph, const Cpu8080 *cpu);
+void CallGraphPrint(const CallGraph *graph);
+int CallGraphWrite(const CallGraph *graph, FILE *file);
+void CallGraphFree(CallGraph *graph);
+
+/* Calls, returns and stack tricks on every engine against what they have to give, see selfcheck.c */
+int CallGraphSelfCheck(void);
+
+#endif
@@ -1,48 +1,170 @@
+#include <stddef.h>
 #include <stdio.h>
+#include <string.h>
 #include "cpu.h"
+#include "flags.h"
+#include "block.h"
+#include "jit.h"
+#include "image.h"
+#include "replay.h"
+#include "histogram.h"
+#include "callgraph.h"
+#include "heatmap.h"
+
+/* The register file and PC have to stay inside the first 16 bytes, see Cpu8080 */
+_Static_assert(offsetof(Cpu8080, PC) + sizeof(uint16_t) <= 16, "register file outgrew its cache line slot");
+_Static_assert(sizeof(((Cpu8080 *)0)->pairs) == REG_FILE_SIZE, "pairs and registers must alias exactly");
 
-uint8_t memory[MEM_MAX] = { 0 };
-uint8_t registers[REG_COUNT] = { 0 };
-uint8_t ioPorts[NUM_IO_PORTS] = { 0 };
+/*
+    Step() and the handlers all read, write and fetch through these;
+    MemRead(), MemWrite(), FetchByte() and FetchWord() are the same for
+    everybody else. With the slow paths in them GCC stops inlining them into
+    the 200-odd handlers, so the RAM case would cost a call per access.
+    In RUN_MEMORY_HEATMAP builds only these count into a heatmap, which is
+    why Execute() runs every engine as Step() while one is attached.
+*/
+#if defined(__GNUC__) || defined(__clang__)
+#define BUS_INLINE          static inline __attribute__((always_inline))
+#else
+#define BUS_INLINE          static inline
+#endif
+
+BUS_INLINE uint8_t BusRead(Cpu8080 *cpu, uint16_t addr) {
+    const uint8_t *page = cpu->readPage[addr >> MEM_PAGE_SHIFT];
+
+#ifdef RUN_MEMORY_HEATMAP
+    if (cpu->heatmap) {
+        HeatmapCount(cpu->heatmap, HEATMAP_READ, addr);
+    }
+#endif
+
+    return page ? page[addr & (MEM_PAGE_SIZE - 1)] : MemReadSlow(cpu, addr);
+}
+
+/* BusRead() of an instruction's own bytes */
+BUS_INLINE uint8_t BusFetch(Cpu8080 *cpu, uint16_t addr) {
+    const uint8_t *page = cpu->readPage[addr >> MEM_PAGE_SHIFT];
+
+#ifdef RUN_MEMORY_HEATMAP
+    if (cpu->heatmap) {
+        HeatmapCount(cpu->heatmap, HEATMAP_FETCH, addr);
+    }
+#endif
+
+    return page ? page[addr & (MEM_PAGE_SIZE - 1)] : MemReadSlow(cpu, addr);
+}
+
+BUS_INLINE void BusWrite(Cpu8080 *cpu, uint16_t addr, uint8_t value) {
+    uint8_t *page = cpu->writePage[addr >> MEM_PAGE_SHIFT];
+
+#ifdef RUN_MEMORY_HEATMAP
+    if (cpu->heatmap) {
+        HeatmapCount(cpu->heatmap, HEATMAP_WRITE, addr);
+    }
+#endif
+
+    if (!page) {
+        MemWriteSlow(cpu, addr, value);
+        return;
+    }
+
+    page[addr & (MEM_PAGE_SIZE - 1)] = value;
+    cpu->dirtyPages[addr >> MEM_PAGE_SHIFT] = 1;
+
+    if (cpu->codePages[addr >> CODE_PAGE_SHIFT]) {
+        CodeWritten(cpu, addr);
+    }
+}
+
+BUS_INLINE uint8_t BusFetchByte(Cpu8080 *cpu) {
+    return BusFetch(cpu, cpu->PC++);
+}
+
+BUS_INLINE uint16_t BusFetchWord(Cpu8080 *cpu) {
+    uint16_t word = (uint16_t)(BusFetch(cpu, cpu->PC) | (BusFetch(cpu, (uint16_t)(cpu->PC + 1)) << 8));
+    cpu->PC += 2;
+
+    return word;
+}
+
+/* Everything but memory[], which is left as it is */
+static void CpuClear(Cpu8080 *cpu) {
+    memset(cpu, 0, offsetof(Cpu8080, memory));
+    cpu->flags = 0x02;
+    cpu->engine = ENGINE_RUN;
+}
+
+void CpuInit(Cpu8080 *cpu) {
+    CpuClear(cpu);
+    memset(cpu->memory, 0, sizeof(cpu->memory));
+    MemMapRam(cpu, 0, MEM_MAX, cpu->memory);
+}
+
+/* CpuInit() for a machine running image, without touching memory[] (see image.c) */
+void CpuInitShared(Cpu8080 *cpu, SharedImage *image) {
+    CpuClear(cpu);
+    ImageAttach(cpu, image);
+}
+
+/* The reference engine: one opcodeTable call per instruction. Returns the cycles it took. */
+int Step(Cpu8080 *cpu) {
+    if (cpu->halted) {
+        return 0;
+    }
+
+    uint16_t prevPC = cpu->PC;
+    uint8_t opcode = BusFetchByte(cpu);
 
-uint8_t flags = 0x02;
-uint16_t PC = 0, SP = 0;
+    if (opcodeTable[opcode]) {
+#ifdef RUN_OPCODE_PROFILE
+        HistogramOpcode(cpu->histogram, opcode);
 
-Bool halted = FALSE;
-Bool interruptsEnabled = FALSE;
+        int cycles = opcodeTable[opcode](cpu);
 
-Bool CheckCondition(Cond cond) {
+        HistogramCycles(cpu->histogram, opcode, (unsigned int)cycles);
+        return cycles;
+#else
+        return opcodeTable[opcode](cpu);
+#endif
+    }
+
+    printf("Unknown opcode: 0x%02X at PC=0x%04X\n", opcode, prevPC);
+    
+    return 4;
+}
+
+Bool CheckCondition(Cpu8080 *cpu, Cond cond) {
     switch (cond) {
         case COND_NZ: {
-            return !IsFlagActive(FLAG_ZERO);
+            return !IsFlagActive(cpu, FLAG_ZERO);
         }
         
         case COND_Z: {
-            return IsFlagActive(FLAG_ZERO);
+            return IsFlagActive(cpu, FLAG_ZERO);
         }
         
         case COND_NC: {
-            return !IsFlagActive(FLAG_CARRY);
+            return !IsFlagActive(cpu, FLAG_CARRY);
         }
         
         case COND_C: {
-            return IsFlagActive(FLAG_CARRY);
+            return IsFlagActive(cpu, FLAG_CARRY);
         }
         
         case COND_PO: {
-            return !IsFlagActive(FLAG_PARITY);
+            return !IsFlagActive(cpu, FLAG_PARITY);
         }
 
         case COND_PE: {
-            return IsFlagActive(FLAG_PARITY);
+            return IsFlagActive(cpu, FLAG_PARITY);
         }
         
         case COND_P: {
-            return !IsFlagActive(FLAG_SIGN);
+            return !IsFlagActive(cpu, FLAG_SIGN);
         }
         
         case COND_M: {
-            return IsFlagActive(FLAG_SIGN);
+            return IsFlagActive(cpu, FLAG_SIGN);
         }
         
         default: {
@@ -51,513 +173,714 @@ Bool CheckCondition(Cond cond) {
     }
 }
 
-uint8_t MemRead(uint16_t addr) {
-    return memory[addr];
+uint8_t MemRead(Cpu8080 *cpu, uint16_t addr) {
+    return BusRead(cpu, addr);
 }
 
-void MemWrite(uint16_t addr, uint8_t value) {
-    memory[addr] = value;
+void MemWrite(Cpu8080 *cpu, uint16_t addr, uint8_t value) {
+    BusWrite(cpu, addr, value);
 }
 
-uint8_t IORead(uint8_t port) {
-    return ioPorts[port];
+/* Pages without host bytes to read: handler pages and unmapped ones */
+uint8_t MemReadSlow(Cpu8080 *cpu, uint16_t addr) {
+    const MemHandler *handler = &cpu->handlers[addr >> MEM_PAGE_SHIFT];
+
+    if (!handler->read) {
+        return MEM_OPEN_BUS;
+    }
+
+    if (cpu->replay) {
+        return ReplayMemoryRead(cpu, addr, handler);
+    }
+
+    cpu->handlerCalls++;
+    return handler->read(cpu, addr, handler->context);
 }
-void IOWrite(uint8_t port, uint8_t value) {
-    ioPorts[port] = value;
+
+/* Pages without host bytes to write: ROM, handler pages and unmapped ones */
+void MemWriteSlow(Cpu8080 *cpu, uint16_t addr, uint8_t value) {
+    const MemHandler *handler = &cpu->handlers[addr >> MEM_PAGE_SHIFT];
+
+    if (handler->write) {
+        cpu->handlerCalls++;
+        handler->write(cpu, addr, value, handler->context);
+    }
 }
 
-uint8_t FetchByte(void) {
-    return memory[PC++];
+/* Host-side look at guest memory: never calls a handler, those pages read as open bus */
+uint8_t MemPeek(const Cpu8080 *cpu, uint16_t addr) {
+    const uint8_t *page = cpu->readPage[addr >> MEM_PAGE_SHIFT];
+
+    return page ? page[addr & (MEM_PAGE_SIZE - 1)] : MEM_OPEN_BUS;
 }
 
-uint16_t FetchWord(void) {
-    uint16_t word = memory[PC] | (memory[PC + 1] << 8);
-    PC += 2;
+/*
+    Host-side store, also into ROM (patching a trap into it, say). Handler
+    pages are left alone. A shared page gets its own copy first, unless it
+    holds value already.
+*/
+void MemPoke(Cpu8080 *cpu, uint16_t addr, uint8_t value) {
+    if (cpu->sharedPages[addr >> MEM_PAGE_SHIFT]) {
+        if (MemOwnPage(cpu, addr >> MEM_PAGE_SHIFT)[addr & (MEM_PAGE_SIZE - 1)] == value) {
+            return;
+        }
 
-    return word;
+        ImageUnshare(cpu, (uint16_t)(addr & ~(MEM_PAGE_SIZE - 1)), MEM_PAGE_SIZE);
+    }
+
+    uint8_t *page = cpu->readPage[addr >> MEM_PAGE_SHIFT];
+
+    if (page) {
+        page[addr & (MEM_PAGE_SIZE - 1)] = value;
+        cpu->dirtyPages[addr >> MEM_PAGE_SHIFT] = 1;
+        CodeRangeWritten(cpu, addr, 1);
+    }
 }
 
-Bool IsFlagActive(Flags flagBit) {
-    return (flags >> flagBit) & 1;
+/* Everything the block cache and the JIT have decoded, at once */
+static void DropDecodedCode(Cpu8080 *cpu) {
+    if (cpu->blocks) {
+        BlockFlush(cpu->blocks);
+    }
+
+    if (cpu->jit) {
+        JitFlush(cpu->jit);
+    }
+
+    memset(cpu->codePages, 0, sizeof(cpu->codePages));
 }
 
-void ActivateFlag(Flags flagBit) {
-    flags |= (1 << flagBit);
+/*
+    Points the pages covering [addr, addr + size) somewhere new. addr and
+    size have to be whole pages (-1 otherwise). Whatever was decoded from
+    those addresses is dropped, it may not be there anymore. Only the flat
+    bus is ever decoded (see RunBlocks()), and memory[] may have been
+    stored to through any address while it was mapped some other way, so
+    everything is dropped on the way back to it. Other maps have nothing
+    decoded, which keeps a bank switch (see BankSelect()) down to the page
+    pointers.
+*/
+static int MemMap(Cpu8080 *cpu, uint16_t addr, uint32_t size, uint8_t *read, uint8_t *write,
+    const MemHandler *handler) {
+    static const MemHandler none = { NULL, NULL, NULL };
+    Bool wasFlat = cpu->flatBus;
+
+    if ((addr & (MEM_PAGE_SIZE - 1)) || (size & (MEM_PAGE_SIZE - 1)) || addr + size > MEM_MAX) {
+        return -1;
+    }
+
+    for (uint32_t idx = 0; idx < size >> MEM_PAGE_SHIFT; idx++) {
+        int page = (addr >> MEM_PAGE_SHIFT) + (int)idx;
+        uint32_t offset = idx << MEM_PAGE_SHIFT;
+
+        cpu->readPage[page] = read ? read + offset : NULL;
+        cpu->writePage[page] = write ? write + offset : NULL;
+        cpu->handlers[page] = handler ? *handler : none;
+    }
+
+    cpu->flatBus = TRUE;
+
+    for (int page = 0; page < MEM_PAGE_COUNT; page++) {
+        uint8_t *own = &cpu->memory[page << MEM_PAGE_SHIFT];
+
+        if (cpu->readPage[page] != own || cpu->writePage[page] != own) {
+            cpu->flatBus = FALSE;
+            break;
+        }
+    }
+
+    if (cpu->flatBus != wasFlat) {
+        cpu->yield = TRUE;
+    }
+
+    if (cpu->flatBus && !wasFlat) {
+        DropDecodedCode(cpu);
+    } else if (cpu->flatBus) {
+        CodeRangeWritten(cpu, addr, size);
+    }
+
+    return 0;
 }
 
-void DeActivateFlag(Flags flagBit) {
-    flags &= ~(1 << flagBit);
+int MemMapRam(Cpu8080 *cpu, uint16_t addr, uint32_t size, uint8_t *host) {
+    return MemMap(cpu, addr, size, host, host, NULL);
 }
 
-void ClearFlags(void) {
-    flags = 0x02;
+/* Guest stores to a ROM page are dropped */
+int MemMapRom(Cpu8080 *cpu, uint16_t addr, uint32_t size, uint8_t *host) {
+    return MemMap(cpu, addr, size, host, NULL, NULL);
 }
 
-uint8_t Parity(uint8_t value) {
-    uint8_t count = 0;
-    
-    for (int i = 0; i < 8; i++) {
-        if (value & (1 << i)) {
-            count++;
-        }
-    }
-    
-    return (count % 2) == 0;
+/* Reads come from host like ROM, stores go to write (copy-on-write, see image.c) */
+int MemMapReadOnly(Cpu8080 *cpu, uint16_t addr, uint32_t size, uint8_t *host, MemWriteHandler write,
+    void *context) {
+    MemHandler handler = { NULL, write, context };
+
+    return MemMap(cpu, addr, size, host, NULL, &handler);
 }
 
-int CalcRegisterIdx(RegPair rp) {
-    return (rp - RP_BC) * 2 + 1;
+/* Every access to these pages goes through read and write */
+int MemMapHandler(Cpu8080 *cpu, uint16_t addr, uint32_t size, MemReadHandler read, MemWriteHandler write,
+    void *context) {
+    MemHandler handler = { read, write, context };
+
+    return MemMap(cpu, addr, size, NULL, NULL, &handler);
 }
 
-uint16_t GetPSW(void) {
-    return (registers[REG_A] << 8) | flags;
+/* Reads see MEM_OPEN_BUS, stores are dropped */
+int MemUnmap(Cpu8080 *cpu, uint16_t addr, uint32_t size) {
+    return MemMap(cpu, addr, size, NULL, NULL, NULL);
 }
 
-void SetPSW(uint16_t psw) {
-    registers[REG_A] = psw >> 8;
-    flags = psw & 0xFF;
+/* The bytes of memory[] page page, wherever they are: in memory[] or still in a shared image */
+const uint8_t *MemOwnPage(const Cpu8080 *cpu, int page) {
+    if (cpu->sharedPages[page]) {
+        return &cpu->image->memory[page << MEM_PAGE_SHIFT];
+    }
+
+    return &cpu->memory[page << MEM_PAGE_SHIFT];
 }
 
-void UpdateZSP(uint8_t result) {
-    if (result == 0) {
-        ActivateFlag(FLAG_ZERO);
-    } else {
-        DeActivateFlag(FLAG_ZERO);
+/* All 64K of memory[] into to, as MemOwnPage() sees it */
+void MemCopyOwn(const Cpu8080 *cpu, uint8_t *to) {
+    if (!cpu->image) {
+        memcpy(to, cpu->memory, MEM_MAX);
+        return;
     }
 
-    if (result & 0x80) {
-        ActivateFlag(FLAG_SIGN);
-    } else {
-        DeActivateFlag(FLAG_SIGN);
+    for (int page = 0; page < MEM_PAGE_COUNT; page++) {
+        memcpy(to + (page << MEM_PAGE_SHIFT), MemOwnPage(cpu, page), MEM_PAGE_SIZE);
     }
+}
 
-    if (Parity(result)) {
-        ActivateFlag(FLAG_PARITY);
-    } else {
-        DeActivateFlag(FLAG_PARITY);
+/* Called by the engines for every range they decode */
+void MarkCodePages(Cpu8080 *cpu, uint16_t addr, uint16_t size) {
+    for (uint32_t page = addr >> CODE_PAGE_SHIFT; page <= (uint32_t)(addr + size - 1) >> CODE_PAGE_SHIFT; page++) {
+        cpu->codePages[page & (CODE_PAGE_COUNT - 1)] = 1;
     }
 }
 
-void UpdateFlagsZSPCA_ADD(uint8_t oldVal, uint8_t updateVal, uint16_t result) {
-    UpdateZSP((uint8_t)result);
-    
-    if (result & 0x100) {
-        ActivateFlag(FLAG_CARRY);
-    } else {
-        DeActivateFlag(FLAG_CARRY);
+/*
+    Slow path of a store into a marked page. The engines keep a per-byte
+    map of what they decoded, so only the translations that include addr
+    are dropped, not the page.
+*/
+void CodeWritten(Cpu8080 *cpu, uint16_t addr) {
+    if (cpu->blocks && cpu->blocks->codeMap[addr]) {
+        BlockInvalidate(cpu->blocks, addr, NULL);
+        cpu->codeGeneration++;
     }
 
-    if (((oldVal & 0x0F) + (updateVal & 0x0F)) & 0x10) {
-        ActivateFlag(FLAG_AUXILIARY_CARRY);
-    } else {
-        DeActivateFlag(FLAG_AUXILIARY_CARRY);
+    if (cpu->jit && cpu->jit->codeMap[addr]) {
+        JitInvalidate(cpu->jit, addr);
+        cpu->codeGeneration++;
     }
 }
 
-void UpdateFlagsZSPCA_ADC(uint8_t oldVal, uint8_t updateVal, uint8_t carry_in, uint16_t result) {
-    UpdateZSP((uint8_t)result);
-    
-    if (result & 0x100) {
-        ActivateFlag(FLAG_CARRY);
-    } else {
-        DeActivateFlag(FLAG_CARRY);
-    }
+/* For memory filled without MemWrite(), like a program load */
+void CodeRangeWritten(Cpu8080 *cpu, uint16_t addr, uint32_t size) {
+    uint32_t idx = 0;
 
-    if (((oldVal & 0x0F) + (updateVal & 0x0F) + carry_in) & 0x10) {
-        ActivateFlag(FLAG_AUXILIARY_CARRY);
-    } else {
-        DeActivateFlag(FLAG_AUXILIARY_CARRY);
+    while (idx < size) {
+        uint16_t at = (uint16_t)(addr + idx);
+
+        /* Unmarked pages are skipped whole */
+        if (!cpu->codePages[at >> CODE_PAGE_SHIFT]) {
+            idx += (1u << CODE_PAGE_SHIFT) - (at & ((1u << CODE_PAGE_SHIFT) - 1));
+            continue;
+        }
+
+        CodeWritten(cpu, at);
+        idx++;
     }
 }
 
-void UpdateFlagsZSPA_ADD(uint8_t oldVal, uint8_t updateVal, uint16_t result) {
-    UpdateZSP((uint8_t)result);
+/* Forgets every store so far; the host calls it once memory is as it wants it back */
+void MemDirtyClear(Cpu8080 *cpu) {
+    memset(cpu->dirtyPages, 0, sizeof(cpu->dirtyPages));
+}
 
-    if (((oldVal & 0x0F) + (updateVal & 0x0F)) & 0x10) {
-        ActivateFlag(FLAG_AUXILIARY_CARRY);
-    } else {
-        DeActivateFlag(FLAG_AUXILIARY_CARRY);
+/* Fills pages (MEM_PAGE_COUNT of room) with the dirty page numbers in order, returns how many */
+int MemDirtyList(const Cpu8080 *cpu, uint8_t *pages) {
+    int count = 0;
+
+    for (int page = 0; page < MEM_PAGE_COUNT; page++) {
+        if (cpu->dirtyPages[page]) {
+            pages[count++] = (uint8_t)page;
+        }
     }
+
+    return count;
 }
 
-void UpdateFlagsZSPCA_SUB(uint8_t oldVal, uint8_t updateVal, uint16_t result) {
-    UpdateZSP((uint8_t)result);
-    
-    if (result & 0xFF00) {
-        ActivateFlag(FLAG_CARRY);
-    } else {
-        DeActivateFlag(FLAG_CARRY);
+/*
+    Plants TRAP_OPCODE at addr and calls handler whenever it is executed
+    there, however control got to it (CALL, Ccc, RST, PCHL, a jump or just
+    falling through). Anywhere else TRAP_OPCODE stays the NOP it is on real
+    hardware. The trap itself costs what that NOP does, 4 cycles. poll may
+    be NULL (never a poll). Returns -1 when all MAX_TRAPS are taken.
+*/
+int TrapRegister(Cpu8080 *cpu, uint16_t addr, TrapHandler handler, TrapPoll poll) {
+    int idx = 0;
+
+    while (idx < cpu->trapCount && cpu->traps[idx].addr != addr) {
+        idx++;
     }
 
-    if ((oldVal & 0x0F) >= (updateVal & 0x0F)) {
-        ActivateFlag(FLAG_AUXILIARY_CARRY);
-    } else {
-        DeActivateFlag(FLAG_AUXILIARY_CARRY);
+    if (idx == MAX_TRAPS) {
+        return -1;
+    }
+
+    if (idx == cpu->trapCount) {
+        cpu->trapCount++;
     }
+
+    cpu->traps[idx].addr = addr;
+    cpu->traps[idx].handler = handler;
+    cpu->traps[idx].poll = poll;
+    cpu->trapMap[addr >> 3] |= (uint8_t)(1 << (addr & 7));
+
+    /* MemPoke() so it lands in ROM too and anything decoded from addr is dropped */
+    MemPoke(cpu, addr, TRAP_OPCODE);
+    return 0;
 }
 
-void UpdateFlagsZSPCA_SBB(uint8_t oldVal, uint8_t updateVal, uint8_t borrow_in, uint16_t result) {
-    UpdateZSP((uint8_t)result);
-    
-    if (result & 0xFF00) {
-        ActivateFlag(FLAG_CARRY);
-    } else {
-        DeActivateFlag(FLAG_CARRY);
+Bool TrapAt(const Cpu8080 *cpu, uint16_t addr) {
+    return (Bool)((cpu->trapMap[addr >> 3] >> (addr & 7)) & 1);
+}
+
+const Trap *TrapFind(const Cpu8080 *cpu, uint16_t addr) {
+    for (int idx = 0; idx < cpu->trapCount; idx++) {
+        if (cpu->traps[idx].addr == addr) {
+            return &cpu->traps[idx];
+        }
     }
 
-    if ((oldVal & 0x0F) >= ((updateVal & 0x0F) + borrow_in)) {
-        ActivateFlag(FLAG_AUXILIARY_CARRY);
-    } else {
-        DeActivateFlag(FLAG_AUXILIARY_CARRY);
+    return NULL;
+}
+
+/* Returns what the trap's poll hook said about this call */
+Bool TrapFire(Cpu8080 *cpu, uint16_t addr) {
+    const Trap *trap = TrapFind(cpu, addr);
+
+    if (!trap) {
+        return FALSE;
     }
+
+    Bool poll = trap->poll ? trap->poll(cpu) : FALSE;
+
+    trap->handler(cpu, addr);
+
+    if (cpu->stopMask & STOP_ON_TRAP) {
+        cpu->stopReason = STOP_TRAP;
+    }
+
+    return poll;
 }
 
-void UpdateFlagsZSPA_SUB(uint8_t oldVal, uint8_t updateVal, uint16_t result) {
-    UpdateZSP((uint8_t)result);
+/*
+    Execute() with STOP_ON_BREAKPOINT stops in front of the instruction at
+    addr, unless it is the first one that call runs (so a stop can be
+    resumed). Nothing is planted in memory: the block cache and the JIT end
+    their blocks in front of a breakpoint and look between blocks.
+*/
+void BreakpointSet(Cpu8080 *cpu, uint16_t addr) {
+    if (!BreakpointAt(cpu, addr)) {
+        cpu->breakMap[addr >> 3] |= (uint8_t)(1 << (addr & 7));
+        cpu->breakCount++;
+    }
 
-    if ((oldVal & 0x0F) >= (updateVal & 0x0F)) {
-        ActivateFlag(FLAG_AUXILIARY_CARRY);
-    } else {
-        DeActivateFlag(FLAG_AUXILIARY_CARRY);
+    /* Whatever ran across addr is decoded again, and stops in front of it */
+    if (cpu->blocks) {
+        BlockInvalidate(cpu->blocks, addr, NULL);
+    }
+
+    if (cpu->jit) {
+        JitInvalidate(cpu->jit, addr);
     }
 }
 
-void UpdateFlagsZSP_Logical(uint8_t result, int acVal) {
-    UpdateZSP(result);
-    DeActivateFlag(FLAG_CARRY);
-    if (acVal) {
-        ActivateFlag(FLAG_AUXILIARY_CARRY);
-    } else {
-        DeActivateFlag(FLAG_AUXILIARY_CARRY);
+void BreakpointClear(Cpu8080 *cpu, uint16_t addr) {
+    if (BreakpointAt(cpu, addr)) {
+        cpu->breakMap[addr >> 3] &= (uint8_t)~(1 << (addr & 7));
+        cpu->breakCount--;
     }
 }
 
-void UpdateFlagC_ADD(uint8_t oldVal, uint8_t updateVal, uint16_t result) {
-    DeActivateFlag(FLAG_CARRY);
+Bool BreakpointAt(const Cpu8080 *cpu, uint16_t addr) {
+    return (Bool)((cpu->breakMap[addr >> 3] >> (addr & 7)) & 1);
+}
+
+uint8_t IORead(Cpu8080 *cpu, uint8_t port) {
+    const IoHandler *handler = &cpu->ioHandlers[port];
+
+    if (!handler->read) {
+        return cpu->ioPorts[port];
+    }
 
-    if(result & 0x100) {
-        ActivateFlag(FLAG_CARRY);
+    /* What a device answers is input from outside, see replay.c */
+    if (cpu->replay) {
+        return ReplayPortRead(cpu, port, handler);
     }
+
+    cpu->handlerCalls++;
+    return handler->read(cpu, port, handler->context);
 }
 
-void UpdateFlagC_SUB(uint8_t oldVal, uint8_t updateVal) {
-    DeActivateFlag(FLAG_CARRY);
+void IOWrite(Cpu8080 *cpu, uint8_t port, uint8_t value) {
+    const IoHandler *handler = &cpu->ioHandlers[port];
 
-    if(oldVal < updateVal) {
-        ActivateFlag(FLAG_CARRY);
+    cpu->ioPorts[port] = value;
+
+    if (handler->write) {
+        cpu->handlerCalls++;
+        handler->write(cpu, port, value, handler->context);
     }
 }
 
-void MOV(Reg8 dst, Reg8 src) {
-    registers[dst] = registers[src];
+/*
+    Attaches a device to count ports from port on. Either callback may be
+    NULL. The handlers may map memory, schedule events or raise
+    interrupts; the engines leave right after the IN or OUT (see yield).
+*/
+int IoRegister(Cpu8080 *cpu, uint8_t port, uint32_t count, IoReadHandler read, IoWriteHandler write,
+    void *context) {
+    if (count == 0 || port + count > NUM_IO_PORTS) {
+        return -1;
+    }
+
+    for (uint32_t idx = 0; idx < count; idx++) {
+        IoHandler *handler = &cpu->ioHandlers[port + idx];
+
+        handler->read = read;
+        handler->write = write;
+        handler->context = context;
+    }
+
+    return 0;
 }
 
-void MOV_FROM_M(Reg8 dst) {
-    uint16_t addr = (registers[REG_H] << 8) | registers[REG_L];
-    registers[dst] = MemRead(addr);
+/* Back to plain ioPorts[] */
+int IoUnregister(Cpu8080 *cpu, uint8_t port, uint32_t count) {
+    return IoRegister(cpu, port, count, NULL, NULL, NULL);
 }
 
-void MOV_TO_M(Reg8 src) {
-    uint16_t addr = (registers[REG_H] << 8) | registers[REG_L];
-    MemWrite(addr, registers[src]);
+uint8_t FetchByte(Cpu8080 *cpu) {
+    return BusFetch(cpu, cpu->PC++);
 }
 
-void MVI(Reg8 dst, uint8_t imm) {
-    registers[dst] = imm;
+uint16_t FetchWord(Cpu8080 *cpu) {
+    uint16_t word = (uint16_t)(BusFetch(cpu, cpu->PC) | (BusFetch(cpu, (uint16_t)(cpu->PC + 1)) << 8));
+    cpu->PC += 2;
+
+    return word;
 }
 
-void MVI_M(uint8_t imm) {
-    uint16_t addr = (uint16_t)((registers[REG_H] << 8) | registers[REG_L]);
-    MemWrite(addr, imm);
+Bool IsFlagActive(Cpu8080 *cpu, Flags flagBit) {
+    return (cpu->flags >> flagBit) & 1;
 }
 
-void LXI(RegPair rp, uint16_t imm) {
-    if (rp == RP_SP) {
-        SP = imm;
-        return;
-    }
-    
-    if (rp == RP_PSW) {
-        registers[REG_A] = (uint8_t)(imm >> 8);
-        flags = (uint8_t)(imm & 0xFF);
-        return;
-    }
+void ActivateFlag(Cpu8080 *cpu, Flags flagBit) {
+    cpu->flags |= (1 << flagBit);
+}
 
-    int idx = CalcRegisterIdx(rp);
-    registers[idx] = (uint8_t)(imm >> 8);
-    registers[idx + 1] = (uint8_t)(imm & 0xFF);
+void DeActivateFlag(Cpu8080 *cpu, Flags flagBit) {
+    cpu->flags &= ~(1 << flagBit);
 }
 
-void LDA(uint16_t addr) {
-    registers[REG_A] = MemRead(addr);
+void ClearFlags(Cpu8080 *cpu) {
+    cpu->flags = 0x02;
 }
 
-void STA(uint16_t addr) {
-    MemWrite(addr, registers[REG_A]);
+uint8_t Parity(uint8_t value) {
+    return (zspTable[value] >> FLAG_PARITY) & 1;
 }
 
-void LHLD(uint16_t addr) {
-    registers[REG_L] = MemRead(addr);
-    registers[REG_H] = MemRead(addr + 1);
+uint16_t GetPSW(Cpu8080 *cpu) {
+    return cpu->pairs[RP_PSW];
 }
 
-void SHLD(uint16_t addr) {
-    MemWrite(addr, registers[REG_L]);
-    MemWrite(addr + 1, registers[REG_H]);
+void SetPSW(Cpu8080 *cpu, uint16_t psw) {
+    cpu->pairs[RP_PSW] = psw;
 }
 
-void LDAX(RegPair rp) {
-    uint16_t addr = 0;
-    
-    if (rp == RP_BC) {
-        addr = (uint16_t)((registers[REG_B] << 8) | registers[REG_C]);
-    }
+/*
+    All of these are branch-free, the flag bits come out of the tables in flags.c.
+    FlagTableSelfCheck() compares them against the original bit-by-bit versions.
+*/
+void UpdateZSP(Cpu8080 *cpu, uint8_t result) {
+    cpu->flags = (uint8_t)((cpu->flags & ~FLAGS_ZSP_MASK) | zspTable[result]);
+}
 
-    if (rp == RP_DE) {
-        addr = (uint16_t)((registers[REG_D] << 8) | registers[REG_E]);
-    }
+void UpdateFlagsZSPCA_ADD(Cpu8080 *cpu, uint8_t oldVal, uint8_t updateVal, uint16_t result) {
+    cpu->flags = (uint8_t)((cpu->flags & ~FLAGS_ALL_MASK) | zspTable[(uint8_t)result] |
+        carryAddTable[ALU_INDEX(oldVal, updateVal, result, 7)] |
+        auxCarryAddTable[ALU_INDEX(oldVal, updateVal, result, 3)]);
+}
 
-    registers[REG_A] = MemRead(addr);
+void UpdateFlagsZSPCA_ADC(Cpu8080 *cpu, uint8_t oldVal, uint8_t updateVal, uint8_t carry_in, uint16_t result) {
+    /* result already has carry_in in it, so the tables need nothing else */
+    (void)carry_in;
+    UpdateFlagsZSPCA_ADD(cpu, oldVal, updateVal, result);
 }
 
-void STAX(RegPair rp) {
-    uint16_t addr = 0;
-    
-    if (rp == RP_BC) {
-        addr = (uint16_t)((registers[REG_B] << 8) | registers[REG_C]);
-    }
+void UpdateFlagsZSPA_ADD(Cpu8080 *cpu, uint8_t oldVal, uint8_t updateVal, uint16_t result) {
+    cpu->flags = (uint8_t)((cpu->flags & ~FLAGS_ZSPAC_MASK) | zspTable[(uint8_t)result] |
+        auxCarryAddTable[ALU_INDEX(oldVal, updateVal, result, 3)]);
+}
 
-    if (rp == RP_DE) {
-        addr = (uint16_t)((registers[REG_D] << 8) | registers[REG_E]);
-    }
-    
-    MemWrite(addr, registers[REG_A]);
+void UpdateFlagsZSPCA_SUB(Cpu8080 *cpu, uint8_t oldVal, uint8_t updateVal, uint16_t result) {
+    cpu->flags = (uint8_t)((cpu->flags & ~FLAGS_ALL_MASK) | zspTable[(uint8_t)result] |
+        carrySubTable[ALU_INDEX(oldVal, updateVal, result, 7)] |
+        auxCarrySubTable[ALU_INDEX(oldVal, updateVal, result, 3)]);
 }
 
-void XCHG(void) {
-    uint8_t tempH = registers[REG_H], tempL = registers[REG_L];
-    registers[REG_H] = registers[REG_D];
-    registers[REG_L] = registers[REG_E];
-    registers[REG_D] = tempH;
-    registers[REG_E] = tempL;
+void UpdateFlagsZSPCA_SBB(Cpu8080 *cpu, uint8_t oldVal, uint8_t updateVal, uint8_t borrow_in, uint16_t result) {
+    (void)borrow_in;
+    UpdateFlagsZSPCA_SUB(cpu, oldVal, updateVal, result);
 }
 
-void ADD(Reg8 src) {
-    uint16_t result = registers[REG_A] + registers[src];
-    
-    UpdateFlagsZSPCA_ADD(registers[REG_A], registers[src], result);
-    registers[REG_A] = (uint8_t)result;
+void UpdateFlagsZSPA_SUB(Cpu8080 *cpu, uint8_t oldVal, uint8_t updateVal, uint16_t result) {
+    cpu->flags = (uint8_t)((cpu->flags & ~FLAGS_ZSPAC_MASK) | zspTable[(uint8_t)result] |
+        auxCarrySubTable[ALU_INDEX(oldVal, updateVal, result, 3)]);
 }
 
-void ADD_M(void) {
-    uint16_t addr = (registers[REG_H] << 8) | registers[REG_L];
-    uint8_t memVal = MemRead(addr);
-    uint16_t result = registers[REG_A] + memVal;
-    
-    UpdateFlagsZSPCA_ADD(registers[REG_A], memVal, result);
-    registers[REG_A] = (uint8_t)result;
+void UpdateFlagsZSP_Logical(Cpu8080 *cpu, uint8_t result, int acVal) {
+    cpu->flags = (uint8_t)((cpu->flags & ~FLAGS_ALL_MASK) | zspTable[result] | ((acVal != 0) << FLAG_AUXILIARY_CARRY));
 }
 
-void ADI(uint8_t imm) {
-    uint16_t result = registers[REG_A] + imm;
+void UpdateFlagC_ADD(Cpu8080 *cpu, uint8_t oldVal, uint8_t updateVal, uint16_t result) {
+    cpu->flags = (uint8_t)((cpu->flags & ~0x01) | carryAddTable[ALU_INDEX(oldVal, updateVal, result, 7)]);
+}
 
-    UpdateFlagsZSPCA_ADD(registers[REG_A], imm, result);
-    registers[REG_A] = (uint8_t)result;
+void UpdateFlagC_SUB(Cpu8080 *cpu, uint8_t oldVal, uint8_t updateVal) {
+    cpu->flags = (uint8_t)((cpu->flags & ~0x01) | (oldVal < updateVal));
 }
 
-void ADC(Reg8 src) {
-    uint8_t carry_in = IsFlagActive(FLAG_CARRY);
-    uint16_t result = registers[REG_A] + registers[src] + carry_in;
-    
-    ClearFlags();
+void MOV(Cpu8080 *cpu, Reg8 dst, Reg8 src) {
+    cpu->registers[dst] = cpu->registers[src];
+}
 
-    uint8_t res8 = (uint8_t)result;
+void MOV_FROM_M(Cpu8080 *cpu, Reg8 dst) {
+    uint16_t addr = cpu->pairs[RP_HL];
+    cpu->registers[dst] = BusRead(cpu, addr);
+}
 
-    if(res8 == 0) {
-        ActivateFlag(FLAG_ZERO);
-    }
+void MOV_TO_M(Cpu8080 *cpu, Reg8 src) {
+    uint16_t addr = cpu->pairs[RP_HL];
+    BusWrite(cpu, addr, cpu->registers[src]);
+}
 
-    if(res8 & 0x80) {
-        ActivateFlag(FLAG_SIGN);
-    }
+void MVI(Cpu8080 *cpu, Reg8 dst, uint8_t imm) {
+    cpu->registers[dst] = imm;
+}
 
-    if(Parity(res8)) {
-        ActivateFlag(FLAG_PARITY);
-    }
+void MVI_M(Cpu8080 *cpu, uint8_t imm) {
+    uint16_t addr = cpu->pairs[RP_HL];
+    BusWrite(cpu, addr, imm);
+}
 
-    if(result & 0x100) {
-        ActivateFlag(FLAG_CARRY);
-    }
+void LXI(Cpu8080 *cpu, RegPair rp, uint16_t imm) {
+    cpu->pairs[rp] = imm;
+}
 
-    if(((registers[REG_A] & 0x0F) + (registers[src] & 0x0F) + carry_in) & 0x10) {
-        ActivateFlag(FLAG_AUXILIARY_CARRY);
-    }
+void LDA(Cpu8080 *cpu, uint16_t addr) {
+    cpu->registers[REG_A] = BusRead(cpu, addr);
+}
+
+void STA(Cpu8080 *cpu, uint16_t addr) {
+    BusWrite(cpu, addr, cpu->registers[REG_A]);
+}
+
+void LHLD(Cpu8080 *cpu, uint16_t addr) {
+    cpu->pairs[RP_HL] = (uint16_t)(BusRead(cpu, addr) | (BusRead(cpu, addr + 1) << 8));
+}
+
+void SHLD(Cpu8080 *cpu, uint16_t addr) {
+    BusWrite(cpu, addr, cpu->registers[REG_L]);
+    BusWrite(cpu, addr + 1, cpu->registers[REG_H]);
+}
+
+/* Only BC and DE exist for LDAX/STAX */
+void LDAX(Cpu8080 *cpu, RegPair rp) {
+    cpu->registers[REG_A] = BusRead(cpu, cpu->pairs[rp]);
+}
+
+void STAX(Cpu8080 *cpu, RegPair rp) {
+    BusWrite(cpu, cpu->pairs[rp], cpu->registers[REG_A]);
+}
+
+void XCHG(Cpu8080 *cpu) {
+    uint16_t temp = cpu->pairs[RP_HL];
+
+    cpu->pairs[RP_HL] = cpu->pairs[RP_DE];
+    cpu->pairs[RP_DE] = temp;
+}
+
+void ADD(Cpu8080 *cpu, Reg8 src) {
+    uint16_t result = cpu->registers[REG_A] + cpu->registers[src];
     
-    registers[REG_A] = res8;
+    UpdateFlagsZSPCA_ADD(cpu, cpu->registers[REG_A], cpu->registers[src], result);
+    cpu->registers[REG_A] = (uint8_t)result;
 }
 
-void ADC_M(void) {
-    uint16_t addr = (registers[REG_H] << 8) | registers[REG_L];
-    uint8_t memVal = MemRead(addr);
-    uint8_t carry_in = IsFlagActive(FLAG_CARRY);
-    uint16_t result = registers[REG_A] + memVal + carry_in;
+void ADD_M(Cpu8080 *cpu) {
+    uint16_t addr = cpu->pairs[RP_HL];
+    uint8_t memVal = BusRead(cpu, addr);
+    uint16_t result = cpu->registers[REG_A] + memVal;
     
-    ClearFlags();
+    UpdateFlagsZSPCA_ADD(cpu, cpu->registers[REG_A], memVal, result);
+    cpu->registers[REG_A] = (uint8_t)result;
+}
+
+void ADI(Cpu8080 *cpu, uint8_t imm) {
+    uint16_t result = cpu->registers[REG_A] + imm;
+
+    UpdateFlagsZSPCA_ADD(cpu, cpu->registers[REG_A], imm, result);
+    cpu->registers[REG_A] = (uint8_t)result;
+}
+
+void ADC(Cpu8080 *cpu, Reg8 src) {
+    uint8_t carry_in = IsFlagActive(cpu, FLAG_CARRY);
+    uint16_t result = cpu->registers[REG_A] + cpu->registers[src] + carry_in;
+    
+    ClearFlags(cpu);
     
-    UpdateFlagsZSPCA_ADC(registers[REG_A], memVal, carry_in, result);
-    registers[REG_A] = (uint8_t)result;
+    UpdateFlagsZSPCA_ADC(cpu, cpu->registers[REG_A], cpu->registers[src], carry_in, result);
+    cpu->registers[REG_A] = (uint8_t)result;
 }
 
-void ACI(uint8_t imm) {
-    uint8_t carry_in = IsFlagActive(FLAG_CARRY);
-    uint16_t result = registers[REG_A] + imm + carry_in;
+void ADC_M(Cpu8080 *cpu) {
+    uint16_t addr = cpu->pairs[RP_HL];
+    uint8_t memVal = BusRead(cpu, addr);
+    uint8_t carry_in = IsFlagActive(cpu, FLAG_CARRY);
+    uint16_t result = cpu->registers[REG_A] + memVal + carry_in;
     
-    ClearFlags();
+    ClearFlags(cpu);
     
-    UpdateFlagsZSPCA_ADC(registers[REG_A], imm, carry_in, result);
-    registers[REG_A] = (uint8_t)result;
+    UpdateFlagsZSPCA_ADC(cpu, cpu->registers[REG_A], memVal, carry_in, result);
+    cpu->registers[REG_A] = (uint8_t)result;
 }
 
-void SUB(Reg8 src) {
-    uint16_t result = registers[REG_A] - registers[src];
+void ACI(Cpu8080 *cpu, uint8_t imm) {
+    uint8_t carry_in = IsFlagActive(cpu, FLAG_CARRY);
+    uint16_t result = cpu->registers[REG_A] + imm + carry_in;
     
-    UpdateFlagsZSPCA_SUB(registers[REG_A], registers[src], result);
-    registers[REG_A] = (uint8_t)result;
+    ClearFlags(cpu);
+    
+    UpdateFlagsZSPCA_ADC(cpu, cpu->registers[REG_A], imm, carry_in, result);
+    cpu->registers[REG_A] = (uint8_t)result;
 }
 
-void SUB_M(void) {
-    uint16_t addr = (registers[REG_H] << 8) | registers[REG_L];
-    uint8_t memVal = MemRead(addr);
-    uint16_t result = registers[REG_A] - memVal;
+void SUB(Cpu8080 *cpu, Reg8 src) {
+    uint16_t result = cpu->registers[REG_A] - cpu->registers[src];
     
-    UpdateFlagsZSPCA_SUB(registers[REG_A], memVal, result);
-    registers[REG_A] = (uint8_t)result;
+    UpdateFlagsZSPCA_SUB(cpu, cpu->registers[REG_A], cpu->registers[src], result);
+    cpu->registers[REG_A] = (uint8_t)result;
 }
 
-void SUI(uint8_t imm) {
-    uint16_t result = registers[REG_A] - imm;
+void SUB_M(Cpu8080 *cpu) {
+    uint16_t addr = cpu->pairs[RP_HL];
+    uint8_t memVal = BusRead(cpu, addr);
+    uint16_t result = cpu->registers[REG_A] - memVal;
     
-    UpdateFlagsZSPCA_SUB(registers[REG_A], imm, result);
-    registers[REG_A] = (uint8_t)result;
+    UpdateFlagsZSPCA_SUB(cpu, cpu->registers[REG_A], memVal, result);
+    cpu->registers[REG_A] = (uint8_t)result;
 }
 
-void SBB(Reg8 src) {
-    uint8_t borrow_in = IsFlagActive(FLAG_CARRY);
-    uint16_t result = registers[REG_A] - registers[src] - borrow_in;
+void SUI(Cpu8080 *cpu, uint8_t imm) {
+    uint16_t result = cpu->registers[REG_A] - imm;
     
-    ClearFlags();
+    UpdateFlagsZSPCA_SUB(cpu, cpu->registers[REG_A], imm, result);
+    cpu->registers[REG_A] = (uint8_t)result;
+}
+
+void SBB(Cpu8080 *cpu, Reg8 src) {
+    uint8_t borrow_in = IsFlagActive(cpu, FLAG_CARRY);
+    uint16_t result = cpu->registers[REG_A] - cpu->registers[src] - borrow_in;
+    
+    ClearFlags(cpu);
     
-    UpdateFlagsZSPCA_SBB(registers[REG_A], registers[src], borrow_in, result);
-    registers[REG_A] = (uint8_t)result;
+    UpdateFlagsZSPCA_SBB(cpu, cpu->registers[REG_A], cpu->registers[src], borrow_in, result);
+    cpu->registers[REG_A] = (uint8_t)result;
 }
 
-void SBB_M(void) {
-    uint16_t addr = (registers[REG_H] << 8) | registers[REG_L];
-    uint8_t memVal = MemRead(addr);
-    uint8_t borrow_in = IsFlagActive(FLAG_CARRY);
-    uint16_t result = registers[REG_A] - memVal - borrow_in;
+void SBB_M(Cpu8080 *cpu) {
+    uint16_t addr = cpu->pairs[RP_HL];
+    uint8_t memVal = BusRead(cpu, addr);
+    uint8_t borrow_in = IsFlagActive(cpu, FLAG_CARRY);
+    uint16_t result = cpu->registers[REG_A] - memVal - borrow_in;
     
-    ClearFlags();
+    ClearFlags(cpu);
     
-    UpdateFlagsZSPCA_SBB(registers[REG_A], memVal, borrow_in, result);
-    registers[REG_A] = (uint8_t)result;
+    UpdateFlagsZSPCA_SBB(cpu, cpu->registers[REG_A], memVal, borrow_in, result);
+    cpu->registers[REG_A] = (uint8_t)result;
 }
 
-void SBI(uint8_t imm) {
-    uint8_t borrow_in = IsFlagActive(FLAG_CARRY);
-    uint16_t result = registers[REG_A] - imm - borrow_in;
+void SBI(Cpu8080 *cpu, uint8_t imm) {
+    uint8_t borrow_in = IsFlagActive(cpu, FLAG_CARRY);
+    uint16_t result = cpu->registers[REG_A] - imm - borrow_in;
     
-    ClearFlags();
+    ClearFlags(cpu);
     
-    UpdateFlagsZSPCA_SBB(registers[REG_A], imm, borrow_in, result);
-    registers[REG_A] = (uint8_t)result;
+    UpdateFlagsZSPCA_SBB(cpu, cpu->registers[REG_A], imm, borrow_in, result);
+    cpu->registers[REG_A] = (uint8_t)result;
 }
 
-void INR(Reg8 dst) {
-    uint16_t result = registers[dst] + 1;
+void INR(Cpu8080 *cpu, Reg8 dst) {
+    uint16_t result = cpu->registers[dst] + 1;
     
-    UpdateFlagsZSPA_ADD(registers[dst], 1, result);
-    registers[dst] = (uint8_t)result;
+    UpdateFlagsZSPA_ADD(cpu, cpu->registers[dst], 1, result);
+    cpu->registers[dst] = (uint8_t)result;
 }
 
-void INR_M(void) {
-    uint16_t addr = (registers[REG_H] << 8) | registers[REG_L];
-    uint8_t memVal = MemRead(addr);
+void INR_M(Cpu8080 *cpu) {
+    uint16_t addr = cpu->pairs[RP_HL];
+    uint8_t memVal = BusRead(cpu, addr);
     uint16_t result = memVal + 1;
     
-    UpdateFlagsZSPA_ADD(memVal, 1, result);
-    MemWrite(addr, (uint8_t)result);
+    UpdateFlagsZSPA_ADD(cpu, memVal, 1, result);
+    BusWrite(cpu, addr, (uint8_t)result);
 }
 
-void DCR(Reg8 dst) {
-    uint16_t result = registers[dst] - 1;
+void DCR(Cpu8080 *cpu, Reg8 dst) {
+    uint16_t result = cpu->registers[dst] - 1;
     
-    UpdateFlagsZSPA_SUB(registers[dst], 1, result);
-    registers[dst] = (uint8_t)result;
+    UpdateFlagsZSPA_SUB(cpu, cpu->registers[dst], 1, result);
+    cpu->registers[dst] = (uint8_t)result;
 }
 
-void DCR_M(void) {
-    uint16_t addr = (registers[REG_H] << 8) | registers[REG_L];
-    uint8_t memVal = MemRead(addr);
+void DCR_M(Cpu8080 *cpu) {
+    uint16_t addr = cpu->pairs[RP_HL];
+    uint8_t memVal = BusRead(cpu, addr);
     uint16_t result = memVal - 1;
     
-    UpdateFlagsZSPA_SUB(memVal, 1, result);
-    MemWrite(addr, (uint8_t)result);
+    UpdateFlagsZSPA_SUB(cpu, memVal, 1, result);
+    BusWrite(cpu, addr, (uint8_t)result);
 }
 
-void INX(RegPair rp) {
-    if (rp == RP_SP) {
-        SP++;
-    } else {
-        int idx = CalcRegisterIdx(rp);
-        uint16_t result = ((registers[idx] << 8) | registers[idx + 1]) + 1;
-        
-        registers[idx]     = result >> 8;
-        registers[idx + 1] = result & 0xFF;
-    }
+/* SP is pairs[RP_SP], so INX/DCX/DAD SP need no special case */
+void INX(Cpu8080 *cpu, RegPair rp) {
+    cpu->pairs[rp]++;
 }
 
-void DCX(RegPair rp) {
-    if (rp == RP_SP) {
-        SP--;
-    } else {
-        int idx = CalcRegisterIdx(rp);
-        uint16_t result = ((registers[idx] << 8) | registers[idx + 1]) - 1;
-        
-        registers[idx]     = result >> 8;
-        registers[idx + 1] = result & 0xFF;
-    }
+void DCX(Cpu8080 *cpu, RegPair rp) {
+    cpu->pairs[rp]--;
 }
 
-void DAD(RegPair rp) {
-    uint32_t operand = 0;
-    
-    if (rp == RP_SP) {
-        operand = SP;
-    } else {
-        int idx = CalcRegisterIdx(rp);
-        operand = ((registers[idx] << 8) | registers[idx + 1]);
-    }
-    
-    uint32_t result = ((registers[REG_H] << 8) | registers[REG_L]) + operand;
-    
-    /* DAD only affects Carry flag, preserves all other flags (Z, S, P, AC) */
-    if(result > 0xFFFF) {
-        ActivateFlag(FLAG_CARRY);
-    }
-    else {
-        DeActivateFlag(FLAG_CARRY);
-    }
+void DAD(Cpu8080 *cpu, RegPair rp) {
+    uint32_t result = (uint32_t)cpu->pairs[RP_HL] + cpu->pairs[rp];
 
-    registers[REG_H] = (uint8_t)((result >> 8) & 0xFF);
-    registers[REG_L] = (uint8_t)(result & 0xFF);
+    /* DAD only affects Carry flag, preserves all other flags (Z, S, P, AC) */
+    cpu->flags = (uint8_t)((cpu->flags & ~0x01) | (result >> 16));
+    cpu->pairs[RP_HL] = (uint16_t)result;
 }
 
-void DAA(void) {
-    uint8_t oldA = registers[REG_A];
+void DAA(Cpu8080 *cpu) {
+    uint8_t oldA = cpu->registers[REG_A];
     uint8_t adjust = 0;
-    uint8_t carry = IsFlagActive(FLAG_CARRY);
-    uint8_t ac = IsFlagActive(FLAG_AUXILIARY_CARRY);
+    uint8_t carry = IsFlagActive(cpu, FLAG_CARRY);
+    uint8_t ac = IsFlagActive(cpu, FLAG_AUXILIARY_CARRY);
 
     if ((oldA & 0x0F) > 9 || ac) {
         adjust += 0x06;
@@ -565,342 +888,317 @@ void DAA(void) {
     
     if (oldA > 0x99 || carry) {
         adjust += 0x60;
-        ActivateFlag(FLAG_CARRY);
+        ActivateFlag(cpu, FLAG_CARRY);
     } else {
-        DeActivateFlag(FLAG_CARRY);
+        DeActivateFlag(cpu, FLAG_CARRY);
     }
 
     uint16_t result = oldA + adjust;
     
     /* AC is set if there's a carry from bit 3 to 4 during the first adjustment */
-    if (((oldA & 0x0F) + (adjust & 0x0F)) & 0x10) {
-        ActivateFlag(FLAG_AUXILIARY_CARRY);
-    }
-    else {
-        DeActivateFlag(FLAG_AUXILIARY_CARRY);
-    }
+    cpu->flags = (uint8_t)((cpu->flags & ~(1 << FLAG_AUXILIARY_CARRY)) |
+        auxCarryAddTable[ALU_INDEX(oldA, adjust, result, 3)]);
 
-    registers[REG_A] = (uint8_t)result;
-    
-    if (registers[REG_A] == 0) {
-        ActivateFlag(FLAG_ZERO);
-    }
-    else {
-        DeActivateFlag(FLAG_ZERO);
-    }
-    
-    if (registers[REG_A] & 0x80) {
-        ActivateFlag(FLAG_SIGN);
-    }
-    else {
-        DeActivateFlag(FLAG_SIGN);
-    }
-    
-    if (Parity(registers[REG_A])) {
-        ActivateFlag(FLAG_PARITY);
-    }
-    else {
-        DeActivateFlag(FLAG_PARITY);
-    }
+    cpu->registers[REG_A] = (uint8_t)result;
+    UpdateZSP(cpu, cpu->registers[REG_A]);
 }
 
-void ANA(Reg8 src) {
-    uint8_t oldA = registers[REG_A];
-    registers[REG_A] &= registers[src];
+void ANA(Cpu8080 *cpu, Reg8 src) {
+    uint8_t oldA = cpu->registers[REG_A];
+    cpu->registers[REG_A] &= cpu->registers[src];
     
-    ClearFlags();
-    UpdateFlagsZSP_Logical(registers[REG_A], (oldA | registers[src]) & 0x08);
+    ClearFlags(cpu);
+    UpdateFlagsZSP_Logical(cpu, cpu->registers[REG_A], (oldA | cpu->registers[src]) & 0x08);
 }
 
-void ANA_M(void) {
-    uint16_t addr = (registers[REG_H] << 8) | registers[REG_L];
-    uint8_t memVal = MemRead(addr);
-    uint8_t oldA = registers[REG_A];
+void ANA_M(Cpu8080 *cpu) {
+    uint16_t addr = cpu->pairs[RP_HL];
+    uint8_t memVal = BusRead(cpu, addr);
+    uint8_t oldA = cpu->registers[REG_A];
     
-    registers[REG_A] &= memVal;
+    cpu->registers[REG_A] &= memVal;
     
-    ClearFlags();
-    UpdateFlagsZSP_Logical(registers[REG_A], (oldA | memVal) & 0x08);
+    ClearFlags(cpu);
+    UpdateFlagsZSP_Logical(cpu, cpu->registers[REG_A], (oldA | memVal) & 0x08);
 }
 
-void ANI(uint8_t imm) {
-    uint8_t oldA = registers[REG_A];
-    registers[REG_A] &= imm;
+void ANI(Cpu8080 *cpu, uint8_t imm) {
+    uint8_t oldA = cpu->registers[REG_A];
+    cpu->registers[REG_A] &= imm;
     
-    ClearFlags();
-    UpdateFlagsZSP_Logical(registers[REG_A], (oldA | imm) & 0x08);
+    ClearFlags(cpu);
+    UpdateFlagsZSP_Logical(cpu, cpu->registers[REG_A], (oldA | imm) & 0x08);
 }
 
-void ORA(Reg8 src) {
-    registers[REG_A] |= registers[src];
+void ORA(Cpu8080 *cpu, Reg8 src) {
+    cpu->registers[REG_A] |= cpu->registers[src];
     
-    ClearFlags();
-    UpdateFlagsZSP_Logical(registers[REG_A], 0);
+    ClearFlags(cpu);
+    UpdateFlagsZSP_Logical(cpu, cpu->registers[REG_A], 0);
 }
 
-void ORA_M(void) {
-    uint16_t addr = (registers[REG_H] << 8) | registers[REG_L];
-    registers[REG_A] |= MemRead(addr);
+void ORA_M(Cpu8080 *cpu) {
+    uint16_t addr = cpu->pairs[RP_HL];
+    cpu->registers[REG_A] |= BusRead(cpu, addr);
     
-    ClearFlags();
-    UpdateFlagsZSP_Logical(registers[REG_A], 0);
+    ClearFlags(cpu);
+    UpdateFlagsZSP_Logical(cpu, cpu->registers[REG_A], 0);
 }
 
-void ORI(uint8_t imm) {
-    registers[REG_A] |= imm;
+void ORI(Cpu8080 *cpu, uint8_t imm) {
+    cpu->registers[REG_A] |= imm;
     
-    ClearFlags();
-    UpdateFlagsZSP_Logical(registers[REG_A], 0);
+    ClearFlags(cpu);
+    UpdateFlagsZSP_Logical(cpu, cpu->registers[REG_A], 0);
 }
 
-void XRA(Reg8 src) {
-    registers[REG_A] ^= registers[src];
+void XRA(Cpu8080 *cpu, Reg8 src) {
+    cpu->registers[REG_A] ^= cpu->registers[src];
     
-    ClearFlags();
-    UpdateFlagsZSP_Logical(registers[REG_A], 0);
+    ClearFlags(cpu);
+    UpdateFlagsZSP_Logical(cpu, cpu->registers[REG_A], 0);
 }
 
-void XRA_M(void) {
-    uint16_t addr = (registers[REG_H] << 8) | registers[REG_L];
-    registers[REG_A] ^= MemRead(addr);
+void XRA_M(Cpu8080 *cpu) {
+    uint16_t addr = cpu->pairs[RP_HL];
+    cpu->registers[REG_A] ^= BusRead(cpu, addr);
     
-    ClearFlags();
-    UpdateFlagsZSP_Logical(registers[REG_A], 0);
+    ClearFlags(cpu);
+    UpdateFlagsZSP_Logical(cpu, cpu->registers[REG_A], 0);
 }
 
-void XRI(uint8_t imm) {
-    registers[REG_A] ^= imm;
+void XRI(Cpu8080 *cpu, uint8_t imm) {
+    cpu->registers[REG_A] ^= imm;
     
-    ClearFlags();
-    UpdateFlagsZSP_Logical(registers[REG_A], 0);
+    ClearFlags(cpu);
+    UpdateFlagsZSP_Logical(cpu, cpu->registers[REG_A], 0);
 }
 
-void CMP(Reg8 src) {
-    uint16_t result = registers[REG_A] - registers[src];
-    UpdateFlagsZSPCA_SUB(registers[REG_A], registers[src], result);
+void CMP(Cpu8080 *cpu, Reg8 src) {
+    uint16_t result = cpu->registers[REG_A] - cpu->registers[src];
+    UpdateFlagsZSPCA_SUB(cpu, cpu->registers[REG_A], cpu->registers[src], result);
 }
 
-void CMP_M(void) {
-    uint16_t addr = (registers[REG_H] << 8) | registers[REG_L];
-    uint8_t memVal = MemRead(addr);
-    uint16_t result = registers[REG_A] - memVal;
+void CMP_M(Cpu8080 *cpu) {
+    uint16_t addr = cpu->pairs[RP_HL];
+    uint8_t memVal = BusRead(cpu, addr);
+    uint16_t result = cpu->registers[REG_A] - memVal;
     
-    UpdateFlagsZSPCA_SUB(registers[REG_A], memVal, result);
+    UpdateFlagsZSPCA_SUB(cpu, cpu->registers[REG_A], memVal, result);
 }
 
-void CPI(uint8_t imm) {
-    uint16_t result = registers[REG_A] - imm;
-    UpdateFlagsZSPCA_SUB(registers[REG_A], imm, result);
+void CPI(Cpu8080 *cpu, uint8_t imm) {
+    uint16_t result = cpu->registers[REG_A] - imm;
+    UpdateFlagsZSPCA_SUB(cpu, cpu->registers[REG_A], imm, result);
 }
 
-void RLC(void) {
-    uint8_t msb = (uint8_t)((registers[REG_A] & 0x80) >> 7);
-    registers[REG_A] = (uint8_t)((registers[REG_A] << 1) | msb);
+void RLC(Cpu8080 *cpu) {
+    uint8_t msb = (uint8_t)((cpu->registers[REG_A] & 0x80) >> 7);
+    cpu->registers[REG_A] = (uint8_t)((cpu->registers[REG_A] << 1) | msb);
     
     if (msb) {
-        ActivateFlag(FLAG_CARRY);
+        ActivateFlag(cpu, FLAG_CARRY);
     } else {
-        DeActivateFlag(FLAG_CARRY);
+        DeActivateFlag(cpu, FLAG_CARRY);
     }
 }
 
-void RRC(void) {
-    uint8_t lsb = (uint8_t)(registers[REG_A] & 0x01);
-    registers[REG_A] = (uint8_t)((registers[REG_A] >> 1) | (lsb << 7));
+void RRC(Cpu8080 *cpu) {
+    uint8_t lsb = (uint8_t)(cpu->registers[REG_A] & 0x01);
+    cpu->registers[REG_A] = (uint8_t)((cpu->registers[REG_A] >> 1) | (lsb << 7));
     
     if (lsb) {
-        ActivateFlag(FLAG_CARRY);
+        ActivateFlag(cpu, FLAG_CARRY);
     } else {
-        DeActivateFlag(FLAG_CARRY);
+        DeActivateFlag(cpu, FLAG_CARRY);
     }
 }
 
-void RAL(void) {
-    uint8_t oldCarry = IsFlagActive(FLAG_CARRY);
-    uint8_t msb = (uint8_t)((registers[REG_A] & 0x80) >> 7);
+void RAL(Cpu8080 *cpu) {
+    uint8_t oldCarry = IsFlagActive(cpu, FLAG_CARRY);
+    uint8_t msb = (uint8_t)((cpu->registers[REG_A] & 0x80) >> 7);
     
-    registers[REG_A] = (uint8_t)((registers[REG_A] << 1) | oldCarry);
+    cpu->registers[REG_A] = (uint8_t)((cpu->registers[REG_A] << 1) | oldCarry);
     
     if (msb) {
-        ActivateFlag(FLAG_CARRY);
+        ActivateFlag(cpu, FLAG_CARRY);
     } else {
-        DeActivateFlag(FLAG_CARRY);
+        DeActivateFlag(cpu, FLAG_CARRY);
     }
 }
 
-void RAR(void) {
-    uint8_t oldCarry = IsFlagActive(FLAG_CARRY);
-    uint8_t lsb = (uint8_t)(registers[REG_A] & 0x01);
+void RAR(Cpu8080 *cpu) {
+    uint8_t oldCarry = IsFlagActive(cpu, FLAG_CARRY);
+    uint8_t lsb = (uint8_t)(cpu->registers[REG_A] & 0x01);
     
-    registers[REG_A] = (uint8_t)((registers[REG_A] >> 1) | (oldCarry << 7));
+    cpu->registers[REG_A] = (uint8_t)((cpu->registers[REG_A] >> 1) | (oldCarry << 7));
     
     if (lsb) {
-        ActivateFlag(FLAG_CARRY);
+        ActivateFlag(cpu, FLAG_CARRY);
     } else {
-        DeActivateFlag(FLAG_CARRY);
+        DeActivateFlag(cpu, FLAG_CARRY);
     }
 }
 
-void CMA(void) {
-    registers[REG_A] = ~registers[REG_A];
+void CMA(Cpu8080 *cpu) {
+    cpu->registers[REG_A] = ~cpu->registers[REG_A];
 }
 
-void CMC(void) {
-    flags ^= 1;
+void CMC(Cpu8080 *cpu) {
+    cpu->flags ^= 1;
 }
 
-void STC(void) {
-    ActivateFlag(FLAG_CARRY);
+void STC(Cpu8080 *cpu) {
+    ActivateFlag(cpu, FLAG_CARRY);
 }
 
-void JMP(uint16_t addr) {
-    PC = addr;
+void JMP(Cpu8080 *cpu, uint16_t addr) {
+    cpu->PC = addr;
 }
 
-void JCC(Cond cond, uint16_t addr) {
-    if (CheckCondition(cond)) {
-        PC = addr;
+void JCC(Cpu8080 *cpu, Cond cond, uint16_t addr) {
+    if (CheckCondition(cpu, cond)) {
+        cpu->PC = addr;
     }
 }
 
-void CALL(uint16_t addr) {
-    MemWrite(--SP, (PC >> 8) & 0xFF);
-    MemWrite(--SP, PC & 0xFF);
-    PC = addr;
+void CALL(Cpu8080 *cpu, uint16_t addr) {
+    BusWrite(cpu, --cpu->SP, (cpu->PC >> 8) & 0xFF);
+    BusWrite(cpu, --cpu->SP, cpu->PC & 0xFF);
+
+    if (cpu->callGraph) {
+        CallGraphCall(cpu->callGraph, cpu, (uint16_t)(cpu->PC - 3), addr);
+    }
+
+    cpu->PC = addr;
 }
 
-void CCC(Cond cond, uint16_t addr) {
-    if (CheckCondition(cond)) {
-        CALL(addr);
+void CCC(Cpu8080 *cpu, Cond cond, uint16_t addr) {
+    if (CheckCondition(cpu, cond)) {
+        CALL(cpu, addr);
     }
 }
 
-void RET(void) {
-    uint8_t low = MemRead(SP++);
-    uint8_t high = MemRead(SP++);
-    PC = ((uint16_t)high << 8) | low;
+void RET(Cpu8080 *cpu) {
+    uint8_t low = BusRead(cpu, cpu->SP++);
+    uint8_t high = BusRead(cpu, cpu->SP++);
+    cpu->PC = ((uint16_t)high << 8) | low;
+
+    if (cpu->callGraph) {
+        CallGraphReturn(cpu->callGraph, cpu);
+    }
 }
 
-void RCC(Cond cond) {
-    if (CheckCondition(cond)) {
-        RET();
+void RCC(Cpu8080 *cpu, Cond cond) {
+    if (CheckCondition(cpu, cond)) {
+        RET(cpu);
     }
 }
 
-void RST(uint8_t rst) {
-    MemWrite(--SP, (PC >> 8) & 0xFF);
-    MemWrite(--SP, PC & 0xFF);
-    PC = 8 * rst;
+void RST(Cpu8080 *cpu, uint8_t rst) {
+    BusWrite(cpu, --cpu->SP, (cpu->PC >> 8) & 0xFF);
+    BusWrite(cpu, --cpu->SP, cpu->PC & 0xFF);
+
+    if (cpu->callGraph) {
+        CallGraphCall(cpu->callGraph, cpu, (uint16_t)(cpu->PC - 1), (uint16_t)(8 * rst));
+    }
+
+    cpu->PC = 8 * rst;
 }
 
-void PCHL(void) {
-    PC = (uint16_t)((registers[REG_H] << 8) | registers[REG_L]);
+void PCHL(Cpu8080 *cpu) {
+    cpu->PC = cpu->pairs[RP_HL];
 }
 
-void PUSH(RegPair rp) {
-    uint8_t high, low;
-    
-    if (rp == RP_SP) {
-        high = (uint8_t)(SP >> 8);
-        low = (uint8_t)(SP & 0xFF);
-    } else {
-        int idx = CalcRegisterIdx(rp);
-        high = registers[idx];
-        low  = registers[idx + 1];
-    }
+void PUSH(Cpu8080 *cpu, RegPair rp) {
+    uint16_t value = cpu->pairs[rp];
 
-    MemWrite(--SP, high);
-    MemWrite(--SP, low);
+    BusWrite(cpu, --cpu->SP, (uint8_t)(value >> 8));
+    BusWrite(cpu, --cpu->SP, (uint8_t)(value & 0xFF));
 }
 
-void PUSH_PSW(void) {
+void PUSH_PSW(Cpu8080 *cpu) {
     uint8_t psw = 0x02;
-    psw |= (flags & (1 << FLAG_SIGN)) ? 0x80 : 0;
-    psw |= (flags & (1 << FLAG_ZERO)) ? 0x40 : 0;
-    psw |= (flags & (1 << FLAG_AUXILIARY_CARRY)) ? 0x10 : 0;
-    psw |= (flags & (1 << FLAG_PARITY)) ? 0x04 : 0;
-    psw |= (flags & (1 << FLAG_CARRY)) ? 0x01 : 0;
+    psw |= (cpu->flags & (1 << FLAG_SIGN)) ? 0x80 : 0;
+    psw |= (cpu->flags & (1 << FLAG_ZERO)) ? 0x40 : 0;
+    psw |= (cpu->flags & (1 << FLAG_AUXILIARY_CARRY)) ? 0x10 : 0;
+    psw |= (cpu->flags & (1 << FLAG_PARITY)) ? 0x04 : 0;
+    psw |= (cpu->flags & (1 << FLAG_CARRY)) ? 0x01 : 0;
 
-    MemWrite(--SP, registers[REG_A]);
-    MemWrite(--SP, psw);
+    BusWrite(cpu, --cpu->SP, cpu->registers[REG_A]);
+    BusWrite(cpu, --cpu->SP, psw);
 }
 
-void POP(RegPair rp) {
-    uint8_t low  = MemRead(SP++);
-    uint8_t high = MemRead(SP++);
-    
-    if (rp == RP_SP) {
-        SP = (uint16_t)((high << 8) | low);
-    } else {
-        int idx = CalcRegisterIdx(rp);
-        registers[idx]     = high;
-        registers[idx + 1] = low;
-    }
+void POP(Cpu8080 *cpu, RegPair rp) {
+    uint8_t low  = BusRead(cpu, cpu->SP++);
+    uint8_t high = BusRead(cpu, cpu->SP++);
+
+    cpu->pairs[rp] = (uint16_t)((high << 8) | low);
 }
 
-void POP_PSW(void) {
-    uint8_t psw = MemRead(SP++);
-    registers[REG_A] = MemRead(SP++);
+void POP_PSW(Cpu8080 *cpu) {
+    uint8_t psw = BusRead(cpu, cpu->SP++);
+    cpu->registers[REG_A] = BusRead(cpu, cpu->SP++);
     
-    flags = 0x02;
+    cpu->flags = 0x02;
     
     if (psw & 0x80) {
-        ActivateFlag(FLAG_SIGN);
+        ActivateFlag(cpu, FLAG_SIGN);
     }
     
     if (psw & 0x40) {
-        ActivateFlag(FLAG_ZERO);
+        ActivateFlag(cpu, FLAG_ZERO);
     }
     
     if (psw & 0x10) {
-        ActivateFlag(FLAG_AUXILIARY_CARRY);
+        ActivateFlag(cpu, FLAG_AUXILIARY_CARRY);
     }
     
     if (psw & 0x04) {
-        ActivateFlag(FLAG_PARITY);
+        ActivateFlag(cpu, FLAG_PARITY);
     }
     
     if (psw & 0x01) {
-        ActivateFlag(FLAG_CARRY);
+        ActivateFlag(cpu, FLAG_CARRY);
     }
 }
 
-void XTHL(void) {
-    uint8_t tempL = registers[REG_L];
-    uint8_t tempH = registers[REG_H];
+void XTHL(Cpu8080 *cpu) {
+    uint16_t temp = cpu->pairs[RP_HL];
 
-    registers[REG_L] = MemRead(SP);
-    registers[REG_H] = MemRead(SP + 1);
+    cpu->pairs[RP_HL] = (uint16_t)(BusRead(cpu, cpu->SP) | (BusRead(cpu, cpu->SP + 1) << 8));
 
-    MemWrite(SP, tempL);
-    MemWrite(SP + 1, tempH);
+    BusWrite(cpu, cpu->SP, (uint8_t)(temp & 0xFF));
+    BusWrite(cpu, cpu->SP + 1, (uint8_t)(temp >> 8));
 }
 
-void SPHL(void) {
-    SP = (uint16_t)((registers[REG_H] << 8) | registers[REG_L]);
+void SPHL(Cpu8080 *cpu) {
+    cpu->SP = cpu->pairs[RP_HL];
 }
 
-void IN(uint8_t port) {
-    registers[REG_A] = IORead(port);
+void IN(Cpu8080 *cpu, uint8_t port) {
+    cpu->registers[REG_A] = IORead(cpu, port);
 }
 
-void OUT(uint8_t port) {
-    IOWrite(port, registers[REG_A]);
+void OUT(Cpu8080 *cpu, uint8_t port) {
+    IOWrite(cpu, port, cpu->registers[REG_A]);
 }
 
-void EI(void) {
-    interruptsEnabled = TRUE;
+void EI(Cpu8080 *cpu) {
+    cpu->interruptsEnabled = TRUE;
 }
 
-void DI(void) {
-    interruptsEnabled = FALSE;
+void DI(Cpu8080 *cpu) {
+    cpu->interruptsEnabled = FALSE;
 }
 
-void HLT(void) {
-    halted = TRUE;
+void HLT(Cpu8080 *cpu) {
+    cpu->halted = TRUE;
 }
 
-void NOP(void) {}
+void NOP(Cpu8080 *cpu) {
+    (void)cpu;
+}
 
 /*
     Jump table.
@@ -909,1316 +1207,1324 @@ void NOP(void) {}
 */
 OpcodeHandler opcodeTable[256];
 
-static int op_00(void) {
-    NOP();
+static int op_00(Cpu8080 *cpu) {
+    NOP(cpu);
     return 4;
 }
 
-static int op_01(void) {
-    LXI(RP_BC, FetchWord());
+static int op_01(Cpu8080 *cpu) {
+    LXI(cpu, RP_BC, BusFetchWord(cpu));
     return 10;
 }
 
-static int op_02(void) {
-    STAX(RP_BC);
+static int op_02(Cpu8080 *cpu) {
+    STAX(cpu, RP_BC);
     return 7;
 }
 
-static int op_03(void) {
-    INX(RP_BC);
+static int op_03(Cpu8080 *cpu) {
+    INX(cpu, RP_BC);
     return 5;
 }
 
-static int op_04(void) {
-    INR(REG_B);
+static int op_04(Cpu8080 *cpu) {
+    INR(cpu, REG_B);
     return 5;
 }
 
-static int op_05(void) {
-    DCR(REG_B);
+static int op_05(Cpu8080 *cpu) {
+    DCR(cpu, REG_B);
     return 5;
 }
 
-static int op_06(void) {
-    MVI(REG_B, FetchByte());
+static int op_06(Cpu8080 *cpu) {
+    MVI(cpu, REG_B, BusFetchByte(cpu));
     return 7;
 }
 
-static int op_07(void) {
-    RLC();
+static int op_07(Cpu8080 *cpu) {
+    RLC(cpu);
     return 4;
 }
 
-static int op_08(void) {
-    NOP();
+/* Undocumented NOP, and TRAP_OPCODE */
+static int op_08(Cpu8080 *cpu) {
+    uint16_t addr = (uint16_t)(cpu->PC - 1);
+
+    if (TrapAt(cpu, addr)) {
+        TrapFire(cpu, addr);
+    } else {
+        NOP(cpu);
+    }
+
     return 4;
 }
 
-static int op_09(void) {
-    DAD(RP_BC);
+static int op_09(Cpu8080 *cpu) {
+    DAD(cpu, RP_BC);
     return 10;
 }
 
-static int op_0a(void) {
-    LDAX(RP_BC);
+static int op_0a(Cpu8080 *cpu) {
+    LDAX(cpu, RP_BC);
     return 7;
 }
 
-static int op_0b(void) {
-    DCX(RP_BC);
+static int op_0b(Cpu8080 *cpu) {
+    DCX(cpu, RP_BC);
     return 5;
 }
 
-static int op_0c(void) {
-    INR(REG_C);
+static int op_0c(Cpu8080 *cpu) {
+    INR(cpu, REG_C);
     return 5;
 }
 
-static int op_0d(void) {
-    DCR(REG_C);
+static int op_0d(Cpu8080 *cpu) {
+    DCR(cpu, REG_C);
     return 5;
 }
 
-static int op_0e(void) {
-    MVI(REG_C, FetchByte());
+static int op_0e(Cpu8080 *cpu) {
+    MVI(cpu, REG_C, BusFetchByte(cpu));
     return 7;
 }
 
-static int op_0f(void) {
-    RRC();
+static int op_0f(Cpu8080 *cpu) {
+    RRC(cpu);
     return 4;
 }
 
-static int op_10(void) {
-    NOP();
+static int op_10(Cpu8080 *cpu) {
+    NOP(cpu);
     return 4;
 }
 
-static int op_11(void) {
-    LXI(RP_DE, FetchWord());
+static int op_11(Cpu8080 *cpu) {
+    LXI(cpu, RP_DE, BusFetchWord(cpu));
     return 10;
 }
 
-static int op_12(void) {
-    STAX(RP_DE);
+static int op_12(Cpu8080 *cpu) {
+    STAX(cpu, RP_DE);
     return 7;
 }
 
-static int op_13(void) {
-    INX(RP_DE);
+static int op_13(Cpu8080 *cpu) {
+    INX(cpu, RP_DE);
     return 5;
 }
 
-static int op_14(void) {
-    INR(REG_D);
+static int op_14(Cpu8080 *cpu) {
+    INR(cpu, REG_D);
     return 5;
 }
 
-static int op_15(void) {
-    DCR(REG_D);
+static int op_15(Cpu8080 *cpu) {
+    DCR(cpu, REG_D);
     return 5;
 }
 
-static int op_16(void) {
-    MVI(REG_D, FetchByte());
+static int op_16(Cpu8080 *cpu) {
+    MVI(cpu, REG_D, BusFetchByte(cpu));
     return 7;
 }
 
-static int op_17(void) {
-    RAL();
+static int op_17(Cpu8080 *cpu) {
+    RAL(cpu);
     return 4;
 }
 
-static int op_18(void) {
-    NOP();
+static int op_18(Cpu8080 *cpu) {
+    NOP(cpu);
     return 4;
 }
 
-static int op_19(void) {
-    DAD(RP_DE);
+static int op_19(Cpu8080 *cpu) {
+    DAD(cpu, RP_DE);
     return 10;
 }
 
-static int op_1a(void) {
-    LDAX(RP_DE);
+static int op_1a(Cpu8080 *cpu) {
+    LDAX(cpu, RP_DE);
     return 7;
 }
 
-static int op_1b(void) {
-    DCX(RP_DE);
+static int op_1b(Cpu8080 *cpu) {
+    DCX(cpu, RP_DE);
     return 5;
 }
 
-static int op_1c(void) {
-    INR(REG_E);
+static int op_1c(Cpu8080 *cpu) {
+    INR(cpu, REG_E);
     return 5;
 }
 
-static int op_1d(void) {
-    DCR(REG_E);
+static int op_1d(Cpu8080 *cpu) {
+    DCR(cpu, REG_E);
     return 5;
 }
 
-static int op_1e(void) {
-    MVI(REG_E, FetchByte());
+static int op_1e(Cpu8080 *cpu) {
+    MVI(cpu, REG_E, BusFetchByte(cpu));
     return 7;
 }
 
-static int op_1f(void) {
-    RAR();
+static int op_1f(Cpu8080 *cpu) {
+    RAR(cpu);
     return 4;
 }
 
-static int op_20(void) {
-    NOP();
+static int op_20(Cpu8080 *cpu) {
+    NOP(cpu);
     return 4;
 }
 
-static int op_21(void) {
-    LXI(RP_HL, FetchWord());
+static int op_21(Cpu8080 *cpu) {
+    LXI(cpu, RP_HL, BusFetchWord(cpu));
     return 10;
 }
 
-static int op_22(void) {
-    SHLD(FetchWord());
+static int op_22(Cpu8080 *cpu) {
+    SHLD(cpu, BusFetchWord(cpu));
     return 16;
 }
 
-static int op_23(void) {
-    INX(RP_HL);
+static int op_23(Cpu8080 *cpu) {
+    INX(cpu, RP_HL);
     return 5;
 }
 
-static int op_24(void) {
-    INR(REG_H);
+static int op_24(Cpu8080 *cpu) {
+    INR(cpu, REG_H);
     return 5;
 }
 
-static int op_25(void) {
-    DCR(REG_H);
+static int op_25(Cpu8080 *cpu) {
+    DCR(cpu, REG_H);
     return 5;
 }
 
-static int op_26(void) {
-    MVI(REG_H, FetchByte());
+static int op_26(Cpu8080 *cpu) {
+    MVI(cpu, REG_H, BusFetchByte(cpu));
     return 7;
 }
 
-static int op_27(void) {
-    DAA();
+static int op_27(Cpu8080 *cpu) {
+    DAA(cpu);
     return 4;
 }
 
-static int op_28(void) {
-    NOP();
+static int op_28(Cpu8080 *cpu) {
+    NOP(cpu);
     return 4;
 }
 
-static int op_29(void) {
-    DAD(RP_HL);
+static int op_29(Cpu8080 *cpu) {
+    DAD(cpu, RP_HL);
     return 10;
 }
 
-static int op_2a(void) {
-    LHLD(FetchWord());
+static int op_2a(Cpu8080 *cpu) {
+    LHLD(cpu, BusFetchWord(cpu));
     return 16;
 }
 
-static int op_2b(void) {
-    DCX(RP_HL);
+static int op_2b(Cpu8080 *cpu) {
+    DCX(cpu, RP_HL);
     return 5;
 }
 
-static int op_2c(void) {
-    INR(REG_L);
+static int op_2c(Cpu8080 *cpu) {
+    INR(cpu, REG_L);
     return 5;
 }
 
-static int op_2d(void) {
-    DCR(REG_L);
+static int op_2d(Cpu8080 *cpu) {
+    DCR(cpu, REG_L);
     return 5;
 }
 
-static int op_2e(void) {
-    MVI(REG_L, FetchByte());
+static int op_2e(Cpu8080 *cpu) {
+    MVI(cpu, REG_L, BusFetchByte(cpu));
     return 7;
 }
 
-static int op_2f(void) {
-    CMA();
+static int op_2f(Cpu8080 *cpu) {
+    CMA(cpu);
     return 4;
 }
 
-static int op_30(void) {
-    NOP();
+static int op_30(Cpu8080 *cpu) {
+    NOP(cpu);
     return 4;
 }
 
-static int op_31(void) {
-    LXI(RP_SP, FetchWord());
+static int op_31(Cpu8080 *cpu) {
+    LXI(cpu, RP_SP, BusFetchWord(cpu));
     return 10;
 }
 
-static int op_32(void) {
-    STA(FetchWord());
+static int op_32(Cpu8080 *cpu) {
+    STA(cpu, BusFetchWord(cpu));
     return 13;
 }
 
-static int op_33(void) {
-    INX(RP_SP);
+static int op_33(Cpu8080 *cpu) {
+    INX(cpu, RP_SP);
     return 5;
 }
 
-static int op_34(void) {
-    INR_M();
+static int op_34(Cpu8080 *cpu) {
+    INR_M(cpu);
     return 10;
 }
 
-static int op_35(void) {
-    DCR_M();
+static int op_35(Cpu8080 *cpu) {
+    DCR_M(cpu);
     return 10;
 }
 
-static int op_36(void) {
-    MVI_M(FetchByte());
+static int op_36(Cpu8080 *cpu) {
+    MVI_M(cpu, BusFetchByte(cpu));
     return 10;
 }
 
-static int op_37(void) {
-    STC();
+static int op_37(Cpu8080 *cpu) {
+    STC(cpu);
     return 4;
 }
 
-static int op_38(void) {
-    NOP();
+static int op_38(Cpu8080 *cpu) {
+    NOP(cpu);
     return 4;
 }
 
-static int op_39(void) {
-    DAD(RP_SP);
+static int op_39(Cpu8080 *cpu) {
+    DAD(cpu, RP_SP);
     return 10;
 }
 
-static int op_3a(void) {
-    LDA(FetchWord());
+static int op_3a(Cpu8080 *cpu) {
+    LDA(cpu, BusFetchWord(cpu));
     return 13;
 }
 
-static int op_3b(void) {
-    DCX(RP_SP);
+static int op_3b(Cpu8080 *cpu) {
+    DCX(cpu, RP_SP);
     return 5;
 }
 
-static int op_3c(void) {
-    INR(REG_A);
+static int op_3c(Cpu8080 *cpu) {
+    INR(cpu, REG_A);
     return 5;
 }
 
-static int op_3d(void) {
-    DCR(REG_A);
+static int op_3d(Cpu8080 *cpu) {
+    DCR(cpu, REG_A);
     return 5;
 }
 
-static int op_3e(void) {
-    MVI(REG_A, FetchByte());
+static int op_3e(Cpu8080 *cpu) {
+    MVI(cpu, REG_A, BusFetchByte(cpu));
     return 7;
 }
 
-static int op_3f(void) {
-    CMC();
+static int op_3f(Cpu8080 *cpu) {
+    CMC(cpu);
     return 4;
 }
 
-static int op_40(void) {
-    MOV(REG_B, REG_B);
+static int op_40(Cpu8080 *cpu) {
+    MOV(cpu, REG_B, REG_B);
     return 5;
 }
 
-static int op_41(void) {
-    MOV(REG_B, REG_C);
+static int op_41(Cpu8080 *cpu) {
+    MOV(cpu, REG_B, REG_C);
     return 5;
 }
 
-static int op_42(void) {
-    MOV(REG_B, REG_D);
+static int op_42(Cpu8080 *cpu) {
+    MOV(cpu, REG_B, REG_D);
     return 5;
 }
 
-static int op_43(void) {
-    MOV(REG_B, REG_E);
+static int op_43(Cpu8080 *cpu) {
+    MOV(cpu, REG_B, REG_E);
     return 5;
 }
 
-static int op_44(void) {
-    MOV(REG_B, REG_H);
+static int op_44(Cpu8080 *cpu) {
+    MOV(cpu, REG_B, REG_H);
     return 5;
 }
 
-static int op_45(void) {
-    MOV(REG_B, REG_L);
+static int op_45(Cpu8080 *cpu) {
+    MOV(cpu, REG_B, REG_L);
     return 5;
 }
 
-static int op_46(void) {
-    MOV_FROM_M(REG_B);
+static int op_46(Cpu8080 *cpu) {
+    MOV_FROM_M(cpu, REG_B);
     return 7;
 }
 
-static int op_47(void) {
-    MOV(REG_B, REG_A);
+static int op_47(Cpu8080 *cpu) {
+    MOV(cpu, REG_B, REG_A);
     return 5;
 }
 
-static int op_48(void) {
-    MOV(REG_C, REG_B);
+static int op_48(Cpu8080 *cpu) {
+    MOV(cpu, REG_C, REG_B);
     return 5;
 }
 
-static int op_49(void) {
-    MOV(REG_C, REG_C);
+static int op_49(Cpu8080 *cpu) {
+    MOV(cpu, REG_C, REG_C);
     return 5;
 }
 
-static int op_4a(void) {
-    MOV(REG_C, REG_D);
+static int op_4a(Cpu8080 *cpu) {
+    MOV(cpu, REG_C, REG_D);
     return 5;
 }
 
-static int op_4b(void) {
-    MOV(REG_C, REG_E);
+static int op_4b(Cpu8080 *cpu) {
+    MOV(cpu, REG_C, REG_E);
     return 5;
 }
 
-static int op_4c(void) {
-    MOV(REG_C, REG_H);
+static int op_4c(Cpu8080 *cpu) {
+    MOV(cpu, REG_C, REG_H);
     return 5;
 }
 
-static int op_4d(void) {
-    MOV(REG_C, REG_L);
+static int op_4d(Cpu8080 *cpu) {
+    MOV(cpu, REG_C, REG_L);
     return 5;
 }
 
-static int op_4e(void) {
-    MOV_FROM_M(REG_C);
+static int op_4e(Cpu8080 *cpu) {
+    MOV_FROM_M(cpu, REG_C);
     return 7;
 }
 
-static int op_4f(void) {
-    MOV(REG_C, REG_A);
+static int op_4f(Cpu8080 *cpu) {
+    MOV(cpu, REG_C, REG_A);
     return 5;
 }
 
 
-static int op_50(void) {
-    MOV(REG_D, REG_B);
+static int op_50(Cpu8080 *cpu) {
+    MOV(cpu, REG_D, REG_B);
     return 5;
 }
 
-static int op_51(void) {
-    MOV(REG_D, REG_C);
+static int op_51(Cpu8080 *cpu) {
+    MOV(cpu, REG_D, REG_C);
     return 5;
 }
 
-static int op_52(void) {
-    MOV(REG_D, REG_D);
+static int op_52(Cpu8080 *cpu) {
+    MOV(cpu, REG_D, REG_D);
     return 5;
 }
 
-static int op_53(void) {
-    MOV(REG_D, REG_E);
+static int op_53(Cpu8080 *cpu) {
+    MOV(cpu, REG_D, REG_E);
     return 5;
 }
 
-static int op_54(void) {
-    MOV(REG_D, REG_H);
+static int op_54(Cpu8080 *cpu) {
+    MOV(cpu, REG_D, REG_H);
     return 5;
 }
 
-static int op_55(void) {
-    MOV(REG_D, REG_L);
+static int op_55(Cpu8080 *cpu) {
+    MOV(cpu, REG_D, REG_L);
     return 5;
 }
 
-static int op_56(void) {
-    MOV_FROM_M(REG_D);
+static int op_56(Cpu8080 *cpu) {
+    MOV_FROM_M(cpu, REG_D);
     return 7;
 }
 
-static int op_57(void) {
-    MOV(REG_D, REG_A);
+static int op_57(Cpu8080 *cpu) {
+    MOV(cpu, REG_D, REG_A);
     return 5;
 }
 
-static int op_58(void) {
-    MOV(REG_E, REG_B);
+static int op_58(Cpu8080 *cpu) {
+    MOV(cpu, REG_E, REG_B);
     return 5;
 }
 
-static int op_59(void) {
-    MOV(REG_E, REG_C);
+static int op_59(Cpu8080 *cpu) {
+    MOV(cpu, REG_E, REG_C);
     return 5;
 }
 
-static int op_5a(void) {
-    MOV(REG_E, REG_D);
+static int op_5a(Cpu8080 *cpu) {
+    MOV(cpu, REG_E, REG_D);
     return 5;
 }
 
-static int op_5b(void) {
-    MOV(REG_E, REG_E);
+static int op_5b(Cpu8080 *cpu) {
+    MOV(cpu, REG_E, REG_E);
     return 5;
 }
 
-static int op_5c(void) {
-    MOV(REG_E, REG_H);
+static int op_5c(Cpu8080 *cpu) {
+    MOV(cpu, REG_E, REG_H);
     return 5;
 }
 
-static int op_5d(void) {
-    MOV(REG_E, REG_L);
+static int op_5d(Cpu8080 *cpu) {
+    MOV(cpu, REG_E, REG_L);
     return 5;
 }
 
-static int op_5e(void) {
-    MOV_FROM_M(REG_E);
+static int op_5e(Cpu8080 *cpu) {
+    MOV_FROM_M(cpu, REG_E);
     return 7;
 }
 
-static int op_5f(void) {
-    MOV(REG_E, REG_A);
+static int op_5f(Cpu8080 *cpu) {
+    MOV(cpu, REG_E, REG_A);
     return 5;
 }
 
-static int op_60(void) {
-    MOV(REG_H, REG_B);
+static int op_60(Cpu8080 *cpu) {
+    MOV(cpu, REG_H, REG_B);
     return 5;
 }
 
-static int op_61(void) {
-    MOV(REG_H, REG_C);
+static int op_61(Cpu8080 *cpu) {
+    MOV(cpu, REG_H, REG_C);
     return 5;
 }
 
-static int op_62(void) {
-    MOV(REG_H, REG_D);
+static int op_62(Cpu8080 *cpu) {
+    MOV(cpu, REG_H, REG_D);
     return 5;
 }
 
-static int op_63(void) {
-    MOV(REG_H, REG_E);
+static int op_63(Cpu8080 *cpu) {
+    MOV(cpu, REG_H, REG_E);
     return 5;
 }
 
-static int op_64(void) {
-    MOV(REG_H, REG_H);
+static int op_64(Cpu8080 *cpu) {
+    MOV(cpu, REG_H, REG_H);
     return 5;
 }
 
-static int op_65(void) {
-    MOV(REG_H, REG_L);
+static int op_65(Cpu8080 *cpu) {
+    MOV(cpu, REG_H, REG_L);
     return 5;
 }
 
-static int op_66(void) {
-    MOV_FROM_M(REG_H);
+static int op_66(Cpu8080 *cpu) {
+    MOV_FROM_M(cpu, REG_H);
     return 7;
 }
 
-static int op_67(void) {
-    MOV(REG_H, REG_A);
+static int op_67(Cpu8080 *cpu) {
+    MOV(cpu, REG_H, REG_A);
     return 5;
 }
 
-static int op_68(void) {
-    MOV(REG_L, REG_B);
+static int op_68(Cpu8080 *cpu) {
+    MOV(cpu, REG_L, REG_B);
     return 5;
 }
 
-static int op_69(void) {
-    MOV(REG_L, REG_C);
+static int op_69(Cpu8080 *cpu) {
+    MOV(cpu, REG_L, REG_C);
     return 5;
 }
 
-static int op_6a(void) {
-    MOV(REG_L, REG_D);
+static int op_6a(Cpu8080 *cpu) {
+    MOV(cpu, REG_L, REG_D);
     return 5;
 }
 
-static int op_6b(void) {
-    MOV(REG_L, REG_E);
+static int op_6b(Cpu8080 *cpu) {
+    MOV(cpu, REG_L, REG_E);
     return 5;
 }
 
-static int op_6c(void) {
-    MOV(REG_L, REG_H);
+static int op_6c(Cpu8080 *cpu) {
+    MOV(cpu, REG_L, REG_H);
     return 5;
 }
 
-static int op_6d(void) {
-    MOV(REG_L, REG_L);
+static int op_6d(Cpu8080 *cpu) {
+    MOV(cpu, REG_L, REG_L);
     return 5;
 }
 
-static int op_6e(void) {
-    MOV_FROM_M(REG_L);
+static int op_6e(Cpu8080 *cpu) {
+    MOV_FROM_M(cpu, REG_L);
     return 7;
 }
 
-static int op_6f(void) {
-    MOV(REG_L, REG_A);
+static int op_6f(Cpu8080 *cpu) {
+    MOV(cpu, REG_L, REG_A);
     return 5;
 }
 
-static int op_70(void) {
-    MOV_TO_M(REG_B);
+static int op_70(Cpu8080 *cpu) {
+    MOV_TO_M(cpu, REG_B);
     return 7;
 }
 
-static int op_71(void) {
-    MOV_TO_M(REG_C);
+static int op_71(Cpu8080 *cpu) {
+    MOV_TO_M(cpu, REG_C);
     return 7;
 }
 
-static int op_72(void) {
-    MOV_TO_M(REG_D);
+static int op_72(Cpu8080 *cpu) {
+    MOV_TO_M(cpu, REG_D);
     return 7;
 }
 
-static int op_73(void) {
-    MOV_TO_M(REG_E);
+static int op_73(Cpu8080 *cpu) {
+    MOV_TO_M(cpu, REG_E);
     return 7;
 }
 
-static int op_74(void) {
-    MOV_TO_M(REG_H);
+static int op_74(Cpu8080 *cpu) {
+    MOV_TO_M(cpu, REG_H);
     return 7;
 }
 
-static int op_75(void) {
-    MOV_TO_M(REG_L);
+static int op_75(Cpu8080 *cpu) {
+    MOV_TO_M(cpu, REG_L);
     return 7;
 }
 
-static int op_76(void) {
-    HLT();
+static int op_76(Cpu8080 *cpu) {
+    HLT(cpu);
     return 7;
 }
 
-static int op_77(void) {
-    MOV_TO_M(REG_A);
+static int op_77(Cpu8080 *cpu) {
+    MOV_TO_M(cpu, REG_A);
     return 7;
 }
 
-static int op_78(void) {
-    MOV(REG_A, REG_B);
+static int op_78(Cpu8080 *cpu) {
+    MOV(cpu, REG_A, REG_B);
     return 5;
 }
 
-static int op_79(void) {
-    MOV(REG_A, REG_C);
+static int op_79(Cpu8080 *cpu) {
+    MOV(cpu, REG_A, REG_C);
     return 5;
 }
 
-static int op_7a(void) {
-    MOV(REG_A, REG_D);
+static int op_7a(Cpu8080 *cpu) {
+    MOV(cpu, REG_A, REG_D);
     return 5;
 }
 
-static int op_7b(void) {
-    MOV(REG_A, REG_E);
+static int op_7b(Cpu8080 *cpu) {
+    MOV(cpu, REG_A, REG_E);
     return 5;
 }
 
-static int op_7c(void) {
-    MOV(REG_A, REG_H);
+static int op_7c(Cpu8080 *cpu) {
+    MOV(cpu, REG_A, REG_H);
     return 5;
 }
 
-static int op_7d(void) {
-    MOV(REG_A, REG_L);
+static int op_7d(Cpu8080 *cpu) {
+    MOV(cpu, REG_A, REG_L);
     return 5;
 }
 
-static int op_7e(void) {
-    MOV_FROM_M(REG_A);
+static int op_7e(Cpu8080 *cpu) {
+    MOV_FROM_M(cpu, REG_A);
     return 7;
 }
 
-static int op_7f(void) {
-    MOV(REG_A, REG_A);
+static int op_7f(Cpu8080 *cpu) {
+    MOV(cpu, REG_A, REG_A);
     return 5;
 }
 
-static int op_80(void) {
-    ADD(REG_B);
+static int op_80(Cpu8080 *cpu) {
+    ADD(cpu, REG_B);
     return 4;
 }
 
-static int op_81(void) {
-    ADD(REG_C);
+static int op_81(Cpu8080 *cpu) {
+    ADD(cpu, REG_C);
     return 4;
 }
 
-static int op_82(void) {
-    ADD(REG_D);
+static int op_82(Cpu8080 *cpu) {
+    ADD(cpu, REG_D);
     return 4;
 }
 
-static int op_83(void) {
-    ADD(REG_E);
+static int op_83(Cpu8080 *cpu) {
+    ADD(cpu, REG_E);
     return 4;
 }
 
-static int op_84(void) {
-    ADD(REG_H);
+static int op_84(Cpu8080 *cpu) {
+    ADD(cpu, REG_H);
     return 4;
 }
 
-static int op_85(void) {
-    ADD(REG_L);
+static int op_85(Cpu8080 *cpu) {
+    ADD(cpu, REG_L);
     return 4;
 }
 
-static int op_86(void) {
-    ADD_M();
+static int op_86(Cpu8080 *cpu) {
+    ADD_M(cpu);
     return 7;
 }
 
-static int op_87(void) {
-    ADD(REG_A);
+static int op_87(Cpu8080 *cpu) {
+    ADD(cpu, REG_A);
     return 4;
 }
 
-static int op_88(void) {
-    ADC(REG_B);
+static int op_88(Cpu8080 *cpu) {
+    ADC(cpu, REG_B);
     return 4;
 }
 
-static int op_89(void) {
-    ADC(REG_C);
+static int op_89(Cpu8080 *cpu) {
+    ADC(cpu, REG_C);
     return 4;
 }
 
-static int op_8a(void) {
-    ADC(REG_D);
+static int op_8a(Cpu8080 *cpu) {
+    ADC(cpu, REG_D);
     return 4;
 }
 
-static int op_8b(void) {
-    ADC(REG_E);
+static int op_8b(Cpu8080 *cpu) {
+    ADC(cpu, REG_E);
     return 4;
 }
 
-static int op_8c(void) {
-    ADC(REG_H);
+static int op_8c(Cpu8080 *cpu) {
+    ADC(cpu, REG_H);
     return 4;
 }
 
-static int op_8d(void) {
-    ADC(REG_L);
+static int op_8d(Cpu8080 *cpu) {
+    ADC(cpu, REG_L);
     return 4;
 }
 
-static int op_8e(void) {
-    ADC_M();
+static int op_8e(Cpu8080 *cpu) {
+    ADC_M(cpu);
     return 7;
 }
 
-static int op_8f(void) {
-    ADC(REG_A);
+static int op_8f(Cpu8080 *cpu) {
+    ADC(cpu, REG_A);
     return 4;
 }
 
-static int op_90(void) {
-    SUB(REG_B);
+static int op_90(Cpu8080 *cpu) {
+    SUB(cpu, REG_B);
     return 4;
 }
 
-static int op_91(void) {
-    SUB(REG_C);
+static int op_91(Cpu8080 *cpu) {
+    SUB(cpu, REG_C);
     return 4;
 }
 
-static int op_92(void) {
-    SUB(REG_D);
+static int op_92(Cpu8080 *cpu) {
+    SUB(cpu, REG_D);
     return 4;
 }
 
-static int op_93(void) {
-    SUB(REG_E);
+static int op_93(Cpu8080 *cpu) {
+    SUB(cpu, REG_E);
     return 4;
 }
 
-static int op_94(void) {
-    SUB(REG_H);
+static int op_94(Cpu8080 *cpu) {
+    SUB(cpu, REG_H);
     return 4;
 }
 
-static int op_95(void) {
-    SUB(REG_L);
+static int op_95(Cpu8080 *cpu) {
+    SUB(cpu, REG_L);
     return 4;
 }
 
-static int op_96(void) {
-    SUB_M();
+static int op_96(Cpu8080 *cpu) {
+    SUB_M(cpu);
     return 7;
 }
 
-static int op_97(void) {
-    SUB(REG_A);
+static int op_97(Cpu8080 *cpu) {
+    SUB(cpu, REG_A);
     return 4;
 }
 
-static int op_98(void) {
-    SBB(REG_B);
+static int op_98(Cpu8080 *cpu) {
+    SBB(cpu, REG_B);
     return 4;
 }
 
-static int op_99(void) {
-    SBB(REG_C);
+static int op_99(Cpu8080 *cpu) {
+    SBB(cpu, REG_C);
     return 4;
 }
 
-static int op_9a(void) {
-    SBB(REG_D);
+static int op_9a(Cpu8080 *cpu) {
+    SBB(cpu, REG_D);
     return 4;
 }
 
-static int op_9b(void) {
-    SBB(REG_E);
+static int op_9b(Cpu8080 *cpu) {
+    SBB(cpu, REG_E);
     return 4;
 }
 
-static int op_9c(void) {
-    SBB(REG_H);
+static int op_9c(Cpu8080 *cpu) {
+    SBB(cpu, REG_H);
     return 4;
 }
 
-static int op_9d(void) {
-    SBB(REG_L);
+static int op_9d(Cpu8080 *cpu) {
+    SBB(cpu, REG_L);
     return 4;
 }
 
-static int op_9e(void) {
-    SBB_M();
+static int op_9e(Cpu8080 *cpu) {
+    SBB_M(cpu);
     return 7;
 }
 
-static int op_9f(void) {
-    SBB(REG_A);
+static int op_9f(Cpu8080 *cpu) {
+    SBB(cpu, REG_A);
     return 4;
 }
 
-static int op_a0(void) {
-    ANA(REG_B);
+static int op_a0(Cpu8080 *cpu) {
+    ANA(cpu, REG_B);
     return 4;
 }
 
-static int op_a1(void) {
-    ANA(REG_C);
+static int op_a1(Cpu8080 *cpu) {
+    ANA(cpu, REG_C);
     return 4;
 }
 
-static int op_a2(void) {
-    ANA(REG_D);
+static int op_a2(Cpu8080 *cpu) {
+    ANA(cpu, REG_D);
     return 4;
 }
 
-static int op_a3(void) {
-    ANA(REG_E);
+static int op_a3(Cpu8080 *cpu) {
+    ANA(cpu, REG_E);
     return 4;
 }
 
-static int op_a4(void) {
-    ANA(REG_H);
+static int op_a4(Cpu8080 *cpu) {
+    ANA(cpu, REG_H);
     return 4;
 }
 
-static int op_a5(void) {
-    ANA(REG_L);
+static int op_a5(Cpu8080 *cpu) {
+    ANA(cpu, REG_L);
     return 4;
 }
 
-static int op_a6(void) {
-    ANA_M();
+static int op_a6(Cpu8080 *cpu) {
+    ANA_M(cpu);
     return 7;
 }
 
-static int op_a7(void) {
-    ANA(REG_A);
+static int op_a7(Cpu8080 *cpu) {
+    ANA(cpu, REG_A);
     return 4;
 }
 
-static int op_a8(void) {
-    XRA(REG_B);
+static int op_a8(Cpu8080 *cpu) {
+    XRA(cpu, REG_B);
     return 4;
 }
 
-static int op_a9(void) {
-    XRA(REG_C);
+static int op_a9(Cpu8080 *cpu) {
+    XRA(cpu, REG_C);
     return 4;
 }
 
-static int op_aa(void) {
-    XRA(REG_D);
+static int op_aa(Cpu8080 *cpu) {
+    XRA(cpu, REG_D);
     return 4;
 }
 
-static int op_ab(void) {
-    XRA(REG_E);
+static int op_ab(Cpu8080 *cpu) {
+    XRA(cpu, REG_E);
     return 4;
 }
 
-static int op_ac(void) {
-    XRA(REG_H);
+static int op_ac(Cpu8080 *cpu) {
+    XRA(cpu, REG_H);
     return 4;
 }
 
-static int op_ad(void) {
-    XRA(REG_L);
+static int op_ad(Cpu8080 *cpu) {
+    XRA(cpu, REG_L);
     return 4;
 }
 
-static int op_ae(void) {
-    XRA_M();
+static int op_ae(Cpu8080 *cpu) {
+    XRA_M(cpu);
     return 7;
 }
 
-static int op_af(void) {
-    XRA(REG_A);
+static int op_af(Cpu8080 *cpu) {
+    XRA(cpu, REG_A);
     return 4;
 }
 
 
-static int op_b0(void) {
-    ORA(REG_B);
+static int op_b0(Cpu8080 *cpu) {
+    ORA(cpu, REG_B);
     return 4;
 }
 
-static int op_b1(void) {
-    ORA(REG_C);
+static int op_b1(Cpu8080 *cpu) {
+    ORA(cpu, REG_C);
     return 4;
 }
 
-static int op_b2(void) {
-    ORA(REG_D);
+static int op_b2(Cpu8080 *cpu) {
+    ORA(cpu, REG_D);
     return 4;
 }
 
-static int op_b3(void) {
-    ORA(REG_E);
+static int op_b3(Cpu8080 *cpu) {
+    ORA(cpu, REG_E);
     return 4;
 }
 
-static int op_b4(void) {
-    ORA(REG_H);
+static int op_b4(Cpu8080 *cpu) {
+    ORA(cpu, REG_H);
     return 4;
 }
 
-static int op_b5(void) {
-    ORA(REG_L);
+static int op_b5(Cpu8080 *cpu) {
+    ORA(cpu, REG_L);
     return 4;
 }
 
-static int op_b6(void) {
-    ORA_M();
+static int op_b6(Cpu8080 *cpu) {
+    ORA_M(cpu);
     return 7;
 }
 
-static int op_b7(void) {
-    ORA(REG_A);
+static int op_b7(Cpu8080 *cpu) {
+    ORA(cpu, REG_A);
     return 4;
 }
 
-static int op_b8(void) {
-    CMP(REG_B);
+static int op_b8(Cpu8080 *cpu) {
+    CMP(cpu, REG_B);
     return 4;
 }
 
-static int op_b9(void) {
-    CMP(REG_C);
+static int op_b9(Cpu8080 *cpu) {
+    CMP(cpu, REG_C);
     return 4;
 }
 
-static int op_ba(void) {
-    CMP(REG_D);
+static int op_ba(Cpu8080 *cpu) {
+    CMP(cpu, REG_D);
     return 4;
 }
 
-static int op_bb(void) {
-    CMP(REG_E);
+static int op_bb(Cpu8080 *cpu) {
+    CMP(cpu, REG_E);
     return 4;
 }
 
-static int op_bc(void) {
-    CMP(REG_H);
+static int op_bc(Cpu8080 *cpu) {
+    CMP(cpu, REG_H);
     return 4;
 }
 
-static int op_bd(void) {
-    CMP(REG_L);
+static int op_bd(Cpu8080 *cpu) {
+    CMP(cpu, REG_L);
     return 4;
 }
 
-static int op_be(void) {
-    CMP_M();
+static int op_be(Cpu8080 *cpu) {
+    CMP_M(cpu);
     return 7;
 }
 
-static int op_bf(void) {
-    CMP(REG_A);
+static int op_bf(Cpu8080 *cpu) {
+    CMP(cpu, REG_A);
     return 4;
 }
 
-static int op_c0(void) {
-    int c = IsFlagActive(FLAG_ZERO) ? 5 : 11;
-    RCC(COND_NZ);
+static int op_c0(Cpu8080 *cpu) {
+    int c = IsFlagActive(cpu, FLAG_ZERO) ? 5 : 11;
+    RCC(cpu, COND_NZ);
     
     return c;
 }
 
-static int op_c1(void) {
-    POP(RP_BC);
+static int op_c1(Cpu8080 *cpu) {
+    POP(cpu, RP_BC);
     return 10;
 }
 
-static int op_c2(void) {
-    JCC(COND_NZ, FetchWord());
+static int op_c2(Cpu8080 *cpu) {
+    JCC(cpu, COND_NZ, BusFetchWord(cpu));
     return 10;
 }
 
-static int op_c3(void) {
-    JMP(FetchWord());
+static int op_c3(Cpu8080 *cpu) {
+    JMP(cpu, BusFetchWord(cpu));
     return 10;
 }
 
-static int op_c4(void) {
-    int c = IsFlagActive(FLAG_ZERO) ? 11 : 17;
-    CCC(COND_NZ, FetchWord());
+static int op_c4(Cpu8080 *cpu) {
+    int c = IsFlagActive(cpu, FLAG_ZERO) ? 11 : 17;
+    CCC(cpu, COND_NZ, BusFetchWord(cpu));
     
     return c;
 }
 
-static int op_c5(void) {
-    PUSH(RP_BC);
+static int op_c5(Cpu8080 *cpu) {
+    PUSH(cpu, RP_BC);
     return 11;
 }
 
-static int op_c6(void) {
-    ADI(FetchByte());
+static int op_c6(Cpu8080 *cpu) {
+    ADI(cpu, BusFetchByte(cpu));
     return 7;
 }
 
-static int op_c7(void) {
-    RST(0);
+static int op_c7(Cpu8080 *cpu) {
+    RST(cpu, 0);
     return 11;
 }
 
-static int op_c8(void) {
-    int c = IsFlagActive(FLAG_ZERO) ? 11 : 5;
-    RCC(COND_Z);
+static int op_c8(Cpu8080 *cpu) {
+    int c = IsFlagActive(cpu, FLAG_ZERO) ? 11 : 5;
+    RCC(cpu, COND_Z);
     
     return c;
 }
 
-static int op_c9(void) {
-    RET();
+static int op_c9(Cpu8080 *cpu) {
+    RET(cpu);
     return 10;
 }
 
-static int op_ca(void) {
-    JCC(COND_Z, FetchWord());
+static int op_ca(Cpu8080 *cpu) {
+    JCC(cpu, COND_Z, BusFetchWord(cpu));
     return 10;
 }
 
-static int op_cb(void) {
-    JMP(FetchWord());
+static int op_cb(Cpu8080 *cpu) {
+    JMP(cpu, BusFetchWord(cpu));
     return 10;
 }
 
-static int op_cc(void) {
-    int c = IsFlagActive(FLAG_ZERO) ? 17 : 11;
-    CCC(COND_Z, FetchWord());
+static int op_cc(Cpu8080 *cpu) {
+    int c = IsFlagActive(cpu, FLAG_ZERO) ? 17 : 11;
+    CCC(cpu, COND_Z, BusFetchWord(cpu));
     
     return c;
 }
 
-static int op_cd(void) {
-    CALL(FetchWord());
+static int op_cd(Cpu8080 *cpu) {
+    CALL(cpu, BusFetchWord(cpu));
     return 17;
 }
 
-static int op_ce(void) {
-    ACI(FetchByte());
+static int op_ce(Cpu8080 *cpu) {
+    ACI(cpu, BusFetchByte(cpu));
     return 7;
 }
 
-static int op_cf(void) {
-    RST(1);
+static int op_cf(Cpu8080 *cpu) {
+    RST(cpu, 1);
     return 11;
 }
 
-static int op_d0(void) {
-    int c = IsFlagActive(FLAG_CARRY) ? 5 : 11;
-    RCC(COND_NC);
+static int op_d0(Cpu8080 *cpu) {
+    int c = IsFlagActive(cpu, FLAG_CARRY) ? 5 : 11;
+    RCC(cpu, COND_NC);
     
     return c;
 }
 
-static int op_d1(void) {
-    POP(RP_DE);
+static int op_d1(Cpu8080 *cpu) {
+    POP(cpu, RP_DE);
     return 10;
 }
 
-static int op_d2(void) {
-    JCC(COND_NC, FetchWord());
+static int op_d2(Cpu8080 *cpu) {
+    JCC(cpu, COND_NC, BusFetchWord(cpu));
     return 10;
 }
 
-static int op_d3(void) {
-    OUT(FetchByte());
+static int op_d3(Cpu8080 *cpu) {
+    OUT(cpu, BusFetchByte(cpu));
     return 10;
 }
 
-static int op_d4(void) {
-    int c = IsFlagActive(FLAG_CARRY) ? 11 : 17;
-    CCC(COND_NC, FetchWord());
+static int op_d4(Cpu8080 *cpu) {
+    int c = IsFlagActive(cpu, FLAG_CARRY) ? 11 : 17;
+    CCC(cpu, COND_NC, BusFetchWord(cpu));
     
     return c;
 }
 
-static int op_d5(void) {
-    PUSH(RP_DE);
+static int op_d5(Cpu8080 *cpu) {
+    PUSH(cpu, RP_DE);
     return 11;
 }
 
-static int op_d6(void) {
-    SUI(FetchByte());
+static int op_d6(Cpu8080 *cpu) {
+    SUI(cpu, BusFetchByte(cpu));
     return 7;
 }
 
-static int op_d7(void) {
-    RST(2);
+static int op_d7(Cpu8080 *cpu) {
+    RST(cpu, 2);
     return 11;
 }
 
-static int op_d8(void) {
-    int c = IsFlagActive(FLAG_CARRY) ? 11 : 5;
-    RCC(COND_C);
+static int op_d8(Cpu8080 *cpu) {
+    int c = IsFlagActive(cpu, FLAG_CARRY) ? 11 : 5;
+    RCC(cpu, COND_C);
     
     return c;
 }
 
-static int op_d9(void) {
-    RET();
+static int op_d9(Cpu8080 *cpu) {
+    RET(cpu);
     return 10;
 }
 
-static int op_da(void) {
-    JCC(COND_C, FetchWord());
+static int op_da(Cpu8080 *cpu) {
+    JCC(cpu, COND_C, BusFetchWord(cpu));
     return 10;
 }
 
-static int op_db(void) {
-    IN(FetchByte());
+static int op_db(Cpu8080 *cpu) {
+    IN(cpu, BusFetchByte(cpu));
     return 10;
 }
 
-static int op_dc(void) {
-    int c = IsFlagActive(FLAG_CARRY) ? 17 : 11;
-    CCC(COND_C, FetchWord());
+static int op_dc(Cpu8080 *cpu) {
+    int c = IsFlagActive(cpu, FLAG_CARRY) ? 17 : 11;
+    CCC(cpu, COND_C, BusFetchWord(cpu));
     
     return c;
 }
 
-static int op_dd(void) {
-    CALL(FetchWord());
+static int op_dd(Cpu8080 *cpu) {
+    CALL(cpu, BusFetchWord(cpu));
     return 17;
 }
 
-static int op_de(void) {
-    SBI(FetchByte());
+static int op_de(Cpu8080 *cpu) {
+    SBI(cpu, BusFetchByte(cpu));
     return 7;
 }
 
-static int op_df(void) {
-    RST(3);
+static int op_df(Cpu8080 *cpu) {
+    RST(cpu, 3);
     return 11;
 }
 
-static int op_e0(void) {
-    int c = IsFlagActive(FLAG_PARITY) ? 5 : 11;
-    RCC(COND_PO);
+static int op_e0(Cpu8080 *cpu) {
+    int c = IsFlagActive(cpu, FLAG_PARITY) ? 5 : 11;
+    RCC(cpu, COND_PO);
     
     return c;
 }
 
-static int op_e1(void) {
-    POP(RP_HL);
+static int op_e1(Cpu8080 *cpu) {
+    POP(cpu, RP_HL);
     return 10;
 }
 
-static int op_e2(void) {
-    JCC(COND_PO, FetchWord());
+static int op_e2(Cpu8080 *cpu) {
+    JCC(cpu, COND_PO, BusFetchWord(cpu));
     return 10;
 }
 
-static int op_e3(void) {
-    XTHL();
+static int op_e3(Cpu8080 *cpu) {
+    XTHL(cpu);
     return 18;
 }
 
-static int op_e4(void) {
-    int c = IsFlagActive(FLAG_PARITY) ? 11 : 17;
-    CCC(COND_PO, FetchWord());
+static int op_e4(Cpu8080 *cpu) {
+    int c = IsFlagActive(cpu, FLAG_PARITY) ? 11 : 17;
+    CCC(cpu, COND_PO, BusFetchWord(cpu));
     
     return c;
 }
 
-static int op_e5(void) {
-    PUSH(RP_HL);
+static int op_e5(Cpu8080 *cpu) {
+    PUSH(cpu, RP_HL);
     return 11;
 }
 
-static int op_e6(void) {
-    ANI(FetchByte());
+static int op_e6(Cpu8080 *cpu) {
+    ANI(cpu, BusFetchByte(cpu));
     return 7;
 }
 
-static int op_e7(void) {
-    RST(4);
+static int op_e7(Cpu8080 *cpu) {
+    RST(cpu, 4);
     return 11;
 }
 
-static int op_e8(void) {
-    int c = IsFlagActive(FLAG_PARITY) ? 11 : 5;
-    RCC(COND_PE);
+static int op_e8(Cpu8080 *cpu) {
+    int c = IsFlagActive(cpu, FLAG_PARITY) ? 11 : 5;
+    RCC(cpu, COND_PE);
     
     return c;
 }
 
-static int op_e9(void) {
-    PCHL();
+static int op_e9(Cpu8080 *cpu) {
+    PCHL(cpu);
     return 5;
 }
 
-static int op_ea(void) {
-    JCC(COND_PE, FetchWord());
+static int op_ea(Cpu8080 *cpu) {
+    JCC(cpu, COND_PE, BusFetchWord(cpu));
     return 10;
 }
 
-static int op_eb(void) {
-    XCHG();
+static int op_eb(Cpu8080 *cpu) {
+    XCHG(cpu);
     return 5;
 }
 
-static int op_ec(void) {
-    int c = IsFlagActive(FLAG_PARITY) ? 17 : 11;
-    CCC(COND_PE, FetchWord());
+static int op_ec(Cpu8080 *cpu) {
+    int c = IsFlagActive(cpu, FLAG_PARITY) ? 17 : 11;
+    CCC(cpu, COND_PE, BusFetchWord(cpu));
     
     return c;
 }
 
-static int op_ed(void) {
-    CALL(FetchWord());
+static int op_ed(Cpu8080 *cpu) {
+    CALL(cpu, BusFetchWord(cpu));
     return 17;
 }
 
-static int op_ee(void) {
-    XRI(FetchByte());
+static int op_ee(Cpu8080 *cpu) {
+    XRI(cpu, BusFetchByte(cpu));
     return 7;
 }
 
-static int op_ef(void) {
-    RST(5);
+static int op_ef(Cpu8080 *cpu) {
+    RST(cpu, 5);
     return 11;
 }
 
-static int op_f0(void) {
-    int c = IsFlagActive(FLAG_SIGN) ? 5 : 11;
-    RCC(COND_P);
+static int op_f0(Cpu8080 *cpu) {
+    int c = IsFlagActive(cpu, FLAG_SIGN) ? 5 : 11;
+    RCC(cpu, COND_P);
     return c;
 }
 
-static int op_f1(void) {
-    POP_PSW();
+static int op_f1(Cpu8080 *cpu) {
+    POP_PSW(cpu);
     return 10;
 }
 
-static int op_f2(void) {
-    JCC(COND_P, FetchWord());
+static int op_f2(Cpu8080 *cpu) {
+    JCC(cpu, COND_P, BusFetchWord(cpu));
     return 10;
 }
 
-static int op_f3(void) {
-    DI();
+static int op_f3(Cpu8080 *cpu) {
+    DI(cpu);
     return 4;
 }
 
-static int op_f4(void) {
-    int c = IsFlagActive(FLAG_SIGN) ? 11 : 17;
-    CCC(COND_P, FetchWord());
+static int op_f4(Cpu8080 *cpu) {
+    int c = IsFlagActive(cpu, FLAG_SIGN) ? 11 : 17;
+    CCC(cpu, COND_P, BusFetchWord(cpu));
     
     return c;
 }
 
-static int op_f5(void) {
-    PUSH_PSW();
+static int op_f5(Cpu8080 *cpu) {
+    PUSH_PSW(cpu);
     return 11;
 }
 
-static int op_f6(void) {
-    ORI(FetchByte());
+static int op_f6(Cpu8080 *cpu) {
+    ORI(cpu, BusFetchByte(cpu));
     return 7;
 }
 
-static int op_f7(void) {
-    RST(6);
+static int op_f7(Cpu8080 *cpu) {
+    RST(cpu, 6);
     return 11;
 }
 
-static int op_f8(void) {
-    int c = IsFlagActive(FLAG_SIGN) ? 11 : 5;
-    RCC(COND_M);
+static int op_f8(Cpu8080 *cpu) {
+    int c = IsFlagActive(cpu, FLAG_SIGN) ? 11 : 5;
+    RCC(cpu, COND_M);
     
     return c;
 }
 
-static int op_f9(void) {
-    SPHL();
+static int op_f9(Cpu8080 *cpu) {
+    SPHL(cpu);
     return 5;
 }
 
-static int op_fa(void) {
-    JCC(COND_M, FetchWord());
+static int op_fa(Cpu8080 *cpu) {
+    JCC(cpu, COND_M, BusFetchWord(cpu));
     return 10;
 }
 
-static int op_fb(void) {
-    EI();
+static int op_fb(Cpu8080 *cpu) {
+    EI(cpu);
     return 4;
 }
 
-static int op_fc(void) {
-    int c = IsFlagActive(FLAG_SIGN) ? 17 : 11;
-    CCC(COND_M, FetchWord());
+static int op_fc(Cpu8080 *cpu) {
+    int c = IsFlagActive(cpu, FLAG_SIGN) ? 17 : 11;
+    CCC(cpu, COND_M, BusFetchWord(cpu));
     
     return c;
 }
 
-static int op_fd(void) {
-    CALL(FetchWord());
+static int op_fd(Cpu8080 *cpu) {
+    CALL(cpu, BusFetchWord(cpu));
     return 17;
 }
 
-static int op_fe(void) {
-    CPI(FetchByte());
+static int op_fe(Cpu8080 *cpu) {
+    CPI(cpu, BusFetchByte(cpu));
     return 7;
 }
 
-static int op_ff(void) {
-    RST(7);
+static int op_ff(Cpu8080 *cpu) {
+    RST(cpu, 7);
     return 11;
 }
 
@@ -10,27 +10,69 @@
 #define BDOS_READ_STRING            0xA
 
 #define MEM_MAX                     0x10000
-#define REG_COUNT                   0x7
 #define NUM_IO_PORTS                0x100
 
+/* Pairs go into the register file in host byte order, see Reg8 */
+#if defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define CPU_BIG_ENDIAN              1
+#endif
+
+/* Undocumented NOP that host traps are planted as, see TrapRegister() */
+#define TRAP_OPCODE                 0x08
+#define MAX_TRAPS                   8
+
+/* Events pending at once, see EventSchedule() */
+#define MAX_EVENTS                  32
+
+/* The memory bus is a table of 256 byte pages, see MemMapRam() */
+#define MEM_PAGE_SHIFT              8
+#define MEM_PAGE_SIZE               (1 << MEM_PAGE_SHIFT)
+#define MEM_PAGE_COUNT              (MEM_MAX >> MEM_PAGE_SHIFT)
+
+/* What a read from an unmapped page returns */
+#define MEM_OPEN_BUS                0xFF
+
+/* Granularity of the "has decoded code" marks, see codePages */
+#define CODE_PAGE_SHIFT             8
+#define CODE_PAGE_COUNT             (MEM_MAX >> CODE_PAGE_SHIFT)
+
+/*
+    Byte offsets into Cpu8080.registers. Each pair is one host uint16_t
+    (Cpu8080.pairs), so which half comes first depends on the host.
+    The flag byte is the low half of PSW, between SP and A.
+*/
 typedef enum {
-    REG_A = 0,
-    REG_B,
+#ifdef CPU_BIG_ENDIAN
+    REG_B = 0,
     REG_C,
     REG_D,
     REG_E,
     REG_H,
-    REG_L
+    REG_L,
+    REG_A = 8
+#else
+    REG_C = 0,
+    REG_B,
+    REG_E,
+    REG_D,
+    REG_L,
+    REG_H,
+    REG_A = 9
+#endif
 } Reg8;
 
+/* Also the index into Cpu8080.pairs */
 typedef enum {
     RP_BC = 0,
     RP_DE,
     RP_HL,
     RP_SP,
-    RP_PSW
+    RP_PSW,
+    RP_COUNT
 } RegPair;
 
+#define REG_FILE_SIZE               (RP_COUNT * 2)
+
 typedef enum {
     COND_NZ = 0,
     COND_Z,
@@ -65,127 +107,394 @@ static const uint8_t condFlag[4] = {
     FLAG_SIGN
 };
 
-extern uint8_t memory[MEM_MAX];
-extern uint8_t registers[REG_COUNT];
-extern uint8_t ioPorts[NUM_IO_PORTS];
-extern uint8_t flags;
-extern uint16_t PC, SP;
+/* Which loop Execute() runs, see the README */
+typedef enum {
+    ENGINE_STEP = 0,
+    ENGINE_RUN,
+    ENGINE_BLOCK,
+    ENGINE_JIT
+} Engine;
+
+/* Why Execute() returned */
+typedef enum {
+    STOP_NONE = 0,
+    STOP_HALT,
+    STOP_BUDGET,
+    STOP_BREAKPOINT,
+    STOP_TRAP
+} StopReason;
+
+/* Execute() stopMask bits. A halt and the end of the budget always stop. */
+#define STOP_ON_BREAKPOINT          (1u << STOP_BREAKPOINT)
+#define STOP_ON_TRAP                (1u << STOP_TRAP)
+
+typedef struct Cpu8080 Cpu8080;
+typedef struct BdosState BdosState;
+typedef struct BlockCache BlockCache;
+typedef struct JitCache JitCache;
+typedef struct BankedMemory BankedMemory;
+typedef struct SharedImage SharedImage;
+typedef struct Replay Replay;
+typedef struct Trace Trace;
+typedef struct OpcodeHistogram OpcodeHistogram;
+typedef struct CallGraph CallGraph;
+typedef struct Heatmap Heatmap;
+
+/*
+    Runs instead of the guest code at addr. PC is addr + 1 on entry, the
+    handler leaves it wherever execution should go on.
+*/
+typedef void (*TrapHandler)(Cpu8080 *cpu, uint16_t addr);
+
+/*
+    Optional, asked right before the handler runs: TRUE when this call only
+    looks at something (console status and the like) and changes nothing
+    but registers, so a loop around it may be an idle loop, see IdlePoll().
+*/
+typedef Bool (*TrapPoll)(const Cpu8080 *cpu);
+
+typedef struct {
+    uint16_t addr;
+    TrapHandler handler;
+    TrapPoll poll;
+} Trap;
+
+/* Device callbacks of a handler page, addr is the full guest address */
+typedef uint8_t (*MemReadHandler)(Cpu8080 *cpu, uint16_t addr, void *context);
+typedef void (*MemWriteHandler)(Cpu8080 *cpu, uint16_t addr, uint8_t value, void *context);
+
+/* Either may be NULL: reads then see MEM_OPEN_BUS and stores are dropped */
+typedef struct {
+    MemReadHandler read;
+    MemWriteHandler write;
+    void *context;
+} MemHandler;
 
-extern Bool halted;
-extern Bool interruptsEnabled;
+/* Called by Execute() once cpu->cycles has reached when, see event.c */
+typedef void (*EventHandler)(Cpu8080 *cpu, unsigned long long when, void *context);
+
+typedef struct {
+    unsigned long long when;
+    EventHandler handler;
+    void *context;
+    int id;
+    Bool wakes;                         /* may call InterruptRequest(), see EventScheduleObserver() */
+} Event;
+
+/* A binary min-heap on (when, id), heap[0] is the next one due */
+typedef struct {
+    Event heap[MAX_EVENTS];
+    int count;
+    int wakes;                          /* pending events that may interrupt a HLT */
+    int lastId;
+    unsigned long long fired;
+} EventQueue;
+
+/* Device callbacks of an I/O port, see IoRegister() */
+typedef uint8_t (*IoReadHandler)(Cpu8080 *cpu, uint8_t port, void *context);
+typedef void (*IoWriteHandler)(Cpu8080 *cpu, uint8_t port, uint8_t value, void *context);
+
+/* Either may be NULL: IN then reads ioPorts[], OUT only stores there */
+typedef struct {
+    IoReadHandler read;
+    IoWriteHandler write;
+    void *context;
+} IoHandler;
+
+/*
+    What IdlePoll() knows: the register state right after the last poll (an
+    IN, or a trap whose poll hook said TRUE) and how much it has skipped.
+*/
+typedef struct {
+    Bool valid;
+    uint16_t addr;
+    uint8_t registers[REG_FILE_SIZE];
+    uint16_t PC;
+    Bool interruptsEnabled;
+    uint32_t backoff;
+
+    unsigned long long skippedCycles;
+    unsigned long long skippedInstructions;
+    unsigned long long fastForwards;
+} IdleState;
+
+/*
+    Everything one machine owns lives in here, nothing is global anymore.
+    A process can host as many of these as it likes, one thread each.
+    The struct is big (64 KB of memory) so allocate it on the heap.
+*/
+struct Cpu8080 {
+    /*
+        The register file, first so that it and PC are the first 12 bytes
+        of the struct: malloc() hands out 16 byte aligned blocks, so they
+        always sit in one cache line. 16 bit work on a pair is one load or
+        store through pairs, the 8 bit registers are its halves.
+    */
+    union {
+        uint16_t pairs[RP_COUNT];
+        uint8_t registers[REG_FILE_SIZE];
+
+        struct {
+            uint16_t pairsBCDEHL[3];
+            uint16_t SP;
+#ifdef CPU_BIG_ENDIAN
+            uint8_t accumulator;
+            uint8_t flags;
+#else
+            uint8_t flags;
+            uint8_t accumulator;
+#endif
+        };
+    };
+
+    uint16_t PC;
+
+    Bool halted;
+    Bool interruptsEnabled;
+    uint8_t interruptPending;           /* bit n requests RST n, see InterruptRequest() */
+
+    BdosState *bdos;
+    BlockCache *blocks;                 /* NULL unless RunBlocks() is used */
+    JitCache *jit;                      /* NULL unless RunJit() is used */
+    BankedMemory *bank;                 /* NULL unless banked, see BankAttach() */
+    SharedImage *image;                 /* NULL unless made by CpuInitShared() */
+    Replay *replay;                     /* NULL unless recording or replaying, see ReplayStart() */
+    Trace *trace;                       /* NULL unless tracing, see TraceStart() */
+    OpcodeHistogram *histogram;         /* counted into by EMU_OPCODE_PROFILE builds only, see histogram.c */
+    CallGraph *callGraph;               /* NULL unless profiling calls, see CallGraphStart() */
+    Heatmap *heatmap;                   /* counted into by EMU_MEMORY_HEATMAP builds only, see heatmap.c */
+    Engine engine;                      /* ENGINE_RUN after CpuInit() */
+
+    /* Set by Execute() for its engine, stopReason is set where it stops early */
+    unsigned int stopMask;
+    StopReason stopReason;
+
+    /*
+        Set by host code that needs Execute() to look at the machine again:
+        a map change between the flat bus and anything else, an earlier
+        event or an interrupt request. The engines clear it on entry and
+        leave at the end of the instruction that set it (AFTER_TRAP()).
+    */
+    Bool yield;
+
+    /* Running totals, kept up to date by Execute() and the engines */
+    unsigned long long cycles;
+    unsigned long long instructions;
+
+    /*
+        Non-zero for every 256 byte page the block cache or the JIT has
+        decoded code from, so a store only tests its page before going on.
+        Marks are only cleared when everything is dropped (see MemMap()),
+        a stale one only costs a trip through CodeWritten(). codeGeneration
+        counts the stores that really did hit decoded code.
+    */
+    uint8_t codePages[CODE_PAGE_COUNT];
+    uint32_t codeGeneration;
+
+    /*
+        Non-zero for every page of the address space stored to since the
+        last MemDirtyClear(), by the guest on any engine or by MemPoke().
+        Kept by address, not by what backs it, so a store into another
+        bank marks the page too. See ResetRestore() in state.c.
+    */
+    uint8_t dirtyPages[MEM_PAGE_COUNT];
+
+    /* Host traps. TRAP_OPCODE only fires where trapMap has the address's bit */
+    Trap traps[MAX_TRAPS];
+    int trapCount;
+    uint8_t trapMap[MEM_MAX / 8];
+
+    IdleState idle;
+
+    /* Device callbacks at a future cycle and the interrupts they raise, see event.c */
+    EventQueue events;
+    unsigned long long interrupts;      /* taken, see InterruptAccept() */
+
+    /* Breakpoints, only looked at with STOP_ON_BREAKPOINT */
+    int breakCount;
+    uint8_t breakMap[MEM_MAX / 8];
+
+    /*
+        The memory bus. readPage and writePage hold the host bytes behind
+        every page, so the common case is one table lookup; NULL sends the
+        access to the page's handler (MemReadSlow(), MemWriteSlow()). A ROM
+        page has no writePage. CpuInit() maps all of memory[] as RAM, which
+        is flatBus: the only layout the block cache and the JIT decode,
+        they address memory[] directly. Anything else runs in Run().
+    */
+    uint8_t *readPage[MEM_PAGE_COUNT];
+    uint8_t *writePage[MEM_PAGE_COUNT];
+    MemHandler handlers[MEM_PAGE_COUNT];
+    Bool flatBus;
+
+    /*
+        Non-zero for every page of memory[] whose bytes are still those of
+        image, not copied in yet (see image.c). memory[] there is never
+        touched, so read it through MemOwnPage().
+    */
+    uint8_t sharedPages[MEM_PAGE_COUNT];
+    uint32_t handlerCalls;              /* memory and port handlers called, see IdlePoll() */
+
+    /*
+        I/O ports, indexed by port number so IN and OUT are one table
+        lookup. ioPorts[] latches every OUT and is what IN reads from a
+        port with no read handler.
+    */
+    IoHandler ioHandlers[NUM_IO_PORTS];
+    uint8_t ioPorts[NUM_IO_PORTS];
+
+    /* Last, so CpuInitShared() can clear everything else and leave it alone */
+    uint8_t memory[MEM_MAX];
+};
 
 void OpInit(void);
-int Step(void);
-
-uint8_t MemRead(uint16_t addr);
-void MemWrite(uint16_t addr, uint8_t value);
-uint8_t FetchByte(void);
-uint16_t FetchWord(void);
-uint8_t IORead(uint8_t port);
-void IOWrite(uint8_t port, uint8_t value);
-
-uint16_t GetPSW(void);
-void SetPSW(uint16_t psw);
-int CalcRegisterIdx(RegPair rp);
-Bool IsFlagActive(Flags flagBit);
-void ActivateFlag(Flags flagBit);
-void DeActivateFlag(Flags flagBit);
-void ClearFlags(void);
-Bool CheckCondition(Cond cond);
+void CpuInit(Cpu8080 *cpu);
+void CpuInitShared(Cpu8080 *cpu, SharedImage *image);
+int Step(Cpu8080 *cpu);
+unsigned long long Run(Cpu8080 *cpu, unsigned long long cycleBudget);
+StopReason Execute(Cpu8080 *cpu, unsigned long long maxCycles, unsigned long long maxInstructions,
+    unsigned int stopMask);
+int ExecuteSelfCheck(void);
+int BusSelfCheck(void);
+
+uint8_t MemRead(Cpu8080 *cpu, uint16_t addr);
+void MemWrite(Cpu8080 *cpu, uint16_t addr, uint8_t value);
+uint8_t MemReadSlow(Cpu8080 *cpu, uint16_t addr);
+void MemWriteSlow(Cpu8080 *cpu, uint16_t addr, uint8_t value);
+uint8_t MemPeek(const Cpu8080 *cpu, uint16_t addr);
+void MemPoke(Cpu8080 *cpu, uint16_t addr, uint8_t value);
+int MemMapRam(Cpu8080 *cpu, uint16_t addr, uint32_t size, uint8_t *host);
+int MemMapRom(Cpu8080 *cpu, uint16_t addr, uint32_t size, uint8_t *host);
+int MemMapReadOnly(Cpu8080 *cpu, uint16_t addr, uint32_t size, uint8_t *host, MemWriteHandler write,
+    void *context);
+const uint8_t *MemOwnPage(const Cpu8080 *cpu, int page);
+void MemCopyOwn(const Cpu8080 *cpu, uint8_t *to);
+int MemMapHandler(Cpu8080 *cpu, uint16_t addr, uint32_t size, MemReadHandler read, MemWriteHandler write,
+    void *context);
+int MemUnmap(Cpu8080 *cpu, uint16_t addr, uint32_t size);
+void MarkCodePages(Cpu8080 *cpu, uint16_t addr, uint16_t size);
+void CodeWritten(Cpu8080 *cpu, uint16_t addr);
+void CodeRangeWritten(Cpu8080 *cpu, uint16_t addr, uint32_t size);
+void MemDirtyClear(Cpu8080 *cpu);
+int MemDirtyList(const Cpu8080 *cpu, uint8_t *pages);
+
+int TrapRegister(Cpu8080 *cpu, uint16_t addr, TrapHandler handler, TrapPoll poll);
+Bool TrapAt(const Cpu8080 *cpu, uint16_t addr);
+const Trap *TrapFind(const Cpu8080 *cpu, uint16_t addr);
+Bool TrapFire(Cpu8080 *cpu, uint16_t addr);
+
+void BreakpointSet(Cpu8080 *cpu, uint16_t addr);
+void BreakpointClear(Cpu8080 *cpu, uint16_t addr);
+Bool BreakpointAt(const Cpu8080 *cpu, uint16_t addr);
+uint8_t FetchByte(Cpu8080 *cpu);
+uint16_t FetchWord(Cpu8080 *cpu);
+uint8_t IORead(Cpu8080 *cpu, uint8_t port);
+void IOWrite(Cpu8080 *cpu, uint8_t port, uint8_t value);
+int IoRegister(Cpu8080 *cpu, uint8_t port, uint32_t count, IoReadHandler read, IoWriteHandler write,
+    void *context);
+int IoUnregister(Cpu8080 *cpu, uint8_t port, uint32_t count);
+
+uint16_t GetPSW(Cpu8080 *cpu);
+void SetPSW(Cpu8080 *cpu, uint16_t psw);
+Bool IsFlagActive(Cpu8080 *cpu, Flags flagBit);
+void ActivateFlag(Cpu8080 *cpu, Flags flagBit);
+void DeActivateFlag(Cpu8080 *cpu, Flags flagBit);
+void ClearFlags(Cpu8080 *cpu);
+Bool CheckCondition(Cpu8080 *cpu, Cond cond);
 
 uint8_t Parity(uint8_t value);
-void UpdateZSP(uint8_t result);
-void UpdateFlagsZSPCA_ADD(uint8_t oldVal, uint8_t updateVal, uint16_t result);
-void UpdateFlagsZSPCA_ADC(uint8_t oldVal, uint8_t updateVal, uint8_t carry_in, uint16_t result);
-void UpdateFlagsZSPA_ADD(uint8_t oldVal, uint8_t updateVal, uint16_t result);
-void UpdateFlagsZSPCA_SUB(uint8_t oldVal, uint8_t updateVal, uint16_t result);
-void UpdateFlagsZSPCA_SBB(uint8_t oldVal, uint8_t updateVal, uint8_t borrow_in, uint16_t result);
-void UpdateFlagsZSPA_SUB(uint8_t oldVal, uint8_t updateVal, uint16_t result);
-void UpdateFlagsZSP_Logical(uint8_t result, int acVal);
-void UpdateFlagC_ADD(uint8_t oldVal, uint8_t updateVal, uint16_t result);
-void UpdateFlagC_SUB(uint8_t oldVal, uint8_t updateVal);
-
-void MOV(Reg8 dst, Reg8 src);
-void MOV_FROM_M(Reg8 dst);
-void MOV_TO_M(Reg8 src);
-void MVI(Reg8 dst, uint8_t imm);
-void MVI_M(uint8_t imm);
-void LXI(RegPair rp, uint16_t imm);
-void LDA(uint16_t addr);
-void STA(uint16_t addr);
-void LHLD(uint16_t addr);
-void SHLD(uint16_t addr);
-void LDAX(RegPair rp);
-void STAX(RegPair rp);
-void XCHG(void);
-
-void ADD(Reg8 src);
-void ADD_M(void);
-void ADI(uint8_t imm);
-void ADC(Reg8 src);
-void ADC_M(void);
-void ACI(uint8_t imm);
-void SUB(Reg8 src);
-void SUB_M(void);
-void SUI(uint8_t imm);
-void SBB(Reg8 src);
-void SBB_M(void);
-void SBI(uint8_t imm);
-
-void INR(Reg8 dst);
-void INR_M(void);
-void DCR(Reg8 dst);
-void DCR_M(void);
-void INX(RegPair rp);
-void DCX(RegPair rp);
-void DAD(RegPair rp);
-void DAA(void);
-
-void ANA(Reg8 src);
-void ANA_M(void);
-void ANI(uint8_t imm);
-void ORA(Reg8 src);
-void ORA_M(void);
-void ORI(uint8_t imm);
-void XRA(Reg8 src);
-void XRA_M(void);
-void XRI(uint8_t imm);
-void CMP(Reg8 src);
-void CMP_M(void);
-void CPI(uint8_t imm);
-
-void RLC(void);
-void RRC(void);
-void RAL(void);
-void RAR(void);
-void CMA(void);
-void CMC(void);
-void STC(void);
-
-void JMP(uint16_t addr);
-void JCC(Cond cond, uint16_t addr);
-void CALL(uint16_t addr);
-void CCC(Cond cond, uint16_t addr);
-void RET(void);
-void RCC(Cond cond);
-void RST(uint8_t rst);
-void PCHL(void);
-
-void PUSH(RegPair rp);
-void PUSH_PSW(void);
-void POP(RegPair rp);
-void POP_PSW(void);
-void XTHL(void);
-void SPHL(void);
-
-void IN(uint8_t port);
-void OUT(uint8_t port);
-void EI(void);
-void DI(void);
-void HLT(void);
-void NOP(void);
-
-typedef int (*OpcodeHandler)(void);
+void UpdateZSP(Cpu8080 *cpu, uint8_t result);
+void UpdateFlagsZSPCA_ADD(Cpu8080 *cpu, uint8_t oldVal, uint8_t updateVal, uint16_t result);
+void UpdateFlagsZSPCA_ADC(Cpu8080 *cpu, uint8_t oldVal, uint8_t updateVal, uint8_t carry_in, uint16_t result);
+void UpdateFlagsZSPA_ADD(Cpu8080 *cpu, uint8_t oldVal, uint8_t updateVal, uint16_t result);
+void UpdateFlagsZSPCA_SUB(Cpu8080 *cpu, uint8_t oldVal, uint8_t updateVal, uint16_t result);
+void UpdateFlagsZSPCA_SBB(Cpu8080 *cpu, uint8_t oldVal, uint8_t updateVal, uint8_t borrow_in, uint16_t result);
+void UpdateFlagsZSPA_SUB(Cpu8080 *cpu, uint8_t oldVal, uint8_t updateVal, uint16_t result);
+void UpdateFlagsZSP_Logical(Cpu8080 *cpu, uint8_t result, int acVal);
+void UpdateFlagC_ADD(Cpu8080 *cpu, uint8_t oldVal, uint8_t updateVal, uint16_t result);
+void UpdateFlagC_SUB(Cpu8080 *cpu, uint8_t oldVal, uint8_t updateVal);
+
+void MOV(Cpu8080 *cpu, Reg8 dst, Reg8 src);
+void MOV_FROM_M(Cpu8080 *cpu, Reg8 dst);
+void MOV_TO_M(Cpu8080 *cpu, Reg8 src);
+void MVI(Cpu8080 *cpu, Reg8 dst, uint8_t imm);
+void MVI_M(Cpu8080 *cpu, uint8_t imm);
+void LXI(Cpu8080 *cpu, RegPair rp, uint16_t imm);
+void LDA(Cpu8080 *cpu, uint16_t addr);
+void STA(Cpu8080 *cpu, uint16_t addr);
+void LHLD(Cpu8080 *cpu, uint16_t addr);
+void SHLD(Cpu8080 *cpu, uint16_t addr);
+void LDAX(Cpu8080 *cpu, RegPair rp);
+void STAX(Cpu8080 *cpu, RegPair rp);
+void XCHG(Cpu8080 *cpu);
+
+void ADD(Cpu8080 *cpu, Reg8 src);
+void ADD_M(Cpu8080 *cpu);
+void ADI(Cpu8080 *cpu, uint8_t imm);
+void ADC(Cpu8080 *cpu, Reg8 src);
+void ADC_M(Cpu8080 *cpu);
+void ACI(Cpu8080 *cpu, uint8_t imm);
+void SUB(Cpu8080 *cpu, Reg8 src);
+void SUB_M(Cpu8080 *cpu);
+void SUI(Cpu8080 *cpu, uint8_t imm);
+void SBB(Cpu8080 *cpu, Reg8 src);
+void SBB_M(Cpu8080 *cpu);
+void SBI(Cpu8080 *cpu, uint8_t imm);
+
+void INR(Cpu8080 *cpu, Reg8 dst);
+void INR_M(Cpu8080 *cpu);
+void DCR(Cpu8080 *cpu, Reg8 dst);
+void DCR_M(Cpu8080 *cpu);
+void INX(Cpu8080 *cpu, RegPair rp);
+void DCX(Cpu8080 *cpu, RegPair rp);
+void DAD(Cpu8080 *cpu, RegPair rp);
+void DAA(Cpu8080 *cpu);
+
+void ANA(Cpu8080 *cpu, Reg8 src);
+void ANA_M(Cpu8080 *cpu);
+void ANI(Cpu8080 *cpu, uint8_t imm);
+void ORA(Cpu8080 *cpu, Reg8 src);
+void ORA_M(Cpu8080 *cpu);
+void ORI(Cpu8080 *cpu, uint8_t imm);
+void XRA(Cpu8080 *cpu, Reg8 src);
+void XRA_M(Cpu8080 *cpu);
+void XRI(Cpu8080 *cpu, uint8_t imm);
+void CMP(Cpu8080 *cpu, Reg8 src);
+void CMP_M(Cpu8080 *cpu);
+void CPI(Cpu8080 *cpu, uint8_t imm);
+
+void RLC(Cpu8080 *cpu);
+void RRC(Cpu8080 *cpu);
+void RAL(Cpu8080 *cpu);
+void RAR(Cpu8080 *cpu);
+void CMA(Cpu8080 *cpu);
+void CMC(Cpu8080 *cpu);
+void STC(Cpu8080 *cpu);
+
+void JMP(Cpu8080 *cpu, uint16_t addr);
+void JCC(Cpu8080 *cpu, Cond cond, uint16_t addr);
+void CALL(Cpu8080 *cpu, uint16_t addr);
+void CCC(Cpu8080 *cpu, Cond cond, uint16_t addr);
+void RET(Cpu8080 *cpu);
+void RCC(Cpu8080 *cpu, Cond cond);
+void RST(Cpu8080 *cpu, uint8_t rst);
+void PCHL(Cpu8080 *cpu);
+
+void PUSH(Cpu8080 *cpu, RegPair rp);
+void PUSH_PSW(Cpu8080 *cpu);
+void POP(Cpu8080 *cpu, RegPair rp);
+void POP_PSW(Cpu8080 *cpu);
+void XTHL(Cpu8080 *cpu);
+void SPHL(Cpu8080 *cpu);
+
+void IN(Cpu8080 *cpu, uint8_t port);
+void OUT(Cpu8080 *cpu, uint8_t port);
+void EI(Cpu8080 *cpu);
+void DI(Cpu8080 *cpu);
+void HLT(Cpu8080 *cpu);
+void NOP(Cpu8080 *cpu);
+
+typedef int (*OpcodeHandler)(Cpu8080 *cpu);
 extern OpcodeHandler opcodeTable[256];
 
 #endif
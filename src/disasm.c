@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include "block.h"
+#include "disasm.h"
+
+/*
+    Text for an instruction, for the trace decoder (trace.c) and the
+    profiler reports. The undocumented opcodes get the name of the
+    documented one they act like (see run_ops.h), 08 is NOP even where it
+    is a trap.
+*/
+
+const char *const opNames[256] = {
+    "NOP", "LXI B,", "STAX B", "INX B", "INR B", "DCR B", "MVI B,", "RLC",
+    "NOP", "DAD B", "LDAX B", "DCX B", "INR C", "DCR C", "MVI C,", "RRC",
+    "NOP", "LXI D,", "STAX D", "INX D", "INR D", "DCR D", "MVI D,", "RAL",
+    "NOP", "DAD D", "LDAX D", "DCX D", "INR E", "DCR E", "MVI E,", "RAR",
+    "NOP", "LXI H,", "SHLD ", "INX H", "INR H", "DCR H", "MVI H,", "DAA",
+    "NOP", "DAD H", "LHLD ", "DCX H", "INR L", "DCR L", "MVI L,", "CMA",
+    "NOP", "LXI SP,", "STA ", "INX SP", "INR M", "DCR M", "MVI M,", "STC",
+    "NOP", "DAD SP", "LDA ", "DCX SP", "INR A", "DCR A", "MVI A,", "CMC",
+    "MOV B,B", "MOV B,C", "MOV B,D", "MOV B,E", "MOV B,H", "MOV B,L", "MOV B,M", "MOV B,A",
+    "MOV C,B", "MOV C,C", "MOV C,D", "MOV C,E", "MOV C,H", "MOV C,L", "MOV C,M", "MOV C,A",
+    "MOV D,B", "MOV D,C", "MOV D,D", "MOV D,E", "MOV D,H", "MOV D,L", "MOV D,M", "MOV D,A",
+    "MOV E,B", "MOV E,C", "MOV E,D", "MOV E,E", "MOV E,H", "MOV E,L", "MOV E,M", "MOV E,A",
+    "MOV H,B", "MOV H,C", "MOV H,D", "MOV H,E", "MOV H,H", "MOV H,L", "MOV H,M", "MOV H,A",
+    "MOV L,B", "MOV L,C", "MOV L,D", "MOV L,E", "MOV L,H", "MOV L,L", "MOV L,M", "MOV L,A",
+    "MOV M,B", "MOV M,C", "MOV M,D", "MOV M,E", "MOV M,H", "MOV M,L", "HLT", "MOV M,A",
+    "MOV A,B", "MOV A,C", "MOV A,D", "MOV A,E", "MOV A,H", "MOV A,L", "MOV A,M", "MOV A,A",
+    "ADD B", "ADD C", "ADD D", "ADD E", "ADD H", "ADD L", "ADD M", "ADD A",
+    "ADC B", "ADC C", "ADC D", "ADC E", "ADC H", "ADC L", "ADC M", "ADC A",
+    "SUB B", "SUB C", "SUB D", "SUB E", "SUB H", "SUB L", "SUB M", "SUB A",
+    "SBB B", "SBB C", "SBB D", "SBB E", "SBB H", "SBB L", "SBB M", "SBB A",
+    "ANA B", "ANA C", "ANA D", "ANA E", "ANA H", "ANA L", "ANA M", "ANA A",
+    "XRA B", "XRA C", "XRA D", "XRA E", "XRA H", "XRA L", "XRA M", "XRA A",
+    "ORA B", "ORA C", "ORA D", "ORA E", "ORA H", "ORA L", "ORA M", "ORA A",
+    "CMP B", "CMP C", "CMP D", "CMP E", "CMP H", "CMP L", "CMP M", "CMP A",
+    "RNZ", "POP B", "JNZ ", "JMP ", "CNZ ", "PUSH B", "ADI ", "RST 0",
+    "RZ", "RET", "JZ ", "JMP ", "CZ ", "CALL ", "ACI ", "RST 1",
+    "RNC", "POP D", "JNC ", "OUT ", "CNC ", "PUSH D", "SUI ", "RST 2",
+    "RC", "RET", "JC ", "IN ", "CC ", "CALL ", "SBI ", "RST 3",
+    "RPO", "POP H", "JPO ", "XTHL", "CPO ", "PUSH H", "ANI ", "RST 4",
+    "RPE", "PCHL", "JPE ", "XCHG", "CPE ", "CALL ", "XRI ", "RST 5",
+    "RP", "POP PSW", "JP ", "DI", "CP ", "PUSH PSW", "ORI ", "RST 6",
+    "RM", "SPHL", "JM ", "EI", "CM ", "CALL ", "CPI ", "RST 7"
+};
+
+/* bytes[0] is the opcode, the operand follows as in memory. Returns the instruction length */
+int Disassemble(const uint8_t *bytes, char *text, size_t size) {
+    int length = opLength[bytes[0]];
+
+    switch (length) {
+        case 2: {
+            snprintf(text, size, "%s%02XH", opNames[bytes[0]], bytes[1]);
+            break;
+        }
+
+        case 3: {
+            snprintf(text, size, "%s%04XH", opNames[bytes[0]], bytes[1] | (bytes[2] << 8));
+            break;
+        }
+
+        default: {
+            snprintf(text, size, "%s", opNames[bytes[0]]);
+            break;
+        }
+    }
+
+    return length;
+}
@@ -0,0 +1,15 @@
+#ifndef DISASM_H
+#define DISASM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Longest text Disassemble() writes, the terminating 0 included */
+#define DISASM_TEXT_SIZE            16
+
+/* Intel mnemonic of every opcode, up to where the operand goes */
+extern const char *const opNames[256];
+
+int Disassemble(const uint8_t *bytes, char *text, size_t size);
+
+#endif
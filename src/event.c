@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include "cpu.h"
+#include "event.h"
+#include "callgraph.h"
+
+/*
+    Timed device callbacks and interrupts. A device schedules a handler at
+    an absolute cycle count and Execute() runs it once cpu->cycles has got
+    there; a handler that wants to run again schedules itself from the when
+    it was called with, so a periodic timer does not drift.
+
+    The engines never look at the queue. Execute() cuts the budget it hands
+    them at the next event, and since they only check the budget between
+    blocks, that is the one check per block there is. They stop at the
+    first instruction boundary at or past the event, whichever engine runs.
+
+    An interrupt is a bit in interruptPending. Execute() takes it between
+    batches while interruptsEnabled is set, the way the 8080 does when the
+    device puts RST n on the bus: push PC, jump to n * 8, interrupts off.
+    A request that comes in while they are off waits for the next EI.
+*/
+
+static Bool Earlier(const Event *a, const Event *b) {
+    return (Bool)(a->when < b->when || (a->when == b->when && a->id < b->id));
+}
+
+static void SiftUp(EventQueue *queue, int idx) {
+    Event event = queue->heap[idx];
+
+    while (idx > 0) {
+        int parent = (idx - 1) / 2;
+
+        if (!Earlier(&event, &queue->heap[parent])) {
+            break;
+        }
+
+        queue->heap[idx] = queue->heap[parent];
+        idx = parent;
+    }
+
+    queue->heap[idx] = event;
+}
+
+static void SiftDown(EventQueue *queue, int idx) {
+    Event event = queue->heap[idx];
+
+    for (;;) {
+        int child = idx * 2 + 1;
+
+        if (child >= queue->count) {
+            break;
+        }
+
+        if (child + 1 < queue->count && Earlier(&queue->heap[child + 1], &queue->heap[child])) {
+            child++;
+        }
+
+        if (!Earlier(&queue->heap[child], &event)) {
+            break;
+        }
+
+        queue->heap[idx] = queue->heap[child];
+        idx = child;
+    }
+
+    queue->heap[idx] = event;
+}
+
+static void Remove(EventQueue *queue, int idx) {
+    queue->wakes -= queue->heap[idx].wakes;
+    queue->count--;
+
+    if (idx == queue->count) {
+        return;
+    }
+
+    queue->heap[idx] = queue->heap[queue->count];
+    SiftUp(queue, idx);
+    SiftDown(queue, idx);
+}
+
+static int Schedule(Cpu8080 *cpu, unsigned long long when, EventHandler handler, void *context, Bool wakes) {
+    EventQueue *queue = &cpu->events;
+
+    if (queue->count == MAX_EVENTS || !handler) {
+        return -1;
+    }
+
+    if (when < EventNext(cpu)) {
+        cpu->yield = TRUE;
+    }
+
+    queue->lastId = queue->lastId == 0x7FFFFFFF ? 1 : queue->lastId + 1;
+
+    Event *event = &queue->heap[queue->count];
+
+    event->when = when;
+    event->handler = handler;
+    event->context = context;
+    event->id = queue->lastId;
+    event->wakes = wakes;
+    queue->wakes += wakes;
+
+    SiftUp(queue, queue->count++);
+
+    return queue->lastId;
+}
+
+/*
+    Calls handler once cpu->cycles reaches when (right away if it already
+    has). Returns an id for EventCancel(), -1 when MAX_EVENTS are pending.
+    Safe to call from a handler, a trap or an I/O port: an event earlier
+    than any pending one makes the running engine leave (see yield).
+*/
+int EventSchedule(Cpu8080 *cpu, unsigned long long when, EventHandler handler, void *context) {
+    return Schedule(cpu, when, handler, context, TRUE);
+}
+
+/*
+    The same for a handler that only looks at the machine (a profiler, say)
+    and never calls InterruptRequest(). It runs on time like any other, but
+    a HLT with only these pending stops Execute() rather than waiting.
+*/
+int EventScheduleObserver(Cpu8080 *cpu, unsigned long long when, EventHandler handler, void *context) {
+    return Schedule(cpu, when, handler, context, FALSE);
+}
+
+/* FALSE if id is not pending (it fired already, say) */
+Bool EventCancel(Cpu8080 *cpu, int id) {
+    EventQueue *queue = &cpu->events;
+
+    for (int idx = 0; idx < queue->count; idx++) {
+        if (queue->heap[idx].id == id) {
+            Remove(queue, idx);
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+unsigned long long EventNext(const Cpu8080 *cpu) {
+    return cpu->events.count ? cpu->events.heap[0].when : EVENT_NEVER;
+}
+
+/* Runs every event that is due, in order; what they schedule runs too if it is due */
+void EventRunDue(Cpu8080 *cpu) {
+    EventQueue *queue = &cpu->events;
+
+    while (queue->count && queue->heap[0].when <= cpu->cycles) {
+        Event event = queue->heap[0];
+
+        Remove(queue, 0);
+        queue->fired++;
+        event.handler(cpu, event.when, event.context);
+    }
+}
+
+/* Asks for RST rst (0 to 7); it is taken by Execute() as soon as interrupts are on */
+void InterruptRequest(Cpu8080 *cpu, int rst) {
+    cpu->interruptPending |= (uint8_t)(1u << (rst & 7));
+    cpu->yield = TRUE;
+}
+
+/*
+    Takes the lowest pending RST if interrupts are on: the push, the jump
+    and INTERRUPT_CYCLES, counted as the instruction it is. A HLT waiting
+    for it is over, the return address is the one after the HLT.
+*/
+Bool InterruptAccept(Cpu8080 *cpu) {
+    if (!cpu->interruptPending || !cpu->interruptsEnabled) {
+        return FALSE;
+    }
+
+    int rst = 0;
+
+    while (!(cpu->interruptPending & (1u << rst))) {
+        rst++;
+    }
+
+    cpu->interruptPending &= (uint8_t)~(1u << rst);
+    cpu->interruptsEnabled = FALSE;
+    cpu->halted = FALSE;
+
+    cpu->SP -= 2;
+    MemWrite(cpu, (uint16_t)(cpu->SP + 1), (uint8_t)(cpu->PC >> 8));
+    MemWrite(cpu, cpu->SP, (uint8_t)cpu->PC);
+
+    /* A call from wherever it was */
+    if (cpu->callGraph) {
+        CallGraphCall(cpu->callGraph, cpu, cpu->PC, (uint16_t)(rst * 8));
+    }
+
+    cpu->PC = (uint16_t)(rst * 8);
+
+    cpu->cycles += INTERRUPT_CYCLES;
+    cpu->instructions++;
+    cpu->interrupts++;
+
+    return TRUE;
+}
+
+static void TimerTick(Cpu8080 *cpu, unsigned long long when, void *context) {
+    Timer *timer = (Timer *)context;
+
+    timer->ticks++;
+    InterruptRequest(cpu, timer->rst);
+    timer->id = EventSchedule(cpu, when + timer->period, TimerTick, timer);
+}
+
+/* First tick period cycles from now. -1 if the queue is full. */
+int TimerStart(Cpu8080 *cpu, Timer *timer, unsigned long long period, int rst) {
+    timer->period = period ? period : 1;
+    timer->rst = rst;
+    timer->ticks = 0;
+    timer->id = EventSchedule(cpu, cpu->cycles + timer->period, TimerTick, timer);
+
+    return timer->id < 0 ? -1 : 0;
+}
+
+void TimerStop(Cpu8080 *cpu, Timer *timer) {
+    EventCancel(cpu, timer->id);
+    timer->id = -1;
+}
+
+void EventPrintStats(const Cpu8080 *cpu) {
+    printf("[events] %llu fired, %d pending, %llu interrupts taken\n",
+        cpu->events.fired, cpu->events.count, cpu->interrupts);
+}
@@ -0,0 +1,45 @@
+#ifndef EVENT_H
+#define EVENT_H
+
+#include <stdint.h>
+#include "cpu.h"
+
+/* EventNext() with nothing scheduled */
+#define EVENT_NEVER                 (~0ULL)
+
+/* Cycles the 8080 takes to answer an interrupt with the RST it reads */
+#define INTERRUPT_CYCLES            11
+
+/* EI, the one instruction the 8080 never takes an interrupt right after */
+#define EI_OPCODE                   0xFB
+
+/* Longest a HLT waits on events that never interrupt when Execute() has no cycle limit */
+#define HALT_WAIT_LIMIT             (1ULL << 32)
+
+/* The 8080's usual clock, what --timer counts its rate in */
+#define CPU_CLOCK_HZ                2000000ULL
+
+/* A device raising RST rst every period cycles, see TimerStart() */
+typedef struct {
+    unsigned long long period;
+    int rst;
+    int id;
+    unsigned long long ticks;
+} Timer;
+
+int EventSchedule(Cpu8080 *cpu, unsigned long long when, EventHandler handler, void *context);
+int EventScheduleObserver(Cpu8080 *cpu, unsigned long long when, EventHandler handler, void *context);
+Bool EventCancel(Cpu8080 *cpu, int id);
+unsigned long long EventNext(const Cpu8080 *cpu);
+void EventRunDue(Cpu8080 *cpu);
+
+void InterruptRequest(Cpu8080 *cpu, int rst);
+Bool InterruptAccept(Cpu8080 *cpu);
+int TimerStart(Cpu8080 *cpu, Timer *timer, unsigned long long period, int rst);
+void TimerStop(Cpu8080 *cpu, Timer *timer);
+void EventPrintStats(const Cpu8080 *cpu);
+
+/* Timer interrupt check against Step(), see selfcheck.c */
+int InterruptSelfCheck(void);
+
+#endif
@@ -0,0 +1,41 @@
+#include "flags.h"
+
+/*
+    The preprocessor spells out all 256 entries, nothing is computed at
+    runtime. Parity is even parity, P=1 when the number of set bits is even.
+*/
+#define ZSP_S(v)        ((v) & 0x80)
+#define ZSP_Z(v)        ((v) == 0 ? 0x40 : 0)
+#define ZSP_P(v)        ((((v) ^ ((v) >> 1) ^ ((v) >> 2) ^ ((v) >> 3) ^ \
+                          ((v) >> 4) ^ ((v) >> 5) ^ ((v) >> 6) ^ ((v) >> 7)) & 1) ? 0 : 0x04)
+#define ZSP(v)          (ZSP_S(v) | ZSP_Z(v) | ZSP_P(v))
+#define ZSP4(v)         ZSP(v), ZSP((v) + 1), ZSP((v) + 2), ZSP((v) + 3)
+#define ZSP16(v)        ZSP4(v), ZSP4((v) + 4), ZSP4((v) + 8), ZSP4((v) + 12)
+#define ZSP64(v)        ZSP16(v), ZSP16((v) + 16), ZSP16((v) + 32), ZSP16((v) + 48)
+
+const uint8_t zspTable[256] = {
+    ZSP64(0), ZSP64(64), ZSP64(128), ZSP64(192)
+};
+
+/*
+    Index is (a, v, result) bits. For addition there is a carry out when both
+    operand bits are set, or one is set and the result bit is clear. For
+    subtraction there is a borrow out when the result bit disagrees with
+    what a - v would give without a borrow in.
+*/
+const uint8_t carryAddTable[8] = {
+    0x00, 0x00, 0x01, 0x00, 0x01, 0x00, 0x01, 0x01
+};
+
+const uint8_t carrySubTable[8] = {
+    0x00, 0x01, 0x01, 0x01, 0x00, 0x00, 0x00, 0x01
+};
+
+const uint8_t auxCarryAddTable[8] = {
+    0x00, 0x00, 0x10, 0x00, 0x10, 0x00, 0x10, 0x10
+};
+
+/* 8080 AC after a subtraction is set when there was NO borrow out of bit 3 */
+const uint8_t auxCarrySubTable[8] = {
+    0x10, 0x00, 0x00, 0x00, 0x10, 0x10, 0x10, 0x00
+};
@@ -0,0 +1,31 @@
+#ifndef FLAGS_H
+#define FLAGS_H
+
+#include <stdint.h>
+
+/*
+    Precomputed flag tables, all generated at compile time (see flags.c).
+
+    zspTable gives the S, Z and P bits of a result already in their PSW
+    positions. The carry tables are indexed by bit 7 (CY) or bit 3 (AC) of
+    the two operands and the result, see ALU_INDEX. Because the result
+    already includes any carry/borrow in, the same tables cover ADD/ADC and
+    SUB/SBB/CMP. Values are pre-shifted (0x01 for CY, 0x10 for AC) so they
+    can be OR-ed straight into the flag byte.
+*/
+#define ALU_INDEX(a, v, result, bit) \
+    ((((a) >> (bit)) & 1) << 2 | (((v) >> (bit)) & 1) << 1 | (((result) >> (bit)) & 1))
+
+#define FLAGS_ZSP_MASK              0xC4
+#define FLAGS_ZSPAC_MASK            0xD4
+#define FLAGS_ALL_MASK              0xD5
+
+extern const uint8_t zspTable[256];
+extern const uint8_t carryAddTable[8];
+extern const uint8_t carrySubTable[8];
+extern const uint8_t auxCarryAddTable[8];
+extern const uint8_t auxCarrySubTable[8];
+
+int FlagTableSelfCheck(void);
+
+#endif
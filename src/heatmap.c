@@ -0,0 +1,363 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "event.h"
+#include "heatmap.h"
+
+/*
+    Memory heatmap. Step()'s bus counts every fetch, read and write by page
+    and, with bytes on, by address (see HeatmapCount()), compiled in only
+    when RUN_MEMORY_HEATMAP is defined (the EMU_MEMORY_HEATMAP CMake
+    option): a test per access costs Step() a tenth of its speed even with
+    nothing attached, so the default build has no trace of it. MemRead() and
+    MemWrite() go through the same bus, so what BDOS copies in and out for
+    the program counts too; MemPeek() and MemPoke() are the host's and
+    don't. The other engines don't go through the bus at all, so Execute()
+    runs every engine as Step() while a heatmap is attached.
+
+    The working set is sampled off an event every interval cycles, the way
+    the profiler samples PC: a page is in an interval's set if its counts
+    moved since the last sample. Stopping takes one more sample for what
+    ran after the last, so the samples cover every cycle counted. Like the
+    profiler's, the samples never keep a HLT from ending Execute().
+*/
+
+/* Out of line, so the bus's 200-odd inlined copies only test cpu->heatmap */
+void HeatmapCount(Heatmap *heatmap, HeatmapKind kind, uint16_t addr) {
+    heatmap->pages[kind][addr >> MEM_PAGE_SHIFT]++;
+
+    if (heatmap->bytes) {
+        heatmap->bytes[kind][addr]++;
+    }
+}
+
+Bool HeatmapAvailable(void) {
+#ifdef RUN_MEMORY_HEATMAP
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+/* Bits needed for count, 0 for 0 */
+static int BitLength(unsigned long long count) {
+    int bits = 0;
+
+    while (count) {
+        bits++;
+        count >>= 1;
+    }
+
+    return bits;
+}
+
+static int AddSample(Heatmap *heatmap, const WorkingSetSample *sample) {
+    if (heatmap->sampleCount == heatmap->sampleCapacity) {
+        int capacity = heatmap->sampleCapacity ? heatmap->sampleCapacity * 2 : 256;
+        WorkingSetSample *samples = (WorkingSetSample *)realloc(heatmap->samples,
+            (size_t)capacity * sizeof(WorkingSetSample));
+
+        if (!samples) {
+            return -1;
+        }
+
+        heatmap->samples = samples;
+        heatmap->sampleCapacity = capacity;
+    }
+
+    heatmap->samples[heatmap->sampleCount++] = *sample;
+    return 0;
+}
+
+/* The pages touched since the last sample, at the machine's counts now */
+static void TakeSample(Heatmap *heatmap, const Cpu8080 *cpu) {
+    WorkingSetSample sample;
+
+    memset(&sample, 0, sizeof(sample));
+    heatmap->cycles += cpu->cycles - heatmap->lastCycles;
+    heatmap->instructions += cpu->instructions - heatmap->lastInstructions;
+    heatmap->lastCycles = cpu->cycles;
+    heatmap->lastInstructions = cpu->instructions;
+
+    for (int page = 0; page < MEM_PAGE_COUNT; page++) {
+        Bool touched = FALSE;
+
+        for (int kind = 0; kind < HEATMAP_KINDS; kind++) {
+            if (heatmap->pages[kind][page] != heatmap->last[kind][page]) {
+                sample.pages[kind]++;
+                touched = TRUE;
+            }
+        }
+
+        if (touched) {
+            sample.touched++;
+            heatmap->ever[page] = 1;
+        }
+
+        sample.total += heatmap->ever[page];
+    }
+
+    memcpy(heatmap->last, heatmap->pages, sizeof(heatmap->last));
+    sample.cycles = heatmap->cycles;
+    sample.instructions = heatmap->instructions;
+
+    /* With no memory left the interval is still in the counts, just not in the samples */
+    AddSample(heatmap, &sample);
+}
+
+static void HeatmapSample(Cpu8080 *cpu, unsigned long long when, void *context) {
+    Heatmap *heatmap = (Heatmap *)context;
+    unsigned long long next = when + heatmap->interval;
+
+    /* A stopped heatmap's sample, put back by TimelineSeek() with the rest of the queue */
+    if (!heatmap->running) {
+        return;
+    }
+
+    TakeSample(heatmap, cpu);
+
+    /* A HLT can pass several intervals at once, the one sample stands for all of them */
+    if (next <= cpu->cycles) {
+        next = cpu->cycles + heatmap->interval;
+    }
+
+    heatmap->id = EventScheduleObserver(cpu, next, HeatmapSample, heatmap);
+}
+
+/* bytes counts by address as well as by page, 1.5MB more. -1 with no memory left. */
+int HeatmapInit(Heatmap *heatmap, Bool bytes, unsigned long long interval) {
+    memset(heatmap, 0, sizeof(*heatmap));
+    heatmap->interval = interval ? interval : 1;
+    heatmap->id = -1;
+
+    if (bytes) {
+        heatmap->bytes = (unsigned long long (*)[MEM_MAX])calloc(HEATMAP_KINDS, sizeof(*heatmap->bytes));
+
+        if (!heatmap->bytes) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+    Attaches the heatmap, the first sample interval cycles from now. Adds to
+    what earlier runs counted. -1 if the queue is full.
+*/
+int HeatmapStart(Cpu8080 *cpu, Heatmap *heatmap) {
+    heatmap->lastCycles = cpu->cycles;
+    heatmap->lastInstructions = cpu->instructions;
+    heatmap->running = TRUE;
+    heatmap->id = EventScheduleObserver(cpu, cpu->cycles + heatmap->interval, HeatmapSample, heatmap);
+
+    if (heatmap->id < 0) {
+        heatmap->running = FALSE;
+        return -1;
+    }
+
+    cpu->heatmap = heatmap;
+    return 0;
+}
+
+/* Samples what ran since the last sample and detaches the heatmap */
+void HeatmapStop(Cpu8080 *cpu, Heatmap *heatmap) {
+    if (!heatmap->running) {
+        return;
+    }
+
+    if (cpu->cycles != heatmap->lastCycles) {
+        TakeSample(heatmap, cpu);
+    }
+
+    EventCancel(cpu, heatmap->id);
+    heatmap->id = -1;
+    heatmap->running = FALSE;
+    cpu->heatmap = NULL;
+}
+
+static unsigned long long Total(const Heatmap *heatmap, int kind) {
+    unsigned long long total = 0;
+
+    for (int page = 0; page < MEM_PAGE_COUNT; page++) {
+        total += heatmap->pages[kind][page];
+    }
+
+    return total;
+}
+
+static int PagesTouched(const Heatmap *heatmap, int kind) {
+    int pages = 0;
+
+    for (int page = 0; page < MEM_PAGE_COUNT; page++) {
+        pages += heatmap->pages[kind][page] != 0;
+    }
+
+    return pages;
+}
+
+/* One kind's pages as 16 rows of 16, the page's high digit down and low digit across */
+static void PrintGrid(const Heatmap *heatmap, int kind, const char *name) {
+    static const char shades[] = " .:-=+*#%@";
+    unsigned long long max = 0;
+    int maxBits;
+
+    for (int page = 0; page < MEM_PAGE_COUNT; page++) {
+        if (heatmap->pages[kind][page] > max) {
+            max = heatmap->pages[kind][page];
+        }
+    }
+
+    maxBits = BitLength(max);
+    printf("[heatmap] %s by page, '%c' the fewest to '%c' %llu\n", name, shades[1], shades[9], max);
+    printf("[heatmap]     0123456789ABCDEF\n");
+
+    for (int row = 0; row < 16; row++) {
+        char line[17];
+
+        for (int col = 0; col < 16; col++) {
+            int bits = BitLength(heatmap->pages[kind][row * 16 + col]);
+
+            /* On a log scale, so a page read once still shows next to one read a million times */
+            line[col] = shades[!bits ? 0 : maxBits == 1 ? 9 : 1 + 8 * (bits - 1) / (maxBits - 1)];
+        }
+
+        line[16] = '\0';
+        printf("[heatmap] %Xx |%s|\n", row, line);
+    }
+}
+
+void HeatmapPrint(const Heatmap *heatmap) {
+    static const char *names[HEATMAP_KINDS] = { "fetches", "reads", "writes" };
+    int peak = 0;
+    unsigned long long sum = 0;
+    int total = 0;
+
+    for (int idx = 0; idx < heatmap->sampleCount; idx++) {
+        if (heatmap->samples[idx].touched > peak) {
+            peak = heatmap->samples[idx].touched;
+        }
+
+        sum += heatmap->samples[idx].touched;
+    }
+
+    for (int page = 0; page < MEM_PAGE_COUNT; page++) {
+        total += heatmap->ever[page];
+    }
+
+    printf("[heatmap] %llu fetches, %llu reads, %llu writes in %llu cycles\n",
+        Total(heatmap, HEATMAP_FETCH), Total(heatmap, HEATMAP_READ), Total(heatmap, HEATMAP_WRITE),
+        heatmap->cycles);
+    printf("[heatmap] pages: %d fetched, %d read, %d written, %d in all\n",
+        PagesTouched(heatmap, HEATMAP_FETCH), PagesTouched(heatmap, HEATMAP_READ),
+        PagesTouched(heatmap, HEATMAP_WRITE), total);
+    printf("[heatmap] working set per %llu cycles: %d pages at most, %.1f on average over %d samples\n",
+        heatmap->interval, peak, heatmap->sampleCount ? (double)sum / heatmap->sampleCount : 0.0,
+        heatmap->sampleCount);
+
+    for (int kind = 0; kind < HEATMAP_KINDS; kind++) {
+        PrintGrid(heatmap, kind, names[kind]);
+    }
+}
+
+/* Every page, or with bytes counted every address that was touched */
+int HeatmapWriteCsv(const Heatmap *heatmap, FILE *file) {
+    if (!heatmap->bytes) {
+        fprintf(file, "page,fetches,reads,writes\n");
+
+        for (int page = 0; page < MEM_PAGE_COUNT; page++) {
+            fprintf(file, "%02X,%llu,%llu,%llu\n", page, heatmap->pages[HEATMAP_FETCH][page],
+                heatmap->pages[HEATMAP_READ][page], heatmap->pages[HEATMAP_WRITE][page]);
+        }
+
+        return ferror(file) ? -1 : 0;
+    }
+
+    fprintf(file, "address,fetches,reads,writes\n");
+
+    for (int addr = 0; addr < MEM_MAX; addr++) {
+        unsigned long long fetches = heatmap->bytes[HEATMAP_FETCH][addr];
+        unsigned long long reads = heatmap->bytes[HEATMAP_READ][addr];
+        unsigned long long writes = heatmap->bytes[HEATMAP_WRITE][addr];
+
+        if (fetches || reads || writes) {
+            fprintf(file, "%04X,%llu,%llu,%llu\n", addr, fetches, reads, writes);
+        }
+    }
+
+    return ferror(file) ? -1 : 0;
+}
+
+/* A row per sample, pages in the interval and, in total, in all intervals so far */
+int HeatmapWriteWorkingSet(const Heatmap *heatmap, FILE *file) {
+    fprintf(file, "cycles,instructions,fetched,read,written,touched,total\n");
+
+    for (int idx = 0; idx < heatmap->sampleCount; idx++) {
+        const WorkingSetSample *sample = &heatmap->samples[idx];
+
+        fprintf(file, "%llu,%llu,%u,%u,%u,%u,%u\n", sample->cycles, sample->instructions,
+            sample->pages[HEATMAP_FETCH], sample->pages[HEATMAP_READ], sample->pages[HEATMAP_WRITE],
+            sample->touched, sample->total);
+    }
+
+    return ferror(file) ? -1 : 0;
+}
+
+/* 0 for none, else 64 up to 255 for the most, by bit length like PrintGrid() */
+static uint8_t Shade(unsigned long long count, int maxBits) {
+    return count ? (uint8_t)(64 + 191 * BitLength(count) / maxBits) : 0;
+}
+
+/*
+    A binary PPM, one row per page and one pixel per byte: red for writes,
+    green for reads, blue for fetches. Without bytes counted every pixel
+    of a row has its page's counts.
+*/
+int HeatmapWriteImage(const Heatmap *heatmap, FILE *file) {
+    int maxBits[HEATMAP_KINDS];
+    uint8_t row[HEATMAP_IMAGE_WIDTH * 3];
+
+    for (int kind = 0; kind < HEATMAP_KINDS; kind++) {
+        unsigned long long max = 0;
+
+        for (int addr = 0; addr < MEM_MAX; addr++) {
+            unsigned long long count = heatmap->bytes ? heatmap->bytes[kind][addr]
+                : heatmap->pages[kind][addr >> MEM_PAGE_SHIFT];
+
+            if (count > max) {
+                max = count;
+            }
+        }
+
+        maxBits[kind] = BitLength(max);
+    }
+
+    fprintf(file, "P6\n%d %d\n255\n", HEATMAP_IMAGE_WIDTH, HEATMAP_IMAGE_HEIGHT);
+
+    for (int page = 0; page < HEATMAP_IMAGE_HEIGHT; page++) {
+        for (int col = 0; col < HEATMAP_IMAGE_WIDTH; col++) {
+            int addr = page << MEM_PAGE_SHIFT | col;
+
+            for (int kind = 0; kind < HEATMAP_KINDS; kind++) {
+                unsigned long long count = heatmap->bytes ? heatmap->bytes[kind][addr]
+                    : heatmap->pages[kind][page];
+
+                /* Fetches are blue, the last of the three */
+                row[col * 3 + HEATMAP_WRITE - kind] = Shade(count, maxBits[kind]);
+            }
+        }
+
+        fwrite(row, 1, sizeof(row), file);
+    }
+
+    return ferror(file) ? -1 : 0;
+}
+
+void HeatmapFree(Heatmap *heatmap) {
+    free(heatmap->bytes);
+    free(heatmap->samples);
+    heatmap->bytes = NULL;
+    heatmap->samples = NULL;
+    heatmap->sampleCount = 0;
+    heatmap->sampleCapacity = 0;
+}
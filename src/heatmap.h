@@ -0,0 +1,69 @@
+#ifndef HEATMAP_H
+#define HEATMAP_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "cpu.h"
+
+/* Cycles between working set samples unless --heatmap-interval says otherwise */
+#define HEATMAP_DEFAULT_INTERVAL    100000ULL
+
+/* The image: one pixel per byte, one row per page */
+#define HEATMAP_IMAGE_WIDTH         MEM_PAGE_SIZE
+#define HEATMAP_IMAGE_HEIGHT        MEM_PAGE_COUNT
+
+typedef enum {
+    HEATMAP_FETCH = 0,                  /* opcode and operand bytes */
+    HEATMAP_READ,
+    HEATMAP_WRITE,
+    HEATMAP_KINDS
+} HeatmapKind;
+
+/* The pages one interval touched, and all of them so far */
+typedef struct {
+    unsigned long long cycles;          /* at its end, counted from the first start */
+    unsigned long long instructions;
+    uint16_t pages[HEATMAP_KINDS];
+    uint16_t touched;                   /* any of the three */
+    uint16_t total;                     /* touched in this or any interval before */
+} WorkingSetSample;
+
+/*
+    Guest memory accesses by page, and with bytes by address, see
+    heatmap.c. Hung off cpu->heatmap, but only an EMU_MEMORY_HEATMAP build
+    (RUN_MEMORY_HEATMAP) ever counts into it.
+*/
+struct Heatmap {
+    unsigned long long pages[HEATMAP_KINDS][MEM_PAGE_COUNT];
+    unsigned long long (*bytes)[MEM_MAX];   /* bytes[kind][addr], NULL unless counting bytes */
+    unsigned long long last[HEATMAP_KINDS][MEM_PAGE_COUNT];     /* pages at the last sample */
+    uint8_t ever[MEM_PAGE_COUNT];
+    unsigned long long interval;
+    int id;
+    Bool running;
+    unsigned long long lastCycles;      /* the machine's counts at the last sample */
+    unsigned long long lastInstructions;
+    unsigned long long cycles;          /* what the samples cover */
+    unsigned long long instructions;
+    WorkingSetSample *samples;
+    int sampleCount;
+    int sampleCapacity;
+};
+
+/* Called by Step()'s bus for every access, in RUN_MEMORY_HEATMAP builds only, see cpu.c */
+void HeatmapCount(Heatmap *heatmap, HeatmapKind kind, uint16_t addr);
+
+Bool HeatmapAvailable(void);
+int HeatmapInit(Heatmap *heatmap, Bool bytes, unsigned long long interval);
+int HeatmapStart(Cpu8080 *cpu, Heatmap *heatmap);
+void HeatmapStop(Cpu8080 *cpu, Heatmap *heatmap);
+void HeatmapPrint(const Heatmap *heatmap);
+int HeatmapWriteCsv(const Heatmap *heatmap, FILE *file);
+int HeatmapWriteWorkingSet(const Heatmap *heatmap, FILE *file);
+int HeatmapWriteImage(const Heatmap *heatmap, FILE *file);
+void HeatmapFree(Heatmap *heatmap);
+
+/* A copy loop counted on every engine against the accesses it makes, see selfcheck.c */
+int HeatmapSelfCheck(void);
+
+#endif
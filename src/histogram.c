@@ -0,0 +1,255 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "block.h"
+#include "disasm.h"
+#include "histogram.h"
+
+/*
+    Opcode histogram. The counting itself is HistogramOpcode() and
+    HistogramCycles() in the dispatch of Step(), Run(), RunPaged() and
+    RunBlocks() and in IdlePoll(), compiled in only when RUN_OPCODE_PROFILE
+    is defined (the EMU_OPCODE_PROFILE CMake option), so the default build
+    has no trace of it. The JIT's native code cannot be counted, so that
+    build has no JIT and RunJit() is RunBlocks().
+
+    Cycles are the ones each instruction took, the taken or not taken cost
+    of a conditional CALL or RET included. Trips round a poll loop that
+    IdlePoll() skipped count as if they had run, so every engine counts
+    what Step() would.
+*/
+
+typedef struct {
+    unsigned int opcode;
+    unsigned long long count;
+    unsigned long long cycles;
+} OpcodeRow;
+
+typedef struct {
+    unsigned int first;
+    unsigned int second;
+    unsigned long long count;
+} PairRow;
+
+Bool HistogramAvailable(void) {
+#ifdef RUN_OPCODE_PROFILE
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+void HistogramClear(OpcodeHistogram *histogram) {
+    memset(histogram, 0, sizeof(*histogram));
+    histogram->last = HISTOGRAM_NO_OPCODE;
+}
+
+/* length instructions that ran times over, right after the last of them ran */
+void HistogramRepeat(OpcodeHistogram *histogram, const uint8_t *opcodes, const uint8_t *cycles, int length,
+    unsigned long long times) {
+    if (!histogram || !times) {
+        return;
+    }
+
+    for (int idx = 0; idx < length; idx++) {
+        histogram->count[opcodes[idx]] += times;
+        histogram->cycles[opcodes[idx]] += times * cycles[idx];
+        histogram->pairs[idx ? opcodes[idx - 1] : opcodes[length - 1]][opcodes[idx]] += times;
+    }
+}
+
+/* "MVI B,n", "JMP nn": the name with a stand-in for the operand */
+static void OpcodeText(unsigned int opcode, char *text, size_t size) {
+    snprintf(text, size, "%s%s", opNames[opcode], opLength[opcode] == 3 ? "nn" : opLength[opcode] == 2 ? "n" : "");
+}
+
+static double Percent(unsigned long long part, unsigned long long whole) {
+    return whole ? 100.0 * (double)part / (double)whole : 0.0;
+}
+
+/* Most cycles first, then most runs, then by opcode */
+static int CompareOpcodeRows(const void *left, const void *right) {
+    const OpcodeRow *a = (const OpcodeRow *)left;
+    const OpcodeRow *b = (const OpcodeRow *)right;
+
+    if (a->cycles != b->cycles) {
+        return a->cycles > b->cycles ? -1 : 1;
+    }
+
+    if (a->count != b->count) {
+        return a->count > b->count ? -1 : 1;
+    }
+
+    return (int)a->opcode - (int)b->opcode;
+}
+
+static int ComparePairRows(const void *left, const void *right) {
+    const PairRow *a = (const PairRow *)left;
+    const PairRow *b = (const PairRow *)right;
+
+    if (a->count != b->count) {
+        return a->count > b->count ? -1 : 1;
+    }
+
+    return (int)(a->first * 256 + a->second) - (int)(b->first * 256 + b->second);
+}
+
+static void Totals(const OpcodeHistogram *histogram, unsigned long long *count, unsigned long long *cycles) {
+    *count = 0;
+    *cycles = 0;
+
+    for (int opcode = 0; opcode < 256; opcode++) {
+        *count += histogram->count[opcode];
+        *cycles += histogram->cycles[opcode];
+    }
+}
+
+/* The opcodes that ran, most cycles first, then the HISTOGRAM_REPORT_PAIRS most common pairs */
+void HistogramPrint(const OpcodeHistogram *histogram) {
+    OpcodeRow rows[256];
+    PairRow top[HISTOGRAM_REPORT_PAIRS];
+    unsigned long long count;
+    unsigned long long cycles;
+    unsigned long long pairTotal = 0;
+    unsigned long pairsRun = 0;
+    int used = 0;
+    int shown = 0;
+
+    Totals(histogram, &count, &cycles);
+
+    for (unsigned int opcode = 0; opcode < 256; opcode++) {
+        if (histogram->count[opcode]) {
+            rows[used].opcode = opcode;
+            rows[used].count = histogram->count[opcode];
+            rows[used].cycles = histogram->cycles[opcode];
+            used++;
+        }
+    }
+
+    qsort(rows, (size_t)used, sizeof(rows[0]), CompareOpcodeRows);
+
+    printf("[histogram] %llu instructions, %llu cycles, %d of 256 opcodes run\n", count, cycles, used);
+    printf("  op  instruction            count  instr%%           cycles  cycle%%  cycles/op\n");
+
+    for (int idx = 0; idx < used; idx++) {
+        char text[DISASM_TEXT_SIZE];
+
+        OpcodeText(rows[idx].opcode, text, sizeof(text));
+        printf("  %02X  %-12s %15llu  %5.1f%%  %15llu  %5.1f%%  %9.2f\n", rows[idx].opcode, text,
+            rows[idx].count, Percent(rows[idx].count, count), rows[idx].cycles, Percent(rows[idx].cycles, cycles),
+            (double)rows[idx].cycles / (double)rows[idx].count);
+    }
+
+    /* Only the top few are kept, so one pass with an insertion into a short sorted list */
+    for (unsigned int first = 0; first < 256; first++) {
+        for (unsigned int second = 0; second < 256; second++) {
+            PairRow row = { first, second, histogram->pairs[first][second] };
+            int at;
+
+            if (!row.count) {
+                continue;
+            }
+
+            pairTotal += row.count;
+            pairsRun++;
+
+            if (shown == HISTOGRAM_REPORT_PAIRS && ComparePairRows(&row, &top[shown - 1]) >= 0) {
+                continue;
+            }
+
+            at = shown < HISTOGRAM_REPORT_PAIRS ? shown++ : shown - 1;
+
+            while (at > 0 && ComparePairRows(&row, &top[at - 1]) < 0) {
+                top[at] = top[at - 1];
+                at--;
+            }
+
+            top[at] = row;
+        }
+    }
+
+    printf("[histogram] top %d of %lu opcode pairs run\n", shown, pairsRun);
+    printf("  pair   instructions                  count   pair%%\n");
+
+    for (int idx = 0; idx < shown; idx++) {
+        char first[DISASM_TEXT_SIZE];
+        char second[DISASM_TEXT_SIZE];
+        char both[2 * DISASM_TEXT_SIZE + 2];
+
+        OpcodeText(top[idx].first, first, sizeof(first));
+        OpcodeText(top[idx].second, second, sizeof(second));
+        snprintf(both, sizeof(both), "%s; %s", first, second);
+        printf("  %02X %02X  %-24s %15llu  %5.1f%%\n", top[idx].first, top[idx].second, both,
+            top[idx].count, Percent(top[idx].count, pairTotal));
+    }
+}
+
+/*
+    One row per opcode, all 256 in opcode order, then one per pair that ran
+    with first and second in opcode order:
+        kind,first,second,instruction,count,cycles
+    The pairs have no cycles of their own, that column is empty for them.
+*/
+int HistogramWriteCsv(const OpcodeHistogram *histogram, FILE *file) {
+    fprintf(file, "kind,first,second,instruction,count,cycles\n");
+
+    for (unsigned int opcode = 0; opcode < 256; opcode++) {
+        char text[DISASM_TEXT_SIZE];
+
+        OpcodeText(opcode, text, sizeof(text));
+        fprintf(file, "opcode,%02X,,\"%s\",%llu,%llu\n", opcode, text,
+            histogram->count[opcode], histogram->cycles[opcode]);
+    }
+
+    for (unsigned int first = 0; first < 256; first++) {
+        for (unsigned int second = 0; second < 256; second++) {
+            char one[DISASM_TEXT_SIZE];
+            char two[DISASM_TEXT_SIZE];
+
+            if (!histogram->pairs[first][second]) {
+                continue;
+            }
+
+            OpcodeText(first, one, sizeof(one));
+            OpcodeText(second, two, sizeof(two));
+            fprintf(file, "pair,%02X,%02X,\"%s; %s\",%llu,\n", first, second, one, two,
+                histogram->pairs[first][second]);
+        }
+    }
+
+    return ferror(file) ? -1 : 0;
+}
+
+/* The same as HistogramWriteCsv(), with the totals on top and opcodes as numbers */
+int HistogramWriteJson(const OpcodeHistogram *histogram, FILE *file) {
+    unsigned long long count;
+    unsigned long long cycles;
+    const char *separator = "";
+
+    Totals(histogram, &count, &cycles);
+
+    fprintf(file, "{\n  \"instructions\": %llu,\n  \"cycles\": %llu,\n  \"opcodes\": [\n", count, cycles);
+
+    for (unsigned int opcode = 0; opcode < 256; opcode++) {
+        char text[DISASM_TEXT_SIZE];
+
+        OpcodeText(opcode, text, sizeof(text));
+        fprintf(file, "    {\"opcode\": %u, \"instruction\": \"%s\", \"count\": %llu, \"cycles\": %llu}%s\n",
+            opcode, text, histogram->count[opcode], histogram->cycles[opcode], opcode < 255 ? "," : "");
+    }
+
+    fprintf(file, "  ],\n  \"pairs\": [");
+
+    for (unsigned int first = 0; first < 256; first++) {
+        for (unsigned int second = 0; second < 256; second++) {
+            if (histogram->pairs[first][second]) {
+                fprintf(file, "%s\n    {\"first\": %u, \"second\": %u, \"count\": %llu}", separator, first, second,
+                    histogram->pairs[first][second]);
+                separator = ",";
+            }
+        }
+    }
+
+    fprintf(file, "\n  ]\n}\n");
+    return ferror(file) ? -1 : 0;
+}
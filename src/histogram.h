@@ -0,0 +1,61 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "cpu.h"
+
+/* Pairs the report prints, the files have all of them */
+#define HISTOGRAM_REPORT_PAIRS      32
+
+/* last before the first instruction: no pair to count yet */
+#define HISTOGRAM_NO_OPCODE         0x100
+
+/*
+    Executions and cycles of every opcode and how often each opcode follows
+    each other one, see histogram.c. Hung off cpu->histogram, but only an
+    EMU_OPCODE_PROFILE build (RUN_OPCODE_PROFILE) ever counts into it.
+*/
+struct OpcodeHistogram {
+    unsigned long long count[256];
+    unsigned long long cycles[256];
+    unsigned long long pairs[256][256]; /* pairs[first][second] */
+    unsigned int last;                  /* the opcode counted last, or HISTOGRAM_NO_OPCODE */
+};
+
+/*
+    Called by the engines for every instruction they run, in RUN_OPCODE_PROFILE
+    builds only: HistogramOpcode() as it starts, HistogramCycles() once it
+    knows what it took. A poll counts the idle loop trips IdlePoll() runs
+    or skips in between, so they have to come after it.
+*/
+static inline void HistogramOpcode(OpcodeHistogram *histogram, unsigned int opcode) {
+    if (histogram) {
+        histogram->count[opcode]++;
+
+        if (histogram->last != HISTOGRAM_NO_OPCODE) {
+            histogram->pairs[histogram->last][opcode]++;
+        }
+
+        histogram->last = opcode;
+    }
+}
+
+static inline void HistogramCycles(OpcodeHistogram *histogram, unsigned int opcode, unsigned int cycles) {
+    if (histogram) {
+        histogram->cycles[opcode] += cycles;
+    }
+}
+
+Bool HistogramAvailable(void);
+void HistogramClear(OpcodeHistogram *histogram);
+void HistogramRepeat(OpcodeHistogram *histogram, const uint8_t *opcodes, const uint8_t *cycles, int length,
+    unsigned long long times);
+void HistogramPrint(const OpcodeHistogram *histogram);
+int HistogramWriteCsv(const OpcodeHistogram *histogram, FILE *file);
+int HistogramWriteJson(const OpcodeHistogram *histogram, FILE *file);
+
+/* Two programs counted on every engine against Step(), see selfcheck.c */
+int HistogramSelfCheck(void);
+
+#endif
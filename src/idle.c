@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <string.h>
+#include "cpu.h"
+#include "idle.h"
+#include "histogram.h"
+
+/*
+    Idle loop detection. CP/M programs wait for input by spinning on BDOS
+    function 11 or on an IN from a status port, and nothing they read can
+    change until the host does something between two Run() slices.
+
+    The engines call IdlePoll() right after every poll instruction (IN, or a
+    trap whose poll hook says so). When a poll at the same address comes
+    back with exactly the register state it left with last time, one more
+    trip round the loop is run here, one instruction at a time, refusing
+    anything that could have an effect: OUT, HLT, a trap that is not a poll,
+    any access to a memory handler page, an IN from a port with a read
+    handler (see IoRegister()), a store that changes memory (CALL and
+    PUSH rewriting the same return address are fine), or a breakpoint
+    while Execute() stops at them. If that
+    trip also ends where it started, every further trip would be identical,
+    so whole trips are skipped until the budget is nearly used up and the
+    counters are advanced as if they had run. The machine ends up exactly
+    where it would have been.
+
+    Step() is the reference and never fast-forwards.
+*/
+
+static void Snapshot(Cpu8080 *cpu, uint16_t addr) {
+    IdleState *idle = &cpu->idle;
+
+    idle->valid = TRUE;
+    idle->addr = addr;
+    memcpy(idle->registers, cpu->registers, sizeof(idle->registers));
+    idle->PC = cpu->PC;
+    idle->interruptsEnabled = cpu->interruptsEnabled;
+}
+
+static Bool SameState(const Cpu8080 *cpu, const IdleState *idle) {
+    return (Bool)(memcmp(idle->registers, cpu->registers, sizeof(idle->registers)) == 0 &&
+        idle->PC == cpu->PC &&
+        idle->interruptsEnabled == cpu->interruptsEnabled);
+}
+
+/* Bytes the instruction at addr would store to, at most two */
+static int StoreTargets(Cpu8080 *cpu, uint16_t addr, uint16_t *targets) {
+    uint8_t opcode = MemPeek(cpu, addr);
+    uint16_t imm = (uint16_t)(MemPeek(cpu, (uint16_t)(addr + 1)) | (MemPeek(cpu, (uint16_t)(addr + 2)) << 8));
+
+    if ((opcode & 0xC0) == 0x40 && (opcode & 0x38) == 0x30) {
+        targets[0] = cpu->pairs[RP_HL];
+        return 1;
+    }
+
+    switch (opcode) {
+        case 0x02:
+        case 0x12: {    /* STAX */
+            targets[0] = cpu->pairs[opcode == 0x02 ? RP_BC : RP_DE];
+            return 1;
+        }
+
+        case 0x22: {    /* SHLD */
+            targets[0] = imm;
+            targets[1] = (uint16_t)(imm + 1);
+            return 2;
+        }
+
+        case 0x32: {    /* STA */
+            targets[0] = imm;
+            return 1;
+        }
+
+        case 0x34:
+        case 0x35:
+        case 0x36: {    /* INR M, DCR M, MVI M */
+            targets[0] = cpu->pairs[RP_HL];
+            return 1;
+        }
+
+        case 0xE3: {    /* XTHL */
+            targets[0] = cpu->SP;
+            targets[1] = (uint16_t)(cpu->SP + 1);
+            return 2;
+        }
+
+        default: {
+            break;
+        }
+    }
+
+    /* PUSH, CALL, Ccc and RST all push; a Ccc that is not taken stores nothing */
+    if ((opcode & 0xCF) == 0xC5 || (opcode & 0xCF) == 0xCD || (opcode & 0xC7) == 0xC4 ||
+        (opcode & 0xC7) == 0xC7) {
+        targets[0] = (uint16_t)(cpu->SP - 1);
+        targets[1] = (uint16_t)(cpu->SP - 2);
+        return 2;
+    }
+
+    return 0;
+}
+
+/* What a trip ran, for the opcode histogram build (see histogram.c) */
+typedef struct {
+    int length;
+    uint8_t opcodes[IDLE_MAX_STEPS];
+    uint8_t cycles[IDLE_MAX_STEPS];
+} IdleTrip;
+
+/* FALSE for anything that has an effect besides registers and memory stores */
+static Bool Quiet(const Cpu8080 *cpu, uint16_t addr) {
+    uint8_t opcode = MemPeek(cpu, addr);
+
+    if (opcode == 0x76 || opcode == 0xD3) {
+        return FALSE;
+    }
+
+    /* The engine stops in front of it once this gives up */
+    if ((cpu->stopMask & STOP_ON_BREAKPOINT) && cpu->breakCount && BreakpointAt(cpu, addr)) {
+        return FALSE;
+    }
+
+    if (opcode == TRAP_OPCODE && TrapAt(cpu, addr)) {
+        const Trap *trap = TrapFind(cpu, addr);
+
+        return (Bool)(trap && trap->poll && trap->poll(cpu));
+    }
+
+    return TRUE;
+}
+
+/*
+    Runs from just after the poll at addr to just after the next one. FALSE
+    if that takes too long or anything on the way is not quiet.
+*/
+static Bool RunTrip(Cpu8080 *cpu, uint16_t addr, unsigned long long *cycles, unsigned long long *instructions,
+    IdleTrip *trip) {
+    for (int step = 0; step < IDLE_MAX_STEPS; step++) {
+        uint16_t at = cpu->PC;
+        uint16_t targets[2];
+        uint8_t before[2];
+
+        if (!Quiet(cpu, at)) {
+            return FALSE;
+        }
+
+        int stores = StoreTargets(cpu, at, targets);
+
+        for (int idx = 0; idx < stores; idx++) {
+            before[idx] = MemPeek(cpu, targets[idx]);
+        }
+
+        uint32_t handlerCalls = cpu->handlerCalls;
+
+        /* cpu->instructions runs along, a port handler on the way sees the count Step() would */
+        uint8_t opcode = FetchByte(cpu);
+        int took = opcodeTable[opcode](cpu);
+
+        *cycles += (unsigned long long)took;
+        (*instructions)++;
+        cpu->instructions++;
+
+#ifdef RUN_OPCODE_PROFILE
+        HistogramOpcode(cpu->histogram, opcode);
+        HistogramCycles(cpu->histogram, opcode, (unsigned int)took);
+        trip->opcodes[step] = opcode;
+        trip->cycles[step] = (uint8_t)took;
+        trip->length = step + 1;
+#else
+        (void)trip;
+#endif
+
+        /* Anything on a handler page, fetch, load or store, or a port handler is a device access */
+        if (cpu->handlerCalls != handlerCalls) {
+            return FALSE;
+        }
+
+        for (int idx = 0; idx < stores; idx++) {
+            if (MemPeek(cpu, targets[idx]) != before[idx]) {
+                return FALSE;
+            }
+        }
+
+        if (at == addr) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/*
+    Called with the machine state up to date, right after the poll
+    instruction at addr. cyclesLeft is what the engine may still run after
+    that instruction. Returns the cycles run or skipped on the engine's
+    behalf and their instruction count in *instructions; the engine adds
+    both to its own totals and reloads the registers.
+*/
+unsigned long long IdlePoll(Cpu8080 *cpu, uint16_t addr, unsigned long long cyclesLeft,
+    unsigned long long *instructions) {
+    IdleState *idle = &cpu->idle;
+    unsigned long long cycles = 0;
+    unsigned long long count = 0;
+    IdleTrip trip;
+
+    *instructions = 0;
+
+    if (idle->backoff) {
+        idle->backoff--;
+        return 0;
+    }
+
+    if (!idle->valid || idle->addr != addr || !SameState(cpu, idle)) {
+        Snapshot(cpu, addr);
+        return 0;
+    }
+
+    if (cyclesLeft < IDLE_MIN_LEFT) {
+        return 0;
+    }
+
+    /* The engines count the poll instruction itself after this returns */
+    cpu->instructions++;
+
+    Bool quiet = RunTrip(cpu, addr, &cycles, &count, &trip);
+
+    cpu->instructions -= count + 1;
+    *instructions = count;
+
+    if (!quiet || !SameState(cpu, idle)) {
+        idle->valid = FALSE;
+        idle->backoff = IDLE_BACKOFF;
+        return cycles;
+    }
+
+    unsigned long long trips = (cyclesLeft - cycles) / cycles;
+
+    if (trips * cycles > IDLE_MAX_SKIP) {
+        trips = IDLE_MAX_SKIP / cycles;
+    }
+
+    idle->skippedCycles += trips * cycles;
+    idle->skippedInstructions += trips * count;
+    idle->fastForwards++;
+
+    *instructions += trips * count;
+
+#ifdef RUN_OPCODE_PROFILE
+    HistogramRepeat(cpu->histogram, trip.opcodes, trip.cycles, trip.length, trips);
+#endif
+
+    return cycles + trips * cycles;
+}
+
+void IdlePrintStats(const Cpu8080 *cpu) {
+    const IdleState *idle = &cpu->idle;
+
+    printf("[idle] %llu cycles (%llu instructions) skipped in %llu fast-forwards\n",
+        idle->skippedCycles, idle->skippedInstructions, idle->fastForwards);
+}
@@ -0,0 +1,26 @@
+#ifndef IDLE_H
+#define IDLE_H
+
+#include <stdint.h>
+#include "cpu.h"
+
+/* Longest loop body that is looked at, in instructions */
+#define IDLE_MAX_STEPS              64
+
+/* Worst case cycles of IDLE_MAX_STEPS instructions (XTHL takes 18) */
+#define IDLE_MIN_LEFT               (IDLE_MAX_STEPS * 18)
+
+/* Polls ignored after a loop turned out to do more than poll */
+#define IDLE_BACKOFF                64
+
+/* Most one fast-forward skips, so an unlimited budget cannot wrap the counters */
+#define IDLE_MAX_SKIP               (1ULL << 32)
+
+unsigned long long IdlePoll(Cpu8080 *cpu, uint16_t addr, unsigned long long cyclesLeft,
+    unsigned long long *instructions);
+void IdlePrintStats(const Cpu8080 *cpu);
+
+/* Fast-forward check against Step(), see selfcheck.c */
+int IdleSelfCheck(void);
+
+#endif
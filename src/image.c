@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cpu.h"
+#include "image.h"
+
+/*
+    Copy-on-write program images, for running the same program on many
+    machines at once. The program is set up once on one machine (loaded,
+    CP/M page zero filled in, traps planted) and taken with ImageCreate().
+    A machine made from it with CpuInitShared() maps every page of the
+    image read-only, and its first store to a page copies that page into
+    its own memory[] and maps it as RAM. From then on the page is the
+    machine's like any other.
+
+    CpuInitShared() never touches memory[], so where a fresh allocation
+    this big is untouched zero pages until written (malloc() on glibc,
+    calloc() on most hosts), a machine costs its registers and tables plus
+    the pages it wrote, not 64K.
+
+    A machine that still shares pages is not on the flat bus, so it runs in
+    Run() through the page table and not on the block cache or the JIT.
+    Once it has copied every page, or the host gives it its own copy with
+    ImageUnshare(), it is flat again and Execute() moves it over.
+*/
+
+/* Copy of cpu's memory[] as it is now, shared pages included. The caller holds the one reference. */
+SharedImage *ImageCreate(const Cpu8080 *cpu) {
+    SharedImage *image = (SharedImage *)malloc(sizeof(SharedImage));
+
+    if (!image) {
+        return NULL;
+    }
+
+    memset(&image->stats, 0, sizeof(image->stats));
+    image->references = 1;
+    MemCopyOwn(cpu, image->memory);
+
+    return image;
+}
+
+/* Drops a reference, the last one frees the image */
+void ImageRelease(SharedImage *image) {
+    if (image && --image->references == 0) {
+        free(image);
+    }
+}
+
+/* The write handler of shared pages: copy, map as RAM and store again */
+static void ImageCopyOnWrite(Cpu8080 *cpu, uint16_t addr, uint8_t value, void *context) {
+    (void)context;
+    ImageUnshare(cpu, (uint16_t)(addr & ~(MEM_PAGE_SIZE - 1)), MEM_PAGE_SIZE);
+    MemWrite(cpu, addr, value);
+}
+
+/* Maps all of image read-only in place of memory[], see CpuInitShared() */
+void ImageAttach(Cpu8080 *cpu, SharedImage *image) {
+    cpu->image = image;
+    image->references++;
+    image->stats.attached++;
+    memset(cpu->sharedPages, 1, sizeof(cpu->sharedPages));
+    MemMapReadOnly(cpu, 0, MEM_MAX, image->memory, ImageCopyOnWrite, NULL);
+}
+
+/*
+    Gives the pages covering [addr, addr + size) their own copy in memory[].
+    Pages mapped somewhere else right now (another bank) are copied but
+    stay mapped where they are.
+*/
+void ImageUnshare(Cpu8080 *cpu, uint16_t addr, uint32_t size) {
+    SharedImage *image = cpu->image;
+    uint32_t last = (addr + size - 1) >> MEM_PAGE_SHIFT;
+
+    for (uint32_t page = addr >> MEM_PAGE_SHIFT; size && page <= last && page < MEM_PAGE_COUNT; page++) {
+        uint16_t offset = (uint16_t)(page << MEM_PAGE_SHIFT);
+
+        if (!cpu->sharedPages[page]) {
+            continue;
+        }
+
+        memcpy(&cpu->memory[offset], &image->memory[offset], MEM_PAGE_SIZE);
+        cpu->sharedPages[page] = 0;
+        image->stats.copies++;
+
+        if (cpu->readPage[page] == &image->memory[offset]) {
+            MemMapRam(cpu, offset, MEM_PAGE_SIZE, &cpu->memory[offset]);
+        }
+    }
+}
+
+/*
+    For a machine that is done with image: drops its reference and unmaps
+    what it still shared. One that is to run on calls ImageUnshare() for
+    all of memory first.
+*/
+void ImageDetach(Cpu8080 *cpu) {
+    SharedImage *image = cpu->image;
+
+    if (!image) {
+        return;
+    }
+
+    for (int page = 0; page < MEM_PAGE_COUNT; page++) {
+        uint16_t offset = (uint16_t)(page << MEM_PAGE_SHIFT);
+
+        if (cpu->sharedPages[page] && cpu->readPage[page] == &image->memory[offset]) {
+            MemUnmap(cpu, offset, MEM_PAGE_SIZE);
+        }
+    }
+
+    memset(cpu->sharedPages, 0, sizeof(cpu->sharedPages));
+    cpu->image = NULL;
+    ImageRelease(image);
+}
+
+/* Pages of memory[] cpu has not copied yet */
+int ImageSharedPages(const Cpu8080 *cpu) {
+    int count = 0;
+
+    for (int page = 0; page < MEM_PAGE_COUNT; page++) {
+        count += cpu->sharedPages[page] != 0;
+    }
+
+    return count;
+}
+
+void ImagePrintStats(const SharedImage *image) {
+    printf("[image] %d references, %llu machines attached, %llu pages copied on write (%llu K)\n",
+        image->references, image->stats.attached, image->stats.copies,
+        (image->stats.copies * MEM_PAGE_SIZE) >> 10);
+}
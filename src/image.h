@@ -0,0 +1,31 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdint.h>
+#include "cpu.h"
+
+typedef struct {
+    unsigned long long attached;        /* machines ever made from the image */
+    unsigned long long copies;          /* pages they copied on first write */
+} ImageStats;
+
+/*
+    A read-only 64K memory image shared by many machines, see image.c.
+    Counted: the creator holds one reference and every machine made from
+    it another. None of it is thread safe.
+*/
+struct SharedImage {
+    int references;
+    ImageStats stats;
+    uint8_t memory[MEM_MAX];
+};
+
+SharedImage *ImageCreate(const Cpu8080 *cpu);
+void ImageRelease(SharedImage *image);
+void ImageAttach(Cpu8080 *cpu, SharedImage *image);
+void ImageUnshare(Cpu8080 *cpu, uint16_t addr, uint32_t size);
+void ImageDetach(Cpu8080 *cpu);
+int ImageSharedPages(const Cpu8080 *cpu);
+void ImagePrintStats(const SharedImage *image);
+
+#endif
@@ -0,0 +1,1560 @@
+#ifdef __linux__
+/* memfd_create(), see JitCacheInit() */
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cpu.h"
+#include "block.h"
+#include "jit.h"
+#include "idle.h"
+
+/*
+    x86-64 dynamic recompiler. A guest block (same boundaries as the block
+    cache, see EndsBlock() in block.c) becomes a run of host code that jumps
+    straight into the next block's translation when it has one (see
+    EmitStubs()), so RunJit() only sees misses, halts and traps.
+
+    Host register use, from enter to leave:
+        rbx     Cpu8080 *, flags and memory are addressed off it
+        rbp     cycle budget of this entry
+        r12     codeMap of this cache, for the store check
+        r13     set by the store check when the running block was overwritten
+        r14     cycles run since enter, r15 instructions
+        r8-r11  BC DE HL SP, as zero-extended 16 bit values
+        esi     A, zero-extended
+        eax     guest address, ecx/edx scratch
+        edi     page number of a store, for its dirtyPages mark
+
+    Pairs live in host registers because that is how the 8080 uses them for
+    addresses. The high halves (B D H) cost a shift to read and a rotate
+    pair to write. The Cpu8080 copies are only brought up to date around
+    calls into C and on the way out.
+
+    S/Z/P/AC/CY come straight out of LAHF, whose AH layout is the 8080 PSW
+    layout (S Z 0 AC 0 P 1 CY). After a subtraction only AC needs a flip.
+    A flag result that the next flag-writing instruction overwrites before
+    anything can look at it is never stored.
+
+    DAA, IN and OUT are not translated. They go through the op_XX handlers in
+    cpu.c like the Step() engine does. TRAP_OPCODE ends a block and asks
+    TrapAt() at run time, exactly as in Step() and Run(). IN ends a block
+    too, both of them are polls and go past IdlePoll() on the way out. OUT
+    ends one because it may switch banks, after which memory is no longer
+    flat and RunJit() has to hand over.
+*/
+
+#ifdef JIT_AVAILABLE
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define OFF_REG(r)          ((int32_t)(offsetof(Cpu8080, registers) + (r)))
+#define OFF_PAIR(rp)        ((int32_t)(offsetof(Cpu8080, pairs) + (rp) * 2))
+#define OFF_F               ((int32_t)offsetof(Cpu8080, flags))
+#define OFF_PC              ((int32_t)offsetof(Cpu8080, PC))
+#define OFF_HALTED          ((int32_t)offsetof(Cpu8080, halted))
+#define OFF_INT             ((int32_t)offsetof(Cpu8080, interruptsEnabled))
+#define OFF_CYCLES          ((int32_t)offsetof(Cpu8080, cycles))
+#define OFF_INSTR           ((int32_t)offsetof(Cpu8080, instructions))
+#define OFF_MEM             ((int32_t)offsetof(Cpu8080, memory))
+#define OFF_YIELD           ((int32_t)offsetof(Cpu8080, yield))
+#define OFF_PENDING         ((int32_t)offsetof(Cpu8080, interruptPending))
+#define OFF_DIRTY           ((int32_t)offsetof(Cpu8080, dirtyPages))
+
+/* Host register numbers as they go into ModRM, 8 bit ones without REX */
+enum {
+    AL = 0, CL, DL, BL, AH, CH, DH, BH
+};
+
+enum {
+    EAX = 0, ECX, EDX
+};
+
+#define EMIT(t, ...)        EmitBytes((t), (const uint8_t[]){ __VA_ARGS__ }, sizeof((const uint8_t[]){ __VA_ARGS__ }))
+
+#define JIT_MAX_EXITS       (BLOCK_MAX_OPS * 2 + 2)
+#define JIT_MAX_STORES      (BLOCK_MAX_OPS * 2)
+
+typedef enum {
+    FLAGS_UNTOUCHED = 0,
+    FLAGS_OVERWRITTEN,
+    FLAGS_READ
+} FlagUse;
+
+/* An exit that is jumped to rather than fallen into, emitted after the block body */
+typedef struct {
+    uint8_t *patch;
+    uint16_t pc;
+    uint32_t cycles;
+    uint32_t instructions;
+} JitExit;
+
+/* The slow path of one store check */
+typedef struct {
+    uint8_t *patch;
+    uint8_t *resume;
+} JitStore;
+
+typedef struct {
+    uint8_t opcode;
+    uint16_t operand;
+    uint16_t pc;
+    uint16_t nextPC;
+} JitOp;
+
+typedef struct {
+    JitCache *jit;
+    uint8_t *pos;
+    uint16_t start;
+    Bool stored;
+
+    JitExit exits[JIT_MAX_EXITS];
+    int exitCount;
+    JitStore stores[JIT_MAX_STORES];
+    int storeCount;
+} Translator;
+
+/* 8080 register field (B C D E H L M A) to Reg8, M has none */
+static const int8_t regField[8] = {
+    REG_B, REG_C, REG_D, REG_E, REG_H, REG_L, -1, REG_A
+};
+
+/* ADD ADC SUB SBB ANA XRA ORA CMP as "op r8, r/m8" */
+static const uint8_t aluOpcode[8] = {
+    0x02, 0x12, 0x2A, 0x1A, 0x22, 0x32, 0x0A, 0x3A
+};
+
+/* NZ Z NC C PO PE P M: flag bit tested, taken when set for odd conditions */
+static const uint8_t condMask[8] = {
+    0x40, 0x40, 0x01, 0x01, 0x04, 0x04, 0x80, 0x80
+};
+
+static void EmitBytes(Translator *t, const uint8_t *bytes, size_t count) {
+    memcpy(t->pos, bytes, count);
+    t->pos += count;
+}
+
+static void Emit8(Translator *t, uint8_t value) {
+    *t->pos++ = value;
+}
+
+static void Emit16(Translator *t, uint16_t value) {
+    memcpy(t->pos, &value, 2);
+    t->pos += 2;
+}
+
+static void Emit32(Translator *t, uint32_t value) {
+    memcpy(t->pos, &value, 4);
+    t->pos += 4;
+}
+
+static void Emit64(Translator *t, uint64_t value) {
+    memcpy(t->pos, &value, 8);
+    t->pos += 8;
+}
+
+static void Patch32(uint8_t *patch, const uint8_t *target) {
+    int32_t rel = (int32_t)(target - (patch + 4));
+    memcpy(patch, &rel, 4);
+}
+
+/* ModRM for [rbx + disp32] */
+static void EmitRbx(Translator *t, int reg, int32_t disp) {
+    Emit8(t, (uint8_t)(0x80 | (reg << 3) | 3));
+    Emit32(t, (uint32_t)disp);
+}
+
+/* ModRM + SIB for guest memory at [rbx + rax + memory] */
+static void EmitGuest(Translator *t, int reg) {
+    Emit8(t, (uint8_t)(0x84 | (reg << 3)));
+    Emit8(t, 0x03);
+    Emit32(t, (uint32_t)OFF_MEM);
+}
+
+/* Which pair a Reg8 is half of, and whether it is the high half (B D H); x86-64 is little endian */
+#define REG_PAIR(reg)       ((reg) >> 1)
+#define REG_HIGH(reg)       ((reg) & 1)
+
+/* host (al, cl or dl) = guest register, the bits above it are not cleared */
+static void LoadReg8(Translator *t, int host, int reg) {
+    if (reg == REG_A) {
+        EMIT(t, 0x89, (uint8_t)(0xF0 | host));
+        return;
+    }
+
+    int rp = REG_PAIR(reg);
+    EMIT(t, 0x44, 0x89, (uint8_t)(0xC0 | (rp << 3) | host));
+
+    if (REG_HIGH(reg)) {
+        EMIT(t, 0xC1, (uint8_t)(0xE8 | host), 0x08);
+    }
+}
+
+/*
+    Guest register = host byte. A takes any of the eight legacy byte
+    registers, the others only al, cl, dl or bl because they need REX.
+    Writing a high half goes through rotates, which change CF and OF.
+*/
+static void StoreReg8(Translator *t, int host, int reg) {
+    if (reg == REG_A) {
+        EMIT(t, 0x0F, 0xB6, (uint8_t)(0xF0 | host));
+        return;
+    }
+
+    int rp = REG_PAIR(reg);
+    Bool high = (Bool)REG_HIGH(reg);
+
+    if (high) {
+        EMIT(t, 0x66, 0x41, 0xC1, (uint8_t)(0xC8 | rp), 0x08);
+    }
+
+    EMIT(t, 0x41, 0x88, (uint8_t)(0xC0 | (host << 3) | rp));
+
+    if (high) {
+        EMIT(t, 0x66, 0x41, 0xC1, (uint8_t)(0xC8 | rp), 0x08);
+    }
+}
+
+static void LoadFlags(Translator *t, int host) {
+    Emit8(t, 0x8A);
+    EmitRbx(t, host, OFF_F);
+}
+
+static void StoreFlags(Translator *t, int host) {
+    Emit8(t, 0x88);
+    EmitRbx(t, host, OFF_F);
+}
+
+/* host = guest byte at [rax] */
+static void LoadGuest(Translator *t, int host) {
+    Emit8(t, 0x8A);
+    EmitGuest(t, host);
+}
+
+/* host = pair, zero-extended */
+static void LoadPair(Translator *t, int host, RegPair rp) {
+    EMIT(t, 0x44, 0x89, (uint8_t)(0xC0 | (rp << 3) | host));
+}
+
+/* pair = low 16 bits of host */
+static void StorePair(Translator *t, int host, RegPair rp) {
+    EMIT(t, 0x44, 0x0F, 0xB7, (uint8_t)(0xC0 | (rp << 3) | host));
+}
+
+/* Host registers to Cpu8080, one 16-bit store per pair */
+static void EmitSpill(Translator *t) {
+    for (int rp = RP_BC; rp <= RP_SP; rp++) {
+        EMIT(t, 0x66, 0x44, 0x89);
+        EmitRbx(t, rp, OFF_PAIR(rp));
+    }
+
+    EMIT(t, 0x40, 0x88);
+    EmitRbx(t, 6, OFF_REG(REG_A));
+}
+
+/* Cpu8080 to host registers */
+static void EmitReload(Translator *t) {
+    for (int rp = RP_BC; rp <= RP_SP; rp++) {
+        EMIT(t, 0x44, 0x0F, 0xB7);
+        EmitRbx(t, rp, OFF_PAIR(rp));
+    }
+
+    EMIT(t, 0x0F, 0xB6);
+    EmitRbx(t, 6, OFF_REG(REG_A));
+}
+
+static void EmitCallHelper(Translator *t, const void *helper) {
+    EMIT(t, 0x48, 0xB8);
+    Emit64(t, (uint64_t)(uintptr_t)helper);
+    EMIT(t, 0xFF, 0xD0);
+}
+
+/* First argument = rbx */
+static void EmitArgCpu(Translator *t) {
+#ifdef _WIN32
+    EMIT(t, 0x48, 0x89, 0xD9);
+#else
+    EMIT(t, 0x48, 0x89, 0xDF);
+#endif
+}
+
+static void EmitArg1Imm(Translator *t, uint32_t value) {
+#ifdef _WIN32
+    Emit8(t, 0xBA);
+#else
+    Emit8(t, 0xBE);
+#endif
+    Emit32(t, value);
+}
+
+/* Second argument = eax */
+static void EmitArg1Eax(Translator *t) {
+#ifdef _WIN32
+    EMIT(t, 0x89, 0xC2);
+#else
+    EMIT(t, 0x89, 0xC6);
+#endif
+}
+
+/* Third argument = budget - r14 - cycles, what is left after them (may be negative) */
+static void EmitArg2Left(Translator *t, uint32_t cycles) {
+#ifdef _WIN32
+    EMIT(t, 0x49, 0x89, 0xE8, 0x4D, 0x29, 0xF0, 0x49, 0x81, 0xE8);
+#else
+    EMIT(t, 0x48, 0x89, 0xEA, 0x4C, 0x29, 0xF2, 0x48, 0x81, 0xEA);
+#endif
+    Emit32(t, cycles);
+}
+
+static void EmitArg2Imm(Translator *t, uint32_t value) {
+#ifdef _WIN32
+    EMIT(t, 0x41, 0xB8);
+#else
+    Emit8(t, 0xBA);
+#endif
+    Emit32(t, value);
+}
+
+/*
+    Guest store of host byte register at [rax]. The page mark and the codeMap
+    test are the whole fast path; the call back into C sits out of line
+    after the block.
+*/
+static void EmitStore(Translator *t, int host) {
+    Emit8(t, 0x88);
+    EmitGuest(t, host);
+
+    /* movzx edi, ah; mov byte [rbx + rdi + dirtyPages], 1 */
+    EMIT(t, 0x0F, 0xB6, 0xFC);
+    EMIT(t, 0xC6, 0x84, 0x3B);
+    Emit32(t, (uint32_t)OFF_DIRTY);
+    Emit8(t, 0x01);
+
+    EMIT(t, 0x41, 0x80, 0x3C, 0x04, 0x00);
+    EMIT(t, 0x0F, 0x85);
+    t->stores[t->storeCount].patch = t->pos;
+    Emit32(t, 0);
+    t->stores[t->storeCount].resume = t->pos;
+    t->storeCount++;
+    t->stored = TRUE;
+}
+
+/* PUSH of ch (high) and cl (low) */
+static void EmitPush(Translator *t) {
+    LoadPair(t, EAX, RP_SP);
+    EMIT(t, 0x66, 0xFF, 0xC8);
+    EmitStore(t, CH);
+    EMIT(t, 0x66, 0xFF, 0xC8);
+    EmitStore(t, CL);
+    StorePair(t, EAX, RP_SP);
+}
+
+/* POP into ch (high) and cl (low) */
+static void EmitPop(Translator *t) {
+    LoadPair(t, EAX, RP_SP);
+    LoadGuest(t, CL);
+    EMIT(t, 0x66, 0xFF, 0xC0);
+    LoadGuest(t, CH);
+    EMIT(t, 0x66, 0xFF, 0xC0);
+    StorePair(t, EAX, RP_SP);
+}
+
+/* Adds a path's cost to the running totals in r14 (cycles) and r15 (instructions) */
+static void EmitAccount(Translator *t, uint32_t cycles, uint32_t instructions) {
+    EMIT(t, 0x49, 0x81, 0xC6);
+    Emit32(t, cycles);
+    EMIT(t, 0x49, 0x81, 0xC7);
+    Emit32(t, instructions);
+}
+
+/*
+    Before a helper that calls host code: moves r15 plus the first before
+    instructions of this block onto cpu->instructions, so the helper sees
+    the count Step() would have, and sets r15 so that the EmitLeave() with
+    before + 1 after it leaves 1 there for the instruction itself.
+*/
+static void EmitSyncInstructions(Translator *t, uint32_t before) {
+    EMIT(t, 0x4C, 0x01);
+    EmitRbx(t, 7, OFF_INSTR);
+    EMIT(t, 0x48, 0x81);
+    EmitRbx(t, 0, OFF_INSTR);
+    Emit32(t, before);
+    EMIT(t, 0x49, 0xC7, 0xC7);
+    Emit32(t, (uint32_t)(1 - (int32_t)(before + 1)));
+}
+
+static void EmitJump(Translator *t, const uint8_t *target) {
+    Emit8(t, 0xE9);
+    Emit32(t, 0);
+    Patch32(t->pos - 4, target);
+}
+
+/* Leaves for the guest address in eax, straight into its translation when there is one */
+static void EmitChain(Translator *t, uint32_t cycles, uint32_t instructions) {
+    EmitAccount(t, cycles, instructions);
+    EmitJump(t, t->jit->chain);
+}
+
+static void EmitExit(Translator *t, uint16_t pc, uint32_t cycles, uint32_t instructions) {
+    Emit8(t, 0xB8);
+    Emit32(t, pc);
+    EmitChain(t, cycles, instructions);
+}
+
+/* Back to RunJit() with PC already stored, for traps */
+static void EmitLeave(Translator *t, uint32_t cycles, uint32_t instructions) {
+    EmitAccount(t, cycles, instructions);
+    EmitJump(t, t->jit->leave);
+}
+
+
+/* Exit reached through the rel32 just emitted, written out after the block */
+static void DeferExit(Translator *t, uint16_t pc, uint32_t cycles, uint32_t instructions) {
+    JitExit *exit = &t->exits[t->exitCount++];
+
+    exit->patch = t->pos - 4;
+    exit->pc = pc;
+    exit->cycles = cycles;
+    exit->instructions = instructions;
+}
+
+/* test flags, cond; jcc rel32 to be patched. Jumps when the condition is (taken ? true : false) */
+static uint8_t *EmitCondJump(Translator *t, int cond, Bool taken) {
+    Emit8(t, 0xF6);
+    EmitRbx(t, 0, OFF_F);
+    Emit8(t, condMask[cond]);
+
+    /* Odd conditions hold when the bit is set */
+    Bool jumpIfSet = (Bool)((cond & 1) == taken);
+    EMIT(t, 0x0F, jumpIfSet ? 0x85 : 0x84);
+    Emit32(t, 0);
+
+    return t->pos - 4;
+}
+
+static void EmitSetHalted(Translator *t) {
+    Emit8(t, 0xC7);
+    EmitRbx(t, 0, OFF_HALTED);
+    Emit32(t, TRUE);
+}
+
+/* Back to RunJit() with the machine halted */
+static void EmitStop(Translator *t, uint16_t pc, uint32_t cycles, uint32_t instructions) {
+    EmitSetHalted(t);
+    EMIT(t, 0x66, 0xC7);
+    EmitRbx(t, 0, OFF_PC);
+    Emit16(t, pc);
+    EmitLeave(t, cycles, instructions);
+}
+
+static FlagUse GetFlagUse(uint8_t opcode) {
+    if (opcode >= 0x80 && opcode < 0xC0) {
+        return (opcode & 0xF0) == 0x80 || (opcode & 0xF0) == 0x90 ?
+            (opcode & 0x08 ? FLAGS_READ : FLAGS_OVERWRITTEN) : FLAGS_OVERWRITTEN;
+    }
+
+    switch (opcode) {
+        case 0xC6: case 0xD6: case 0xE6: case 0xEE: case 0xF6: case 0xFE: case 0xF1: {
+            return FLAGS_OVERWRITTEN;
+        }
+
+        case 0x00: case 0x08: case 0x10: case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:
+        case 0x01: case 0x11: case 0x21: case 0x31:
+        case 0x03: case 0x13: case 0x23: case 0x33:
+        case 0x0B: case 0x1B: case 0x2B: case 0x3B:
+        case 0x06: case 0x0E: case 0x16: case 0x1E: case 0x26: case 0x2E: case 0x3E:
+        case 0x0A: case 0x1A: case 0x2A: case 0x3A:
+        case 0x2F: case 0xC1: case 0xD1: case 0xE1: case 0xEB: case 0xF9: case 0xF3: case 0xFB: {
+            return FLAGS_UNTOUCHED;
+        }
+
+        default: {
+            break;
+        }
+    }
+
+    /* MOV r,r and MOV r,M; MOV M,r stores and may leave the block */
+    if (opcode >= 0x40 && opcode < 0x80 && (opcode & 0xF8) != 0x70) {
+        return FLAGS_UNTOUCHED;
+    }
+
+    return FLAGS_READ;
+}
+
+/* TRUE when the flags written by ops[idx] are overwritten before anything reads them */
+static Bool FlagsDead(const JitOp *ops, int count, int idx) {
+    for (int next = idx + 1; next < count; next++) {
+        FlagUse use = GetFlagUse(ops[next].opcode);
+
+        if (use != FLAGS_UNTOUCHED) {
+            return use == FLAGS_OVERWRITTEN;
+        }
+    }
+
+    return FALSE;
+}
+
+/* INR/DCR: S Z P AC from AH (in dl), CY kept */
+static void EmitIncDecFlags(Translator *t, Bool dec) {
+    EMIT(t, 0x88, 0xE2);
+    EMIT(t, 0x80, 0xE2, 0xD4);
+
+    if (dec) {
+        EMIT(t, 0x80, 0xF2, 0x10);
+    }
+
+    Emit8(t, 0x8A);
+    EmitRbx(t, DH, OFF_F);
+    EMIT(t, 0x80, 0xE6, 0x01);
+    EMIT(t, 0x0A, 0xD6);
+    EMIT(t, 0x80, 0xCA, 0x02);
+    StoreFlags(t, DL);
+}
+
+/* A = A op cl, for the eight 0x80-0xBF groups */
+static void EmitAlu(Translator *t, int kind, Bool dead) {
+    LoadReg8(t, AL, REG_A);
+
+    if (kind == 1 || kind == 3) {
+        /* ADC/SBB: guest CY into host CF */
+        LoadFlags(t, DL);
+        EMIT(t, 0xD0, 0xEA);
+    }
+
+    if (kind == 4 && !dead) {
+        EMIT(t, 0x88, 0xC2);
+        EMIT(t, 0x0A, 0xD1);
+    }
+
+    EMIT(t, aluOpcode[kind], 0xC1);
+
+    if (kind != 7) {
+        StoreReg8(t, AL, REG_A);
+    }
+
+    if (dead) {
+        return;
+    }
+
+    Emit8(t, 0x9F);
+
+    switch (kind) {
+        case 0:
+        case 1: {
+            EMIT(t, 0x80, 0xE4, 0xD5);
+            EMIT(t, 0x80, 0xCC, 0x02);
+            break;
+        }
+
+        case 2:
+        case 3:
+        case 7: {
+            /* x86 AF is a borrow, 8080 AC after a subtraction is its inverse */
+            EMIT(t, 0x80, 0xE4, 0xD5);
+            EMIT(t, 0x80, 0xF4, 0x12);
+            break;
+        }
+
+        case 4: {
+            EMIT(t, 0x80, 0xE4, 0xC4);
+            EMIT(t, 0x80, 0xE2, 0x08);
+            EMIT(t, 0xD0, 0xE2);
+            EMIT(t, 0x0A, 0xE2);
+            EMIT(t, 0x80, 0xCC, 0x02);
+            break;
+        }
+
+        default: {
+            EMIT(t, 0x80, 0xE4, 0xC4);
+            EMIT(t, 0x80, 0xCC, 0x02);
+            break;
+        }
+    }
+
+    StoreFlags(t, AH);
+}
+
+/* Rotates: CY from host CF, the rest of the flags kept */
+static void EmitRotate(Translator *t, uint8_t modrm, Bool throughCarry) {
+    if (throughCarry) {
+        LoadFlags(t, CL);
+        EMIT(t, 0xD0, 0xE9);
+    }
+
+    LoadReg8(t, AL, REG_A);
+    EMIT(t, 0xD0, modrm);
+    StoreReg8(t, AL, REG_A);
+    EMIT(t, 0x0F, 0x92, 0xC1);
+    LoadFlags(t, DL);
+    EMIT(t, 0x80, 0xE2, 0xFE);
+    EMIT(t, 0x0A, 0xD1);
+    StoreFlags(t, DL);
+}
+
+static void JitCold(Cpu8080 *cpu, uint32_t opcode) {
+    opcodeTable[opcode](cpu);
+}
+
+/* What IdlePoll() runs or skips goes straight on the counters, leave adds r14/r15 to them */
+static void JitPoll(Cpu8080 *cpu, uint16_t addr, long long left) {
+    unsigned long long instructions;
+
+    if (left > 0) {
+        cpu->cycles += IdlePoll(cpu, addr, (unsigned long long)left, &instructions);
+        cpu->instructions += instructions;
+    }
+}
+
+/* TRAP_OPCODE: a host trap where one is registered, a NOP everywhere else */
+static void JitTrap(Cpu8080 *cpu, uint32_t addr, long long left) {
+    if (TrapAt(cpu, (uint16_t)addr) && TrapFire(cpu, (uint16_t)addr) && !cpu->halted && !cpu->stopReason) {
+        JitPoll(cpu, (uint16_t)addr, left);
+    }
+}
+
+/* IN through op_db() like a cold opcode, then it is a poll */
+static void JitIn(Cpu8080 *cpu, uint32_t addr, long long left) {
+    cpu->PC = (uint16_t)(addr + 1);
+    opcodeTable[0xDB](cpu);
+    JitPoll(cpu, (uint16_t)addr, left);
+}
+
+/* Where code written at the given place in buffer is run from, see JitCacheInit() */
+static const uint8_t *Runnable(const JitCache *jit, const uint8_t *code) {
+    return jit->exec + (code - jit->buffer);
+}
+
+static void DropBlock(JitCache *jit, uint16_t start) {
+    JitBlock *blk = &jit->blocks[start];
+
+    for (uint16_t idx = 0; idx < blk->size; idx++) {
+        jit->codeMap[(uint16_t)(start + idx)]--;
+    }
+
+    blk->code = NULL;
+}
+
+/*
+    Drops every translation decoded from addr. A block is at most
+    BLOCK_MAX_BYTES long, so only that many start addresses can cover it.
+*/
+void JitInvalidate(JitCache *jit, uint16_t addr) {
+    for (uint16_t back = 0; back < BLOCK_MAX_BYTES && jit->codeMap[addr]; back++) {
+        uint16_t from = (uint16_t)(addr - back);
+        JitBlock *blk = &jit->blocks[from];
+
+        if (!blk->code || (uint16_t)(addr - from) >= blk->size) {
+            continue;
+        }
+
+        DropBlock(jit, from);
+        jit->stats.invalidated++;
+    }
+}
+
+/*
+    Called by the generated store check when addr holds translated code.
+    Returns non-zero when the block starting at start (the one running)
+    was dropped with it.
+*/
+static int JitCodeWritten(Cpu8080 *cpu, uint32_t addr, uint32_t start) {
+    JitCache *jit = cpu->jit;
+
+    cpu->codeGeneration++;
+    JitInvalidate(jit, (uint16_t)addr);
+
+    return jit->blocks[start].code == NULL;
+}
+
+static void EmitCold(Translator *t, const JitOp *op) {
+    EmitSpill(t);
+    EMIT(t, 0x66, 0xC7);
+    EmitRbx(t, 0, OFF_PC);
+    Emit16(t, (uint16_t)(op->pc + 1));
+    EmitArgCpu(t);
+    EmitArg1Imm(t, op->opcode);
+    EmitCallHelper(t, (const void *)JitCold);
+    EmitReload(t);
+}
+
+/* Everything that does not end a block */
+static void EmitBody(Translator *t, const JitOp *op, Bool flagsDead) {
+    uint8_t opcode = op->opcode;
+    int dst = (opcode >> 3) & 7;
+    int src = opcode & 7;
+    RegPair rp = (RegPair)((opcode >> 4) & 3);
+
+    if (opcode >= 0x40 && opcode < 0x80) {
+        if (src == 6) {
+            LoadPair(t, EAX, RP_HL);
+            LoadGuest(t, CL);
+            StoreReg8(t, CL, regField[dst]);
+        } else if (dst == 6) {
+            LoadPair(t, EAX, RP_HL);
+            LoadReg8(t, CL, regField[src]);
+            EmitStore(t, CL);
+        } else if (dst != src) {
+            LoadReg8(t, CL, regField[src]);
+            StoreReg8(t, CL, regField[dst]);
+        }
+
+        return;
+    }
+
+    if (opcode >= 0x80 && opcode < 0xC0) {
+        if (src == 6) {
+            LoadPair(t, EAX, RP_HL);
+            LoadGuest(t, CL);
+        } else {
+            LoadReg8(t, CL, regField[src]);
+        }
+
+        EmitAlu(t, dst, flagsDead);
+        return;
+    }
+
+    switch (opcode & 0xC7) {
+        case 0x00: {    /* NOP */
+            return;
+        }
+
+        case 0x04:      /* INR */
+        case 0x05: {    /* DCR */
+            Bool dec = (Bool)(opcode & 1);
+
+            if (dst == 6) {
+                LoadPair(t, EAX, RP_HL);
+                LoadGuest(t, CL);
+                EMIT(t, 0xFE, dec ? 0xC9 : 0xC1);
+
+                if (!flagsDead) {
+                    Emit8(t, 0x9F);
+                    EmitIncDecFlags(t, dec);
+                    LoadPair(t, EAX, RP_HL);
+                }
+
+                EmitStore(t, CL);
+                return;
+            }
+
+            LoadReg8(t, AL, regField[dst]);
+            EMIT(t, 0xFE, dec ? 0xC8 : 0xC0);
+
+            if (!flagsDead) {
+                Emit8(t, 0x9F);
+                EmitIncDecFlags(t, dec);
+            }
+
+            StoreReg8(t, AL, regField[dst]);
+            return;
+        }
+
+        case 0x06: {    /* MVI */
+            if (dst == 6) {
+                LoadPair(t, EAX, RP_HL);
+                EMIT(t, 0xB1, (uint8_t)op->operand);
+                EmitStore(t, CL);
+            } else {
+                EMIT(t, 0xB1, (uint8_t)op->operand);
+                StoreReg8(t, CL, regField[dst]);
+            }
+
+            return;
+        }
+
+        case 0xC6: {    /* ADI ACI SUI SBI ANI XRI ORI CPI */
+            EMIT(t, 0xB1, (uint8_t)op->operand);
+            EmitAlu(t, dst, flagsDead);
+            return;
+        }
+
+        default: {
+            break;
+        }
+    }
+
+    switch (opcode & 0xCF) {
+        case 0x01: {    /* LXI */
+            EMIT(t, 0x41, (uint8_t)(0xB8 | rp));
+            Emit32(t, op->operand);
+            return;
+        }
+
+        case 0x03:      /* INX */
+        case 0x0B: {    /* DCX */
+            Bool dec = (Bool)((opcode & 0x08) != 0);
+
+            /* 16 bit inc/dec wraps and leaves the upper half zero */
+            EMIT(t, 0x66, 0x41, 0xFF, (uint8_t)((dec ? 0xC8 : 0xC0) | rp));
+            return;
+        }
+
+        case 0x09: {    /* DAD */
+            EMIT(t, 0x66, 0x45, 0x01, (uint8_t)(0xC0 | (rp << 3) | RP_HL));
+            EMIT(t, 0x0F, 0x92, 0xC0);
+            LoadFlags(t, DL);
+            EMIT(t, 0x80, 0xE2, 0xFE);
+            EMIT(t, 0x0A, 0xD0);
+            StoreFlags(t, DL);
+            return;
+        }
+
+        case 0xC1: {    /* POP */
+            EmitPop(t);
+
+            /* The SP slot is PSW for PUSH/POP */
+            if (rp == RP_SP) {
+                EMIT(t, 0x80, 0xE1, 0xD5);
+                EMIT(t, 0x80, 0xC9, 0x02);
+                StoreFlags(t, CL);
+                StoreReg8(t, CH, REG_A);
+            } else {
+                StorePair(t, ECX, rp);
+            }
+
+            return;
+        }
+
+        case 0xC5: {    /* PUSH */
+            if (rp == RP_SP) {
+                LoadReg8(t, CL, REG_A);
+                EMIT(t, 0xC1, 0xE1, 0x08);
+                LoadFlags(t, CL);
+                EMIT(t, 0x80, 0xE1, 0xD5);
+                EMIT(t, 0x80, 0xC9, 0x02);
+            } else {
+                LoadPair(t, ECX, rp);
+            }
+
+            EmitPush(t);
+            return;
+        }
+
+        default: {
+            break;
+        }
+    }
+
+    switch (opcode) {
+        case 0x02:      /* STAX B */
+        case 0x12: {    /* STAX D */
+            LoadPair(t, EAX, rp);
+            LoadReg8(t, CL, REG_A);
+            EmitStore(t, CL);
+            return;
+        }
+
+        case 0x0A:      /* LDAX B */
+        case 0x1A: {    /* LDAX D */
+            LoadPair(t, EAX, rp);
+            LoadGuest(t, CL);
+            StoreReg8(t, CL, REG_A);
+            return;
+        }
+
+        case 0x22: {    /* SHLD */
+            Emit8(t, 0xB8);
+            Emit32(t, op->operand);
+            LoadReg8(t, CL, REG_L);
+            EmitStore(t, CL);
+            EMIT(t, 0x66, 0xFF, 0xC0);
+            LoadReg8(t, CL, REG_H);
+            EmitStore(t, CL);
+            return;
+        }
+
+        case 0x2A: {    /* LHLD */
+            Emit8(t, 0xB8);
+            Emit32(t, op->operand);
+            LoadGuest(t, CL);
+            StoreReg8(t, CL, REG_L);
+            EMIT(t, 0x66, 0xFF, 0xC0);
+            LoadGuest(t, CL);
+            StoreReg8(t, CL, REG_H);
+            return;
+        }
+
+        case 0x32: {    /* STA */
+            Emit8(t, 0xB8);
+            Emit32(t, op->operand);
+            LoadReg8(t, CL, REG_A);
+            EmitStore(t, CL);
+            return;
+        }
+
+        case 0x3A: {    /* LDA */
+            Emit8(t, 0x8A);
+            EmitRbx(t, CL, OFF_MEM + op->operand);
+            StoreReg8(t, CL, REG_A);
+            return;
+        }
+
+        case 0x07: {    /* RLC */
+            EmitRotate(t, 0xC0, FALSE);
+            return;
+        }
+
+        case 0x0F: {    /* RRC */
+            EmitRotate(t, 0xC8, FALSE);
+            return;
+        }
+
+        case 0x17: {    /* RAL */
+            EmitRotate(t, 0xD0, TRUE);
+            return;
+        }
+
+        case 0x1F: {    /* RAR */
+            EmitRotate(t, 0xD8, TRUE);
+            return;
+        }
+
+        case 0x2F: {    /* CMA */
+            EMIT(t, 0x81, 0xF6);
+            Emit32(t, 0xFF);
+            return;
+        }
+
+        case 0x37: {    /* STC */
+            Emit8(t, 0x80);
+            EmitRbx(t, 1, OFF_F);
+            Emit8(t, 0x01);
+            return;
+        }
+
+        case 0x3F: {    /* CMC */
+            Emit8(t, 0x80);
+            EmitRbx(t, 6, OFF_F);
+            Emit8(t, 0x01);
+            return;
+        }
+
+        case 0xE3: {    /* XTHL */
+            LoadPair(t, EAX, RP_SP);
+            LoadPair(t, ECX, RP_HL);
+            LoadGuest(t, DL);
+            EmitStore(t, CL);
+            EMIT(t, 0x66, 0xFF, 0xC0);
+            LoadGuest(t, DH);
+            EmitStore(t, CH);
+            StorePair(t, EDX, RP_HL);
+            return;
+        }
+
+        case 0xEB: {    /* XCHG */
+            EMIT(t, 0x45, 0x87, 0xCA);
+            return;
+        }
+
+        case 0xF9: {    /* SPHL */
+            LoadPair(t, EAX, RP_HL);
+            StorePair(t, EAX, RP_SP);
+            return;
+        }
+
+        case 0xF3: {    /* DI; EI ends a block, see EmitEnd() */
+            Emit8(t, 0xC7);
+            EmitRbx(t, 0, OFF_INT);
+            Emit32(t, FALSE);
+            return;
+        }
+
+        default: {
+            /* DAA */
+            EmitCold(t, op);
+            return;
+        }
+    }
+}
+
+/*
+    The last instruction of a block. cycles is what the block took before it,
+    count includes it.
+*/
+static void EmitEnd(Translator *t, const JitOp *op, uint32_t cycles, uint32_t count) {
+    uint8_t opcode = op->opcode;
+    uint16_t next = op->nextPC;
+    uint16_t target = op->operand;
+    int cond = (opcode >> 3) & 7;
+    uint8_t *skip;
+
+    if (opcode == TRAP_OPCODE) {
+        /* Stores in the handler go through MemWrite(), which drops what they overwrite */
+        EmitSpill(t);
+        EMIT(t, 0x66, 0xC7);
+        EmitRbx(t, 0, OFF_PC);
+        Emit16(t, next);
+        EmitArgCpu(t);
+        EmitArg1Imm(t, op->pc);
+        EmitArg2Left(t, cycles + 4);
+        EmitSyncInstructions(t, count - 1);
+        EmitCallHelper(t, (const void *)JitTrap);
+        EmitReload(t);
+        EmitLeave(t, cycles + 4, count);
+        return;
+    }
+
+    if (opcode == 0xDB) {
+        /* IN, which sets PC itself */
+        EmitSpill(t);
+        EmitArgCpu(t);
+        EmitArg1Imm(t, op->pc);
+        EmitArg2Left(t, cycles + 10);
+        EmitSyncInstructions(t, count - 1);
+        EmitCallHelper(t, (const void *)JitIn);
+        EmitReload(t);
+        EmitLeave(t, cycles + 10, count);
+        return;
+    }
+
+    if (opcode == 0xD3) {
+        /* OUT; chains on unless the port set yield (a bank switch, see BankSelect()) */
+        EmitCold(t, op);
+        Emit8(t, 0x83);
+        EmitRbx(t, 7, OFF_YIELD);
+        Emit8(t, 0);
+        EMIT(t, 0x0F, 0x85);
+        Emit32(t, 0);
+        skip = t->pos - 4;
+        EmitExit(t, next, cycles + 10, count);
+        Patch32(skip, t->pos);
+        EmitLeave(t, cycles + 10, count);
+        return;
+    }
+
+    if (opcode == 0xFB) {
+        /* EI; chains on unless an interrupt is waiting for it, see Execute() */
+        Emit8(t, 0xC7);
+        EmitRbx(t, 0, OFF_INT);
+        Emit32(t, TRUE);
+        Emit8(t, 0x80);
+        EmitRbx(t, 7, OFF_PENDING);
+        Emit8(t, 0);
+        EMIT(t, 0x0F, 0x85);
+        Emit32(t, 0);
+        skip = t->pos - 4;
+        EmitExit(t, next, cycles + 4, count);
+        Patch32(skip, t->pos);
+        EMIT(t, 0x66, 0xC7);
+        EmitRbx(t, 0, OFF_PC);
+        Emit16(t, next);
+        EmitLeave(t, cycles + 4, count);
+        return;
+    }
+
+    if (opcode == 0x76) {
+        /* HLT */
+        EmitStop(t, next, cycles + 7, count);
+        return;
+    }
+
+    switch (opcode & 0xC7) {
+        case 0xC0: {    /* Rcc */
+            skip = EmitCondJump(t, cond, FALSE);
+            EmitPop(t);
+            EMIT(t, 0x0F, 0xB7, 0xC1);      /* movzx eax, cx */
+            EmitChain(t, cycles + 11, count);
+            Patch32(skip, t->pos);
+            EmitExit(t, next, cycles + 5, count);
+            return;
+        }
+
+        case 0xC2: {    /* Jcc */
+            EmitCondJump(t, cond, TRUE);
+            DeferExit(t, target, cycles + 10, count);
+            EmitExit(t, next, cycles + 10, count);
+            return;
+        }
+
+        case 0xC4: {    /* Ccc */
+            skip = EmitCondJump(t, cond, FALSE);
+            EMIT(t, 0x66, 0xB9);
+            Emit16(t, next);
+            EmitPush(t);
+            EmitExit(t, target, cycles + 17, count);
+            Patch32(skip, t->pos);
+            EmitExit(t, next, cycles + 11, count);
+            return;
+        }
+
+        case 0xC7: {    /* RST */
+            EMIT(t, 0x66, 0xB9);
+            Emit16(t, next);
+            EmitPush(t);
+            EmitExit(t, (uint16_t)(opcode & 0x38), cycles + 11, count);
+            return;
+        }
+
+        default: {
+            break;
+        }
+    }
+
+    switch (opcode) {
+        case 0xC3:      /* JMP */
+        case 0xCB: {
+            EmitExit(t, target, cycles + 10, count);
+            return;
+        }
+
+        case 0xCD:      /* CALL */
+        case 0xDD:
+        case 0xED:
+        case 0xFD: {
+            EMIT(t, 0x66, 0xB9);
+            Emit16(t, next);
+            EmitPush(t);
+            EmitExit(t, target, cycles + 17, count);
+            return;
+        }
+
+        case 0xC9:      /* RET */
+        case 0xD9: {
+            EmitPop(t);
+            EMIT(t, 0x0F, 0xB7, 0xC1);
+            EmitChain(t, cycles + 10, count);
+            return;
+        }
+
+        case 0xE9: {    /* PCHL */
+            LoadPair(t, EAX, RP_HL);
+            EmitChain(t, cycles + 5, count);
+            return;
+        }
+
+        default: {
+            return;
+        }
+    }
+}
+
+/* Out of line parts: the deferred exits and the slow path of every store check */
+static void EmitTail(Translator *t) {
+    for (int idx = 0; idx < t->exitCount; idx++) {
+        JitExit *exit = &t->exits[idx];
+
+        Patch32(exit->patch, t->pos);
+        EmitExit(t, exit->pc, exit->cycles, exit->instructions);
+    }
+
+    for (int idx = 0; idx < t->storeCount; idx++) {
+        JitStore *store = &t->stores[idx];
+
+        Patch32(store->patch, t->pos);
+
+        /* Save everything live and caller-saved; 32 bytes of shadow space for Win64 */
+        EMIT(t, 0x50, 0x51, 0x52, 0x56, 0x41, 0x50, 0x41, 0x51, 0x41, 0x52, 0x41, 0x53);
+        EMIT(t, 0x48, 0x83, 0xEC, 0x20);
+        EmitArgCpu(t);
+        EmitArg1Eax(t);
+        EmitArg2Imm(t, t->start);
+        EmitCallHelper(t, (const void *)JitCodeWritten);
+        EMIT(t, 0x48, 0x83, 0xC4, 0x20);
+        EMIT(t, 0x85, 0xC0);
+        EMIT(t, 0x41, 0x5B, 0x41, 0x5A, 0x41, 0x59, 0x41, 0x58, 0x5E, 0x5A, 0x59, 0x58);
+
+        EMIT(t, 0x0F, 0x84);
+        Emit32(t, 0);
+        Patch32(t->pos - 4, store->resume);
+
+        EMIT(t, 0x41, 0xBD);
+        Emit32(t, 1);
+        Emit8(t, 0xE9);
+        Emit32(t, 0);
+        Patch32(t->pos - 4, store->resume);
+    }
+}
+
+static JitBlock *Translate(JitCache *jit, Cpu8080 *cpu, uint16_t pc) {
+    const uint8_t *memory = cpu->memory;
+    JitOp ops[BLOCK_MAX_OPS];
+    int count = 0;
+    unsigned int maxCycles = 0;
+    uint16_t start = pc;
+    Translator translator;
+    Translator *t = &translator;
+
+    if (JIT_CODE_SIZE - jit->used < JIT_MAX_BLOCK_CODE) {
+        JitFlush(jit);
+    }
+
+    for (;;) {
+        JitOp *op = &ops[count++];
+        uint8_t opcode = memory[pc];
+
+        op->opcode = opcode;
+        op->pc = pc;
+        op->operand = 0;
+
+        if (opLength[opcode] == 2) {
+            op->operand = memory[(uint16_t)(pc + 1)];
+        } else if (opLength[opcode] == 3) {
+            op->operand = (uint16_t)(memory[(uint16_t)(pc + 1)] | (memory[(uint16_t)(pc + 2)] << 8));
+        }
+
+        pc = (uint16_t)(pc + opLength[opcode]);
+        op->nextPC = pc;
+        maxCycles += opMaxCycles[opcode];
+
+        if (EndsBlock(opcode) || count == BLOCK_MAX_OPS || BreakpointAt(cpu, pc)) {
+            break;
+        }
+    }
+
+    memset(t, 0, sizeof(*t));
+    t->jit = jit;
+    t->start = start;
+    t->pos = jit->buffer + jit->used;
+
+    /* r13d is the "this block was overwritten" flag, see EmitStore() */
+    const uint8_t *entry = t->pos;
+    EMIT(t, 0x45, 0x31, 0xED);
+
+    uint32_t cycles = 0;
+
+    for (int idx = 0; idx < count; idx++) {
+        const JitOp *op = &ops[idx];
+
+        if (EndsBlock(op->opcode)) {
+            EmitEnd(t, op, cycles, (uint32_t)(idx + 1));
+            break;
+        }
+
+        t->stored = FALSE;
+        EmitBody(t, op, FlagsDead(ops, count, idx));
+        cycles += opMaxCycles[op->opcode];
+
+        if (t->stored) {
+            /* This instruction overwrote the block itself, leave before the next one */
+            EMIT(t, 0x45, 0x85, 0xED, 0x0F, 0x85);
+            Emit32(t, 0);
+            DeferExit(t, op->nextPC, cycles, (uint32_t)(idx + 1));
+        }
+
+        if (idx == count - 1) {
+            EmitExit(t, op->nextPC, cycles, (uint32_t)count);
+        }
+    }
+
+    EmitTail(t);
+
+    JitBlock *blk = &jit->blocks[start];
+
+    blk->code = Runnable(jit, entry);
+    blk->size = (uint16_t)(pc - start);
+    blk->maxCycles = (uint16_t)maxCycles;
+
+    for (uint16_t idx = 0; idx < blk->size; idx++) {
+        jit->codeMap[(uint16_t)(start + idx)]++;
+    }
+
+    MarkCodePages(cpu, start, blk->size);
+    jit->stats.translated++;
+    jit->stats.codeBytes += (unsigned long long)(t->pos - (jit->buffer + jit->used));
+    jit->used = (size_t)(t->pos - jit->buffer);
+
+    return blk;
+}
+
+/*
+    The three stubs every block shares, at the start of the buffer so a flush
+    keeps them:
+
+    enter(cpu, budget, code) saves the callee-saved registers, sets up rbx,
+    r12, rbp = budget and r14/r15 = cycles/instructions run so far, loads
+    the guest registers and jumps to the block.
+
+    chain takes a guest address in eax, stores it as PC and jumps straight
+    to its translation when there is one and its worst case still fits in
+    the budget. Anything else goes to leave.
+
+    leave writes the guest registers back, adds r14/r15 to the counters and
+    returns to RunJit().
+*/
+static void EmitStubs(JitCache *jit) {
+    Translator translator;
+    Translator *t = &translator;
+
+    memset(t, 0, sizeof(*t));
+    t->jit = jit;
+    t->pos = jit->buffer;
+
+    jit->leave = t->pos;
+    EmitSpill(t);
+    EMIT(t, 0x4C, 0x01);
+    EmitRbx(t, 6, OFF_CYCLES);
+    EMIT(t, 0x4C, 0x01);
+    EmitRbx(t, 7, OFF_INSTR);
+    EMIT(t, 0x48, 0x83, 0xC4, 0x28);
+#ifdef _WIN32
+    /* rsi and rdi are callee-saved on Win64 */
+    EMIT(t, 0x5F, 0x5E);
+#endif
+    EMIT(t, 0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5D, 0x5B, 0xC3);
+
+    jit->enter = (JitEnter)(void *)Runnable(jit, t->pos);
+    EMIT(t, 0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57);
+#ifdef _WIN32
+    EMIT(t, 0x56, 0x57);
+#endif
+    EMIT(t, 0x48, 0x83, 0xEC, 0x28);
+#ifdef _WIN32
+    EMIT(t, 0x48, 0x89, 0xCB, 0x48, 0x89, 0xD5);
+#else
+    EMIT(t, 0x48, 0x89, 0xFB, 0x48, 0x89, 0xF5);
+#endif
+    EMIT(t, 0x49, 0xBC);
+    Emit64(t, (uint64_t)(uintptr_t)jit->codeMap);
+    EMIT(t, 0x45, 0x31, 0xF6, 0x45, 0x31, 0xFF);
+    EmitReload(t);
+#ifdef _WIN32
+    EMIT(t, 0x41, 0xFF, 0xE0);
+#else
+    EMIT(t, 0xFF, 0xE2);
+#endif
+
+    jit->chain = t->pos;
+    EMIT(t, 0x66, 0x89);
+    EmitRbx(t, EAX, OFF_PC);
+    /* rcx = &blocks[eax]; rdx = its code */
+    EMIT(t, 0x6B, 0xD0, (uint8_t)sizeof(JitBlock));
+    EMIT(t, 0x48, 0xB9);
+    Emit64(t, (uint64_t)(uintptr_t)jit->blocks);
+    EMIT(t, 0x48, 0x01, 0xD1);
+    EMIT(t, 0x48, 0x8B, 0x91);
+    Emit32(t, (uint32_t)offsetof(JitBlock, code));
+    EMIT(t, 0x48, 0x85, 0xD2, 0x0F, 0x84);
+    Emit32(t, 0);
+    Patch32(t->pos - 4, jit->leave);
+    /* r14 + maxCycles > budget: let RunJit() finish it */
+    EMIT(t, 0x0F, 0xB7, 0x89);
+    Emit32(t, (uint32_t)offsetof(JitBlock, maxCycles));
+    EMIT(t, 0x4C, 0x01, 0xF1, 0x48, 0x39, 0xE9, 0x0F, 0x87);
+    Emit32(t, 0);
+    Patch32(t->pos - 4, jit->leave);
+    EMIT(t, 0xFF, 0xE2);
+
+    jit->stubSize = (size_t)(t->pos - jit->buffer);
+    jit->used = jit->stubSize;
+}
+
+/*
+    The buffer is never writable and executable at once: the same memory is
+    mapped twice, buffer to write code into and exec to run it from, so
+    translating costs no protection changes (8080 programs that modify
+    themselves get retranslated tens of thousands of times a second).
+    Jumps inside the buffer are relative and come out the same in both
+    views; only enter and JitBlock.code point into exec, see Runnable().
+*/
+int JitCacheInit(JitCache *jit) {
+    memset(jit, 0, sizeof(*jit));
+
+#ifdef _WIN32
+    HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_EXECUTE_READWRITE, 0, JIT_CODE_SIZE, NULL);
+
+    if (!mapping) {
+        return -1;
+    }
+
+    jit->buffer = (uint8_t *)MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, JIT_CODE_SIZE);
+    jit->exec = (uint8_t *)MapViewOfFile(mapping, FILE_MAP_READ | FILE_MAP_EXECUTE, 0, 0, JIT_CODE_SIZE);
+
+    /* The views keep the mapping alive */
+    CloseHandle(mapping);
+#else
+#ifdef __linux__
+    int fd = memfd_create("jit", MFD_CLOEXEC);
+#else
+    char name[32];
+
+    snprintf(name, sizeof(name), "/8080jit.%ld", (long)getpid());
+
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+
+    if (fd >= 0) {
+        shm_unlink(name);
+    }
+#endif
+
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (ftruncate(fd, JIT_CODE_SIZE) == 0) {
+        jit->buffer = (uint8_t *)mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        jit->exec = (uint8_t *)mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+    }
+
+    close(fd);
+
+    if (jit->buffer == (uint8_t *)MAP_FAILED) {
+        jit->buffer = NULL;
+    }
+
+    if (jit->exec == (uint8_t *)MAP_FAILED) {
+        jit->exec = NULL;
+    }
+#endif
+
+    if (!jit->buffer || !jit->exec) {
+        JitCacheFree(jit);
+        return -1;
+    }
+
+    EmitStubs(jit);
+    return 0;
+}
+
+void JitCacheFree(JitCache *jit) {
+#ifdef _WIN32
+    if (jit->buffer) {
+        UnmapViewOfFile(jit->buffer);
+    }
+
+    if (jit->exec) {
+        UnmapViewOfFile(jit->exec);
+    }
+#else
+    if (jit->buffer) {
+        munmap(jit->buffer, JIT_CODE_SIZE);
+    }
+
+    if (jit->exec) {
+        munmap(jit->exec, JIT_CODE_SIZE);
+    }
+#endif
+
+    jit->buffer = NULL;
+    jit->exec = NULL;
+}
+
+/*
+    Drops every translation but keeps the stubs. Safe to call from inside a
+    block (a trap handler may): the code stays in the buffer until the next
+    translation overwrites it, and that only happens back in RunJit().
+*/
+void JitFlush(JitCache *jit) {
+    memset(jit->blocks, 0, sizeof(jit->blocks));
+    memset(jit->codeMap, 0, sizeof(jit->codeMap));
+    jit->used = jit->stubSize;
+    jit->stats.flushes++;
+}
+
+/*
+    Same stopping rule as RunBlocks(): the budget is checked between blocks,
+    and a block that might not fit in what is left is handed to Run(), which
+    stops on exactly the instruction it would have stopped on by itself,
+    one instruction at a time while breakpoints are on (RunBlocks() does
+    the same with single[]).
+    Blocks chain into each other in generated code, so this loop only runs
+    again on a miss, a halt, a trap or when the budget is nearly gone.
+    Translations load and store memory[] directly, so any other memory
+    map (ROM, handler pages, see MemMapRom()) is handed to RunBlocks(),
+    which passes it on to Run().
+*/
+unsigned long long RunJit(Cpu8080 *cpu, unsigned long long cycleBudget) {
+    JitCache *jit = cpu->jit;
+
+    if (!jit || !jit->buffer || !cpu->flatBus) {
+        return RunBlocks(cpu, cycleBudget);
+    }
+
+    cpu->yield = FALSE;
+
+    unsigned long long start = cpu->cycles;
+    unsigned long long entries = 0;
+    Bool breaks = (Bool)((cpu->stopMask & STOP_ON_BREAKPOINT) && cpu->breakCount);
+
+    while (!cpu->halted && !cpu->stopReason) {
+        unsigned long long done = cpu->cycles - start;
+
+        if (done >= cycleBudget) {
+            break;
+        }
+
+        /*
+            A trap handler or an OUT mapped memory or scheduled an event, or
+            an EI let a waiting interrupt in: back to Execute()
+        */
+        if (cpu->yield || (done && cpu->interruptPending && cpu->interruptsEnabled)) {
+            break;
+        }
+
+        /* Never translated from a breakpoint, so chaining can't run past one */
+        if (cpu->breakCount && BreakpointAt(cpu, cpu->PC)) {
+            if (breaks && done) {
+                cpu->stopReason = STOP_BREAKPOINT;
+                break;
+            }
+
+            Run(cpu, 1);
+            continue;
+        }
+
+        JitBlock *blk = &jit->blocks[cpu->PC];
+
+        if (!blk->code) {
+            blk = Translate(jit, cpu, cpu->PC);
+        }
+
+        /* Run() never looks at breakpoints, so with them on it only gets one instruction at a time */
+        if (cycleBudget - done < blk->maxCycles) {
+            if (breaks) {
+                Run(cpu, 1);
+                continue;
+            }
+
+            Run(cpu, cycleBudget - done);
+            break;
+        }
+
+        entries++;
+        jit->enter(cpu, cycleBudget - done, blk->code);
+    }
+
+    jit->stats.entries += entries;
+
+    return cpu->cycles - start;
+}
+
+#else
+
+int JitCacheInit(JitCache *jit) {
+    memset(jit, 0, sizeof(*jit));
+    return -1;
+}
+
+void JitCacheFree(JitCache *jit) {
+    (void)jit;
+}
+
+void JitFlush(JitCache *jit) {
+    (void)jit;
+}
+
+void JitInvalidate(JitCache *jit, uint16_t addr) {
+    (void)jit;
+    (void)addr;
+}
+
+unsigned long long RunJit(Cpu8080 *cpu, unsigned long long cycleBudget) {
+    return RunBlocks(cpu, cycleBudget);
+}
+
+#endif
+
+void JitPrintStats(const JitCache *jit) {
+    const JitStats *stats = &jit->stats;
+
+    printf("[jit] %llu entries from the dispatcher, %llu translated (%.1f KB code), %llu invalidated, %llu flushes\n",
+        stats->entries, stats->translated, (double)stats->codeBytes / 1024.0,
+        stats->invalidated, stats->flushes);
+}
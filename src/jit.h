@@ -0,0 +1,70 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "cpu.h"
+
+/*
+    Only x86-64 hosts get native code, everywhere else RunJit() is
+    RunBlocks(). So does the opcode histogram build, native code can't be
+    counted (see histogram.c).
+*/
+#if (defined(__x86_64__) || defined(_M_X64)) && !defined(RUN_OPCODE_PROFILE)
+#define JIT_AVAILABLE               1
+#endif
+
+#define JIT_CODE_SIZE               (8 * 1024 * 1024)
+
+/* Worst case host code for one block, a translation never starts with less left */
+#define JIT_MAX_BLOCK_CODE          (16 * 1024)
+
+/* Translations are not C functions, they are only reached through enter */
+typedef void (*JitEnter)(Cpu8080 *cpu, unsigned long long budget, const uint8_t *code);
+
+/*
+    One translated block, indexed by its guest start address. size is in
+    guest bytes (for invalidation), maxCycles is the same worst case the
+    block cache uses so the budget can be checked before entering.
+*/
+typedef struct {
+    const uint8_t *code;
+    uint16_t size;
+    uint16_t maxCycles;
+} JitBlock;
+
+typedef struct {
+    unsigned long long entries;
+    unsigned long long translated;
+    unsigned long long invalidated;
+    unsigned long long flushes;
+    unsigned long long codeBytes;
+} JitStats;
+
+/*
+    codeMap works like the block cache's: per guest byte, how many live
+    translations were made from it. The generated store sequence tests it
+    inline and only calls back into C when it is non-zero.
+*/
+struct JitCache {
+    uint8_t *buffer;
+    uint8_t *exec;
+    size_t used;
+    size_t stubSize;
+    JitEnter enter;
+    const uint8_t *leave;
+    const uint8_t *chain;
+    JitStats stats;
+    uint8_t codeMap[MEM_MAX];
+    JitBlock blocks[MEM_MAX];
+};
+
+int JitCacheInit(JitCache *jit);
+void JitCacheFree(JitCache *jit);
+void JitFlush(JitCache *jit);
+void JitInvalidate(JitCache *jit, uint16_t addr);
+void JitPrintStats(const JitCache *jit);
+
+unsigned long long RunJit(Cpu8080 *cpu, unsigned long long cycleBudget);
+
+#endif
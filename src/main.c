@@ -2,10 +2,44 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <time.h>
 #include "cpu.h"
 #include "bdos.h"
+#include "flags.h"
+#include "block.h"
+#include "jit.h"
+#include "idle.h"
+#include "bench.h"
+#include "bank.h"
+#include "event.h"
+#include "state.h"
+#include "replay.h"
+#include "timeline.h"
+#include "trace.h"
+#include "histogram.h"
+#include "symbols.h"
+#include "profile.h"
+#include "callgraph.h"
+#include "heatmap.h"
 
-int LoadProgram(const char* filename, uint16_t startAddr) {
+static const char *engineNames[] = {
+    "step",
+    "run",
+    "block",
+    "jit"
+};
+
+static const char *stopNames[] = {
+    "nothing",
+    "halt",
+    "budget",
+    "breakpoint",
+    "trap"
+};
+
+_Static_assert(sizeof(stopNames) / sizeof(stopNames[0]) == STOP_TRAP + 1, "one stop name per StopReason");
+
+int LoadProgram(Cpu8080 *cpu, const char* filename, uint16_t startAddr) {
     FILE* fp = fopen(filename, "rb");
     if (!fp) {
         return -1;
@@ -15,83 +49,348 @@ int LoadProgram(const char* filename, uint16_t startAddr) {
     long size = ftell(fp);
     fseek(fp, 0, SEEK_SET);
 
-    fread(&memory[startAddr], 1, (size_t)size, fp);
+    if (size > MEM_MAX - startAddr) {
+        size = MEM_MAX - startAddr;
+    }
+
+    fread(&cpu->memory[startAddr], 1, (size_t)size, fp);
     fclose(fp);
+
+    CodeRangeWritten(cpu, startAddr, (uint32_t)size);
     return 0;
 }
 
-/*
-    CP/M Warm Boot: 0xCD, jmp to addr
-    BDOS call: 0xCD, call 0x0005
-*/
-int Step(void) {
-    if (halted) {
+void PrintState(Cpu8080 *cpu) {
+    printf("\nPC=%04X SP=%04X\n", cpu->PC, cpu->SP);
+    printf("A=%02X B=%02X C=%02X D=%02X E=%02X H=%02X L=%02X\n",
+        cpu->registers[REG_A], cpu->registers[REG_B], cpu->registers[REG_C],
+        cpu->registers[REG_D], cpu->registers[REG_E],
+        cpu->registers[REG_H], cpu->registers[REG_L]);
+
+    printf("S=%d Z=%d A=%d P=%d C=%d\n",
+        IsFlagActive(cpu, FLAG_SIGN),
+        IsFlagActive(cpu, FLAG_ZERO),
+        IsFlagActive(cpu, FLAG_AUXILIARY_CARRY),
+        IsFlagActive(cpu, FLAG_PARITY),
+        IsFlagActive(cpu, FLAG_CARRY));
+
+    printf("HALT=%d INT=%d\n", cpu->halted, cpu->interruptsEnabled);
+}
+
+/* --histogram-csv and --histogram-json, 1 if filename is set but could not be written */
+int SaveHistogram(const OpcodeHistogram *histogram, const char *filename,
+    int (*write)(const OpcodeHistogram *histogram, FILE *file)) {
+    if (!filename) {
         return 0;
     }
 
-    uint16_t prevPC = PC;
-    uint8_t opcode = FetchByte();
+    FILE *fp = fopen(filename, "w");
+    int result = fp ? write(histogram, fp) : -1;
 
-    if (opcode == 0xCD) {
-        uint16_t addr = FetchWord();
+    if (fp && fclose(fp) != 0) {
+        result = -1;
+    }
 
-        if (addr == 0x0005) {
-            BDOS_Call();
-            return 17;
-        }
+    if (result < 0) {
+        fprintf(stderr, "Error: Could not write histogram %s\n", filename);
+    }
 
-        CALL(addr);
+    return result < 0;
+}
 
-        return 17;
+/* --heatmap-csv, --heatmap-image and --working-set-csv, the same */
+int SaveHeatmap(const Heatmap *heatmap, const char *filename, const char *mode,
+    int (*write)(const Heatmap *heatmap, FILE *file)) {
+    if (!filename) {
+        return 0;
     }
-    
-    if (opcode == 0xC3) {
-        uint16_t addr = FetchWord();
-    
-        if (addr == 0x0000) {
-            halted = TRUE;
-            return 10;
-        }
-    
-        JMP(addr);
-    
-        return 10;
+
+    FILE *fp = fopen(filename, mode);
+    int result = fp ? write(heatmap, fp) : -1;
+
+    if (fp && fclose(fp) != 0) {
+        result = -1;
     }
 
-    if (opcodeTable[opcode]) {
-        return opcodeTable[opcode]();
+    if (result < 0) {
+        fprintf(stderr, "Error: Could not write heatmap %s\n", filename);
     }
 
-    printf("Unknown opcode: 0x%02X at PC=0x%04X\n", opcode, prevPC);
-    
-    return 4;
+    return result < 0;
 }
 
-void PrintState(void) {
-    printf("\nPC=%04X SP=%04X\n", PC, SP);
-    printf("A=%02X B=%02X C=%02X D=%02X E=%02X H=%02X L=%02X\n",
-        registers[REG_A], registers[REG_B], registers[REG_C],
-        registers[REG_D], registers[REG_E],
-        registers[REG_H], registers[REG_L]);
+int main(int argc, char* argv[]) {
+    Engine engine = ENGINE_RUN;
+    Bool bench = FALSE;
+    Bool selfCheck = FALSE;
+    Bool microBench = FALSE;
+    Bool timerBench = FALSE;
+    Bool stateBench = FALSE;
+    Bool imageBench = FALSE;
+    unsigned long timerHz = 0;
+    unsigned long runs = 1;
+    unsigned long bankCount = 0;
+    unsigned long bankWindow = BANK_DEFAULT_WINDOW;
+    unsigned long bankPort = BANK_DEFAULT_PORT;
+    const char *replayFile = NULL;
+    ReplayMode replayMode = REPLAY_RECORD;
+    unsigned long rewindMB = 0;
+    unsigned long long rewindInterval = 0;
+    unsigned long long back = 0;
+    const char *traceFile = NULL;
+    const char *decodeFile = NULL;
+    Bool histogramReport = FALSE;
+    const char *histogramCsv = NULL;
+    const char *histogramJson = NULL;
+    const char *symbolsFile = NULL;
+    Bool profileReport = FALSE;
+    const char *profileFolded = NULL;
+    unsigned long long profileInterval = PROFILE_DEFAULT_INTERVAL;
+    const char *callGraphFile = NULL;
+    Bool heatmapReport = FALSE;
+    Bool heatmapBytes = FALSE;
+    const char *heatmapCsv = NULL;
+    const char *heatmapImage = NULL;
+    const char *workingSetCsv = NULL;
+    unsigned long long heatmapInterval = HEATMAP_DEFAULT_INTERVAL;
+    int argCount = 1;
 
-    printf("S=%d Z=%d A=%d P=%d C=%d\n",
-        IsFlagActive(FLAG_SIGN),
-        IsFlagActive(FLAG_ZERO),
-        IsFlagActive(FLAG_AUXILIARY_CARRY),
-        IsFlagActive(FLAG_PARITY),
-        IsFlagActive(FLAG_CARRY));
+    /* Options start with "--" and are taken out so the positional arguments below work as before */
+    for (int idx = 1; idx < argc; idx++) {
+        if (strncmp(argv[idx], "--", 2) != 0) {
+            argv[argCount++] = argv[idx];
+            continue;
+        }
 
-    printf("HALT=%d INT=%d\n", halted, interruptsEnabled);
-}
+        if (strcmp(argv[idx], "--engine=step") == 0) {
+            engine = ENGINE_STEP;
+        } else if (strcmp(argv[idx], "--engine=run") == 0) {
+            engine = ENGINE_RUN;
+        } else if (strcmp(argv[idx], "--engine=block") == 0) {
+            engine = ENGINE_BLOCK;
+        } else if (strcmp(argv[idx], "--engine=jit") == 0) {
+            engine = ENGINE_JIT;
+        } else if (strcmp(argv[idx], "--bench") == 0) {
+            bench = TRUE;
+        } else if (strcmp(argv[idx], "--selfcheck") == 0) {
+            selfCheck = TRUE;
+        } else if (strcmp(argv[idx], "--microbench") == 0) {
+            microBench = TRUE;
+        } else if (strcmp(argv[idx], "--timerbench") == 0) {
+            timerBench = TRUE;
+        } else if (strcmp(argv[idx], "--statebench") == 0) {
+            stateBench = TRUE;
+        } else if (strcmp(argv[idx], "--imagebench") == 0) {
+            imageBench = TRUE;
+        } else if (strncmp(argv[idx], "--runs=", 7) == 0) {
+            runs = strtoul(argv[idx] + 7, NULL, 0);
+            runs = runs ? runs : 1;
+        } else if (strncmp(argv[idx], "--record=", 9) == 0) {
+            replayFile = argv[idx] + 9;
+            replayMode = REPLAY_RECORD;
+        } else if (strncmp(argv[idx], "--replay=", 9) == 0) {
+            replayFile = argv[idx] + 9;
+            replayMode = REPLAY_PLAY;
+        } else if (strncmp(argv[idx], "--rewind=", 9) == 0) {
+            rewindMB = strtoul(argv[idx] + 9, NULL, 0);
+        } else if (strncmp(argv[idx], "--rewind-interval=", 18) == 0) {
+            rewindInterval = strtoull(argv[idx] + 18, NULL, 0);
+        } else if (strncmp(argv[idx], "--back=", 7) == 0) {
+            back = strtoull(argv[idx] + 7, NULL, 0);
+        } else if (strncmp(argv[idx], "--trace=", 8) == 0) {
+            traceFile = argv[idx] + 8;
+        } else if (strncmp(argv[idx], "--trace-decode=", 15) == 0) {
+            decodeFile = argv[idx] + 15;
+        } else if (strcmp(argv[idx], "--histogram") == 0) {
+            histogramReport = TRUE;
+        } else if (strncmp(argv[idx], "--histogram-csv=", 16) == 0) {
+            histogramCsv = argv[idx] + 16;
+        } else if (strncmp(argv[idx], "--histogram-json=", 17) == 0) {
+            histogramJson = argv[idx] + 17;
+        } else if (strncmp(argv[idx], "--symbols=", 10) == 0) {
+            symbolsFile = argv[idx] + 10;
+        } else if (strcmp(argv[idx], "--profile") == 0) {
+            profileReport = TRUE;
+        } else if (strncmp(argv[idx], "--profile-folded=", 17) == 0) {
+            profileFolded = argv[idx] + 17;
+        } else if (strncmp(argv[idx], "--profile-interval=", 19) == 0) {
+            profileInterval = strtoull(argv[idx] + 19, NULL, 0);
+        } else if (strncmp(argv[idx], "--callgraph=", 12) == 0) {
+            callGraphFile = argv[idx] + 12;
+        } else if (strcmp(argv[idx], "--heatmap") == 0) {
+            heatmapReport = TRUE;
+        } else if (strcmp(argv[idx], "--heatmap-bytes") == 0) {
+            heatmapBytes = TRUE;
+        } else if (strncmp(argv[idx], "--heatmap-csv=", 14) == 0) {
+            heatmapCsv = argv[idx] + 14;
+        } else if (strncmp(argv[idx], "--heatmap-image=", 16) == 0) {
+            heatmapImage = argv[idx] + 16;
+        } else if (strncmp(argv[idx], "--working-set-csv=", 18) == 0) {
+            workingSetCsv = argv[idx] + 18;
+        } else if (strncmp(argv[idx], "--heatmap-interval=", 19) == 0) {
+            heatmapInterval = strtoull(argv[idx] + 19, NULL, 0);
+        } else if (strncmp(argv[idx], "--timer=", 8) == 0) {
+            timerHz = strtoul(argv[idx] + 8, NULL, 0);
+        } else if (strncmp(argv[idx], "--banks=", 8) == 0) {
+            bankCount = strtoul(argv[idx] + 8, NULL, 0);
+        } else if (strncmp(argv[idx], "--bank-window=", 14) == 0) {
+            bankWindow = strtoul(argv[idx] + 14, NULL, 0) << 10;
+        } else if (strncmp(argv[idx], "--bank-port=", 12) == 0) {
+            bankPort = strtoul(argv[idx] + 12, NULL, 0);
+        } else {
+            fprintf(stderr, "Error: Unknown option %s\n", argv[idx]);
+            return 1;
+        }
+    }
+
+    argc = argCount;
+
+    if (selfCheck) {
+        OpInit();
+        int failed = FlagTableSelfCheck() != 0;
+        failed |= SmcSelfCheck() != 0;
+        failed |= IdleSelfCheck() != 0;
+        failed |= ExecuteSelfCheck() != 0;
+        failed |= BusSelfCheck() != 0;
+        failed |= BankSelfCheck() != 0;
+        failed |= InterruptSelfCheck() != 0;
+        failed |= ResetSelfCheck() != 0;
+        failed |= ReplaySelfCheck() != 0;
+        failed |= TimelineSelfCheck() != 0;
+        failed |= TraceSelfCheck() != 0;
+        failed |= HistogramSelfCheck() != 0;
+        failed |= ProfilerSelfCheck() != 0;
+        failed |= CallGraphSelfCheck() != 0;
+        failed |= HeatmapSelfCheck() != 0;
+        return failed;
+    }
+
+    if (decodeFile) {
+        FILE *in = fopen(decodeFile, "rb");
+        int result = in ? TraceDecode(in, stdout) : -1;
+
+        if (result < 0) {
+            fprintf(stderr, "Error: %s is not a trace or is cut short\n", decodeFile);
+        }
+
+        if (in) {
+            fclose(in);
+        }
+
+        return result < 0;
+    }
+
+    if (microBench) {
+        OpInit();
+        return MicroBench() != 0;
+    }
+
+    if (timerBench) {
+        OpInit();
+        return TimerBench() != 0;
+    }
+
+    if (stateBench) {
+        OpInit();
+        return StateBench() != 0;
+    }
+
+    if (imageBench) {
+        OpInit();
+        return ImageBench() != 0;
+    }
 
-int main(int argc, char* argv[]) {
     if (argc < 2) {
-        printf("Usage: %s program.bin [max_instructions]\n", argv[0]);
+        printf("Usage: %s [--engine=step|run|block|jit] [--banks=N [--bank-window=4|16] [--bank-port=P]] [--timer=HZ] [--runs=N] [--record=LOG|--replay=LOG] [--rewind=MB [--rewind-interval=N] [--back=N]] [--trace=FILE] [--trace-decode=FILE] [--histogram] [--histogram-csv=FILE] [--histogram-json=FILE] [--symbols=FILE] [--profile] [--profile-folded=FILE] [--profile-interval=N] [--callgraph=FILE] [--heatmap] [--heatmap-bytes] [--heatmap-csv=FILE] [--heatmap-image=FILE] [--working-set-csv=FILE] [--heatmap-interval=N] [--bench] [--microbench] [--timerbench] [--statebench] [--imagebench] [--selfcheck] program.bin [max_instructions]\n", argv[0]);
+        return 1;
+    }
+
+    /* Only the instrumented dispatch counts, see histogram.c */
+    Bool histogramWanted = (Bool)(histogramReport || histogramCsv || histogramJson);
+
+    if (histogramWanted && !HistogramAvailable()) {
+        fprintf(stderr, "Error: --histogram needs a build configured with -DEMU_OPCODE_PROFILE=ON\n");
+        return 1;
+    }
+
+    /* Only the instrumented bus counts, see heatmap.c */
+    Bool heatmapWanted = (Bool)(heatmapReport || heatmapCsv || heatmapImage || workingSetCsv);
+
+    if (heatmapWanted && !HeatmapAvailable()) {
+        fprintf(stderr, "Error: --heatmap needs a build configured with -DEMU_MEMORY_HEATMAP=ON\n");
         return 1;
     }
 
     OpInit();
-    BDOS_Init();
+
+    Cpu8080 *cpu = (Cpu8080 *)malloc(sizeof(Cpu8080));
+    BdosState *bdos = (BdosState *)malloc(sizeof(BdosState));
+
+    if (!cpu || !bdos) {
+        fprintf(stderr, "Error: Could not allocate machine state\n");
+        return 1;
+    }
+
+    CpuInit(cpu);
+    BDOS_Init(bdos);
+    cpu->bdos = bdos;
+
+    /* The low 48K switched in bankWindow windows, the top 16K common */
+    BankedMemory bank;
+
+    memset(&bank, 0, sizeof(bank));
+
+    if (bankCount) {
+        if (bankWindow == 0 || bankPort >= NUM_IO_PORTS ||
+            BankInit(&bank, (uint32_t)bankWindow, (uint32_t)(BANK_DEFAULT_BANKED / bankWindow),
+                (uint32_t)bankCount, (uint8_t)bankPort) < 0) {
+            fprintf(stderr, "Error: Could not set up %lu banks of %luK windows\n", bankCount, bankWindow >> 10);
+            return 1;
+        }
+
+        BankAttach(cpu, &bank);
+    }
+
+    /* RST 7 timerHz times a second of guest time at CPU_CLOCK_HZ */
+    Timer timer;
+
+    if (timerHz) {
+        TimerStart(cpu, &timer, CPU_CLOCK_HZ / timerHz, 7);
+    }
+
+    if (engine == ENGINE_BLOCK) {
+        cpu->blocks = (BlockCache *)malloc(sizeof(BlockCache));
+
+        if (!cpu->blocks) {
+            fprintf(stderr, "Error: Could not allocate block cache\n");
+            return 1;
+        }
+
+        BlockCacheInit(cpu->blocks);
+    }
+
+    if (engine == ENGINE_JIT) {
+        cpu->jit = (JitCache *)malloc(sizeof(JitCache));
+
+        if (!cpu->jit) {
+            fprintf(stderr, "Error: Could not allocate JIT cache\n");
+            return 1;
+        }
+
+        if (JitCacheInit(cpu->jit) < 0) {
+            fprintf(stderr, "Warning: No JIT on this host or in this build, using the block cache\n");
+            free(cpu->jit);
+            cpu->jit = NULL;
+            cpu->blocks = (BlockCache *)malloc(sizeof(BlockCache));
+
+            if (!cpu->blocks) {
+                fprintf(stderr, "Error: Could not allocate block cache\n");
+                return 1;
+            }
+
+            BlockCacheInit(cpu->blocks);
+        }
+    }
 
     uint16_t startAddr = 0x0000;
     char *dotExt = strrchr(argv[1], '.');
@@ -100,19 +399,17 @@ int main(int argc, char* argv[]) {
         startAddr = 0x0100;
     }
 
-    if (LoadProgram(argv[1], startAddr) < 0) {
+    if (LoadProgram(cpu, argv[1], startAddr) < 0) {
         fprintf(stderr, "Error: Could not load program %s\n", argv[1]);
         return 1;
     }
 
-    /* Set up CP/M environment */
-    memory[0x0000] = 0xC3;
-    memory[0x0001] = 0x00;
-    memory[0x0002] = 0x00;
-    memory[0x0005] = 0xC9;
-    
-    PC = startAddr;
-    SP = 0xF000;
+    /* Set up CP/M environment: warm boot and the BDOS entry are host traps */
+    TrapRegister(cpu, 0x0000, BDOS_WarmBoot, NULL);
+    TrapRegister(cpu, BDOS_CALL_ADDR, BDOS_Entry, BDOS_IsPoll);
+
+    cpu->PC = startAddr;
+    cpu->SP = 0xF000;
 
     /* Believe me, I had to take help from AI */
     if (argc >= 2) {
@@ -124,10 +421,10 @@ int main(int argc, char* argv[]) {
         }
         
         uint8_t len = (uint8_t)strlen(cmdTail);
-        memory[0x0080] = len;
+        cpu->memory[0x0080] = len;
         
         for (int idx = 0; idx < len; idx++) {
-            memory[0x0081 + idx] = (uint8_t)cmdTail[idx];
+            cpu->memory[0x0081 + idx] = (uint8_t)cmdTail[idx];
         }
 
         char *arg = (argc >= 3) ? argv[2] : argv[1];
@@ -146,10 +443,10 @@ int main(int argc, char* argv[]) {
             nameLen = 8;
         }
         
-        memset(&memory[0x005D], ' ', 11);
+        memset(&cpu->memory[0x005D], ' ', 11);
         
         for (int idx = 0; idx < nameLen; idx++) {
-            memory[0x005D + idx] = (uint8_t)toupper(filename[idx]);
+            cpu->memory[0x005D + idx] = (uint8_t)toupper(filename[idx]);
         }
         
         if (dot) {
@@ -161,7 +458,7 @@ int main(int argc, char* argv[]) {
             }
             
             for (int idx = 0; idx < extLen; idx++) {
-                memory[0x0065 + idx] = (uint8_t)toupper(ext[idx]);
+                cpu->memory[0x0065 + idx] = (uint8_t)toupper(ext[idx]);
             }
         }
     }
@@ -174,21 +471,340 @@ int main(int argc, char* argv[]) {
         max_instructions = strtoul(argv[3], NULL, 0);
     }
 
-    /* Needed this to test 8080EXER.COM and 8080EXM.COM */
-    if (max_instructions == 0) {
-        while (!halted) {
-            cycles += (unsigned long long)Step();
-            instr++;
+    /* --runs: every run after the first starts from the machine as it is now */
+    ResetImage *image = NULL;
+
+    if (runs > 1) {
+        image = (ResetImage *)malloc(sizeof(ResetImage));
+
+        if (!image) {
+            fprintf(stderr, "Error: Could not allocate reset image\n");
+            return 1;
+        }
+
+        ResetCapture(cpu, image);
+    }
+
+    /* A log covers one run from the machine as it is now */
+    Replay replay;
+    FILE *replayLog = NULL;
+
+    if (replayFile) {
+        if (runs > 1) {
+            fprintf(stderr, "Error: --record and --replay cover a single run, not --runs\n");
+            return 1;
+        }
+
+        replayLog = fopen(replayFile, replayMode == REPLAY_RECORD ? "wb" : "rb");
+
+        if (!replayLog || ReplayStart(cpu, &replay, replayLog, replayMode) < 0) {
+            fprintf(stderr, "Error: Could not open input log %s\n", replayFile);
+            return 1;
+        }
+    }
+
+    /* --rewind: checkpoints and an input log of its own, so --back can go into the run */
+    Timeline timeline;
+
+    if (rewindMB) {
+        if (runs > 1 || replayFile) {
+            fprintf(stderr, "Error: --rewind covers a single run and keeps its own input log, not --runs, --record or --replay\n");
+            return 1;
+        }
+
+        if (TimelineInit(&timeline, cpu, (size_t)rewindMB << 20, rewindInterval) < 0) {
+            fprintf(stderr, "Error: Could not set up --rewind in %lu MB (at least %lu, and no --banks)\n",
+                rewindMB, TIMELINE_MIN_BUDGET >> 20);
+            return 1;
+        }
+    }
+
+    /* --trace: every instruction from here, decoded by --trace-decode */
+    Trace trace;
+    FILE *traceOut = NULL;
+
+    if (traceFile) {
+        traceOut = fopen(traceFile, "wb");
+
+        if (!traceOut || TraceStart(cpu, &trace, traceOut) < 0) {
+            fprintf(stderr, "Error: Could not start trace %s\n", traceFile);
+            return 1;
+        }
+    }
+
+    /* --histogram: counted from here to the end of the run */
+    OpcodeHistogram *histogram = NULL;
+
+    if (histogramWanted) {
+        histogram = (OpcodeHistogram *)malloc(sizeof(OpcodeHistogram));
+
+        if (!histogram) {
+            fprintf(stderr, "Error: Could not allocate the opcode histogram\n");
+            return 1;
+        }
+
+        HistogramClear(histogram);
+        cpu->histogram = histogram;
+    }
+
+    /* --profile: sampled from here to the end of the run, every run of --runs */
+    SymbolTable symbols;
+    Profiler profiler;
+    Bool profiling = (Bool)(profileReport || profileFolded);
+
+    SymbolsInit(&symbols);
+
+    if (symbolsFile && SymbolsLoad(&symbols, symbolsFile) < 0) {
+        fprintf(stderr, "Error: Could not read symbols from %s\n", symbolsFile);
+        return 1;
+    }
+
+    if (profiling && (ProfilerInit(&profiler, &symbols, profileInterval) < 0 || ProfilerStart(cpu, &profiler) < 0)) {
+        fprintf(stderr, "Error: Could not start the profiler\n");
+        return 1;
+    }
+
+    /* --callgraph: every CALL and RET from here, every run of --runs */
+    CallGraph *callGraph = NULL;
+
+    if (callGraphFile) {
+        callGraph = (CallGraph *)malloc(sizeof(CallGraph));
+
+        if (!callGraph || CallGraphInit(callGraph, &symbols) < 0) {
+            fprintf(stderr, "Error: Could not allocate the call graph\n");
+            return 1;
+        }
+
+        CallGraphStart(cpu, callGraph);
+    }
+
+    /* --heatmap: every access from here, every run of --runs; the image wants them by byte */
+    Heatmap *heatmap = NULL;
+
+    if (heatmapWanted) {
+        heatmap = (Heatmap *)malloc(sizeof(Heatmap));
+
+        if (!heatmap || HeatmapInit(heatmap, (Bool)(heatmapBytes || heatmapImage), heatmapInterval) < 0 ||
+            HeatmapStart(cpu, heatmap) < 0) {
+            fprintf(stderr, "Error: Could not start the heatmap\n");
+            return 1;
         }
-    } else {
-        while (!halted && instr < max_instructions) {
-            cycles += (unsigned long long)Step();
-            instr++;
+    }
+
+    clock_t startClock = clock();
+    StopReason reason = STOP_NONE;
+    unsigned long long totalInstr = 0;
+    unsigned long long restored = 0;
+
+    cpu->engine = engine;
+
+    for (unsigned long run = 0; run < runs; run++) {
+        if (run > 0) {
+            /* The last run's frames close at its own counts, the next run starts with nothing on the stack */
+            CallGraphStop(cpu);
+
+            /* And the last working set sample ends with it */
+            if (heatmap) {
+                HeatmapStop(cpu, heatmap);
+            }
+
+            restored += ResetRestore(cpu, image);
+
+            /* The counts start over, so the timer's next tick has to as well */
+            if (timerHz) {
+                TimerStop(cpu, &timer);
+                TimerStart(cpu, &timer, CPU_CLOCK_HZ / timerHz, 7);
+            }
+
+            if (profiling) {
+                ProfilerStop(cpu, &profiler);
+                ProfilerStart(cpu, &profiler);
+            }
+
+            if (callGraph) {
+                CallGraphStart(cpu, callGraph);
+            }
+
+            if (heatmap) {
+                HeatmapStart(cpu, heatmap);
+            }
         }
+
+        /* 0 runs until the program halts, needed this to test 8080EXER.COM and 8080EXM.COM */
+        reason = rewindMB ? TimelineRun(&timeline, cpu, max_instructions, 0) : Execute(cpu, 0, max_instructions, 0);
+        totalInstr += cpu->instructions;
     }
 
+    cycles = cpu->cycles;
+    instr = (unsigned long)cpu->instructions;
+
     printf("\nHALTED after %lu instructions (%llu cycles)\n", instr, cycles);
-    PrintState();
+    PrintState(cpu);
+
+    int status = 0;
+
+    /* Before --back, which would trace, count and sample the instructions it runs again */
+    cpu->histogram = NULL;
+
+    if (profiling) {
+        ProfilerStop(cpu, &profiler);
+    }
+
+    CallGraphStop(cpu);
+
+    if (heatmap) {
+        HeatmapStop(cpu, heatmap);
+    }
+
+    if (traceOut) {
+        if (TraceFinish(cpu) < 0) {
+            fprintf(stderr, "Error: Could not write all of trace %s\n", traceFile);
+            status = 1;
+        }
+
+        fclose(traceOut);
+    }
+
+    /* --back: the state that many instructions before the end, or as far back as the timeline goes */
+    if (rewindMB && back) {
+        unsigned long long target = cpu->instructions > back ? cpu->instructions - back : 0;
+
+        if (target < TimelineOldest(&timeline)) {
+            target = TimelineOldest(&timeline);
+        }
+
+        TimelineSeek(&timeline, cpu, target);
+        printf("\nBACK to instruction %llu (%llu cycles)\n", cpu->instructions, cpu->cycles);
+        PrintState(cpu);
+    }
+
+    /* Only --record and --replay are finished: the timeline's log goes with it */
+    if (replayLog) {
+        status |= ReplayFinish(cpu) < 0;
+        fclose(replayLog);
+        ReplayPrintStats(&replay);
+    }
+
+    if (bench) {
+        double seconds = (double)(clock() - startClock) / CLOCKS_PER_SEC;
+
+        printf("[bench] engine=%s %llu instructions in %.3f s (%.1f MIPS), stopped on %s\n",
+            engineNames[engine], totalInstr, seconds, seconds > 0 ? (double)totalInstr / seconds / 1e6 : 0.0,
+            stopNames[reason]);
+
+        if (image) {
+            printf("[reset] %lu runs, %.1f of %d pages copied back per reset\n",
+                runs, (double)restored / (double)(runs - 1), MEM_PAGE_COUNT);
+        }
+
+        if (cpu->blocks) {
+            BlockPrintStats(cpu->blocks);
+        }
+
+        if (cpu->jit) {
+            JitPrintStats(cpu->jit);
+        }
+
+        if (engine != ENGINE_STEP) {
+            IdlePrintStats(cpu);
+        }
+
+        if (cpu->bank) {
+            BankPrintStats(cpu->bank);
+        }
+
+        if (timerHz) {
+            EventPrintStats(cpu);
+        }
+
+        if (rewindMB) {
+            TimelinePrintStats(&timeline);
+        }
+
+        if (traceOut) {
+            TracePrintStats(&trace);
+        }
+    }
+
+    if (histogramReport) {
+        HistogramPrint(histogram);
+    }
+
+    status |= SaveHistogram(histogram, histogramCsv, HistogramWriteCsv);
+    status |= SaveHistogram(histogram, histogramJson, HistogramWriteJson);
+    free(histogram);
+
+    if (profileReport) {
+        ProfilerPrint(&profiler);
+    }
+
+    if (profileFolded) {
+        FILE *fp = fopen(profileFolded, "w");
+        int result = fp ? ProfilerWriteFolded(&profiler, fp) : -1;
+
+        if (fp && fclose(fp) != 0) {
+            result = -1;
+        }
+
+        if (result < 0) {
+            fprintf(stderr, "Error: Could not write profile %s\n", profileFolded);
+            status = 1;
+        }
+    }
+
+    if (profiling) {
+        ProfilerFree(&profiler);
+    }
+
+    if (callGraph) {
+        FILE *fp = fopen(callGraphFile, "w");
+        int result = fp ? CallGraphWrite(callGraph, fp) : -1;
+
+        if (fp && fclose(fp) != 0) {
+            result = -1;
+        }
+
+        if (result < 0) {
+            fprintf(stderr, "Error: Could not write call graph %s\n", callGraphFile);
+            status = 1;
+        }
+
+        CallGraphPrint(callGraph);
+        CallGraphFree(callGraph);
+        free(callGraph);
+    }
+
+    if (heatmap) {
+        status |= SaveHeatmap(heatmap, heatmapCsv, "w", HeatmapWriteCsv);
+        status |= SaveHeatmap(heatmap, heatmapImage, "wb", HeatmapWriteImage);
+        status |= SaveHeatmap(heatmap, workingSetCsv, "w", HeatmapWriteWorkingSet);
+
+        if (heatmapReport) {
+            HeatmapPrint(heatmap);
+        }
+
+        HeatmapFree(heatmap);
+        free(heatmap);
+    }
+
+    SymbolsFree(&symbols);
+
+    if (rewindMB) {
+        TimelineFree(&timeline, cpu);
+    }
+
+    BDOS_Shutdown(bdos);
+    free(bdos);
+    free(image);
+    free(cpu->blocks);
+    BankFree(&bank);
+
+    if (cpu->jit) {
+        JitCacheFree(cpu->jit);
+        free(cpu->jit);
+    }
+
+    free(cpu);
     
-    return 0;
+    return status;
 }
\ No newline at end of file
@@ -0,0 +1,378 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "event.h"
+#include "profile.h"
+
+/*
+    Guest profiler. An event every interval cycles looks at where the
+    machine is: the cycles and instructions run since the last sample are
+    put down to the PC it finds, and the call stack it was reached through
+    to the same cycles. Events stop every engine, the JIT included, at the
+    first instruction boundary at or past their time, so all of them sample
+    the same PCs. The samples are observer events: they never keep a HLT
+    from ending Execute().
+
+    The call stack is the shadow stack of the call graph attached to the
+    machine (see callgraph.c), kept by CALL, RST, RET and interrupts: the
+    host's if it has one, else the profiler attaches its own. So while
+    sampling every engine runs as Step(). A frame is the location of its
+    call site, the top one where PC is, so an interrupt handler shows up on
+    top of whatever it interrupted. Frames whose return address SP has
+    gone past without a RET (popped, or left by SPHL) are not counted even
+    before the next CALL or RET closes them; ones deeper than
+    PROFILE_MAX_DEPTH lose their outermost frames.
+
+    Frames are locations: the symbol an address is at or after, or with no
+    symbol below it the 64 byte range around it. A location id is the
+    symbol's index, or for a range the symbol count plus addr >> 6.
+*/
+
+static uint32_t SymbolCount(const Profiler *profiler) {
+    return profiler->symbols ? (uint32_t)profiler->symbols->count : 0;
+}
+
+static uint32_t Location(const Profiler *profiler, uint16_t addr) {
+    const Symbol *symbol = profiler->symbols ? SymbolFind(profiler->symbols, addr) : NULL;
+
+    return symbol ? (uint32_t)(symbol - profiler->symbols->symbols) : SymbolCount(profiler) + (addr >> PROFILE_RANGE_SHIFT);
+}
+
+/* The symbol's name, or "0100-013F" for a range */
+static uint16_t LocationName(const Profiler *profiler, uint32_t id, char *text, size_t size) {
+    uint16_t addr;
+
+    if (id < SymbolCount(profiler)) {
+        snprintf(text, size, "%s", profiler->symbols->symbols[id].name);
+        return profiler->symbols->symbols[id].addr;
+    }
+
+    addr = (uint16_t)((id - SymbolCount(profiler)) << PROFILE_RANGE_SHIFT);
+    snprintf(text, size, "%04X-%04X", addr, addr + (1u << PROFILE_RANGE_SHIFT) - 1);
+
+    return addr;
+}
+
+/* The frames PC was reached through, outermost first, PC's own last. Returns how many. */
+static int Unwind(const Cpu8080 *cpu, const Profiler *profiler, uint32_t *frames) {
+    const CallGraph *graph = cpu->callGraph;
+    uint32_t top = cpu->SP ? cpu->SP : 0x10000u;
+    int depth = graph ? graph->depth : 0;
+    int found = 0;
+
+    /* The first frame is the code the graph started at and has no call site */
+    while (depth > 1 && graph->frames[depth - 1].slot < top) {
+        depth--;
+    }
+
+    for (int idx = depth > PROFILE_MAX_DEPTH ? depth - (PROFILE_MAX_DEPTH - 1) : 1; idx < depth; idx++) {
+        frames[found++] = Location(profiler, graph->frames[idx].site);
+    }
+
+    frames[found] = Location(profiler, cpu->PC);
+    return found + 1;
+}
+
+/* FNV-1a over the frames */
+static uint32_t StackHash(const uint32_t *frames, int depth) {
+    uint32_t hash = 2166136261u;
+
+    for (int idx = 0; idx < depth; idx++) {
+        hash = (hash ^ frames[idx]) * 16777619u;
+    }
+
+    return hash;
+}
+
+static ProfileStack *StackSlot(ProfileStack *stacks, int capacity, uint32_t hash, const uint32_t *frames, int depth) {
+    int idx = (int)(hash & (uint32_t)(capacity - 1));
+
+    while (stacks[idx].depth && (stacks[idx].hash != hash || stacks[idx].depth != depth ||
+        memcmp(stacks[idx].frames, frames, (size_t)depth * sizeof(frames[0])) != 0)) {
+        idx = (idx + 1) & (capacity - 1);
+    }
+
+    return &stacks[idx];
+}
+
+static int GrowStacks(Profiler *profiler) {
+    int capacity = profiler->stackCapacity * 2;
+    ProfileStack *stacks = (ProfileStack *)calloc((size_t)capacity, sizeof(ProfileStack));
+
+    if (!stacks) {
+        return -1;
+    }
+
+    for (int idx = 0; idx < profiler->stackCapacity; idx++) {
+        const ProfileStack *stack = &profiler->stacks[idx];
+
+        if (stack->depth) {
+            *StackSlot(stacks, capacity, stack->hash, stack->frames, stack->depth) = *stack;
+        }
+    }
+
+    free(profiler->stacks);
+    profiler->stacks = stacks;
+    profiler->stackCapacity = capacity;
+
+    return 0;
+}
+
+/* -1 if the table is full and can't grow */
+static int AddStack(Profiler *profiler, const uint32_t *frames, int depth, unsigned long long cycles) {
+    uint32_t hash = StackHash(frames, depth);
+    ProfileStack *stack;
+
+    /* Kept at most 3/4 full; short of memory it fills up to one free slot */
+    if (profiler->stackCount * 4 >= profiler->stackCapacity * 3 && GrowStacks(profiler) < 0 &&
+        profiler->stackCount + 1 >= profiler->stackCapacity) {
+        return -1;
+    }
+
+    stack = StackSlot(profiler->stacks, profiler->stackCapacity, hash, frames, depth);
+
+    if (!stack->depth) {
+        stack->hash = hash;
+        stack->depth = depth;
+        memcpy(stack->frames, frames, (size_t)depth * sizeof(frames[0]));
+        profiler->stackCount++;
+    }
+
+    stack->samples++;
+    stack->cycles += cycles;
+
+    return 0;
+}
+
+static void ProfilerSample(Cpu8080 *cpu, unsigned long long when, void *context) {
+    Profiler *profiler = (Profiler *)context;
+    ProfileCount *count = &profiler->counts[cpu->PC];
+    unsigned long long cycles = cpu->cycles - profiler->lastCycles;
+    unsigned long long instructions = cpu->instructions - profiler->lastInstructions;
+    unsigned long long next = when + profiler->interval;
+    uint32_t frames[PROFILE_MAX_DEPTH];
+    int depth;
+
+    /* A stopped profiler's sample, put back by TimelineSeek() with the rest of the queue */
+    if (!profiler->running) {
+        return;
+    }
+
+    depth = Unwind(cpu, profiler, frames);
+
+    count->samples++;
+    count->cycles += cycles;
+    count->instructions += instructions;
+    profiler->samples++;
+    profiler->cycles += cycles;
+    profiler->instructions += instructions;
+
+    if (AddStack(profiler, frames, depth, cycles) < 0) {
+        profiler->lostStacks++;
+    }
+
+    profiler->lastCycles = cpu->cycles;
+    profiler->lastInstructions = cpu->instructions;
+
+    /* A HLT can pass several intervals at once, the one sample stands for all of them */
+    if (next <= cpu->cycles) {
+        next = cpu->cycles + profiler->interval;
+    }
+
+    profiler->id = EventScheduleObserver(cpu, next, ProfilerSample, profiler);
+}
+
+/* symbols may be NULL or empty, then everything goes by range. -1 with no memory left. */
+int ProfilerInit(Profiler *profiler, const SymbolTable *symbols, unsigned long long interval) {
+    memset(profiler, 0, sizeof(*profiler));
+    profiler->symbols = symbols;
+    profiler->interval = interval ? interval : 1;
+    profiler->id = -1;
+    profiler->stackCapacity = 1024;
+    profiler->counts = (ProfileCount *)calloc(0x10000, sizeof(ProfileCount));
+    profiler->stacks = (ProfileStack *)calloc((size_t)profiler->stackCapacity, sizeof(ProfileStack));
+    profiler->graph = (CallGraph *)calloc(1, sizeof(CallGraph));
+
+    if (!profiler->counts || !profiler->stacks || !profiler->graph || CallGraphInit(profiler->graph, symbols) < 0) {
+        ProfilerFree(profiler);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+    First sample interval cycles from now, counting from the machine as it
+    is, the stack from the code at PC on. A call graph the host attaches
+    later takes over from the profiler's own. Adds to what earlier runs
+    sampled. -1 if the queue is full.
+*/
+int ProfilerStart(Cpu8080 *cpu, Profiler *profiler) {
+    if (!cpu->callGraph) {
+        CallGraphStart(cpu, profiler->graph);
+    }
+
+    profiler->lastCycles = cpu->cycles;
+    profiler->lastInstructions = cpu->instructions;
+    profiler->running = TRUE;
+    profiler->id = EventScheduleObserver(cpu, cpu->cycles + profiler->interval, ProfilerSample, profiler);
+
+    return profiler->id < 0 ? -1 : 0;
+}
+
+/* What ran after the last sample is left out. A call graph of the host's stays. */
+void ProfilerStop(Cpu8080 *cpu, Profiler *profiler) {
+    if (cpu->callGraph == profiler->graph) {
+        CallGraphStop(cpu);
+    }
+
+    EventCancel(cpu, profiler->id);
+    profiler->id = -1;
+    profiler->running = FALSE;
+}
+
+typedef struct {
+    uint32_t id;
+    unsigned long long samples;
+    unsigned long long cycles;
+    unsigned long long instructions;
+    unsigned long long total;           /* cycles of the stacks it is on */
+} ProfileRow;
+
+static double Percent(unsigned long long part, unsigned long long whole) {
+    return whole ? 100.0 * (double)part / (double)whole : 0.0;
+}
+
+/* Most cycles of its own first, then most in all, then by id */
+static int CompareRows(const void *left, const void *right) {
+    const ProfileRow *a = (const ProfileRow *)left;
+    const ProfileRow *b = (const ProfileRow *)right;
+
+    if (a->cycles != b->cycles) {
+        return a->cycles > b->cycles ? -1 : 1;
+    }
+
+    if (a->total != b->total) {
+        return a->total > b->total ? -1 : 1;
+    }
+
+    return a->id < b->id ? -1 : a->id > b->id;
+}
+
+/*
+    The PROFILE_REPORT_ROWS locations with most cycles of their own. Total
+    is the share of the samples with the location anywhere on their stack.
+*/
+void ProfilerPrint(const Profiler *profiler) {
+    uint32_t locations = SymbolCount(profiler) + PROFILE_RANGES;
+    ProfileRow *rows = (ProfileRow *)calloc(locations, sizeof(ProfileRow));
+    uint32_t used = 0;
+
+    if (!rows) {
+        fprintf(stderr, "Error: Could not allocate the profile report\n");
+        return;
+    }
+
+    for (uint32_t id = 0; id < locations; id++) {
+        rows[id].id = id;
+    }
+
+    for (unsigned int addr = 0; addr < 0x10000; addr++) {
+        const ProfileCount *count = &profiler->counts[addr];
+
+        if (count->samples) {
+            ProfileRow *row = &rows[Location(profiler, (uint16_t)addr)];
+
+            row->samples += count->samples;
+            row->cycles += count->cycles;
+            row->instructions += count->instructions;
+        }
+    }
+
+    for (int idx = 0; idx < profiler->stackCapacity; idx++) {
+        const ProfileStack *stack = &profiler->stacks[idx];
+
+        for (int frame = 0; frame < stack->depth; frame++) {
+            Bool again = FALSE;
+
+            /* A location that recursed is on the stack once as far as its total goes */
+            for (int before = 0; before < frame && !again; before++) {
+                again = (Bool)(stack->frames[before] == stack->frames[frame]);
+            }
+
+            if (!again) {
+                rows[stack->frames[frame]].total += stack->cycles;
+            }
+        }
+    }
+
+    qsort(rows, locations, sizeof(ProfileRow), CompareRows);
+
+    while (used < locations && (rows[used].samples || rows[used].total)) {
+        used++;
+    }
+
+    printf("[profile] %llu samples every %llu cycles, %llu cycles, %llu instructions, %d symbols\n",
+        profiler->samples, profiler->interval, profiler->cycles, profiler->instructions, (int)SymbolCount(profiler));
+    printf("  addr  location                           cycles   self%%  total%%     instructions    samples\n");
+
+    for (uint32_t idx = 0; idx < used && idx < PROFILE_REPORT_ROWS; idx++) {
+        char name[SYMBOL_NAME_SIZE];
+        uint16_t addr = LocationName(profiler, rows[idx].id, name, sizeof(name));
+
+        printf("  %04X  %-24s %15llu  %5.1f%%  %5.1f%%  %15llu  %9llu\n", addr, name, rows[idx].cycles,
+            Percent(rows[idx].cycles, profiler->cycles), Percent(rows[idx].total, profiler->cycles),
+            rows[idx].instructions, rows[idx].samples);
+    }
+
+    if (used > PROFILE_REPORT_ROWS) {
+        printf("  (%u more locations)\n", used - PROFILE_REPORT_ROWS);
+    }
+
+    if (profiler->lostStacks) {
+        printf("[profile] %llu samples had no room left for their stack\n", profiler->lostStacks);
+    }
+
+    free(rows);
+}
+
+/*
+    One line per call stack, outermost frame first, and the cycles its
+    samples stand for, as flamegraph.pl and speedscope read them:
+        main;outer;inner 123456
+*/
+int ProfilerWriteFolded(const Profiler *profiler, FILE *file) {
+    for (int idx = 0; idx < profiler->stackCapacity; idx++) {
+        const ProfileStack *stack = &profiler->stacks[idx];
+
+        if (!stack->depth) {
+            continue;
+        }
+
+        for (int frame = 0; frame < stack->depth; frame++) {
+            char name[SYMBOL_NAME_SIZE];
+
+            LocationName(profiler, stack->frames[frame], name, sizeof(name));
+            fprintf(file, "%s%s", frame ? ";" : "", name);
+        }
+
+        fprintf(file, " %llu\n", stack->cycles);
+    }
+
+    return ferror(file) ? -1 : 0;
+}
+
+void ProfilerFree(Profiler *profiler) {
+    if (profiler->graph) {
+        CallGraphFree(profiler->graph);
+    }
+
+    free(profiler->graph);
+    free(profiler->counts);
+    free(profiler->stacks);
+    profiler->graph = NULL;
+    profiler->counts = NULL;
+    profiler->stacks = NULL;
+    profiler->stackCount = 0;
+    profiler->stackCapacity = 0;
+}
@@ -0,0 +1,71 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "cpu.h"
+#include "symbols.h"
+#include "callgraph.h"
+
+/* Cycles between samples unless --profile-interval says otherwise */
+#define PROFILE_DEFAULT_INTERVAL    10000ULL
+
+/* Frames kept per sample, the one PC is in included */
+#define PROFILE_MAX_DEPTH           32
+
+/* Code no symbol covers goes by 64 byte ranges */
+#define PROFILE_RANGE_SHIFT         6
+#define PROFILE_RANGES              (0x10000 >> PROFILE_RANGE_SHIFT)
+
+/* Rows the flat profile prints */
+#define PROFILE_REPORT_ROWS         40
+
+/* What the samples that found PC at one address stand for */
+typedef struct {
+    unsigned long long samples;
+    unsigned long long cycles;
+    unsigned long long instructions;
+} ProfileCount;
+
+/* One call stack, outermost frame first, as location ids (see profile.c) */
+typedef struct {
+    uint32_t hash;
+    int depth;                          /* 0: a free slot */
+    uint32_t frames[PROFILE_MAX_DEPTH];
+    unsigned long long samples;
+    unsigned long long cycles;
+} ProfileStack;
+
+/*
+    A PC sampling profiler, see profile.c. Samples off an event every
+    interval cycles, the call stack from a call graph's shadow stack.
+*/
+typedef struct {
+    const SymbolTable *symbols;
+    CallGraph *graph;                   /* attached while the host has none of its own */
+    unsigned long long interval;
+    int id;
+    Bool running;
+    unsigned long long lastCycles;      /* the machine's counts at the last sample */
+    unsigned long long lastInstructions;
+    unsigned long long samples;
+    unsigned long long cycles;          /* all the samples stand for */
+    unsigned long long instructions;
+    unsigned long long lostStacks;      /* samples whose stack found no room, counted flat only */
+    ProfileCount *counts;               /* by PC */
+    ProfileStack *stacks;               /* open addressing, stackCapacity a power of 2 */
+    int stackCount;
+    int stackCapacity;
+} Profiler;
+
+int ProfilerInit(Profiler *profiler, const SymbolTable *symbols, unsigned long long interval);
+int ProfilerStart(Cpu8080 *cpu, Profiler *profiler);
+void ProfilerStop(Cpu8080 *cpu, Profiler *profiler);
+void ProfilerPrint(const Profiler *profiler);
+int ProfilerWriteFolded(const Profiler *profiler, FILE *file);
+void ProfilerFree(Profiler *profiler);
+
+/* A program with known calls sampled on every engine against Step(), see selfcheck.c */
+int ProfilerSelfCheck(void);
+
+#endif
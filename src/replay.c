@@ -0,0 +1,480 @@
+#include <stdio.h>
+#include <string.h>
+#include "cpu.h"
+#include "bdos.h"
+#include "replay.h"
+
+/*
+    Record and replay. A run of a given program image is a pure function of
+    what it reads from outside: console input (BDOS 1 and 10), what the
+    host file system answers to the file calls and whatever a port or
+    memory handler returns. Everything else, the timer and its interrupts
+    included, runs off the cycle count and comes out the same every time.
+
+    Recording logs each of those inputs with the instruction count it was
+    taken at; replaying feeds them back from the log instead of asking the
+    host, so the run comes out bit for bit the same, on any engine, without
+    a terminal, the files or the device. File calls are not made at all
+    while replaying: nothing is read, created, written or removed.
+
+    The engines bring cpu->instructions up to date before any host code
+    runs (SYNC_INSTRUCTIONS() in run.c), so the count means the same on all
+    of them: instructions completed before the one taking the input.
+
+    The log, all numbers little endian:
+
+        "8080RPLY", version u32, hash u64 of the machine at the start
+        records of kind u8, instructions since the last record (varint), payload:
+            CONSOLE     the byte getchar() returned
+            CONSOLE_EOF nothing
+            FILE        func u8, A u8, addr u16, size (varint), size bytes stored there
+            PORT        port u8, value u8
+            END         hash u64 of the machine at the end
+        and, without the instruction count, since the engines only bring it
+        up to date for host code they call themselves:
+            MEMORY      addr u16, value u8
+
+    A record that does not fit what the guest asks for (another kind, call
+    or instruction count) means the log is not of this run. Replay says so
+    once and goes on with live input from there.
+*/
+
+enum {
+    RECORD_CONSOLE = 1,
+    RECORD_CONSOLE_EOF,
+    RECORD_FILE,
+    RECORD_PORT,
+    RECORD_END,
+    RECORD_MEMORY
+};
+
+#define FNV_OFFSET                  0xCBF29CE484222325ULL
+#define FNV_PRIME                   0x00000100000001B3ULL
+
+static uint64_t Fnv(uint64_t hash, const uint8_t *bytes, size_t count) {
+    for (size_t idx = 0; idx < count; idx++) {
+        hash = (hash ^ bytes[idx]) * FNV_PRIME;
+    }
+
+    return hash;
+}
+
+/* Registers, PC, halt and interrupt state, the counts and every page of memory[] */
+static uint64_t StateHash(const Cpu8080 *cpu) {
+    uint8_t fields[REG_FILE_SIZE + 20];
+    size_t pos = 0;
+    uint64_t hash = FNV_OFFSET;
+
+    for (int pair = 0; pair < RP_COUNT; pair++) {
+        fields[pos++] = (uint8_t)cpu->pairs[pair];
+        fields[pos++] = (uint8_t)(cpu->pairs[pair] >> 8);
+    }
+
+    fields[pos++] = (uint8_t)cpu->PC;
+    fields[pos++] = (uint8_t)(cpu->PC >> 8);
+    fields[pos++] = (uint8_t)cpu->halted;
+    fields[pos++] = (uint8_t)cpu->interruptsEnabled;
+
+    for (int shift = 0; shift < 64; shift += 8) {
+        fields[pos++] = (uint8_t)(cpu->cycles >> shift);
+        fields[pos++] = (uint8_t)(cpu->instructions >> shift);
+    }
+
+    hash = Fnv(hash, fields, pos);
+
+    for (int page = 0; page < MEM_PAGE_COUNT; page++) {
+        hash = Fnv(hash, MemOwnPage(cpu, page), MEM_PAGE_SIZE);
+    }
+
+    return hash;
+}
+
+static void PutVarint(FILE *log, unsigned long long value) {
+    while (value >= 0x80) {
+        fputc((int)(value & 0x7F) | 0x80, log);
+        value >>= 7;
+    }
+
+    fputc((int)value, log);
+}
+
+static Bool GetVarint(FILE *log, unsigned long long *value) {
+    *value = 0;
+
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = fgetc(log);
+
+        if (c == EOF) {
+            return FALSE;
+        }
+
+        *value |= (unsigned long long)(c & 0x7F) << shift;
+
+        if (!(c & 0x80)) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static void Put64(FILE *log, uint64_t value) {
+    for (int shift = 0; shift < 64; shift += 8) {
+        fputc((int)(uint8_t)(value >> shift), log);
+    }
+}
+
+static Bool Get64(FILE *log, uint64_t *value) {
+    uint8_t bytes[8];
+
+    if (fread(bytes, 1, sizeof(bytes), log) != sizeof(bytes)) {
+        return FALSE;
+    }
+
+    *value = 0;
+
+    for (int idx = 7; idx >= 0; idx--) {
+        *value = (*value << 8) | bytes[idx];
+    }
+
+    return TRUE;
+}
+
+static void PutRecord(Cpu8080 *cpu, int kind) {
+    Replay *replay = cpu->replay;
+
+    fputc(kind, replay->log);
+    PutVarint(replay->log, cpu->instructions - replay->last);
+    replay->last = cpu->instructions;
+    replay->inputs++;
+}
+
+static void Diverge(Cpu8080 *cpu, const char *what) {
+    Replay *replay = cpu->replay;
+
+    replay->diverged = TRUE;
+    fprintf(stderr, "[replay] %s after %llu instructions and %llu inputs, live input from here\n",
+        what, cpu->instructions, replay->inputs);
+}
+
+/* A recording gone back in time plays until it is where it stopped, then records on */
+static void CatchUp(Cpu8080 *cpu) {
+    Replay *replay = cpu->replay;
+
+    if (replay->resume && ftell(replay->log) >= replay->end) {
+        fseek(replay->log, replay->end, SEEK_SET);
+        replay->mode = REPLAY_RECORD;
+        replay->resume = FALSE;
+    }
+}
+
+/*
+    Playing: the kind of the next record if it was taken right now, its
+    payload is next in the log. 0 once the run has diverged.
+*/
+static int NextRecord(Cpu8080 *cpu) {
+    Replay *replay = cpu->replay;
+    unsigned long long delta;
+    int kind;
+
+    if (replay->diverged) {
+        return 0;
+    }
+
+    kind = fgetc(replay->log);
+
+    if (kind == EOF || !GetVarint(replay->log, &delta)) {
+        Diverge(cpu, "Log ends");
+        return 0;
+    }
+
+    if (replay->last + delta != cpu->instructions) {
+        Diverge(cpu, "Log does not fit the run");
+        return 0;
+    }
+
+    replay->last = cpu->instructions;
+    replay->inputs++;
+    return kind;
+}
+
+static Bool GetRecord(Cpu8080 *cpu, int kind) {
+    int next = NextRecord(cpu);
+
+    if (next && next != kind) {
+        Diverge(cpu, "Log does not fit the run");
+    }
+
+    return (Bool)(next && next == kind);
+}
+
+/*
+    Sets cpu->replay up to record into or play back log, a binary stream
+    the caller opens and closes. Call it once the machine is set up,
+    program and command line in, right before it runs. -1 if playing and
+    log is not a log.
+*/
+int ReplayStart(Cpu8080 *cpu, Replay *replay, FILE *log, ReplayMode mode) {
+    uint8_t header[REPLAY_MAGIC_SIZE + 4];
+    uint64_t hash = StateHash(cpu);
+    uint64_t logged = hash;
+
+    memset(replay, 0, sizeof(*replay));
+    replay->mode = mode;
+    replay->last = cpu->instructions;
+    replay->log = log;
+
+    if (mode == REPLAY_RECORD) {
+        fwrite(REPLAY_MAGIC, 1, REPLAY_MAGIC_SIZE, replay->log);
+        fputc(REPLAY_VERSION, replay->log);
+        fputc(0, replay->log);
+        fputc(0, replay->log);
+        fputc(0, replay->log);
+        Put64(replay->log, hash);
+    } else if (fread(header, 1, sizeof(header), replay->log) != sizeof(header) ||
+        memcmp(header, REPLAY_MAGIC, REPLAY_MAGIC_SIZE) != 0 ||
+        header[REPLAY_MAGIC_SIZE] != REPLAY_VERSION || !Get64(replay->log, &logged)) {
+        return -1;
+    }
+
+    cpu->replay = replay;
+
+    if (mode == REPLAY_PLAY && logged != hash) {
+        Diverge(cpu, "Log was recorded from another program or command line");
+    }
+
+    return 0;
+}
+
+/*
+    Ends the run: recording writes the END record, playing checks the
+    machine against it. Either way cpu->replay is NULL again. -1 if a replay did not come out the same.
+*/
+int ReplayFinish(Cpu8080 *cpu) {
+    Replay *replay = cpu->replay;
+    uint64_t hash = StateHash(cpu);
+    uint64_t logged = 0;
+    unsigned long long inputs;
+
+    if (!replay) {
+        return 0;
+    }
+
+    inputs = replay->inputs;
+    replay->instructions = cpu->instructions;
+
+    if (replay->mode == REPLAY_RECORD) {
+        PutRecord(cpu, RECORD_END);
+        Put64(replay->log, hash);
+        replay->failed = (Bool)(fflush(replay->log) != 0 || ferror(replay->log));
+    } else {
+        if (!replay->diverged && !(GetRecord(cpu, RECORD_END) && Get64(replay->log, &logged))) {
+            replay->diverged = TRUE;
+        }
+
+        replay->failed = (Bool)(replay->diverged || logged != hash);
+    }
+
+    /* The END record is not an input */
+    replay->inputs = inputs;
+    cpu->replay = NULL;
+
+    return replay->failed ? -1 : 0;
+}
+
+void ReplayPrintStats(const Replay *replay) {
+    if (replay->mode == REPLAY_RECORD) {
+        printf("[replay] recorded %llu inputs over %llu instructions%s\n",
+            replay->inputs, replay->instructions, replay->failed ? ", log NOT written" : "");
+        return;
+    }
+
+    printf("[replay] played %llu inputs over %llu instructions, end state %s\n",
+        replay->inputs, replay->instructions, replay->failed ? "DIFFERS" : "matches");
+}
+
+/* Where the log is now, for ReplaySeek(); *last goes with it */
+long ReplayTell(const Cpu8080 *cpu, unsigned long long *last) {
+    *last = cpu->replay->last;
+    return ftell(cpu->replay->log);
+}
+
+/*
+    Puts the log back to what ReplayTell() said, for a machine about to be
+    put back to the same point (see timeline.c). A recording plays what it
+    already has from there and records again once it gets to where it
+    stopped, so the run goes the same way up to there whatever the inputs
+    do now.
+*/
+void ReplaySeek(Cpu8080 *cpu, long position, unsigned long long last) {
+    Replay *replay = cpu->replay;
+
+    if (replay->mode == REPLAY_RECORD) {
+        fflush(replay->log);
+        replay->end = ftell(replay->log);
+        replay->until = cpu->instructions;
+        replay->mode = REPLAY_PLAY;
+        replay->resume = TRUE;
+    }
+
+    fseek(replay->log, position, SEEK_SET);
+    replay->last = last;
+    replay->diverged = FALSE;
+}
+
+/* TRUE while a recording runs again over what it has: the output was made the first time */
+Bool ReplayRerun(const Cpu8080 *cpu) {
+    return (Bool)(cpu->replay->resume && cpu->instructions < cpu->replay->until);
+}
+
+/* getchar() for BDOS 1 and 10 */
+int ReplayConsoleIn(Cpu8080 *cpu) {
+    Replay *replay = cpu->replay;
+    int c;
+
+    CatchUp(cpu);
+
+    if (replay->mode == REPLAY_PLAY) {
+        int kind = NextRecord(cpu);
+
+        if (kind == RECORD_CONSOLE) {
+            return fgetc(replay->log);
+        }
+
+        if (kind == RECORD_CONSOLE_EOF) {
+            return EOF;
+        }
+
+        if (kind) {
+            Diverge(cpu, "Log does not fit the run");
+        }
+
+        return getchar();
+    }
+
+    c = getchar();
+    PutRecord(cpu, c == EOF ? RECORD_CONSOLE_EOF : RECORD_CONSOLE);
+
+    if (c != EOF) {
+        fputc(c, replay->log);
+    }
+
+    return c;
+}
+
+/*
+    Before a BDOS file call: playing, puts what the call returned (A and L,
+    the bytes it stored) in place and returns TRUE, the call is not made.
+*/
+Bool ReplayFilePlay(Cpu8080 *cpu, uint8_t func) {
+    Replay *replay = cpu->replay;
+    unsigned long long size;
+    uint8_t fields[4];
+
+    CatchUp(cpu);
+
+    if (replay->mode != REPLAY_PLAY || !GetRecord(cpu, RECORD_FILE)) {
+        return FALSE;
+    }
+
+    if (fread(fields, 1, sizeof(fields), replay->log) != sizeof(fields) ||
+        !GetVarint(replay->log, &size) || fields[0] != func) {
+        Diverge(cpu, "Log does not fit the run");
+        return FALSE;
+    }
+
+    uint16_t addr = (uint16_t)(fields[2] | (fields[3] << 8));
+
+    for (unsigned long long idx = 0; idx < size; idx++) {
+        MemWrite(cpu, (uint16_t)(addr + idx), (uint8_t)fgetc(replay->log));
+    }
+
+    cpu->registers[REG_A] = fields[1];
+    cpu->registers[REG_L] = fields[1];
+    return TRUE;
+}
+
+/* After a BDOS file call made for real: what it returned and the size bytes it stored at addr */
+void ReplayFileRecord(Cpu8080 *cpu, uint8_t func, uint16_t addr, uint16_t size) {
+    Replay *replay = cpu->replay;
+
+    if (replay->mode != REPLAY_RECORD) {
+        return;
+    }
+
+    PutRecord(cpu, RECORD_FILE);
+    fputc(func, replay->log);
+    fputc(cpu->registers[REG_A], replay->log);
+    fputc((uint8_t)addr, replay->log);
+    fputc((uint8_t)(addr >> 8), replay->log);
+    PutVarint(replay->log, size);
+
+    for (uint16_t idx = 0; idx < size; idx++) {
+        fputc(MemRead(cpu, (uint16_t)(addr + idx)), replay->log);
+    }
+}
+
+/* MemReadSlow() of a handler page; playing, the handler is not called. In order, not by count. */
+uint8_t ReplayMemoryRead(Cpu8080 *cpu, uint16_t addr, const MemHandler *handler) {
+    Replay *replay = cpu->replay;
+    uint8_t fields[3];
+    uint8_t value;
+
+    cpu->handlerCalls++;
+    CatchUp(cpu);
+
+    if (replay->mode == REPLAY_PLAY && !replay->diverged) {
+        int kind = fgetc(replay->log);
+
+        if (kind == RECORD_MEMORY && fread(fields, 1, sizeof(fields), replay->log) == sizeof(fields) &&
+            (fields[0] | (fields[1] << 8)) == addr) {
+            replay->inputs++;
+            return fields[2];
+        }
+
+        Diverge(cpu, kind == EOF ? "Log ends" : "Log does not fit the run");
+    }
+
+    value = handler->read(cpu, addr, handler->context);
+
+    if (replay->mode == REPLAY_RECORD) {
+        fputc(RECORD_MEMORY, replay->log);
+        fputc((uint8_t)addr, replay->log);
+        fputc((uint8_t)(addr >> 8), replay->log);
+        fputc(value, replay->log);
+        replay->inputs++;
+    }
+
+    return value;
+}
+
+/* IORead() of a port with a read handler; playing, the handler is not called */
+uint8_t ReplayPortRead(Cpu8080 *cpu, uint8_t port, const IoHandler *handler) {
+    Replay *replay = cpu->replay;
+    uint8_t value;
+
+    cpu->handlerCalls++;
+    CatchUp(cpu);
+
+    if (replay->mode == REPLAY_PLAY && GetRecord(cpu, RECORD_PORT)) {
+        int logged = fgetc(replay->log);
+
+        value = (uint8_t)fgetc(replay->log);
+
+        if (logged == port) {
+            return value;
+        }
+
+        Diverge(cpu, "Log does not fit the run");
+    }
+
+    value = handler->read(cpu, port, handler->context);
+
+    if (replay->mode == REPLAY_RECORD) {
+        PutRecord(cpu, RECORD_PORT);
+        fputc(port, replay->log);
+        fputc(value, replay->log);
+    }
+
+    return value;
+}
@@ -0,0 +1,52 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "cpu.h"
+
+/* First bytes of every input log, then REPLAY_VERSION */
+#define REPLAY_MAGIC                "8080RPLY"
+#define REPLAY_MAGIC_SIZE           8
+#define REPLAY_VERSION              1
+
+typedef enum {
+    REPLAY_RECORD,
+    REPLAY_PLAY
+} ReplayMode;
+
+/*
+    Record or replay of everything a run takes from outside the guest, see
+    replay.c. Hung off cpu->replay; NULL there costs nothing.
+*/
+struct Replay {
+    ReplayMode mode;
+    FILE *log;
+    unsigned long long last;            /* cpu->instructions at the last record */
+    unsigned long long inputs;          /* records written or played */
+    Bool diverged;                      /* playing, but the log no longer fits: live input from here */
+    Bool failed;                        /* set by ReplayFinish(): not written, or the run came out different */
+    Bool resume;                        /* a recording gone back by ReplaySeek(): record again at end */
+    long end;                           /* where the recording stopped, while resume */
+    unsigned long long until;           /* cpu->instructions then */
+    unsigned long long instructions;    /* the run's, for ReplayPrintStats() */
+};
+
+int ReplayStart(Cpu8080 *cpu, Replay *replay, FILE *log, ReplayMode mode);
+int ReplayFinish(Cpu8080 *cpu);
+long ReplayTell(const Cpu8080 *cpu, unsigned long long *last);
+void ReplaySeek(Cpu8080 *cpu, long position, unsigned long long last);
+Bool ReplayRerun(const Cpu8080 *cpu);
+void ReplayPrintStats(const Replay *replay);
+
+/* The inputs, called by bdos.c, IORead() and MemReadSlow() only while cpu->replay is set */
+int ReplayConsoleIn(Cpu8080 *cpu);
+Bool ReplayFilePlay(Cpu8080 *cpu, uint8_t func);
+void ReplayFileRecord(Cpu8080 *cpu, uint8_t func, uint16_t addr, uint16_t size);
+uint8_t ReplayPortRead(Cpu8080 *cpu, uint8_t port, const IoHandler *handler);
+uint8_t ReplayMemoryRead(Cpu8080 *cpu, uint16_t addr, const MemHandler *handler);
+
+/* A port device recorded on Step() and played back on every engine, see selfcheck.c */
+int ReplaySelfCheck(void);
+
+#endif
@@ -0,0 +1,993 @@
+#include <stdio.h>
+#include <string.h>
+#include "cpu.h"
+#include "event.h"
+#include "flags.h"
+#include "block.h"
+#include "jit.h"
+#include "idle.h"
+#include "trace.h"
+#include "histogram.h"
+
+/*
+    Run() is the fast engine. Unlike Step() there is no opcodeTable and no
+    helper call per instruction: every opcode is a label inside this one
+    function and the machine registers live in locals until we leave.
+
+    GCC and Clang get direct threading through computed goto (every handler
+    jumps straight to the next one, so the host branch predictor sees one
+    indirect branch per opcode instead of one shared one). Everything else
+    falls back to a plain switch.
+
+    The semantics (flags, cycle counts, host traps) are the same as Step()
+    and the op_XX handlers in cpu.c, bit for bit.
+*/
+
+#if defined(__GNUC__) || defined(__clang__)
+#define RUN_COMPUTED_GOTO 1
+#endif
+
+/*
+    GCC only gives every handler its own indirect jump if the shared
+    dispatch block stays tiny. The SLP vectorizer packs the 16 bit pair
+    locals into one SSE register on entry and then has to unpack them in
+    front of that jump, which makes it too big, so every opcode ends up
+    going through a single jump again. Keep it off for this file.
+*/
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC optimize("no-tree-slp-vectorize")
+#endif
+
+/*
+    Run() proper is for the flat bus (all of memory[] as RAM, what every
+    CP/M program gets) and indexes memory[] directly. Any other memory map
+    goes to RunPaged() further down, the same handlers over the page table.
+    A store only leaves the fast path when its page holds decoded code, see
+    CodeWritten().
+*/
+#define RD(addr)            mem[(uint16_t)(addr)]
+#define WR(addr, val) do {                                                  \
+        wa = (uint16_t)(addr);                                              \
+        mem[wa] = (uint8_t)(val);                                           \
+        dirtyPages[wa >> MEM_PAGE_SHIFT] = 1;                               \
+        if (codePages[wa >> CODE_PAGE_SHIFT]) {                             \
+            CodeWritten(cpu, wa);                                           \
+        }                                                                   \
+    } while (0)
+#define FETCH8()            mem[pc++]
+#define FETCH16(dst)        do { (dst) = (uint16_t)(mem[pc] | (mem[(uint16_t)(pc + 1)] << 8)); pc += 2; } while (0)
+
+/* Pairs live in 16 bit locals like in Cpu8080.pairs, B C D E H L are their halves */
+#define HI(rp)              ((uint8_t)((rp) >> 8))
+#define LO(rp)              ((uint8_t)(rp))
+#define SET_HI(rp, val)     ((rp) = (uint16_t)(((rp) & 0x00FF) | ((uint8_t)(val) << 8)))
+#define SET_LO(rp, val)     ((rp) = (uint16_t)(((rp) & 0xFF00) | (uint8_t)(val)))
+
+#define PUSH16(val)         do { WR(sp - 1, (val) >> 8); WR(sp - 2, (val) & 0xFF); sp -= 2; } while (0)
+#define POP16(dst)          do { (dst) = (uint16_t)(RD(sp) | (RD(sp + 1) << 8)); sp += 2; } while (0)
+
+#include "run_flags.h"
+
+/*
+    Host code called in the middle of a batch (a trap, a port handler) sees
+    cpu->instructions as the count before the instruction it runs for, the
+    same as under Step(). Record and replay key every input on it.
+*/
+#define SYNC_INSTRUCTIONS() ((void)(cpu->instructions += instr, instr = 0))
+
+#define SAVE_STATE() do {                                                   \
+        cpu->PC = pc; cpu->SP = sp; cpu->flags = FLAGS();                   \
+        cpu->registers[REG_A] = a;                                          \
+        cpu->pairs[RP_BC] = bc; cpu->pairs[RP_DE] = de;                     \
+        cpu->pairs[RP_HL] = hl;                                             \
+        SYNC_INSTRUCTIONS();                                                \
+    } while (0)
+
+#define LOAD_STATE() do {                                                   \
+        pc = cpu->PC; sp = cpu->SP; SET_FLAGS(cpu->flags);                  \
+        a = cpu->registers[REG_A];                                          \
+        bc = cpu->pairs[RP_BC]; de = cpu->pairs[RP_DE];                     \
+        hl = cpu->pairs[RP_HL];                                             \
+    } while (0)
+
+/* Handler addresses in opcode order, for the computed goto tables */
+#define OP_LABELS \
+        &&op_00, &&op_01, &&op_02, &&op_03, &&op_04, &&op_05, &&op_06, &&op_07, \
+        &&op_08, &&op_09, &&op_0a, &&op_0b, &&op_0c, &&op_0d, &&op_0e, &&op_0f, \
+        &&op_10, &&op_11, &&op_12, &&op_13, &&op_14, &&op_15, &&op_16, &&op_17, \
+        &&op_18, &&op_19, &&op_1a, &&op_1b, &&op_1c, &&op_1d, &&op_1e, &&op_1f, \
+        &&op_20, &&op_21, &&op_22, &&op_23, &&op_24, &&op_25, &&op_26, &&op_27, \
+        &&op_28, &&op_29, &&op_2a, &&op_2b, &&op_2c, &&op_2d, &&op_2e, &&op_2f, \
+        &&op_30, &&op_31, &&op_32, &&op_33, &&op_34, &&op_35, &&op_36, &&op_37, \
+        &&op_38, &&op_39, &&op_3a, &&op_3b, &&op_3c, &&op_3d, &&op_3e, &&op_3f, \
+        &&op_40, &&op_41, &&op_42, &&op_43, &&op_44, &&op_45, &&op_46, &&op_47, \
+        &&op_48, &&op_49, &&op_4a, &&op_4b, &&op_4c, &&op_4d, &&op_4e, &&op_4f, \
+        &&op_50, &&op_51, &&op_52, &&op_53, &&op_54, &&op_55, &&op_56, &&op_57, \
+        &&op_58, &&op_59, &&op_5a, &&op_5b, &&op_5c, &&op_5d, &&op_5e, &&op_5f, \
+        &&op_60, &&op_61, &&op_62, &&op_63, &&op_64, &&op_65, &&op_66, &&op_67, \
+        &&op_68, &&op_69, &&op_6a, &&op_6b, &&op_6c, &&op_6d, &&op_6e, &&op_6f, \
+        &&op_70, &&op_71, &&op_72, &&op_73, &&op_74, &&op_75, &&op_76, &&op_77, \
+        &&op_78, &&op_79, &&op_7a, &&op_7b, &&op_7c, &&op_7d, &&op_7e, &&op_7f, \
+        &&op_80, &&op_81, &&op_82, &&op_83, &&op_84, &&op_85, &&op_86, &&op_87, \
+        &&op_88, &&op_89, &&op_8a, &&op_8b, &&op_8c, &&op_8d, &&op_8e, &&op_8f, \
+        &&op_90, &&op_91, &&op_92, &&op_93, &&op_94, &&op_95, &&op_96, &&op_97, \
+        &&op_98, &&op_99, &&op_9a, &&op_9b, &&op_9c, &&op_9d, &&op_9e, &&op_9f, \
+        &&op_a0, &&op_a1, &&op_a2, &&op_a3, &&op_a4, &&op_a5, &&op_a6, &&op_a7, \
+        &&op_a8, &&op_a9, &&op_aa, &&op_ab, &&op_ac, &&op_ad, &&op_ae, &&op_af, \
+        &&op_b0, &&op_b1, &&op_b2, &&op_b3, &&op_b4, &&op_b5, &&op_b6, &&op_b7, \
+        &&op_b8, &&op_b9, &&op_ba, &&op_bb, &&op_bc, &&op_bd, &&op_be, &&op_bf, \
+        &&op_c0, &&op_c1, &&op_c2, &&op_c3, &&op_c4, &&op_c5, &&op_c6, &&op_c7, \
+        &&op_c8, &&op_c9, &&op_ca, &&op_cb, &&op_cc, &&op_cd, &&op_ce, &&op_cf, \
+        &&op_d0, &&op_d1, &&op_d2, &&op_d3, &&op_d4, &&op_d5, &&op_d6, &&op_d7, \
+        &&op_d8, &&op_d9, &&op_da, &&op_db, &&op_dc, &&op_dd, &&op_de, &&op_df, \
+        &&op_e0, &&op_e1, &&op_e2, &&op_e3, &&op_e4, &&op_e5, &&op_e6, &&op_e7, \
+        &&op_e8, &&op_e9, &&op_ea, &&op_eb, &&op_ec, &&op_ed, &&op_ee, &&op_ef, \
+        &&op_f0, &&op_f1, &&op_f2, &&op_f3, &&op_f4, &&op_f5, &&op_f6, &&op_f7, \
+        &&op_f8, &&op_f9, &&op_fa, &&op_fb, &&op_fc, &&op_fd, &&op_fe, &&op_ff
+
+#ifdef RUN_OPCODE_PROFILE
+/*
+    The opcode histogram build (see histogram.c): every handler counts its
+    own opcode, which is a constant there, and NEXT() its cycles.
+*/
+#define OPCODE(n)           op = 0x##n; HistogramOpcode(cpu->histogram, op);
+#define HISTOGRAM(cycles)   HistogramCycles(cpu->histogram, op, (cycles))
+#else
+#define OPCODE(n)
+#define HISTOGRAM(cycles)   ((void)0)
+#endif
+
+#ifdef RUN_COMPUTED_GOTO
+#define OP(n)               op_##n: OPCODE(n)
+#define FETCH_DISPATCH()    do { if (done >= cycleBudget) goto leave; goto *labels[FETCH8()]; } while (0)
+#define DISPATCH()          FETCH_DISPATCH()
+#define NEXT(cycles)        { done += (cycles); instr++; HISTOGRAM(cycles); DISPATCH(); }
+#else
+#define OP(n)               case 0x##n: OPCODE(n)
+#define NEXT(cycles)        { done += (cycles); instr++; HISTOGRAM(cycles); continue; }
+#endif
+
+/*
+    Trap handlers may move PC or drop code, which only RunBlocks() has to
+    stop for. They and OUT (see BankSelect()) may also map memory, after
+    which Run() can no longer index memory[], or schedule an event or
+    raise an interrupt: all of those set cpu->yield and Run() leaves after
+    this instruction.
+*/
+#define AFTER_TRAP()        ((void)(!cpu->yield || (cycleBudget = done)))
+#define AFTER_OUT()         AFTER_TRAP()
+
+/* A request that waited for EI is taken by Execute() after one more instruction */
+#define AFTER_EI()          ((void)(!cpu->interruptPending || (cycleBudget = done)))
+
+/* After the poll instruction at addr, which takes cycles; see IdlePoll() */
+#define IDLE_POLL(addr, cycles) do {                                        \
+        if (done + (cycles) < cycleBudget) {                                \
+            unsigned long long polled;                                      \
+            SAVE_STATE();                                                   \
+            done += IdlePoll(cpu, (addr), cycleBudget - done - (cycles), &polled); \
+            instr += polled;                                                \
+            LOAD_STATE();                                                   \
+            AFTER_TRAP();                                                   \
+        }                                                                   \
+    } while (0)
+#define POLL(addr, cycles)  IDLE_POLL(addr, cycles)
+
+/*
+    Flag byte layout is the PSW layout (S Z 0 AC 0 P 1 CY), see Flags in cpu.h.
+    The helpers below rebuild it the same way the Update* helpers in cpu.c
+    do, from the same tables in flags.c.
+*/
+#define FlagsZSP(result)    zspTable[(uint8_t)(result)]
+
+static inline uint8_t AluAdd(uint8_t a, uint8_t v, uint8_t carry, uint8_t *f) {
+    uint8_t result = (uint8_t)(a + v + carry);
+
+    *f = (uint8_t)(0x02 | zspTable[result] |
+        carryAddTable[ALU_INDEX(a, v, result, 7)] | auxCarryAddTable[ALU_INDEX(a, v, result, 3)]);
+
+    return result;
+}
+
+static inline uint8_t AluSub(uint8_t a, uint8_t v, uint8_t borrow, uint8_t *f) {
+    uint8_t result = (uint8_t)(a - v - borrow);
+
+    *f = (uint8_t)(0x02 | zspTable[result] |
+        carrySubTable[ALU_INDEX(a, v, result, 7)] | auxCarrySubTable[ALU_INDEX(a, v, result, 3)]);
+
+    return result;
+}
+
+static inline uint8_t AluAnd(uint8_t a, uint8_t v, uint8_t *f) {
+    uint8_t result = a & v;
+
+    *f = (uint8_t)(0x02 | zspTable[result] | (((a | v) & 0x08) << 1));
+
+    return result;
+}
+
+/* INR/DCR leave CY alone */
+static inline uint8_t AluInr(uint8_t v, uint8_t *f) {
+    uint8_t result = (uint8_t)(v + 1);
+
+    *f = (uint8_t)((*f & ~FLAGS_ZSPAC_MASK) | zspTable[result] | auxCarryAddTable[ALU_INDEX(v, 1, result, 3)]);
+
+    return result;
+}
+
+static inline uint8_t AluDcr(uint8_t v, uint8_t *f) {
+    uint8_t result = (uint8_t)(v - 1);
+
+    *f = (uint8_t)((*f & ~FLAGS_ZSPAC_MASK) | zspTable[result] | auxCarrySubTable[ALU_INDEX(v, 1, result, 3)]);
+
+    return result;
+}
+
+static inline uint8_t AluDaa(uint8_t a, uint8_t *f) {
+    uint8_t adjust = 0;
+    uint8_t carry = *f & 0x01;
+
+    if ((a & 0x0F) > 9 || (*f & 0x10)) {
+        adjust += 0x06;
+    }
+
+    if (a > 0x99 || carry) {
+        adjust += 0x60;
+        carry = 1;
+    }
+
+    uint8_t result = (uint8_t)(a + adjust);
+
+    *f = (uint8_t)((*f & ~FLAGS_ALL_MASK) | zspTable[result] | carry |
+        auxCarryAddTable[ALU_INDEX(a, adjust, result, 3)]);
+
+    return result;
+}
+
+#ifdef RUN_LAZY_FLAGS
+typedef enum {
+    LAZY_NONE = 0,
+    LAZY_ADD,
+    LAZY_SUB,
+    LAZY_AND,
+    LAZY_LOGIC
+} LazyKind;
+
+typedef struct {
+    uint8_t kind;
+    uint8_t result;
+    uint8_t a, v;
+} LazyFlags;
+
+static inline uint8_t LazyMaterialize(const LazyFlags *lz, uint8_t f) {
+    uint8_t ac;
+
+    switch (lz->kind) {
+        case LAZY_NONE: {
+            return f;
+        }
+
+        case LAZY_ADD: {
+            ac = auxCarryAddTable[ALU_INDEX(lz->a, lz->v, lz->result, 3)];
+            break;
+        }
+
+        case LAZY_SUB: {
+            ac = auxCarrySubTable[ALU_INDEX(lz->a, lz->v, lz->result, 3)];
+            break;
+        }
+
+        case LAZY_AND: {
+            ac = (uint8_t)(((lz->a | lz->v) & 0x08) << 1);
+            break;
+        }
+
+        default: {
+            ac = 0;
+            break;
+        }
+    }
+
+    return (uint8_t)(0x02 | (f & 0x01) | zspTable[lz->result] | ac);
+}
+
+static inline uint8_t LazyAdd(LazyFlags *lz, uint8_t *f, uint8_t a, uint8_t v, uint8_t carry) {
+    uint8_t result = (uint8_t)(a + v + carry);
+
+    *f = (uint8_t)((*f & ~0x01) | carryAddTable[ALU_INDEX(a, v, result, 7)]);
+    lz->kind = LAZY_ADD;
+    lz->a = a;
+    lz->v = v;
+    lz->result = (uint8_t)result;
+
+    return (uint8_t)result;
+}
+
+static inline uint8_t LazySub(LazyFlags *lz, uint8_t *f, uint8_t a, uint8_t v, uint8_t borrow) {
+    uint8_t result = (uint8_t)(a - v - borrow);
+
+    *f = (uint8_t)((*f & ~0x01) | carrySubTable[ALU_INDEX(a, v, result, 7)]);
+    lz->kind = LAZY_SUB;
+    lz->a = a;
+    lz->v = v;
+    lz->result = (uint8_t)result;
+
+    return (uint8_t)result;
+}
+
+static inline uint8_t LazyAnd(LazyFlags *lz, uint8_t *f, uint8_t a, uint8_t v) {
+    *f &= ~0x01;
+    lz->kind = LAZY_AND;
+    lz->a = a;
+    lz->v = v;
+    lz->result = a & v;
+
+    return lz->result;
+}
+
+/* ORA/XRA: AC and CY both end up clear, only the result matters */
+static inline uint8_t LazyLogic(LazyFlags *lz, uint8_t *f, uint8_t result) {
+    *f &= ~0x01;
+    lz->kind = LAZY_LOGIC;
+    lz->result = result;
+
+    return result;
+}
+
+/* INR/DCR are ADD/SUB of 1 that leave CY alone */
+static inline uint8_t LazyIncDec(LazyFlags *lz, LazyKind kind, uint8_t v, int delta) {
+    lz->kind = (uint8_t)kind;
+    lz->a = v;
+    lz->v = 1;
+    lz->result = (uint8_t)(v + delta);
+
+    return lz->result;
+}
+#endif
+
+static unsigned long long RunPaged(Cpu8080 *cpu, unsigned long long cycleBudget);
+
+unsigned long long Run(Cpu8080 *cpu, unsigned long long cycleBudget) {
+    if (cpu->halted) {
+        return 0;
+    }
+
+    cpu->yield = FALSE;
+
+    if (!cpu->flatBus) {
+        return RunPaged(cpu, cycleBudget);
+    }
+
+    uint8_t *mem = cpu->memory;
+    const uint8_t *codePages = cpu->codePages;
+    uint8_t *dirtyPages = cpu->dirtyPages;
+    uint16_t pc, sp, bc, de, hl, w, wa;
+    uint32_t w32;
+    uint8_t a, f, t;
+    unsigned long long done = 0;
+    unsigned long long instr = 0;
+#ifdef RUN_LAZY_FLAGS
+    LazyFlags lz = { LAZY_NONE, 0, 0, 0 };
+#endif
+#ifdef RUN_OPCODE_PROFILE
+    unsigned int op;
+#endif
+
+    LOAD_STATE();
+
+#ifdef RUN_COMPUTED_GOTO
+    static const void *const labels[256] = {
+        OP_LABELS
+    };
+
+    DISPATCH();
+#else
+    for (;;) {
+        if (done >= cycleBudget) {
+            goto leave;
+        }
+
+        switch (FETCH8()) {
+#endif
+
+#include "run_ops.h"
+
+#ifndef RUN_COMPUTED_GOTO
+        }
+    }
+#endif
+
+leave:
+    SAVE_STATE();
+
+    cpu->cycles += done;
+    cpu->instructions += instr;
+
+    return done;
+}
+
+/*
+    Run() for a trace (see trace.c): the same handlers over the flat bus,
+    with a record of the machine in front of every instruction, built from
+    the locals. A poll runs every trip of its loop here rather than going
+    to IdlePoll(), which would skip them without records. Flags are eager
+    here: a record needs all of f every instruction, and working out the
+    lazy ones that often costs more than keeping them. Execute() sends a
+    trace here unless the Step engine, a mapped bus, breakpoints, a call
+    graph or a heatmap need RunSingle().
+*/
+#define RUN_EAGER_FLAGS
+#include "run_flags.h"
+
+#undef POLL
+#define POLL(addr, cycles)  ((void)0)
+
+#define TRACE_RECORD() do {                                                 \
+        const uint8_t *at = &mem[pc];                                       \
+        if (pc > MEM_MAX - 3) {                                             \
+            wrap[0] = mem[pc];                                              \
+            wrap[1] = mem[(uint16_t)(pc + 1)];                              \
+            wrap[2] = mem[(uint16_t)(pc + 2)];                              \
+            at = wrap;                                                      \
+        }                                                                   \
+        TraceRecord(trace, cpu->instructions + instr, pc, sp,               \
+            TRACE_REGISTERS(bc, de, hl, (uint16_t)(a << 8 | FLAGS())),      \
+            cpu->interruptsEnabled, at);                                    \
+    } while (0)
+
+#ifdef RUN_COMPUTED_GOTO
+#undef DISPATCH
+#define DISPATCH()          goto record
+#endif
+
+static unsigned long long RunTraced(Cpu8080 *cpu, unsigned long long cycleBudget) {
+    if (cpu->halted) {
+        return 0;
+    }
+
+    cpu->yield = FALSE;
+
+    Trace *trace = cpu->trace;
+    uint8_t *mem = cpu->memory;
+    const uint8_t *codePages = cpu->codePages;
+    uint8_t *dirtyPages = cpu->dirtyPages;
+    uint16_t pc, sp, bc, de, hl, w, wa;
+    uint32_t w32;
+    uint8_t a, f, t;
+    uint8_t wrap[3];
+    unsigned long long done = 0;
+    unsigned long long instr = 0;
+#ifdef RUN_OPCODE_PROFILE
+    unsigned int op;
+#endif
+
+    LOAD_STATE();
+
+#ifdef RUN_COMPUTED_GOTO
+    static const void *const labels[256] = {
+        OP_LABELS
+    };
+
+record:
+    if (done >= cycleBudget) {
+        goto leave;
+    }
+
+    TRACE_RECORD();
+    goto *labels[FETCH8()];
+#else
+    for (;;) {
+        if (done >= cycleBudget) {
+            goto leave;
+        }
+
+        TRACE_RECORD();
+
+        switch (FETCH8()) {
+#endif
+
+#include "run_ops.h"
+
+#ifndef RUN_COMPUTED_GOTO
+        }
+    }
+#endif
+
+leave:
+    SAVE_STATE();
+
+    cpu->cycles += done;
+    cpu->instructions += instr;
+
+    return done;
+}
+
+#undef RUN_EAGER_FLAGS
+#include "run_flags.h"
+
+#undef POLL
+#define POLL(addr, cycles)  IDLE_POLL(addr, cycles)
+
+#ifdef RUN_COMPUTED_GOTO
+#undef DISPATCH
+#define DISPATCH()          FETCH_DISPATCH()
+#endif
+
+/*
+    Every access goes through the page table, see Cpu8080.readPage. RAM and
+    ROM are one lookup and a test; handler pages and ROM stores leave
+    through MemReadSlow()/MemWriteSlow(). RunBlocks() below uses these too.
+*/
+#undef RD
+#undef WR
+#undef FETCH8
+#undef FETCH16
+#undef AFTER_TRAP
+#undef AFTER_OUT
+
+static inline uint8_t BusRead(Cpu8080 *cpu, uint16_t addr) {
+    const uint8_t *page = cpu->readPage[addr >> MEM_PAGE_SHIFT];
+
+    return page ? page[addr & (MEM_PAGE_SIZE - 1)] : MemReadSlow(cpu, addr);
+}
+
+#define RD(addr)            BusRead(cpu, (uint16_t)(addr))
+#define WR(addr, val) do {                                                  \
+        wa = (uint16_t)(addr);                                              \
+        wp = cpu->writePage[wa >> MEM_PAGE_SHIFT];                          \
+        if (!wp) {                                                          \
+            MemWriteSlow(cpu, wa, (uint8_t)(val));                          \
+        } else {                                                            \
+            wp[wa & (MEM_PAGE_SIZE - 1)] = (uint8_t)(val);                  \
+            dirtyPages[wa >> MEM_PAGE_SHIFT] = 1;                           \
+            if (codePages[wa >> CODE_PAGE_SHIFT]) {                         \
+                CodeWritten(cpu, wa);                                       \
+            }                                                               \
+        }                                                                   \
+    } while (0)
+#define FETCH8()            RD(pc++)
+#define FETCH16(dst)        do { (dst) = (uint16_t)(RD(pc) | (RD(pc + 1) << 8)); pc += 2; } while (0)
+
+/*
+    Reads the page table on every access, so a map change needs nothing,
+    but once memory is flat again (back in bank 0, say) yield is set and
+    it leaves after this instruction so Execute() can go back to the
+    faster engines.
+*/
+#define AFTER_TRAP()        ((void)(!cpu->yield || (cycleBudget = done)))
+#define AFTER_OUT()         AFTER_TRAP()
+
+static unsigned long long RunPaged(Cpu8080 *cpu, unsigned long long cycleBudget) {
+    const uint8_t *codePages = cpu->codePages;
+    uint8_t *dirtyPages = cpu->dirtyPages;
+    uint8_t *wp;
+    uint16_t pc, sp, bc, de, hl, w, wa;
+    uint32_t w32;
+    uint8_t a, f, t;
+    unsigned long long done = 0;
+    unsigned long long instr = 0;
+#ifdef RUN_LAZY_FLAGS
+    LazyFlags lz = { LAZY_NONE, 0, 0, 0 };
+#endif
+#ifdef RUN_OPCODE_PROFILE
+    unsigned int op;
+#endif
+
+    LOAD_STATE();
+
+#ifdef RUN_COMPUTED_GOTO
+    static const void *const labels[256] = {
+        OP_LABELS
+    };
+
+    DISPATCH();
+#else
+    for (;;) {
+        if (done >= cycleBudget) {
+            goto leave;
+        }
+
+        switch (FETCH8()) {
+#endif
+
+#include "run_ops.h"
+
+#ifndef RUN_COMPUTED_GOTO
+        }
+    }
+#endif
+
+leave:
+    SAVE_STATE();
+
+    cpu->cycles += done;
+    cpu->instructions += instr;
+
+    return done;
+}
+
+/*
+    RunBlocks() is Run() over the block cache (block.c). Instead of fetching
+    and decoding one opcode at a time it jumps through the pre-decoded
+    MicroOps of a block; the handlers are the same ones, only FETCH8/FETCH16
+    read the stored operand. Only the last instruction of a block can look
+    at pc, so pc is set to the block's fall-through address on entry rather
+    than per instruction.
+
+    The cycle budget and breakpoints are checked between blocks only (a
+    breakpoint always starts a block, see BuildBlock()). A block whose worst
+    case does not fit in what is left runs one instruction at a time, so we
+    stop at exactly the instruction Run() would have stopped at.
+
+    Blocks are decoded from memory[], so only the flat bus runs here; any
+    other memory map is handed to Run(), which is as fast on it.
+
+    Stores look at codeMap first. Hitting translated code drops the blocks
+    decoded from that byte and, if the running block was one of them, leaves
+    it after the current instruction. The per-byte map is as cheap to test
+    as cpu->codePages and data sharing a page with code (8080EXM is full of
+    it) never leaves the fast path.
+*/
+#undef RD
+#undef FETCH8
+#undef FETCH16
+#undef WR
+#undef OP
+#undef NEXT
+#undef AFTER_TRAP
+#undef AFTER_OUT
+
+#define FETCH8()            ((uint8_t)uop->operand)
+#define FETCH16(dst)        ((dst) = uop->operand)
+
+#define RD(addr)            mem[(uint16_t)(addr)]
+#define WR(addr, val) do {                                                  \
+        wa = (uint16_t)(addr);                                              \
+        mem[wa] = (uint8_t)(val);                                           \
+        dirtyPages[wa >> MEM_PAGE_SHIFT] = 1;                               \
+        if (codeMap[wa]) {                                                  \
+            cpu->codeGeneration++;                                          \
+            if (BlockInvalidate(cache, wa, blk)) {                          \
+                pc = uop->nextPC;                                           \
+                uop = stop;                                                 \
+            }                                                               \
+        }                                                                   \
+    } while (0)
+
+/*
+    The running block may have been dropped by a store from the trap
+    handler. If it set yield, leave at the end of this block too.
+*/
+#define AFTER_TRAP()        (uop = stop, (void)(!cpu->yield || (cycleBudget = done)))
+
+/* OUT and EI always end a block (see EndsBlock()), so this leaves right after them */
+#define AFTER_OUT()         ((void)(!cpu->yield || (cycleBudget = done)))
+
+#ifdef RUN_COMPUTED_GOTO
+#define OP(n)               op_##n: OPCODE(n)
+#define NEXT(cycles)        { done += (cycles); instr++; HISTOGRAM(cycles); goto *(++uop)->handler; }
+#else
+#define OP(n)               case 0x##n: OPCODE(n)
+#define NEXT(cycles)        { done += (cycles); instr++; HISTOGRAM(cycles); uop++; continue; }
+#endif
+
+unsigned long long RunBlocks(Cpu8080 *cpu, unsigned long long cycleBudget) {
+    BlockCache *cache = cpu->blocks;
+
+    if (cpu->halted) {
+        return 0;
+    }
+
+    if (!cache || !cpu->flatBus) {
+        return Run(cpu, cycleBudget);
+    }
+
+    cpu->yield = FALSE;
+
+    uint8_t *mem = cpu->memory;
+    const uint8_t *codeMap = cache->codeMap;
+    uint8_t *dirtyPages = cpu->dirtyPages;
+    uint16_t pc, sp, bc, de, hl, w, wa;
+    uint32_t w32;
+    uint8_t a, f, t;
+    unsigned long long done = 0;
+    unsigned long long instr = 0;
+    unsigned long long chained = 0;
+    unsigned long long lookups = 0;
+#ifdef RUN_LAZY_FLAGS
+    LazyFlags lz = { LAZY_NONE, 0, 0, 0 };
+#endif
+#ifdef RUN_OPCODE_PROFILE
+    unsigned int op;
+#endif
+    Bool breaks = (Bool)((cpu->stopMask & STOP_ON_BREAKPOINT) && cpu->breakCount);
+    Block *blk = NULL;
+    Block *next;
+    uint32_t blkId = 0;
+    int slot = 0;
+    const MicroOp *uop;
+    MicroOp stop[2];
+    MicroOp single[2];
+
+#ifdef RUN_COMPUTED_GOTO
+    static const void *const labels[BLOCK_OP_END + 1] = {
+        OP_LABELS,
+        &&block_end
+    };
+    const void *const *handlers = labels;
+#else
+    const void *const *handlers = NULL;
+#endif
+
+    /* stop[1] and single[1] are END sentinels that never chain */
+    memset(stop, 0, sizeof(stop));
+    stop[1].opcode = BLOCK_OP_END;
+    stop[1].handler = handlers ? handlers[BLOCK_OP_END] : NULL;
+    single[1] = stop[1];
+
+    LOAD_STATE();
+
+block_end:
+    if (done >= cycleBudget) {
+        goto leave;
+    }
+
+    if (breaks && instr && BreakpointAt(cpu, pc)) {
+        cpu->stopReason = STOP_BREAKPOINT;
+        goto leave;
+    }
+
+    next = NULL;
+
+    if (blk && blk->id == blkId) {
+        slot = pc != blk->fallThrough;
+        next = blk->link[slot];
+
+        if (next && (next->id != blk->linkId[slot] || next->startPC != pc)) {
+            next = NULL;
+        }
+    } else {
+        blk = NULL;
+    }
+
+    if (next) {
+        chained++;
+    } else {
+        lookups++;
+        next = BlockLookup(cache, cpu, pc, handlers);
+
+        /* The lookup may have evicted blk to make room for next */
+        if (blk && blk->id == blkId) {
+            blk->link[slot] = next;
+            blk->linkId[slot] = next->id;
+        }
+    }
+
+    if (cycleBudget - done < next->maxCycles) {
+        single[0] = next->ops[0];
+        blk = NULL;
+        uop = single;
+        pc = uop->nextPC;
+    } else {
+        blk = next;
+        blkId = next->id;
+        uop = next->ops;
+        pc = next->fallThrough;
+    }
+
+#ifdef RUN_COMPUTED_GOTO
+    goto *uop->handler;
+#else
+    for (;;) {
+        switch (uop->opcode) {
+#endif
+
+#include "run_ops.h"
+
+#ifndef RUN_COMPUTED_GOTO
+            default:
+                goto block_end;
+        }
+    }
+#endif
+
+leave:
+    SAVE_STATE();
+
+    cpu->cycles += done;
+    cpu->instructions += instr;
+    cache->stats.entries += chained + lookups;
+    cache->stats.chained += chained;
+
+    return done;
+}
+
+/*
+    One instruction per call, for Step() and for Run() while breakpoints are
+    set (Run() never looks at them). Stops where Execute() would have
+    stopped between blocks. While tracing, keeping a call graph or counting
+    memory accesses, every engine is Step() here.
+*/
+static unsigned long long RunSingle(Cpu8080 *cpu, unsigned long long cycleBudget) {
+    Bool breaks = (Bool)((cpu->stopMask & STOP_ON_BREAKPOINT) && cpu->breakCount);
+    unsigned long long done = 0;
+
+    cpu->yield = FALSE;
+
+    while (done < cycleBudget && !cpu->halted && !cpu->stopReason && !cpu->yield) {
+        if (breaks && done && BreakpointAt(cpu, cpu->PC)) {
+            cpu->stopReason = STOP_BREAKPOINT;
+            break;
+        }
+
+        if (cpu->engine != ENGINE_STEP && !cpu->trace && !cpu->callGraph && !cpu->heatmap) {
+            done += Run(cpu, 1);
+            continue;
+        }
+
+        if (cpu->trace) {
+            TraceInstruction(cpu->trace, cpu);
+        }
+
+        unsigned long long cycles = (unsigned long long)Step(cpu);
+
+        done += cycles;
+        cpu->cycles += cycles;
+        cpu->instructions++;
+
+        /* The EI a request was waiting for, see AFTER_EI() */
+        if (cpu->interruptPending && cpu->interruptsEnabled) {
+            break;
+        }
+    }
+
+    return done;
+}
+
+/*
+    Runs cpu->engine until one of the limits is reached (0 is no limit) or
+    something in stopMask happens, and says which. The engines only look at
+    the budget between blocks, so it is handed to them in batches: an
+    instruction limit becomes 4 cycles per instruction left (none is
+    shorter), which can never run past it, and the batches close in on it.
+    A breakpoint does not stop the first instruction, so calling Execute()
+    again after STOP_BREAKPOINT goes on from there.
+
+    Batches also end at the next event (see event.c); due events run and a
+    pending interrupt is taken between them. A HLT with interrupts on waits
+    for the next event instead of stopping, as long as one that may
+    interrupt is pending (see EventScheduleObserver()). With no cycle limit
+    it waits HALT_WAIT_LIMIT cycles at most.
+*/
+StopReason Execute(Cpu8080 *cpu, unsigned long long maxCycles, unsigned long long maxInstructions,
+    unsigned int stopMask) {
+    unsigned long long startCycles = cpu->cycles;
+    unsigned long long startInstructions = cpu->instructions;
+    unsigned long long haltCycles = cpu->cycles;
+
+    cpu->stopMask = stopMask;
+    cpu->stopReason = STOP_NONE;
+
+    for (;;) {
+        unsigned long long ranCycles = cpu->cycles - startCycles;
+        unsigned long long ranInstructions = cpu->instructions - startInstructions;
+        unsigned long long budget = ~0ULL;
+
+        /* Nothing can wake it */
+        if (cpu->halted && !(cpu->interruptsEnabled && (cpu->events.wakes || cpu->interruptPending))) {
+            return STOP_HALT;
+        }
+
+        if (!cpu->halted) {
+            haltCycles = cpu->cycles;
+        }
+
+        if (cpu->stopReason) {
+            return cpu->stopReason;
+        }
+
+        /* A batch that ended right in front of a breakpoint, even with the budget used up */
+        if ((stopMask & STOP_ON_BREAKPOINT) && ranInstructions && BreakpointAt(cpu, cpu->PC)) {
+            return STOP_BREAKPOINT;
+        }
+
+        if (maxCycles) {
+            if (ranCycles >= maxCycles) {
+                return STOP_BUDGET;
+            }
+
+            budget = maxCycles - ranCycles;
+        }
+
+        if (maxInstructions) {
+            if (ranInstructions >= maxInstructions) {
+                return STOP_BUDGET;
+            }
+
+            if (maxInstructions - ranInstructions < budget / 4) {
+                budget = (maxInstructions - ranInstructions) * 4;
+            }
+        }
+
+        if (EventNext(cpu) <= cpu->cycles) {
+            EventRunDue(cpu);
+        }
+
+        if (cpu->interruptPending && cpu->interruptsEnabled) {
+            /*
+                Not right after an EI (EI; RET returns first). A jump to an
+                address behind an EI byte only makes it one instruction late.
+            */
+            if (cpu->halted || MemPeek(cpu, (uint16_t)(cpu->PC - 1)) != EI_OPCODE) {
+                InterruptAccept(cpu);
+                continue;
+            }
+
+            budget = 1;
+        }
+
+        if (cpu->halted) {
+            unsigned long long wake = EventNext(cpu);
+
+            if (maxCycles && wake - startCycles > maxCycles) {
+                wake = startCycles + maxCycles;
+            }
+
+            /* Devices that keep ticking but never interrupt, and no limit to end it */
+            if (!maxCycles && wake - haltCycles > HALT_WAIT_LIMIT) {
+                return STOP_HALT;
+            }
+
+            cpu->cycles = wake;
+            continue;
+        }
+
+        if (EventNext(cpu) - cpu->cycles < budget) {
+            budget = EventNext(cpu) - cpu->cycles;
+        }
+
+        /* A trace on the flat bus is RunTraced() on every engine but Step, unless something below needs Step() */
+        if (cpu->trace && !cpu->callGraph && !cpu->heatmap && cpu->flatBus && cpu->engine != ENGINE_STEP &&
+            !((stopMask & STOP_ON_BREAKPOINT) && cpu->breakCount)) {
+            RunTraced(cpu, budget);
+            continue;
+        }
+
+        /*
+            Any other trace needs every instruction, a call graph the CALL
+            and RET of cpu.c and a heatmap its bus, and Block and JIT fall
+            back to Run() on a mapped bus, which never looks at breakpoints
+        */
+        if (cpu->trace || cpu->callGraph || cpu->heatmap || (!cpu->flatBus && (stopMask & STOP_ON_BREAKPOINT) && cpu->breakCount)) {
+            RunSingle(cpu, budget);
+            continue;
+        }
+
+        switch (cpu->engine) {
+            case ENGINE_JIT: {
+                RunJit(cpu, budget);
+                break;
+            }
+
+            case ENGINE_BLOCK: {
+                RunBlocks(cpu, budget);
+                break;
+            }
+
+            case ENGINE_RUN: {
+                if (!(stopMask & STOP_ON_BREAKPOINT) || !cpu->breakCount) {
+                    Run(cpu, budget);
+                    break;
+                }
+
+                RunSingle(cpu, budget);
+                break;
+            }
+
+            default: {
+                RunSingle(cpu, budget);
+                break;
+            }
+        }
+    }
+}
@@ -0,0 +1,85 @@
+/*
+    The flag macros for the handlers in run_ops.h, included by run.c. Like
+    run_ops.h this is not a normal header: it can be included again to
+    switch a function between lazy and eager flags. RUN_LAZY_FLAGS picks
+    the lazy ones unless RUN_EAGER_FLAGS is defined, which RunTraced() does
+    because it reads all of f in front of every instruction anyway.
+*/
+
+#undef FLAGS
+#undef SET_FLAGS
+#undef COND_NZ
+#undef COND_Z
+#undef COND_PO
+#undef COND_PE
+#undef COND_P
+#undef COND_M
+#undef ADD_OP
+#undef ADC_OP
+#undef SUB_OP
+#undef SBB_OP
+#undef CMP_OP
+#undef ANA_OP
+#undef XRA_OP
+#undef ORA_OP
+#undef INR_OP
+#undef DCR_OP
+#undef DAA_OP
+#undef COND_NC
+#undef COND_C
+
+#if defined(RUN_LAZY_FLAGS) && !defined(RUN_EAGER_FLAGS)
+/*
+    Lazy flags: ALU ops only record what they did (kind, operands, result)
+    and S/Z/P/AC are worked out when someone actually looks at them, which
+    is a conditional jump/call/ret on Z/S/P, PUSH PSW, DAA or leaving Run().
+    CY is cheap and read by ADC/SBB/rotates, so it is always kept in f.
+    When lz.kind is LAZY_NONE all of f is valid.
+*/
+#define FLAGS()             LazyMaterialize(&lz, f)
+#define SET_FLAGS(val)      (f = (uint8_t)(val), lz.kind = LAZY_NONE)
+
+#define COND_NZ             (lz.kind ? lz.result != 0 : !(f & 0x40))
+#define COND_Z              (lz.kind ? lz.result == 0 : (f & 0x40))
+#define COND_PO             (!(lz.kind ? FlagsZSP(lz.result) & 0x04 : f & 0x04))
+#define COND_PE             (lz.kind ? FlagsZSP(lz.result) & 0x04 : f & 0x04)
+#define COND_P              (!(lz.kind ? lz.result & 0x80 : f & 0x80))
+#define COND_M              (lz.kind ? lz.result & 0x80 : f & 0x80)
+
+#define ADD_OP(v)           (a = LazyAdd(&lz, &f, a, (v), 0))
+#define ADC_OP(v)           (a = LazyAdd(&lz, &f, a, (v), f & 0x01))
+#define SUB_OP(v)           (a = LazySub(&lz, &f, a, (v), 0))
+#define SBB_OP(v)           (a = LazySub(&lz, &f, a, (v), f & 0x01))
+#define CMP_OP(v)           ((void)LazySub(&lz, &f, a, (v), 0))
+#define ANA_OP(v)           (a = LazyAnd(&lz, &f, a, (v)))
+#define XRA_OP(v)           (a = LazyLogic(&lz, &f, a ^ (v)))
+#define ORA_OP(v)           (a = LazyLogic(&lz, &f, a | (v)))
+#define INR_OP(v)           LazyIncDec(&lz, LAZY_ADD, (v), 1)
+#define DCR_OP(v)           LazyIncDec(&lz, LAZY_SUB, (v), -1)
+#define DAA_OP()            (f = FLAGS(), lz.kind = LAZY_NONE, a = AluDaa(a, &f))
+#else
+#define FLAGS()             (f)
+#define SET_FLAGS(val)      (f = (uint8_t)(val))
+
+#define COND_NZ             (!(f & 0x40))
+#define COND_Z              (f & 0x40)
+#define COND_PO             (!(f & 0x04))
+#define COND_PE             (f & 0x04)
+#define COND_P              (!(f & 0x80))
+#define COND_M              (f & 0x80)
+
+#define ADD_OP(v)           (a = AluAdd(a, (v), 0, &f))
+#define ADC_OP(v)           (a = AluAdd(a, (v), f & 0x01, &f))
+#define SUB_OP(v)           (a = AluSub(a, (v), 0, &f))
+#define SBB_OP(v)           (a = AluSub(a, (v), f & 0x01, &f))
+#define CMP_OP(v)           ((void)AluSub(a, (v), 0, &f))
+#define ANA_OP(v)           (a = AluAnd(a, (v), &f))
+#define XRA_OP(v)           (a ^= (v), f = (uint8_t)(0x02 | FlagsZSP(a)))
+#define ORA_OP(v)           (a |= (v), f = (uint8_t)(0x02 | FlagsZSP(a)))
+#define INR_OP(v)           AluInr((v), &f)
+#define DCR_OP(v)           AluDcr((v), &f)
+#define DAA_OP()            (a = AluDaa(a, &f))
+#endif
+
+#define COND_NC             (!(f & 0x01))
+#define COND_C              (f & 0x01)
@@ -0,0 +1,1189 @@
+/*
+    The opcode handlers shared by Run(), RunTraced(), RunPaged() and
+    RunBlocks() in run.c. This is not a normal header: it is included once
+    inside each of those functions, after they have defined OP(), NEXT(),
+    RD(), FETCH8(), FETCH16(), WR(), AFTER_TRAP() and AFTER_OUT() for their
+    own way of dispatching. POLL(), AFTER_EI(), HISTOGRAM() and the flag
+    macros from run_flags.h are shared.
+*/
+
+    OP(00) /* NOP */
+        NEXT(4);
+
+    OP(01) /* LXI B */
+        FETCH16(bc);
+        NEXT(10);
+
+    OP(02) /* STAX B */
+        WR(bc, a);
+        NEXT(7);
+
+    OP(03) /* INX B */
+        bc++;
+        NEXT(5);
+
+    OP(04) /* INR B */
+        SET_HI(bc, INR_OP(HI(bc)));
+        NEXT(5);
+
+    OP(05) /* DCR B */
+        SET_HI(bc, DCR_OP(HI(bc)));
+        NEXT(5);
+
+    OP(06) /* MVI B */
+        SET_HI(bc, FETCH8());
+        NEXT(7);
+
+    OP(07) /* RLC */
+        t = (uint8_t)(a >> 7);
+        a = (uint8_t)((a << 1) | t);
+        f = (uint8_t)((f & ~0x01) | t);
+        NEXT(4);
+
+    OP(08) /* NOP (undocumented), TRAP_OPCODE */
+        w = (uint16_t)(pc - 1);
+
+        if (TrapAt(cpu, w)) {
+            SAVE_STATE();
+            t = (uint8_t)TrapFire(cpu, w);
+            LOAD_STATE();
+            AFTER_TRAP();
+
+            /* Halted, or Execute() wants to see every trap */
+            if (cpu->halted || cpu->stopReason) {
+                done += 4;
+                instr++;
+                HISTOGRAM(4);
+                goto leave;
+            }
+
+            if (t) {
+                POLL(w, 4);
+            }
+        }
+        NEXT(4);
+
+    OP(09) /* DAD B */
+        w32 = (uint32_t)hl + bc;
+        f = (uint8_t)((f & ~0x01) | (w32 >> 16));
+        hl = (uint16_t)w32;
+        NEXT(10);
+
+    OP(0a) /* LDAX B */
+        a = RD(bc);
+        NEXT(7);
+
+    OP(0b) /* DCX B */
+        bc--;
+        NEXT(5);
+
+    OP(0c) /* INR C */
+        SET_LO(bc, INR_OP(LO(bc)));
+        NEXT(5);
+
+    OP(0d) /* DCR C */
+        SET_LO(bc, DCR_OP(LO(bc)));
+        NEXT(5);
+
+    OP(0e) /* MVI C */
+        SET_LO(bc, FETCH8());
+        NEXT(7);
+
+    OP(0f) /* RRC */
+        t = (uint8_t)(a & 0x01);
+        a = (uint8_t)((a >> 1) | (t << 7));
+        f = (uint8_t)((f & ~0x01) | t);
+        NEXT(4);
+
+    OP(10) /* NOP */
+        NEXT(4);
+
+    OP(11) /* LXI D */
+        FETCH16(de);
+        NEXT(10);
+
+    OP(12) /* STAX D */
+        WR(de, a);
+        NEXT(7);
+
+    OP(13) /* INX D */
+        de++;
+        NEXT(5);
+
+    OP(14) /* INR D */
+        SET_HI(de, INR_OP(HI(de)));
+        NEXT(5);
+
+    OP(15) /* DCR D */
+        SET_HI(de, DCR_OP(HI(de)));
+        NEXT(5);
+
+    OP(16) /* MVI D */
+        SET_HI(de, FETCH8());
+        NEXT(7);
+
+    OP(17) /* RAL */
+        t = (uint8_t)(a >> 7);
+        a = (uint8_t)((a << 1) | (f & 0x01));
+        f = (uint8_t)((f & ~0x01) | t);
+        NEXT(4);
+
+    OP(18) /* NOP */
+        NEXT(4);
+
+    OP(19) /* DAD D */
+        w32 = (uint32_t)hl + de;
+        f = (uint8_t)((f & ~0x01) | (w32 >> 16));
+        hl = (uint16_t)w32;
+        NEXT(10);
+
+    OP(1a) /* LDAX D */
+        a = RD(de);
+        NEXT(7);
+
+    OP(1b) /* DCX D */
+        de--;
+        NEXT(5);
+
+    OP(1c) /* INR E */
+        SET_LO(de, INR_OP(LO(de)));
+        NEXT(5);
+
+    OP(1d) /* DCR E */
+        SET_LO(de, DCR_OP(LO(de)));
+        NEXT(5);
+
+    OP(1e) /* MVI E */
+        SET_LO(de, FETCH8());
+        NEXT(7);
+
+    OP(1f) /* RAR */
+        t = (uint8_t)(a & 0x01);
+        a = (uint8_t)((a >> 1) | ((f & 0x01) << 7));
+        f = (uint8_t)((f & ~0x01) | t);
+        NEXT(4);
+
+    OP(20) /* NOP */
+        NEXT(4);
+
+    OP(21) /* LXI H */
+        FETCH16(hl);
+        NEXT(10);
+
+    OP(22) /* SHLD */
+        FETCH16(w);
+        WR(w, LO(hl));
+        WR(w + 1, HI(hl));
+        NEXT(16);
+
+    OP(23) /* INX H */
+        hl++;
+        NEXT(5);
+
+    OP(24) /* INR H */
+        SET_HI(hl, INR_OP(HI(hl)));
+        NEXT(5);
+
+    OP(25) /* DCR H */
+        SET_HI(hl, DCR_OP(HI(hl)));
+        NEXT(5);
+
+    OP(26) /* MVI H */
+        SET_HI(hl, FETCH8());
+        NEXT(7);
+
+    OP(27) /* DAA */
+        DAA_OP();
+        NEXT(4);
+
+    OP(28) /* NOP */
+        NEXT(4);
+
+    OP(29) /* DAD H */
+        w32 = (uint32_t)hl + hl;
+        f = (uint8_t)((f & ~0x01) | (w32 >> 16));
+        hl = (uint16_t)w32;
+        NEXT(10);
+
+    OP(2a) /* LHLD */
+        FETCH16(w);
+        hl = (uint16_t)(RD(w) | (RD(w + 1) << 8));
+        NEXT(16);
+
+    OP(2b) /* DCX H */
+        hl--;
+        NEXT(5);
+
+    OP(2c) /* INR L */
+        SET_LO(hl, INR_OP(LO(hl)));
+        NEXT(5);
+
+    OP(2d) /* DCR L */
+        SET_LO(hl, DCR_OP(LO(hl)));
+        NEXT(5);
+
+    OP(2e) /* MVI L */
+        SET_LO(hl, FETCH8());
+        NEXT(7);
+
+    OP(2f) /* CMA */
+        a = (uint8_t)~a;
+        NEXT(4);
+
+    OP(30) /* NOP */
+        NEXT(4);
+
+    OP(31) /* LXI SP */
+        FETCH16(w);
+        sp = w;
+        NEXT(10);
+
+    OP(32) /* STA */
+        FETCH16(w);
+        WR(w, a);
+        NEXT(13);
+
+    OP(33) /* INX SP */
+        sp++;
+        NEXT(5);
+
+    OP(34) /* INR M */
+        w = hl;
+        t = INR_OP(RD(w));
+        WR(w, t);
+        NEXT(10);
+
+    OP(35) /* DCR M */
+        w = hl;
+        t = DCR_OP(RD(w));
+        WR(w, t);
+        NEXT(10);
+
+    OP(36) /* MVI M */
+        t = FETCH8();
+        WR(hl, t);
+        NEXT(10);
+
+    OP(37) /* STC */
+        f |= 0x01;
+        NEXT(4);
+
+    OP(38) /* NOP */
+        NEXT(4);
+
+    OP(39) /* DAD SP */
+        w32 = (uint32_t)hl + sp;
+        f = (uint8_t)((f & ~0x01) | (w32 >> 16));
+        hl = (uint16_t)w32;
+        NEXT(10);
+
+    OP(3a) /* LDA */
+        FETCH16(w);
+        a = RD(w);
+        NEXT(13);
+
+    OP(3b) /* DCX SP */
+        sp--;
+        NEXT(5);
+
+    OP(3c) /* INR A */
+        a = INR_OP(a);
+        NEXT(5);
+
+    OP(3d) /* DCR A */
+        a = DCR_OP(a);
+        NEXT(5);
+
+    OP(3e) /* MVI A */
+        a = FETCH8();
+        NEXT(7);
+
+    OP(3f) /* CMC */
+        f ^= 0x01;
+        NEXT(4);
+
+    OP(40) /* MOV B,B */
+        NEXT(5);
+
+    OP(41) /* MOV B,C */
+        SET_HI(bc, LO(bc));
+        NEXT(5);
+
+    OP(42) /* MOV B,D */
+        SET_HI(bc, HI(de));
+        NEXT(5);
+
+    OP(43) /* MOV B,E */
+        SET_HI(bc, LO(de));
+        NEXT(5);
+
+    OP(44) /* MOV B,H */
+        SET_HI(bc, HI(hl));
+        NEXT(5);
+
+    OP(45) /* MOV B,L */
+        SET_HI(bc, LO(hl));
+        NEXT(5);
+
+    OP(46) /* MOV B,M */
+        SET_HI(bc, RD(hl));
+        NEXT(7);
+
+    OP(47) /* MOV B,A */
+        SET_HI(bc, a);
+        NEXT(5);
+
+    OP(48) /* MOV C,B */
+        SET_LO(bc, HI(bc));
+        NEXT(5);
+
+    OP(49) /* MOV C,C */
+        NEXT(5);
+
+    OP(4a) /* MOV C,D */
+        SET_LO(bc, HI(de));
+        NEXT(5);
+
+    OP(4b) /* MOV C,E */
+        SET_LO(bc, LO(de));
+        NEXT(5);
+
+    OP(4c) /* MOV C,H */
+        SET_LO(bc, HI(hl));
+        NEXT(5);
+
+    OP(4d) /* MOV C,L */
+        SET_LO(bc, LO(hl));
+        NEXT(5);
+
+    OP(4e) /* MOV C,M */
+        SET_LO(bc, RD(hl));
+        NEXT(7);
+
+    OP(4f) /* MOV C,A */
+        SET_LO(bc, a);
+        NEXT(5);
+
+    OP(50) /* MOV D,B */
+        SET_HI(de, HI(bc));
+        NEXT(5);
+
+    OP(51) /* MOV D,C */
+        SET_HI(de, LO(bc));
+        NEXT(5);
+
+    OP(52) /* MOV D,D */
+        NEXT(5);
+
+    OP(53) /* MOV D,E */
+        SET_HI(de, LO(de));
+        NEXT(5);
+
+    OP(54) /* MOV D,H */
+        SET_HI(de, HI(hl));
+        NEXT(5);
+
+    OP(55) /* MOV D,L */
+        SET_HI(de, LO(hl));
+        NEXT(5);
+
+    OP(56) /* MOV D,M */
+        SET_HI(de, RD(hl));
+        NEXT(7);
+
+    OP(57) /* MOV D,A */
+        SET_HI(de, a);
+        NEXT(5);
+
+    OP(58) /* MOV E,B */
+        SET_LO(de, HI(bc));
+        NEXT(5);
+
+    OP(59) /* MOV E,C */
+        SET_LO(de, LO(bc));
+        NEXT(5);
+
+    OP(5a) /* MOV E,D */
+        SET_LO(de, HI(de));
+        NEXT(5);
+
+    OP(5b) /* MOV E,E */
+        NEXT(5);
+
+    OP(5c) /* MOV E,H */
+        SET_LO(de, HI(hl));
+        NEXT(5);
+
+    OP(5d) /* MOV E,L */
+        SET_LO(de, LO(hl));
+        NEXT(5);
+
+    OP(5e) /* MOV E,M */
+        SET_LO(de, RD(hl));
+        NEXT(7);
+
+    OP(5f) /* MOV E,A */
+        SET_LO(de, a);
+        NEXT(5);
+
+    OP(60) /* MOV H,B */
+        SET_HI(hl, HI(bc));
+        NEXT(5);
+
+    OP(61) /* MOV H,C */
+        SET_HI(hl, LO(bc));
+        NEXT(5);
+
+    OP(62) /* MOV H,D */
+        SET_HI(hl, HI(de));
+        NEXT(5);
+
+    OP(63) /* MOV H,E */
+        SET_HI(hl, LO(de));
+        NEXT(5);
+
+    OP(64) /* MOV H,H */
+        NEXT(5);
+
+    OP(65) /* MOV H,L */
+        SET_HI(hl, LO(hl));
+        NEXT(5);
+
+    OP(66) /* MOV H,M */
+        SET_HI(hl, RD(hl));
+        NEXT(7);
+
+    OP(67) /* MOV H,A */
+        SET_HI(hl, a);
+        NEXT(5);
+
+    OP(68) /* MOV L,B */
+        SET_LO(hl, HI(bc));
+        NEXT(5);
+
+    OP(69) /* MOV L,C */
+        SET_LO(hl, LO(bc));
+        NEXT(5);
+
+    OP(6a) /* MOV L,D */
+        SET_LO(hl, HI(de));
+        NEXT(5);
+
+    OP(6b) /* MOV L,E */
+        SET_LO(hl, LO(de));
+        NEXT(5);
+
+    OP(6c) /* MOV L,H */
+        SET_LO(hl, HI(hl));
+        NEXT(5);
+
+    OP(6d) /* MOV L,L */
+        NEXT(5);
+
+    OP(6e) /* MOV L,M */
+        SET_LO(hl, RD(hl));
+        NEXT(7);
+
+    OP(6f) /* MOV L,A */
+        SET_LO(hl, a);
+        NEXT(5);
+
+    OP(70) /* MOV M,B */
+        WR(hl, HI(bc));
+        NEXT(7);
+
+    OP(71) /* MOV M,C */
+        WR(hl, LO(bc));
+        NEXT(7);
+
+    OP(72) /* MOV M,D */
+        WR(hl, HI(de));
+        NEXT(7);
+
+    OP(73) /* MOV M,E */
+        WR(hl, LO(de));
+        NEXT(7);
+
+    OP(74) /* MOV M,H */
+        WR(hl, HI(hl));
+        NEXT(7);
+
+    OP(75) /* MOV M,L */
+        WR(hl, LO(hl));
+        NEXT(7);
+
+    OP(76) /* HLT */
+        cpu->halted = TRUE;
+        done += 7;
+        instr++;
+        HISTOGRAM(7);
+        goto leave;
+
+    OP(77) /* MOV M,A */
+        WR(hl, a);
+        NEXT(7);
+
+    OP(78) /* MOV A,B */
+        a = HI(bc);
+        NEXT(5);
+
+    OP(79) /* MOV A,C */
+        a = LO(bc);
+        NEXT(5);
+
+    OP(7a) /* MOV A,D */
+        a = HI(de);
+        NEXT(5);
+
+    OP(7b) /* MOV A,E */
+        a = LO(de);
+        NEXT(5);
+
+    OP(7c) /* MOV A,H */
+        a = HI(hl);
+        NEXT(5);
+
+    OP(7d) /* MOV A,L */
+        a = LO(hl);
+        NEXT(5);
+
+    OP(7e) /* MOV A,M */
+        a = RD(hl);
+        NEXT(7);
+
+    OP(7f) /* MOV A,A */
+        NEXT(5);
+
+    OP(80) /* ADD B */
+        ADD_OP(HI(bc));
+        NEXT(4);
+
+    OP(81) /* ADD C */
+        ADD_OP(LO(bc));
+        NEXT(4);
+
+    OP(82) /* ADD D */
+        ADD_OP(HI(de));
+        NEXT(4);
+
+    OP(83) /* ADD E */
+        ADD_OP(LO(de));
+        NEXT(4);
+
+    OP(84) /* ADD H */
+        ADD_OP(HI(hl));
+        NEXT(4);
+
+    OP(85) /* ADD L */
+        ADD_OP(LO(hl));
+        NEXT(4);
+
+    OP(86) /* ADD M */
+        ADD_OP(RD(hl));
+        NEXT(7);
+
+    OP(87) /* ADD A */
+        ADD_OP(a);
+        NEXT(4);
+
+    OP(88) /* ADC B */
+        ADC_OP(HI(bc));
+        NEXT(4);
+
+    OP(89) /* ADC C */
+        ADC_OP(LO(bc));
+        NEXT(4);
+
+    OP(8a) /* ADC D */
+        ADC_OP(HI(de));
+        NEXT(4);
+
+    OP(8b) /* ADC E */
+        ADC_OP(LO(de));
+        NEXT(4);
+
+    OP(8c) /* ADC H */
+        ADC_OP(HI(hl));
+        NEXT(4);
+
+    OP(8d) /* ADC L */
+        ADC_OP(LO(hl));
+        NEXT(4);
+
+    OP(8e) /* ADC M */
+        ADC_OP(RD(hl));
+        NEXT(7);
+
+    OP(8f) /* ADC A */
+        ADC_OP(a);
+        NEXT(4);
+
+    OP(90) /* SUB B */
+        SUB_OP(HI(bc));
+        NEXT(4);
+
+    OP(91) /* SUB C */
+        SUB_OP(LO(bc));
+        NEXT(4);
+
+    OP(92) /* SUB D */
+        SUB_OP(HI(de));
+        NEXT(4);
+
+    OP(93) /* SUB E */
+        SUB_OP(LO(de));
+        NEXT(4);
+
+    OP(94) /* SUB H */
+        SUB_OP(HI(hl));
+        NEXT(4);
+
+    OP(95) /* SUB L */
+        SUB_OP(LO(hl));
+        NEXT(4);
+
+    OP(96) /* SUB M */
+        SUB_OP(RD(hl));
+        NEXT(7);
+
+    OP(97) /* SUB A */
+        SUB_OP(a);
+        NEXT(4);
+
+    OP(98) /* SBB B */
+        SBB_OP(HI(bc));
+        NEXT(4);
+
+    OP(99) /* SBB C */
+        SBB_OP(LO(bc));
+        NEXT(4);
+
+    OP(9a) /* SBB D */
+        SBB_OP(HI(de));
+        NEXT(4);
+
+    OP(9b) /* SBB E */
+        SBB_OP(LO(de));
+        NEXT(4);
+
+    OP(9c) /* SBB H */
+        SBB_OP(HI(hl));
+        NEXT(4);
+
+    OP(9d) /* SBB L */
+        SBB_OP(LO(hl));
+        NEXT(4);
+
+    OP(9e) /* SBB M */
+        SBB_OP(RD(hl));
+        NEXT(7);
+
+    OP(9f) /* SBB A */
+        SBB_OP(a);
+        NEXT(4);
+
+    OP(a0) /* ANA B */
+        ANA_OP(HI(bc));
+        NEXT(4);
+
+    OP(a1) /* ANA C */
+        ANA_OP(LO(bc));
+        NEXT(4);
+
+    OP(a2) /* ANA D */
+        ANA_OP(HI(de));
+        NEXT(4);
+
+    OP(a3) /* ANA E */
+        ANA_OP(LO(de));
+        NEXT(4);
+
+    OP(a4) /* ANA H */
+        ANA_OP(HI(hl));
+        NEXT(4);
+
+    OP(a5) /* ANA L */
+        ANA_OP(LO(hl));
+        NEXT(4);
+
+    OP(a6) /* ANA M */
+        ANA_OP(RD(hl));
+        NEXT(7);
+
+    OP(a7) /* ANA A */
+        ANA_OP(a);
+        NEXT(4);
+
+    OP(a8) /* XRA B */
+        XRA_OP(HI(bc));
+        NEXT(4);
+
+    OP(a9) /* XRA C */
+        XRA_OP(LO(bc));
+        NEXT(4);
+
+    OP(aa) /* XRA D */
+        XRA_OP(HI(de));
+        NEXT(4);
+
+    OP(ab) /* XRA E */
+        XRA_OP(LO(de));
+        NEXT(4);
+
+    OP(ac) /* XRA H */
+        XRA_OP(HI(hl));
+        NEXT(4);
+
+    OP(ad) /* XRA L */
+        XRA_OP(LO(hl));
+        NEXT(4);
+
+    OP(ae) /* XRA M */
+        XRA_OP(RD(hl));
+        NEXT(7);
+
+    OP(af) /* XRA A */
+        XRA_OP(a);
+        NEXT(4);
+
+    OP(b0) /* ORA B */
+        ORA_OP(HI(bc));
+        NEXT(4);
+
+    OP(b1) /* ORA C */
+        ORA_OP(LO(bc));
+        NEXT(4);
+
+    OP(b2) /* ORA D */
+        ORA_OP(HI(de));
+        NEXT(4);
+
+    OP(b3) /* ORA E */
+        ORA_OP(LO(de));
+        NEXT(4);
+
+    OP(b4) /* ORA H */
+        ORA_OP(HI(hl));
+        NEXT(4);
+
+    OP(b5) /* ORA L */
+        ORA_OP(LO(hl));
+        NEXT(4);
+
+    OP(b6) /* ORA M */
+        ORA_OP(RD(hl));
+        NEXT(7);
+
+    OP(b7) /* ORA A */
+        ORA_OP(a);
+        NEXT(4);
+
+    OP(b8) /* CMP B */
+        CMP_OP(HI(bc));
+        NEXT(4);
+
+    OP(b9) /* CMP C */
+        CMP_OP(LO(bc));
+        NEXT(4);
+
+    OP(ba) /* CMP D */
+        CMP_OP(HI(de));
+        NEXT(4);
+
+    OP(bb) /* CMP E */
+        CMP_OP(LO(de));
+        NEXT(4);
+
+    OP(bc) /* CMP H */
+        CMP_OP(HI(hl));
+        NEXT(4);
+
+    OP(bd) /* CMP L */
+        CMP_OP(LO(hl));
+        NEXT(4);
+
+    OP(be) /* CMP M */
+        CMP_OP(RD(hl));
+        NEXT(7);
+
+    OP(bf) /* CMP A */
+        CMP_OP(a);
+        NEXT(4);
+
+    OP(c0) /* RNZ */
+        if (COND_NZ) {
+            POP16(pc);
+            NEXT(11);
+        }
+        NEXT(5);
+
+    OP(c1) /* POP B */
+        POP16(bc);
+        NEXT(10);
+
+    OP(c2) /* JNZ */
+        FETCH16(w);
+        if (COND_NZ) {
+            pc = w;
+        }
+        NEXT(10);
+
+    OP(c3) /* JMP */
+        FETCH16(w);
+        pc = w;
+        NEXT(10);
+
+    OP(c4) /* CNZ */
+        FETCH16(w);
+        if (COND_NZ) {
+            PUSH16(pc);
+            pc = w;
+            NEXT(17);
+        }
+        NEXT(11);
+
+    OP(c5) /* PUSH B */
+        PUSH16(bc);
+        NEXT(11);
+
+    OP(c6) /* ADI */
+        ADD_OP(FETCH8());
+        NEXT(7);
+
+    OP(c7) /* RST 0 */
+        PUSH16(pc);
+        pc = 0x0000;
+        NEXT(11);
+
+    OP(c8) /* RZ */
+        if (COND_Z) {
+            POP16(pc);
+            NEXT(11);
+        }
+        NEXT(5);
+
+    OP(c9) /* RET */
+        POP16(pc);
+        NEXT(10);
+
+    OP(ca) /* JZ */
+        FETCH16(w);
+        if (COND_Z) {
+            pc = w;
+        }
+        NEXT(10);
+
+    OP(cb) /* JMP (undocumented) */
+        FETCH16(w);
+        pc = w;
+        NEXT(10);
+
+    OP(cc) /* CZ */
+        FETCH16(w);
+        if (COND_Z) {
+            PUSH16(pc);
+            pc = w;
+            NEXT(17);
+        }
+        NEXT(11);
+
+    OP(cd) /* CALL */
+        FETCH16(w);
+        PUSH16(pc);
+        pc = w;
+        NEXT(17);
+
+    OP(ce) /* ACI */
+        ADC_OP(FETCH8());
+        NEXT(7);
+
+    OP(cf) /* RST 1 */
+        PUSH16(pc);
+        pc = 0x0008;
+        NEXT(11);
+
+    OP(d0) /* RNC */
+        if (COND_NC) {
+            POP16(pc);
+            NEXT(11);
+        }
+        NEXT(5);
+
+    OP(d1) /* POP D */
+        POP16(de);
+        NEXT(10);
+
+    OP(d2) /* JNC */
+        FETCH16(w);
+        if (COND_NC) {
+            pc = w;
+        }
+        NEXT(10);
+
+    OP(d3) /* OUT */
+        t = FETCH8();
+        IOWrite(cpu, t, a);
+        AFTER_OUT();
+        NEXT(10);
+
+    OP(d4) /* CNC */
+        FETCH16(w);
+        if (COND_NC) {
+            PUSH16(pc);
+            pc = w;
+            NEXT(17);
+        }
+        NEXT(11);
+
+    OP(d5) /* PUSH D */
+        PUSH16(de);
+        NEXT(11);
+
+    OP(d6) /* SUI */
+        SUB_OP(FETCH8());
+        NEXT(7);
+
+    OP(d7) /* RST 2 */
+        PUSH16(pc);
+        pc = 0x0010;
+        NEXT(11);
+
+    OP(d8) /* RC */
+        if (COND_C) {
+            POP16(pc);
+            NEXT(11);
+        }
+        NEXT(5);
+
+    OP(d9) /* RET (undocumented) */
+        POP16(pc);
+        NEXT(10);
+
+    OP(da) /* JC */
+        FETCH16(w);
+        if (COND_C) {
+            pc = w;
+        }
+        NEXT(10);
+
+    OP(db) /* IN */
+        t = FETCH8();
+        SYNC_INSTRUCTIONS();
+        a = IORead(cpu, t);
+        POLL((uint16_t)(pc - 2), 10);
+        NEXT(10);
+
+    OP(dc) /* CC */
+        FETCH16(w);
+        if (COND_C) {
+            PUSH16(pc);
+            pc = w;
+            NEXT(17);
+        }
+        NEXT(11);
+
+    OP(dd) /* CALL (undocumented) */
+        FETCH16(w);
+        PUSH16(pc);
+        pc = w;
+        NEXT(17);
+
+    OP(de) /* SBI */
+        SBB_OP(FETCH8());
+        NEXT(7);
+
+    OP(df) /* RST 3 */
+        PUSH16(pc);
+        pc = 0x0018;
+        NEXT(11);
+
+    OP(e0) /* RPO */
+        if (COND_PO) {
+            POP16(pc);
+            NEXT(11);
+        }
+        NEXT(5);
+
+    OP(e1) /* POP H */
+        POP16(hl);
+        NEXT(10);
+
+    OP(e2) /* JPO */
+        FETCH16(w);
+        if (COND_PO) {
+            pc = w;
+        }
+        NEXT(10);
+
+    OP(e3) /* XTHL */
+        w = (uint16_t)(RD(sp) | (RD(sp + 1) << 8));
+        WR(sp, LO(hl));
+        WR(sp + 1, HI(hl));
+        hl = w;
+        NEXT(18);
+
+    OP(e4) /* CPO */
+        FETCH16(w);
+        if (COND_PO) {
+            PUSH16(pc);
+            pc = w;
+            NEXT(17);
+        }
+        NEXT(11);
+
+    OP(e5) /* PUSH H */
+        PUSH16(hl);
+        NEXT(11);
+
+    OP(e6) /* ANI */
+        ANA_OP(FETCH8());
+        NEXT(7);
+
+    OP(e7) /* RST 4 */
+        PUSH16(pc);
+        pc = 0x0020;
+        NEXT(11);
+
+    OP(e8) /* RPE */
+        if (COND_PE) {
+            POP16(pc);
+            NEXT(11);
+        }
+        NEXT(5);
+
+    OP(e9) /* PCHL */
+        pc = hl;
+        NEXT(5);
+
+    OP(ea) /* JPE */
+        FETCH16(w);
+        if (COND_PE) {
+            pc = w;
+        }
+        NEXT(10);
+
+    OP(eb) /* XCHG */
+        w = hl;
+        hl = de;
+        de = w;
+        NEXT(5);
+
+    OP(ec) /* CPE */
+        FETCH16(w);
+        if (COND_PE) {
+            PUSH16(pc);
+            pc = w;
+            NEXT(17);
+        }
+        NEXT(11);
+
+    OP(ed) /* CALL (undocumented) */
+        FETCH16(w);
+        PUSH16(pc);
+        pc = w;
+        NEXT(17);
+
+    OP(ee) /* XRI */
+        XRA_OP(FETCH8());
+        NEXT(7);
+
+    OP(ef) /* RST 5 */
+        PUSH16(pc);
+        pc = 0x0028;
+        NEXT(11);
+
+    OP(f0) /* RP */
+        if (COND_P) {
+            POP16(pc);
+            NEXT(11);
+        }
+        NEXT(5);
+
+    OP(f1) /* POP PSW */
+        t = RD(sp);
+        a = RD(sp + 1);
+        sp += 2;
+        SET_FLAGS(0x02 | (t & 0xD5));
+        NEXT(10);
+
+    OP(f2) /* JP */
+        FETCH16(w);
+        if (COND_P) {
+            pc = w;
+        }
+        NEXT(10);
+
+    OP(f3) /* DI */
+        cpu->interruptsEnabled = FALSE;
+        NEXT(4);
+
+    OP(f4) /* CP */
+        FETCH16(w);
+        if (COND_P) {
+            PUSH16(pc);
+            pc = w;
+            NEXT(17);
+        }
+        NEXT(11);
+
+    OP(f5) /* PUSH PSW */
+        WR(sp - 1, a);
+        WR(sp - 2, 0x02 | (FLAGS() & 0xD5));
+        sp -= 2;
+        NEXT(11);
+
+    OP(f6) /* ORI */
+        ORA_OP(FETCH8());
+        NEXT(7);
+
+    OP(f7) /* RST 6 */
+        PUSH16(pc);
+        pc = 0x0030;
+        NEXT(11);
+
+    OP(f8) /* RM */
+        if (COND_M) {
+            POP16(pc);
+            NEXT(11);
+        }
+        NEXT(5);
+
+    OP(f9) /* SPHL */
+        sp = hl;
+        NEXT(5);
+
+    OP(fa) /* JM */
+        FETCH16(w);
+        if (COND_M) {
+            pc = w;
+        }
+        NEXT(10);
+
+    OP(fb) /* EI */
+        cpu->interruptsEnabled = TRUE;
+        AFTER_EI();
+        NEXT(4);
+
+    OP(fc) /* CM */
+        FETCH16(w);
+        if (COND_M) {
+            PUSH16(pc);
+            pc = w;
+            NEXT(17);
+        }
+        NEXT(11);
+
+    OP(fd) /* CALL (undocumented) */
+        FETCH16(w);
+        PUSH16(pc);
+        pc = w;
+        NEXT(17);
+
+    OP(fe) /* CPI */
+        CMP_OP(FETCH8());
+        NEXT(7);
+
+    OP(ff) /* RST 7 */
+        PUSH16(pc);
+        pc = 0x0038;
+        NEXT(11);
@@ -0,0 +1,2779 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cpu.h"
+#include "flags.h"
+#include "block.h"
+#include "jit.h"
+#include "idle.h"
+#include "bank.h"
+#include "event.h"
+#include "state.h"
+#include "replay.h"
+#include "timeline.h"
+#include "trace.h"
+#include "histogram.h"
+#include "profile.h"
+#include "callgraph.h"
+#include "heatmap.h"
+
+/*
+    Exhaustive check of the flag tables (run with --selfcheck).
+
+    The Ref* functions are the original bit-by-bit flag code from cpu.c,
+    kept here as the reference. Every (a, b, carry) combination of every
+    ALU op is pushed through the cpu.c helpers, the Run() engine and, where
+    there is one, the JIT, and compared with it, result and whole flag byte.
+*/
+
+typedef enum {
+    CHECK_ADD = 0,
+    CHECK_ADC,
+    CHECK_SUB,
+    CHECK_SBB,
+    CHECK_CMP,
+    CHECK_ANA,
+    CHECK_XRA,
+    CHECK_ORA,
+    CHECK_INR,
+    CHECK_DCR,
+    CHECK_DAA,
+    CHECK_COUNT
+} CheckOp;
+
+static const char *checkNames[CHECK_COUNT] = {
+    "ADD", "ADC", "SUB", "SBB", "CMP", "ANA", "XRA", "ORA", "INR", "DCR", "DAA"
+};
+
+/* ADD B .. CMP B, ANA B, XRA B, ORA B, INR A, DCR A, DAA */
+static const uint8_t checkOpcodes[CHECK_COUNT] = {
+    0x80, 0x88, 0x90, 0x98, 0xB8, 0xA0, 0xA8, 0xB0, 0x3C, 0x3D, 0x27
+};
+
+static uint8_t RefParity(uint8_t value) {
+    uint8_t count = 0;
+    
+    for (int i = 0; i < 8; i++) {
+        if (value & (1 << i)) {
+            count++;
+        }
+    }
+    
+    return (count % 2) == 0;
+}
+
+static void RefSet(uint8_t *flags, Flags flagBit, int on) {
+    if (on) {
+        *flags |= (1 << flagBit);
+    } else {
+        *flags &= ~(1 << flagBit);
+    }
+}
+
+static void RefZSP(uint8_t *flags, uint8_t result) {
+    RefSet(flags, FLAG_ZERO, result == 0);
+    RefSet(flags, FLAG_SIGN, result & 0x80);
+    RefSet(flags, FLAG_PARITY, RefParity(result));
+}
+
+static uint8_t RefAlu(CheckOp op, uint8_t a, uint8_t b, uint8_t *flags) {
+    uint8_t carry = *flags & 0x01;
+    uint16_t result;
+
+    switch (op) {
+        case CHECK_ADD:
+        case CHECK_ADC: {
+            uint8_t carry_in = (op == CHECK_ADC) ? carry : 0;
+
+            result = a + b + carry_in;
+            RefZSP(flags, (uint8_t)result);
+            RefSet(flags, FLAG_CARRY, result & 0x100);
+            RefSet(flags, FLAG_AUXILIARY_CARRY, ((a & 0x0F) + (b & 0x0F) + carry_in) & 0x10);
+            return (uint8_t)result;
+        }
+
+        case CHECK_SUB:
+        case CHECK_SBB:
+        case CHECK_CMP: {
+            uint8_t borrow_in = (op == CHECK_SBB) ? carry : 0;
+
+            result = a - b - borrow_in;
+            RefZSP(flags, (uint8_t)result);
+            RefSet(flags, FLAG_CARRY, result & 0xFF00);
+            RefSet(flags, FLAG_AUXILIARY_CARRY, (a & 0x0F) >= ((b & 0x0F) + borrow_in));
+            return (op == CHECK_CMP) ? a : (uint8_t)result;
+        }
+
+        case CHECK_ANA:
+        case CHECK_XRA:
+        case CHECK_ORA: {
+            result = (op == CHECK_ANA) ? (a & b) : (op == CHECK_XRA) ? (a ^ b) : (a | b);
+            *flags = 0x02;
+            RefZSP(flags, (uint8_t)result);
+            RefSet(flags, FLAG_AUXILIARY_CARRY, (op == CHECK_ANA) && ((a | b) & 0x08));
+            return (uint8_t)result;
+        }
+
+        case CHECK_INR: {
+            result = a + 1;
+            RefZSP(flags, (uint8_t)result);
+            RefSet(flags, FLAG_AUXILIARY_CARRY, ((a & 0x0F) + 1) & 0x10);
+            return (uint8_t)result;
+        }
+
+        case CHECK_DCR: {
+            result = a - 1;
+            RefZSP(flags, (uint8_t)result);
+            RefSet(flags, FLAG_AUXILIARY_CARRY, (a & 0x0F) >= 1);
+            return (uint8_t)result;
+        }
+
+        case CHECK_DAA: {
+            uint8_t adjust = 0;
+            uint8_t ac = (*flags >> FLAG_AUXILIARY_CARRY) & 1;
+
+            if ((a & 0x0F) > 9 || ac) {
+                adjust += 0x06;
+            }
+
+            RefSet(flags, FLAG_CARRY, a > 0x99 || carry);
+
+            if (a > 0x99 || carry) {
+                adjust += 0x60;
+            }
+
+            result = a + adjust;
+            RefSet(flags, FLAG_AUXILIARY_CARRY, ((a & 0x0F) + (adjust & 0x0F)) & 0x10);
+            RefZSP(flags, (uint8_t)result);
+            return (uint8_t)result;
+        }
+
+        default: {
+            return a;
+        }
+    }
+}
+
+typedef enum {
+    CHECK_STEP = 0,
+    CHECK_RUN,
+    CHECK_JIT,
+    CHECK_ENGINES
+} CheckEngine;
+
+static const char *engineNames[CHECK_ENGINES] = {
+    "Step", "Run", "Jit"
+};
+
+/*
+    Drives the same instruction through opcodeTable (the cpu.c helpers),
+    Run() or the JIT. The JIT block is the instruction and a HLT, translated
+    once per opcode (the caller flushes when the opcode changes).
+*/
+static void FlagExecute(Cpu8080 *cpu, CheckEngine engine, uint8_t opcode, uint8_t a, uint8_t b, uint8_t flags) {
+    cpu->registers[REG_A] = a;
+    cpu->registers[REG_B] = b;
+    cpu->flags = flags;
+    cpu->halted = FALSE;
+    cpu->memory[0x0000] = opcode;
+    cpu->memory[0x0001] = 0x76;
+    cpu->PC = 0x0000;
+
+    switch (engine) {
+        case CHECK_RUN: {
+            Run(cpu, 1);
+            break;
+        }
+
+        case CHECK_JIT: {
+            RunJit(cpu, 100);
+            break;
+        }
+
+        default: {
+            opcodeTable[opcode](cpu);
+            break;
+        }
+    }
+}
+
+int FlagTableSelfCheck(void) {
+    Cpu8080 *cpu = (Cpu8080 *)malloc(sizeof(Cpu8080));
+    unsigned long combos = 0;
+    unsigned long mismatches = 0;
+
+    if (!cpu) {
+        fprintf(stderr, "Error: Could not allocate machine state\n");
+        return -1;
+    }
+
+    CpuInit(cpu);
+
+    int engines = CHECK_JIT;
+    JitCache *jit = (JitCache *)malloc(sizeof(JitCache));
+
+    if (jit && JitCacheInit(jit) == 0) {
+        cpu->jit = jit;
+        engines = CHECK_ENGINES;
+    }
+
+    for (int op = 0; op < CHECK_COUNT; op++) {
+        if (cpu->jit) {
+            JitFlush(cpu->jit);
+        }
+
+        for (int a = 0; a < 256; a++) {
+            for (int b = 0; b < 256; b++) {
+                /* carry in, and for DAA every AC/CY combination */
+                for (int in = 0; in < 4; in++) {
+                    uint8_t flags = (uint8_t)(0x02 | (in & 1) | ((in & 2) << 3));
+                    uint8_t refFlags = flags;
+                    uint8_t refA = RefAlu((CheckOp)op, (uint8_t)a, (uint8_t)b, &refFlags);
+
+                    for (int engine = 0; engine < engines; engine++) {
+                        FlagExecute(cpu, (CheckEngine)engine, checkOpcodes[op], (uint8_t)a, (uint8_t)b, flags);
+                        combos++;
+
+                        if (cpu->registers[REG_A] != refA || cpu->flags != refFlags) {
+                            if (mismatches < 10) {
+                                printf("[selfcheck] %s %s a=%02X b=%02X flags=%02X: got A=%02X F=%02X, expected A=%02X F=%02X\n",
+                                    engineNames[engine], checkNames[op], a, b, flags,
+                                    cpu->registers[REG_A], cpu->flags, refA, refFlags);
+                            }
+
+                            mismatches++;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    printf("[selfcheck] %lu combinations checked, %lu mismatches\n", combos, mismatches);
+
+    if (jit) {
+        JitCacheFree(jit);
+        free(jit);
+    }
+
+    free(cpu);
+    return (int)(mismatches != 0);
+}
+
+/*
+    Self-modifying code check (also run by --selfcheck). The guest program
+    below patches its own code every way a store can reach it: STA into the
+    running block just ahead of PC, MOV M, SHLD and STAX into the block it
+    jumps to next, and PUSH and CALL with SP pointed into code. Step() is
+    the plain interpreter and the reference; every other engine has to end
+    in the same state, once with one big budget and once in small slices
+    so the paths that run a block's tail one instruction at a time get
+    their turn. The caching engines also have to have noticed the writes.
+*/
+
+#define SMC_ORIGIN                  0x0100
+#define SMC_STACK                   0xF000
+#define SMC_MAX_CALLS               1000000
+
+static const uint8_t smcProgram[] = {
+0x06, 0x0A,                 /* 0100  MVI B,10 */
+    0x0E, 0x00,                 /* 0102  MVI C,0 */
+    0x78,                       /* 0104  MOV A,B */
+    0x32, 0x09, 0x01,           /* 0105  STA patch1+1 */
+    0x16, 0x00,                 /* 0108  MVI D,0 */
+    0x79,                       /* 010A  MOV A,C */
+    0x82,                       /* 010B  ADD D */
+    0x4F,                       /* 010C  MOV C,A */
+    0x78,                       /* 010D  MOV A,B */
+    0xE6, 0x01,                 /* 010E  ANI 1 */
+    0xC6, 0x0C,                 /* 0110  ADI 0CH */
+    0x21, 0x19, 0x01,           /* 0112  LXI H,patch2 */
+    0x77,                       /* 0115  MOV M,A */
+    0xC3, 0x19, 0x01,           /* 0116  JMP patch2 */
+    0x00,                       /* 0119  NOP */
+    0x21, 0x34, 0x12,           /* 011A  LXI H,1234H */
+    0x09,                       /* 011D  DAD B */
+    0x22, 0x25, 0x01,           /* 011E  SHLD patch3+1 */
+    0xC3, 0x24, 0x01,           /* 0121  JMP patch3 */
+    0x11, 0x00, 0x00,           /* 0124  LXI D,0 */
+    0x7B,                       /* 0127  MOV A,E */
+    0xA9,                       /* 0128  XRA C */
+    0x4F,                       /* 0129  MOV C,A */
+    0x11, 0x34, 0x01,           /* 012A  LXI D,patch4+1 */
+    0x78,                       /* 012D  MOV A,B */
+    0x07,                       /* 012E  RLC */
+    0x12,                       /* 012F  STAX D */
+    0xC3, 0x33, 0x01,           /* 0130  JMP patch4 */
+    0x1E, 0x00,                 /* 0133  MVI E,0 */
+    0x79,                       /* 0135  MOV A,C */
+    0x83,                       /* 0136  ADD E */
+    0x4F,                       /* 0137  MOV C,A */
+    0x21, 0x00, 0x00,           /* 0138  LXI H,0 */
+    0x39,                       /* 013B  DAD SP */
+    0x22, 0x62, 0x01,           /* 013C  SHLD savesp */
+    0x31, 0x54, 0x01,           /* 013F  LXI SP,patch5+3 */
+    0xD5,                       /* 0142  PUSH D */
+    0x31, 0x5A, 0x01,           /* 0143  LXI SP,patch6+3 */
+    0xCD, 0x50, 0x01,           /* 0146  CALL sub */
+    0x2A, 0x62, 0x01,           /* 0149  LHLD savesp */
+    0xF9,                       /* 014C  SPHL */
+    0xC3, 0x51, 0x01,           /* 014D  JMP patch5 */
+    0xC9,                       /* 0150  RET */
+    0x21, 0x00, 0x00,           /* 0151  LXI H,0 */
+    0x7D,                       /* 0154  MOV A,L */
+    0x81,                       /* 0155  ADD C */
+    0x4F,                       /* 0156  MOV C,A */
+    0x21, 0x00, 0x00,           /* 0157  LXI H,0 */
+    0x7D,                       /* 015A  MOV A,L */
+    0x81,                       /* 015B  ADD C */
+    0x4F,                       /* 015C  MOV C,A */
+    0x05,                       /* 015D  DCR B */
+    0xC2, 0x04, 0x01,           /* 015E  JNZ loop */
+    0x76,                       /* 0161  HLT */
+    0x00, 0x00,                 /* 0162  DW 0 */
+};
+
+typedef enum {
+    SMC_STEP = 0,
+    SMC_RUN,
+    SMC_BLOCK,
+    SMC_JIT,
+    SMC_ENGINES
+} SmcEngine;
+
+static const char *smcEngineNames[SMC_ENGINES] = {
+    "Step", "Run", "Block", "Jit"
+};
+
+/* One big budget, then slices small enough to split most blocks */
+static const unsigned long long smcSlices[] = {
+    1000000, 7, 50
+};
+
+/* Runs the loaded program to its HLT on one engine */
+static void SmcRun(Cpu8080 *cpu, SmcEngine engine, unsigned long long slice) {
+    for (int calls = 0; !cpu->halted && calls < SMC_MAX_CALLS; calls++) {
+        switch (engine) {
+            case SMC_RUN: {
+                Run(cpu, slice);
+                break;
+            }
+
+            case SMC_BLOCK: {
+                RunBlocks(cpu, slice);
+                break;
+            }
+
+            case SMC_JIT: {
+                RunJit(cpu, slice);
+                break;
+            }
+
+            default: {
+                Step(cpu);
+                break;
+            }
+        }
+    }
+}
+
+static void SmcExecute(Cpu8080 *cpu, SmcEngine engine, unsigned long long slice) {
+    BlockCache *blocks = cpu->blocks;
+    JitCache *jit = cpu->jit;
+    OpcodeHistogram *histogram = cpu->histogram;
+
+    /* A fresh machine loses the page marks, so nothing decoded may survive */
+    if (blocks) {
+        BlockFlush(blocks);
+    }
+
+    if (jit) {
+        JitFlush(jit);
+    }
+
+    CpuInit(cpu);
+    cpu->blocks = engine == SMC_BLOCK ? blocks : NULL;
+    cpu->jit = engine == SMC_JIT ? jit : NULL;
+    cpu->histogram = histogram;
+    memcpy(&cpu->memory[SMC_ORIGIN], smcProgram, sizeof(smcProgram));
+    cpu->PC = SMC_ORIGIN;
+    cpu->SP = SMC_STACK;
+
+    SmcRun(cpu, engine, slice);
+
+    cpu->blocks = blocks;
+    cpu->jit = jit;
+}
+
+int SmcSelfCheck(void) {
+    Cpu8080 *cpu = (Cpu8080 *)malloc(sizeof(Cpu8080));
+    Cpu8080 *ref = (Cpu8080 *)malloc(sizeof(Cpu8080));
+    BlockCache *blocks = (BlockCache *)malloc(sizeof(BlockCache));
+    JitCache *jit = (JitCache *)malloc(sizeof(JitCache));
+    int engines = SMC_JIT;
+    unsigned long runs = 0;
+    unsigned long mismatches = 0;
+
+    if (!cpu || !ref || !blocks || !jit) {
+        fprintf(stderr, "Error: Could not allocate machine state\n");
+        free(cpu);
+        free(ref);
+        free(blocks);
+        free(jit);
+        return -1;
+    }
+
+    CpuInit(cpu);
+    BlockCacheInit(blocks);
+
+    if (JitCacheInit(jit) == 0) {
+        engines = SMC_ENGINES;
+    }
+
+    cpu->blocks = blocks;
+    cpu->jit = jit;
+
+    SmcExecute(cpu, SMC_STEP, 1);
+    memcpy(ref, cpu, sizeof(Cpu8080));
+
+    for (int engine = SMC_RUN; engine < engines; engine++) {
+        for (size_t slice = 0; slice < sizeof(smcSlices) / sizeof(smcSlices[0]); slice++) {
+            SmcExecute(cpu, (SmcEngine)engine, smcSlices[slice]);
+            runs++;
+
+            Bool same = (Bool)(cpu->halted && memcmp(cpu->registers, ref->registers, sizeof(ref->registers)) == 0 &&
+                cpu->flags == ref->flags && cpu->PC == ref->PC && cpu->SP == ref->SP &&
+                memcmp(cpu->memory, ref->memory, sizeof(ref->memory)) == 0);
+
+            /* Run() decodes nothing, the others must have seen their code change */
+            Bool noticed = (Bool)(engine == SMC_RUN || cpu->codeGeneration != 0);
+
+            if (!same || !noticed) {
+                printf("[selfcheck] %s, %llu cycle slices: %s\n", smcEngineNames[engine], smcSlices[slice],
+                    same ? "no decoded code was ever invalidated" : "state differs from Step()");
+                mismatches++;
+            }
+        }
+    }
+
+    printf("[selfcheck] self-modifying code: %lu runs against Step(), %lu mismatches\n", runs, mismatches);
+
+    JitCacheFree(jit);
+    free(jit);
+    free(blocks);
+    free(ref);
+    free(cpu);
+    return (int)(mismatches != 0);
+}
+
+/*
+    Dirty page and reset check (also run by --selfcheck). The program above
+    is loaded once and taken as a ResetImage, then every engine runs it
+    twice from there with ResetRestore() in between. Each run has to mark
+    exactly the pages Step() marks, cover every page that changed, and end
+    like Step(); the second one only does if the restore dropped what the
+    first run translated from the patched code. After each restore memory
+    has to be the image again with nothing dirty.
+*/
+int ResetSelfCheck(void) {
+    Cpu8080 *cpu = (Cpu8080 *)malloc(sizeof(Cpu8080));
+    Cpu8080 *ref = (Cpu8080 *)malloc(sizeof(Cpu8080));
+    ResetImage *image = (ResetImage *)malloc(sizeof(ResetImage));
+    BlockCache *blocks = (BlockCache *)malloc(sizeof(BlockCache));
+    JitCache *jit = (JitCache *)malloc(sizeof(JitCache));
+    int engines = SMC_JIT;
+    unsigned long runs = 0;
+    unsigned long mismatches = 0;
+
+    if (!cpu || !ref || !image || !blocks || !jit) {
+        fprintf(stderr, "Error: Could not allocate machine state\n");
+        free(cpu);
+        free(ref);
+        free(image);
+        free(blocks);
+        free(jit);
+        return -1;
+    }
+
+    CpuInit(cpu);
+    BlockCacheInit(blocks);
+
+    if (JitCacheInit(jit) == 0) {
+        engines = SMC_ENGINES;
+    }
+
+    cpu->blocks = blocks;
+    cpu->jit = jit;
+
+    /* Step() marks what it stores to through MemWrite(), the reference for the rest */
+    SmcExecute(cpu, SMC_STEP, 1);
+    memcpy(ref, cpu, sizeof(Cpu8080));
+
+    for (int engine = SMC_STEP; engine < engines; engine++) {
+        for (size_t slice = 0; slice < sizeof(smcSlices) / sizeof(smcSlices[0]); slice++) {
+            BlockFlush(blocks);
+            JitFlush(jit);
+            CpuInit(cpu);
+            cpu->blocks = engine == SMC_BLOCK ? blocks : NULL;
+            cpu->jit = engine == SMC_JIT ? jit : NULL;
+            memcpy(&cpu->memory[SMC_ORIGIN], smcProgram, sizeof(smcProgram));
+            cpu->PC = SMC_ORIGIN;
+            cpu->SP = SMC_STACK;
+            ResetCapture(cpu, image);
+
+            for (int round = 0; round < 2; round++) {
+                SmcRun(cpu, (SmcEngine)engine, smcSlices[slice]);
+                runs++;
+
+                Bool same = (Bool)(cpu->halted && memcmp(cpu->registers, ref->registers, sizeof(ref->registers)) == 0 &&
+                    cpu->flags == ref->flags && cpu->PC == ref->PC &&
+                    memcmp(cpu->memory, ref->memory, sizeof(ref->memory)) == 0 &&
+                    memcmp(cpu->dirtyPages, ref->dirtyPages, sizeof(ref->dirtyPages)) == 0);
+
+                for (int page = 0; page < MEM_PAGE_COUNT; page++) {
+                    if (!cpu->dirtyPages[page] && memcmp(&cpu->memory[page << MEM_PAGE_SHIFT],
+                        &image->memory[page << MEM_PAGE_SHIFT], MEM_PAGE_SIZE) != 0) {
+                        same = FALSE;
+                    }
+                }
+
+                uint32_t restored = ResetRestore(cpu, image);
+                uint8_t pages[MEM_PAGE_COUNT];
+
+                Bool clean = (Bool)(restored != 0 && MemDirtyList(cpu, pages) == 0 && cpu->PC == SMC_ORIGIN &&
+                    memcmp(cpu->memory, image->memory, sizeof(image->memory)) == 0);
+
+                if (!same || !clean) {
+                    printf("[selfcheck] %s, %llu cycle slices, run %d: %s\n", smcEngineNames[engine],
+                        smcSlices[slice], round + 1, same ? "reset did not restore the image" :
+                        "dirty pages or state differ from Step()");
+                    mismatches++;
+                }
+            }
+        }
+    }
+
+    cpu->blocks = blocks;
+    cpu->jit = jit;
+
+    printf("[selfcheck] dirty pages and reset: %lu runs against Step(), %lu mismatches\n", runs, mismatches);
+
+    JitCacheFree(jit);
+    free(jit);
+    free(blocks);
+    free(image);
+    free(ref);
+    free(cpu);
+    return (int)(mismatches != 0);
+}
+
+/*
+    Idle loop check (also run by --selfcheck). The program first polls in
+    loops that must not be skipped: one that counts down in B and one that
+    comes back to the same registers but bumps a byte in memory every time.
+    It then waits forever on a console status trap reached through CALL,
+    which is idle. The second entry point waits forever on an IN instead.
+    Every engine but Step() is run to the same instruction count with
+    main()'s 4 cycles per instruction budget and has to end exactly where
+    Step() does, having skipped something on the way.
+*/
+
+#define IDLE_ORIGIN                 0x0100
+#define IDLE_PORT                   0x10
+#define IDLE_STATUS_ADDR            0x0005
+#define IDLE_INSTRUCTIONS           1000000ULL
+
+static const uint8_t idleProgram[] = {
+    0x06, 0x14,                 /* 0100  MVI B,20 */
+    0xDB, 0x10,                 /* 0102  IN 10H */
+    0x05,                       /* 0104  DCR B */
+    0xC2, 0x02, 0x01,           /* 0105  JNZ 0102 */
+    0xDB, 0x10,                 /* 0108  IN 10H */
+    0x21, 0x80, 0x01,           /* 010A  LXI H,0180H */
+    0x34,                       /* 010D  INR M */
+    0x7E,                       /* 010E  MOV A,M */
+    0xFE, 0x28,                 /* 010F  CPI 40 */
+    0xCA, 0x18, 0x01,           /* 0111  JZ 0118 */
+    0xAF,                       /* 0114  XRA A */
+    0xC3, 0x08, 0x01,           /* 0115  JMP 0108 */
+    0x0E, 0x0B,                 /* 0118  MVI C,11 */
+    0xCD, 0x05, 0x00,           /* 011A  CALL 0005 */
+    0xB7,                       /* 011D  ORA A */
+    0xCA, 0x18, 0x01,           /* 011E  JZ 0118 */
+    0x76,                       /* 0121  HLT */
+    0xDB, 0x10,                 /* 0122  IN 10H */
+    0xE6, 0x01,                 /* 0124  ANI 1 */
+    0xCA, 0x22, 0x01,           /* 0126  JZ 0122 */
+    0x76,                       /* 0129  HLT */
+};
+
+static const uint16_t idleEntries[] = {
+    0x0100, 0x0122
+};
+
+/* The whole budget in one go, then slices that leave room for a few trips only */
+static const unsigned long long idleSlices[] = {
+    ~0ULL, 5000
+};
+
+/* Console status with nothing typed */
+static void IdleStatus(Cpu8080 *cpu, uint16_t addr) {
+    (void)addr;
+
+    cpu->registers[REG_A] = 0;
+    cpu->registers[REG_L] = 0;
+    RET(cpu);
+}
+
+static Bool IdleStatusPoll(const Cpu8080 *cpu) {
+    (void)cpu;
+
+    return TRUE;
+}
+
+static void IdleExecute(Cpu8080 *cpu, SmcEngine engine, uint16_t entry, unsigned long long slice) {
+    BlockCache *blocks = cpu->blocks;
+    JitCache *jit = cpu->jit;
+
+    if (blocks) {
+        BlockFlush(blocks);
+    }
+
+    if (jit) {
+        JitFlush(jit);
+    }
+
+    CpuInit(cpu);
+    cpu->blocks = engine == SMC_BLOCK ? blocks : NULL;
+    cpu->jit = engine == SMC_JIT ? jit : NULL;
+    memcpy(&cpu->memory[IDLE_ORIGIN], idleProgram, sizeof(idleProgram));
+    cpu->ioPorts[IDLE_PORT] = 0x40;
+    TrapRegister(cpu, IDLE_STATUS_ADDR, IdleStatus, IdleStatusPoll);
+    cpu->PC = entry;
+    cpu->SP = SMC_STACK;
+
+    while (!cpu->halted && cpu->instructions < IDLE_INSTRUCTIONS) {
+        unsigned long long budget = (IDLE_INSTRUCTIONS - cpu->instructions) * 4;
+
+        if (budget > slice) {
+            budget = slice;
+        }
+
+        switch (engine) {
+            case SMC_RUN: {
+                Run(cpu, budget);
+                break;
+            }
+
+            case SMC_BLOCK: {
+                RunBlocks(cpu, budget);
+                break;
+            }
+
+            case SMC_JIT: {
+                RunJit(cpu, budget);
+                break;
+            }
+
+            default: {
+                cpu->cycles += (unsigned long long)Step(cpu);
+                cpu->instructions++;
+                break;
+            }
+        }
+    }
+
+    cpu->blocks = blocks;
+    cpu->jit = jit;
+}
+
+int IdleSelfCheck(void) {
+    Cpu8080 *cpu = (Cpu8080 *)malloc(sizeof(Cpu8080));
+    Cpu8080 *ref = (Cpu8080 *)malloc(sizeof(Cpu8080));
+    BlockCache *blocks = (BlockCache *)malloc(sizeof(BlockCache));
+    JitCache *jit = (JitCache *)malloc(sizeof(JitCache));
+    int engines = SMC_JIT;
+    unsigned long runs = 0;
+    unsigned long mismatches = 0;
+
+    if (!cpu || !ref || !blocks || !jit) {
+        fprintf(stderr, "Error: Could not allocate machine state\n");
+        free(cpu);
+        free(ref);
+        free(blocks);
+        free(jit);
+        return -1;
+    }
+
+    CpuInit(cpu);
+    BlockCacheInit(blocks);
+
+    if (JitCacheInit(jit) == 0) {
+        engines = SMC_ENGINES;
+    }
+
+    cpu->blocks = blocks;
+    cpu->jit = jit;
+
+    for (size_t entry = 0; entry < sizeof(idleEntries) / sizeof(idleEntries[0]); entry++) {
+        IdleExecute(cpu, SMC_STEP, idleEntries[entry], 1);
+        memcpy(ref, cpu, sizeof(Cpu8080));
+
+        for (int engine = SMC_RUN; engine < engines; engine++) {
+            for (size_t slice = 0; slice < sizeof(idleSlices) / sizeof(idleSlices[0]); slice++) {
+                IdleExecute(cpu, (SmcEngine)engine, idleEntries[entry], idleSlices[slice]);
+                runs++;
+
+                Bool same = (Bool)(memcmp(cpu->registers, ref->registers, sizeof(ref->registers)) == 0 &&
+                    cpu->flags == ref->flags && cpu->PC == ref->PC && cpu->SP == ref->SP &&
+                    cpu->cycles == ref->cycles && cpu->instructions == ref->instructions &&
+                    memcmp(cpu->memory, ref->memory, sizeof(ref->memory)) == 0);
+
+                if (!same || cpu->idle.skippedCycles == 0) {
+                    printf("[selfcheck] %s from %04X, %llu cycle slices: %s\n", smcEngineNames[engine],
+                        idleEntries[entry], idleSlices[slice],
+                        same ? "nothing was skipped" : "state differs from Step()");
+                    mismatches++;
+                }
+            }
+        }
+    }
+
+    printf("[selfcheck] idle loops: %lu runs against Step(), %lu mismatches\n", runs, mismatches);
+
+    JitCacheFree(jit);
+    free(jit);
+    free(blocks);
+    free(ref);
+    free(cpu);
+    return (int)(mismatches != 0);
+}
+
+/*
+    Execute() check (also run by --selfcheck). The self-modifying program
+    runs with breakpoints on a jump target, on the instruction it patches
+    and on a subroutine, and the idle program runs with STOP_ON_TRAP. The
+    last program has a breakpoint on the NOP after a CALL not taken, which a
+    22 cycle limit puts inside the block's last, partial batch. Every engine
+    has to stop at the same places, with the same counts, as Step(), with
+    no cycle limit and with small ones, so stops that fall on a batch
+    boundary are looked at too.
+*/
+
+#define EXEC_MAX_STOPS              64
+#define EXEC_INSTRUCTIONS           5000ULL
+
+typedef struct {
+    StopReason reason;
+    uint16_t PC;
+    unsigned long long cycles;
+    unsigned long long instructions;
+} ExecStop;
+
+static const uint8_t execTailProgram[] = {
+    0xF6, 0x01,                 /* 0100  ORI 1 */
+    0xCC, 0x00, 0x02,           /* 0102  CZ 0200 */
+    0x00,                       /* 0105  NOP */
+    0x76,                       /* 0106  HLT */
+};
+
+typedef struct {
+    const uint8_t *program;
+    size_t size;
+    uint16_t breakpoints[3];
+    int breakCount;
+    unsigned int stopMask;
+} ExecCase;
+
+static const ExecCase execCases[] = {
+    { smcProgram, sizeof(smcProgram), { 0x0104, 0x0119, 0x0150 }, 3, STOP_ON_BREAKPOINT },
+    { idleProgram, sizeof(idleProgram), { 0 }, 0, STOP_ON_TRAP },
+    { execTailProgram, sizeof(execTailProgram), { 0x0105 }, 1, STOP_ON_BREAKPOINT }
+};
+
+static const unsigned long long execCycleLimits[] = {
+    0, 50, 22
+};
+
+static int ExecTrace(Cpu8080 *cpu, Engine engine, const ExecCase *test, unsigned long long maxCycles, ExecStop *stops) {
+    BlockCache *blocks = cpu->blocks;
+    JitCache *jit = cpu->jit;
+    int count = 0;
+
+    if (blocks) {
+        BlockFlush(blocks);
+    }
+
+    if (jit) {
+        JitFlush(jit);
+    }
+
+    CpuInit(cpu);
+    cpu->engine = engine;
+    cpu->blocks = engine == ENGINE_BLOCK ? blocks : NULL;
+    cpu->jit = engine == ENGINE_JIT ? jit : NULL;
+    memcpy(&cpu->memory[SMC_ORIGIN], test->program, test->size);
+    cpu->ioPorts[IDLE_PORT] = 0x40;
+    TrapRegister(cpu, IDLE_STATUS_ADDR, IdleStatus, IdleStatusPoll);
+    cpu->PC = SMC_ORIGIN;
+    cpu->SP = SMC_STACK;
+
+    for (int idx = 0; idx < test->breakCount; idx++) {
+        BreakpointSet(cpu, test->breakpoints[idx]);
+    }
+
+    while (count < EXEC_MAX_STOPS && cpu->instructions < EXEC_INSTRUCTIONS) {
+        StopReason reason = Execute(cpu, maxCycles, EXEC_INSTRUCTIONS - cpu->instructions, test->stopMask);
+
+        if (reason == STOP_BUDGET) {
+            continue;
+        }
+
+        stops[count].reason = reason;
+        stops[count].PC = cpu->PC;
+        stops[count].cycles = cpu->cycles;
+        stops[count].instructions = cpu->instructions;
+        count++;
+
+        if (reason == STOP_HALT) {
+            break;
+        }
+    }
+
+    cpu->blocks = blocks;
+    cpu->jit = jit;
+
+    return count;
+}
+
+int ExecuteSelfCheck(void) {
+    Cpu8080 *cpu = (Cpu8080 *)malloc(sizeof(Cpu8080));
+    BlockCache *blocks = (BlockCache *)malloc(sizeof(BlockCache));
+    JitCache *jit = (JitCache *)malloc(sizeof(JitCache));
+    ExecStop ref[EXEC_MAX_STOPS];
+    ExecStop stops[EXEC_MAX_STOPS];
+    int engines = ENGINE_JIT;
+    unsigned long runs = 0;
+    unsigned long mismatches = 0;
+
+    if (!cpu || !blocks || !jit) {
+        fprintf(stderr, "Error: Could not allocate machine state\n");
+        free(cpu);
+        free(blocks);
+        free(jit);
+        return -1;
+    }
+
+    CpuInit(cpu);
+    BlockCacheInit(blocks);
+
+    if (JitCacheInit(jit) == 0) {
+        engines = ENGINE_JIT + 1;
+    }
+
+    cpu->blocks = blocks;
+    cpu->jit = jit;
+
+    for (size_t test = 0; test < sizeof(execCases) / sizeof(execCases[0]); test++) {
+        int refCount = ExecTrace(cpu, ENGINE_STEP, &execCases[test], 0, ref);
+
+        for (int engine = ENGINE_STEP; engine < engines; engine++) {
+            for (size_t limit = 0; limit < sizeof(execCycleLimits) / sizeof(execCycleLimits[0]); limit++) {
+                int count = ExecTrace(cpu, (Engine)engine, &execCases[test], execCycleLimits[limit], stops);
+
+                runs++;
+
+                /* Both have to stop more than once to be worth anything */
+                Bool same = (Bool)(count == refCount && count >= 2);
+
+                for (int idx = 0; same && idx < count; idx++) {
+                    same = (Bool)(stops[idx].reason == ref[idx].reason && stops[idx].PC == ref[idx].PC &&
+                        stops[idx].cycles == ref[idx].cycles && stops[idx].instructions == ref[idx].instructions);
+                }
+
+                if (!same) {
+                    printf("[selfcheck] %s, case %zu, %llu cycle limit: stops differ from Step()\n",
+                        smcEngineNames[engine], test, execCycleLimits[limit]);
+                    mismatches++;
+                }
+            }
+        }
+    }
+
+    printf("[selfcheck] Execute() stops: %lu runs against Step(), %lu mismatches\n", runs, mismatches);
+
+    JitCacheFree(jit);
+    free(jit);
+    free(blocks);
+    free(cpu);
+    return (int)(mismatches != 0);
+}
+
+/*
+    Memory bus check (also run by --selfcheck). The program starts on the
+    flat bus and a trap maps a ROM, a handler page and a hole under it, so
+    every engine has to notice the map changing in the middle of a run.
+    Then it calls into ROM, writes to the ROM (ignored, including its own
+    code), talks to the handler page, reads the hole (open bus) and finally
+    runs code fetched from the handler page. Before all that it writes to
+    a port device and polls another one until it says ready. Every engine
+    has to end with the same state, memory and handler traffic as Step(),
+    run in one go and in short slices.
+*/
+
+#define BUS_ROM_ADDR                0x2000
+#define BUS_ROM_SIZE                0x1000
+#define BUS_DEVICE_ADDR             0x3000
+#define BUS_DEVICE_CODE             0x3010
+#define BUS_HOLE_ADDR               0x4000
+#define BUS_MAP_ADDR                0x0150
+#define BUS_PORT_CODE               0x0130
+#define BUS_PORT_IN                 0x20
+#define BUS_PORT_OUT                0x21
+#define BUS_PORT_READY              300
+#define BUS_INSTRUCTIONS            10000ULL
+
+static const uint8_t busProgram[] = {
+    0xCD, 0x30, 0x01,           /* 0100  CALL 0130 (ports) */
+    0xCD, 0x50, 0x01,           /* 0103  CALL 0150 (map trap) */
+    0x06, 0x14,                 /* 0106  MVI B,20 */
+    0xCD, 0x00, 0x20,           /* 0108  CALL 2000 */
+    0x32, 0x00, 0x30,           /* 010B  STA 3000 */
+    0x3A, 0x01, 0x30,           /* 010E  LDA 3001 */
+    0x4F,                       /* 0111  MOV C,A */
+    0x3A, 0x00, 0x40,           /* 0112  LDA 4000 */
+    0x81,                       /* 0115  ADD C */
+    0x21, 0x05, 0x20,           /* 0116  LXI H,2005 */
+    0x34,                       /* 0119  INR M */
+    0x56,                       /* 011A  MOV D,M */
+    0x32, 0x80, 0x01,           /* 011B  STA 0180 */
+    0x05,                       /* 011E  DCR B */
+    0xC2, 0x08, 0x01,           /* 011F  JNZ 0108 */
+    0xCD, 0x10, 0x30,           /* 0122  CALL 3010 */
+    0x76,                       /* 0125  HLT */
+};
+
+static const uint8_t busPortCode[] = {
+    0x3E, 0x07,                 /* 0130  MVI A,7 */
+    0xD3, 0x21,                 /* 0132  OUT 21H */
+    0xDB, 0x20,                 /* 0134  IN 20H */
+    0xE6, 0x01,                 /* 0136  ANI 1 */
+    0xCA, 0x34, 0x01,           /* 0138  JZ 0134 */
+    0xC9,                       /* 013B  RET */
+};
+
+static const uint8_t busRomCode[] = {
+    0x3E, 0x55,                 /* 2000  MVI A,55H */
+    0x32, 0x10, 0x20,           /* 2002  STA 2010 */
+    0x3A, 0x10, 0x20,           /* 2005  LDA 2010 */
+    0xC9,                       /* 2008  RET */
+};
+
+static const uint8_t busDeviceCode[] = {
+    0x3C,                       /* 3010  INR A */
+    0xC9,                       /* 3011  RET */
+};
+
+typedef struct {
+    unsigned long reads;
+    unsigned long writes;
+    uint8_t last;
+    unsigned long portReads;
+    unsigned long portWrites;
+    uint8_t portLast;
+} BusDevice;
+
+static uint8_t busRom[BUS_ROM_SIZE];
+static BusDevice busDevice;
+
+/* Set, BusExecute() records into or plays back busLog, see ReplaySelfCheck() */
+static FILE *busLog;
+static ReplayMode busLogMode;
+static Replay busReplay;
+
+static uint8_t BusDeviceRead(Cpu8080 *cpu, uint16_t addr, void *context) {
+    BusDevice *device = (BusDevice *)context;
+
+    (void)cpu;
+    device->reads++;
+
+    if (addr >= BUS_DEVICE_CODE && addr < BUS_DEVICE_CODE + sizeof(busDeviceCode)) {
+        return busDeviceCode[addr - BUS_DEVICE_CODE];
+    }
+
+    return addr == BUS_DEVICE_ADDR + 1 ? (uint8_t)device->reads : device->last;
+}
+
+static void BusDeviceWrite(Cpu8080 *cpu, uint16_t addr, uint8_t value, void *context) {
+    BusDevice *device = (BusDevice *)context;
+
+    (void)cpu;
+    (void)addr;
+    device->writes++;
+    device->last = value;
+}
+
+/* Not ready until it has been polled BUS_PORT_READY times, so no poll may be skipped */
+static uint8_t BusPortRead(Cpu8080 *cpu, uint8_t port, void *context) {
+    BusDevice *device = (BusDevice *)context;
+
+    (void)cpu;
+    (void)port;
+    device->portReads++;
+
+    return (uint8_t)(device->portReads >= BUS_PORT_READY);
+}
+
+static void BusPortWrite(Cpu8080 *cpu, uint8_t port, uint8_t value, void *context) {
+    BusDevice *device = (BusDevice *)context;
+
+    (void)cpu;
+    (void)port;
+    device->portWrites++;
+    device->portLast = value;
+}
+
+static void BusMap(Cpu8080 *cpu, uint16_t addr) {
+    (void)addr;
+
+    MemMapRom(cpu, BUS_ROM_ADDR, BUS_ROM_SIZE, busRom);
+    MemMapHandler(cpu, BUS_DEVICE_ADDR, MEM_PAGE_SIZE, BusDeviceRead, BusDeviceWrite, &busDevice);
+    MemUnmap(cpu, BUS_HOLE_ADDR, MEM_PAGE_SIZE);
+    RET(cpu);
+}
+
+/* The machine and its devices as the program starts, blocks and jit attached for their engine */
+static void BusSetup(Cpu8080 *cpu, Engine engine, BlockCache *blocks, JitCache *jit) {
+    if (blocks) {
+        BlockFlush(blocks);
+    }
+
+    if (jit) {
+        JitFlush(jit);
+    }
+
+    memset(busRom, 0, sizeof(busRom));
+    memcpy(busRom, busRomCode, sizeof(busRomCode));
+    busRom[0x10] = 0xA5;
+    memset(&busDevice, 0, sizeof(busDevice));
+
+    CpuInit(cpu);
+    cpu->engine = engine;
+    cpu->blocks = engine == ENGINE_BLOCK ? blocks : NULL;
+    cpu->jit = engine == ENGINE_JIT ? jit : NULL;
+    memcpy(&cpu->memory[SMC_ORIGIN], busProgram, sizeof(busProgram));
+    memcpy(&cpu->memory[BUS_PORT_CODE], busPortCode, sizeof(busPortCode));
+    TrapRegister(cpu, BUS_MAP_ADDR, BusMap, NULL);
+    IoRegister(cpu, BUS_PORT_IN, 1, BusPortRead, NULL, &busDevice);
+    IoRegister(cpu, BUS_PORT_OUT, 1, NULL, BusPortWrite, &busDevice);
+    cpu->PC = SMC_ORIGIN;
+    cpu->SP = SMC_STACK;
+}
+
+static void BusExecute(Cpu8080 *cpu, Engine engine, unsigned long long slice) {
+    BlockCache *blocks = cpu->blocks;
+    JitCache *jit = cpu->jit;
+    OpcodeHistogram *histogram = cpu->histogram;
+
+    BusSetup(cpu, engine, blocks, jit);
+    cpu->histogram = histogram;
+
+    if (busLog) {
+        rewind(busLog);
+        ReplayStart(cpu, &busReplay, busLog, busLogMode);
+    }
+
+    while (!cpu->halted && cpu->instructions < BUS_INSTRUCTIONS) {
+        Execute(cpu, slice, BUS_INSTRUCTIONS - cpu->instructions, 0);
+    }
+
+    ReplayFinish(cpu);
+    cpu->blocks = blocks;
+    cpu->jit = jit;
+}
+
+int BusSelfCheck(void) {
+    Cpu8080 *cpu = (Cpu8080 *)malloc(sizeof(Cpu8080));
+    Cpu8080 *ref = (Cpu8080 *)malloc(sizeof(Cpu8080));
+    BlockCache *blocks = (BlockCache *)malloc(sizeof(BlockCache));
+    JitCache *jit = (JitCache *)malloc(sizeof(JitCache));
+    static const unsigned long long slices[] = { 0, 37 };
+    BusDevice refDevice;
+    int engines = ENGINE_JIT;
+    unsigned long runs = 0;
+    unsigned long mismatches = 0;
+
+    if (!cpu || !ref || !blocks || !jit) {
+        fprintf(stderr, "Error: Could not allocate machine state\n");
+        free(cpu);
+        free(ref);
+        free(blocks);
+        free(jit);
+        return -1;
+    }
+
+    CpuInit(cpu);
+    BlockCacheInit(blocks);
+
+    if (JitCacheInit(jit) == 0) {
+        engines = ENGINE_JIT + 1;
+    }
+
+    cpu->blocks = blocks;
+    cpu->jit = jit;
+
+    BusExecute(cpu, ENGINE_STEP, 0);
+    memcpy(ref, cpu, sizeof(Cpu8080));
+    refDevice = busDevice;
+
+    /* The ROM kept its bytes and the last LDA 2010 read one of them */
+    if (!ref->halted || memcmp(busRom, busRomCode, sizeof(busRomCode)) != 0 || busRom[0x10] != 0xA5 ||
+        ref->registers[REG_D] != 0x3A || refDevice.writes != 20 || refDevice.portReads != BUS_PORT_READY ||
+        refDevice.portWrites != 1 || ref->ioPorts[BUS_PORT_OUT] != 7) {
+        printf("[selfcheck] memory bus: Step() did not see the map it was given\n");
+        mismatches++;
+    }
+
+    for (int engine = ENGINE_RUN; engine < engines; engine++) {
+        for (size_t slice = 0; slice < sizeof(slices) / sizeof(slices[0]); slice++) {
+            BusExecute(cpu, (Engine)engine, slices[slice]);
+            runs++;
+
+            Bool same = (Bool)(memcmp(cpu->registers, ref->registers, sizeof(ref->registers)) == 0 &&
+                cpu->PC == ref->PC && cpu->halted == ref->halted &&
+                cpu->cycles == ref->cycles && cpu->instructions == ref->instructions &&
+                cpu->handlerCalls == ref->handlerCalls &&
+                busDevice.reads == refDevice.reads && busDevice.writes == refDevice.writes &&
+                busDevice.last == refDevice.last && busDevice.portReads == refDevice.portReads &&
+                busDevice.portWrites == refDevice.portWrites && busDevice.portLast == refDevice.portLast &&
+                memcmp(busRom, busRomCode, sizeof(busRomCode)) == 0 &&
+                memcmp(cpu->memory, ref->memory, sizeof(ref->memory)) == 0);
+
+            if (!same) {
+                printf("[selfcheck] %s, %llu cycle slices: bus state differs from Step()\n",
+                    smcEngineNames[engine], slices[slice]);
+                mismatches++;
+            }
+        }
+    }
+
+    printf("[selfcheck] memory bus: %lu runs against Step(), %lu mismatches\n", runs, mismatches);
+
+    JitCacheFree(jit);
+    free(jit);
+    free(blocks);
+    free(ref);
+    free(cpu);
+    return (int)(mismatches != 0);
+}
+
+/*
+    Record and replay check (also run by --selfcheck). The memory bus
+    program is recorded on Step(), its BUS_PORT_READY polls of the port
+    device and its loads from the memory mapped one going into the log,
+    then played back on every engine, in one go and in short slices. Each
+    has to end the way the recording did without calling either read
+    handler once.
+*/
+int ReplaySelfCheck(void) {
+    Cpu8080 *cpu = (Cpu8080 *)malloc(sizeof(Cpu8080));
+    Cpu8080 *ref = (Cpu8080 *)malloc(sizeof(Cpu8080));
+    BlockCache *blocks = (BlockCache *)malloc(sizeof(BlockCache));
+    JitCache *jit = (JitCache *)malloc(sizeof(JitCache));
+    static const unsigned long long slices[] = { 0, 37 };
+    int engines = ENGINE_JIT;
+    unsigned long runs = 0;
+    unsigned long mismatches = 0;
+
+    busLog = tmpfile();
+
+    if (!cpu || !ref || !blocks || !jit || !busLog) {
+        fprintf(stderr, "Error: Could not allocate machine state\n");
+        free(cpu);
+        free(ref);
+        free(blocks);
+        free(jit);
+
+        if (busLog) {
+            fclose(busLog);
+            busLog = NULL;
+        }
+
+        return -1;
+    }
+
+    CpuInit(cpu);
+    BlockCacheInit(blocks);
+
+    if (JitCacheInit(jit) == 0) {
+        engines = ENGINE_JIT + 1;
+    }
+
+    cpu->blocks = blocks;
+    cpu->jit = jit;
+
+    busLogMode = REPLAY_RECORD;
+    BusExecute(cpu, ENGINE_STEP, 0);
+    memcpy(ref, cpu, sizeof(Cpu8080));
+
+    unsigned long long inputs = busDevice.portReads + busDevice.reads;
+
+    if (!ref->halted || busReplay.failed || busReplay.inputs != inputs || busDevice.reads == 0) {
+        printf("[selfcheck] replay: Step() did not record the port reads\n");
+        mismatches++;
+    }
+
+    busLogMode = REPLAY_PLAY;
+
+    for (int engine = ENGINE_STEP; engine < engines; engine++) {
+        for (size_t slice = 0; slice < sizeof(slices) / sizeof(slices[0]); slice++) {
+            BusExecute(cpu, (Engine)engine, slices[slice]);
+            runs++;
+
+            Bool same = (Bool)(!busReplay.failed && busReplay.inputs == inputs &&
+                busDevice.portReads == 0 && busDevice.reads == 0 &&
+                memcmp(cpu->registers, ref->registers, sizeof(ref->registers)) == 0 &&
+                cpu->PC == ref->PC && cpu->halted == ref->halted &&
+                cpu->cycles == ref->cycles && cpu->instructions == ref->instructions &&
+                cpu->handlerCalls == ref->handlerCalls &&
+                memcmp(cpu->memory, ref->memory, sizeof(ref->memory)) == 0);
+
+            if (!same) {
+                printf("[selfcheck] %s, %llu cycle slices: replay differs from the recording\n",
+                    smcEngineNames[engine], slices[slice]);
+                mismatches++;
+            }
+        }
+    }
+
+    printf("[selfcheck] replay: %lu runs against the recording, %lu mismatches\n", runs, mismatches);
+
+    fclose(busLog);
+    busLog = NULL;
+    JitCacheFree(jit);
+    free(jit);
+    free(blocks);
+    free(ref);
+    free(cpu);
+    return (int)(mismatches != 0);
+}
+
+/*
+    Reverse execution check (also run by --selfcheck). The memory bus
+    program runs under a timeline with a checkpoint every
+    TIMELINE_CHECK_INTERVAL instructions on every engine, then seeks back
+    and forth to instruction counts that are compared with Step() run from
+    the start to the same count. The device reads in the past come from the
+    timeline's log: the devices themselves are reset by every reference
+    run. Then reverse-continue to the IN of the poll loop has to land on
+    its last run, then the one before it. Last, a loop with a breakpoint on
+    the NOP after a CALL not taken goes back from one to five instructions
+    after every run of the NOP: the replay's last batch can put the NOP
+    inside a block that runs short of its worst case, which the JIT once
+    ran past.
+*/
+
+#define TIMELINE_CHECK_INTERVAL     97
+#define TIMELINE_TAIL_LOOPS         20
+#define TIMELINE_TAIL_NOP           0x0107
+
+static const uint8_t timelineTailProgram[] = {
+    0x06, TIMELINE_TAIL_LOOPS,  /* 0100  MVI B,20 */
+    0xF6, 0x01,                 /* 0102  ORI 1 */
+    0xCC, 0x00, 0x02,           /* 0104  CZ 0200 */
+    0x00,                       /* 0107  NOP */
+    0x05,                       /* 0108  DCR B */
+    0xC2, 0x02, 0x01,           /* 0109  JNZ 0102 */
+    0x76,                       /* 010C  HLT */
+};
+
+/* The NOP's i-th run is at instruction 3 + 5i, reverse-continue from up to 5 after it has to land on it */
+static unsigned long TimelineTailCheck(Cpu8080 *cpu, Engine engine, BlockCache *blocks, JitCache *jit,
+    unsigned long *runs) {
+    Timeline timeline;
+    unsigned long mismatches = 0;
+
+    BlockFlush(blocks);
+    JitFlush(jit);
+    CpuInit(cpu);
+    cpu->engine = engine;
+    cpu->blocks = engine == ENGINE_BLOCK ? blocks : NULL;
+    cpu->jit = engine == ENGINE_JIT ? jit : NULL;
+    memcpy(&cpu->memory[SMC_ORIGIN], timelineTailProgram, sizeof(timelineTailProgram));
+    cpu->PC = SMC_ORIGIN;
+    cpu->SP = SMC_STACK;
+
+    if (TimelineInit(&timeline, cpu, TIMELINE_MIN_BUDGET, TIMELINE_CHECK_INTERVAL) < 0) {
+        return 1;
+    }
+
+    TimelineRun(&timeline, cpu, 0, 0);
+    BreakpointSet(cpu, TIMELINE_TAIL_NOP);
+
+    for (unsigned long long loop = 0; loop < TIMELINE_TAIL_LOOPS; loop++) {
+        unsigned long long hit = 3 + 5 * loop;
+
+        for (unsigned long long after = 1; after <= 5; after++) {
+            TimelineSeek(&timeline, cpu, hit + after);
+            (*runs)++;
+
+            if (TimelineReverseContinue(&timeline, cpu) != STOP_BREAKPOINT || cpu->instructions != hit ||
+                cpu->PC != TIMELINE_TAIL_NOP) {
+                mismatches++;
+            }
+        }
+    }
+
+    BreakpointClear(cpu, TIMELINE_TAIL_NOP);
+    TimelineFree(&timeline, cpu);
+
+    return mismatches;
+}
+
+static void BusRunTo(Cpu8080 *cpu, unsigned long long instructions) {
+    BusSetup(cpu, ENGINE_STEP, NULL, NULL);
+
+    while (!cpu->halted && cpu->instructions < instructions) {
+        Execute(cpu, 0, instructions - cpu->instructions, 0);
+    }
+}
+
+static Bool BusSame(const Cpu8080 *cpu, const Cpu8080 *ref) {
+    return (Bool)(memcmp(cpu->registers, ref->registers, sizeof(ref->registers)) == 0 &&
+        cpu->PC == ref->PC && cpu->halted == ref->halted &&
+        cpu->cycles == ref->cycles && cpu->instructions == ref->instructions &&
+        memcmp(cpu->memory, ref->memory, sizeof(ref->memory)) == 0);
+}
+
+int TimelineSelfCheck(void) {
+    Cpu8080 *cpu = (Cpu8080 *)malloc(sizeof(Cpu8080));
+    Cpu8080 *ref = (Cpu8080 *)malloc(sizeof(Cpu8080));
+    BlockCache *blocks = (BlockCache *)malloc(sizeof(BlockCache));
+    JitCache *jit = (JitCache *)malloc(sizeof(JitCache));
+    Timeline timeline;
+    unsigned long long end;
+    unsigned long long lastIn = 0;
+    unsigned long long previousIn = 0;
+    int engines = ENGINE_JIT;
+    unsigned long runs = 0;
+    unsigned long mismatches = 0;
+
+    if (!cpu || !ref || !blocks || !jit) {
+        fprintf(stderr, "Error: Could not allocate machine state\n");
+        free(cpu);
+        free(ref);
+        free(blocks);
+        free(jit);
+        return -1;
+    }
+
+    CpuInit(cpu);
+    BlockCacheInit(blocks);
+
+    if (JitCacheInit(jit) == 0) {
+        engines = ENGINE_JIT + 1;
+    }
+
+    /* Where the program ends, and the last two times it was about to run the IN of its poll loop */
+    BusRunTo(ref, BUS_INSTRUCTIONS);
+    end = ref->instructions;
+    BusSetup(ref, ENGINE_STEP, NULL, NULL);
+
+    while (!ref->halted) {
+        if (ref->PC == BUS_PORT_CODE + 4) {
+            previousIn = lastIn;
+            lastIn = ref->instructions;
+        }
+
+        Execute(ref, 0, 1, 0);
+    }
+
+    unsigned long long targets[] = {
+        end - 1, 150, end / 2 + 7, 5, 0, end, 1, TIMELINE_CHECK_INTERVAL * 3, lastIn
+    };
+
+    for (int engine = ENGINE_STEP; engine < engines; engine++) {
+        BusSetup(cpu, (Engine)engine, blocks, jit);
+
+        if (TimelineInit(&timeline, cpu, TIMELINE_MIN_BUDGET, TIMELINE_CHECK_INTERVAL) < 0) {
+            printf("[selfcheck] %s: no timeline\n", smcEngineNames[engine]);
+            mismatches++;
+            continue;
+        }
+
+        TimelineRun(&timeline, cpu, BUS_INSTRUCTIONS, 0);
+
+        for (size_t idx = 0; idx < sizeof(targets) / sizeof(targets[0]); idx++) {
+            int result = TimelineSeek(&timeline, cpu, targets[idx]);
+
+            BusRunTo(ref, targets[idx]);
+            runs++;
+
+            if (result < 0 || !BusSame(cpu, ref)) {
+                printf("[selfcheck] %s, seek to %llu: state differs from Step()\n",
+                    smcEngineNames[engine], targets[idx]);
+                mismatches++;
+            }
+        }
+
+        /* From the end back to the last IN, then the one before */
+        BreakpointSet(cpu, BUS_PORT_CODE + 4);
+        TimelineSeek(&timeline, cpu, end);
+
+        StopReason first = TimelineReverseContinue(&timeline, cpu);
+        unsigned long long firstAt = cpu->instructions;
+        StopReason second = TimelineReverseContinue(&timeline, cpu);
+
+        BusRunTo(ref, previousIn);
+        runs++;
+
+        if (first != STOP_BREAKPOINT || firstAt != lastIn || second != STOP_BREAKPOINT || !BusSame(cpu, ref)) {
+            printf("[selfcheck] %s: reverse-continue did not stop where Step() was\n", smcEngineNames[engine]);
+            mismatches++;
+        }
+
+        BreakpointClear(cpu, BUS_PORT_CODE + 4);
+        TimelineFree(&timeline, cpu);
+
+        if (TimelineTailCheck(cpu, (Engine)engine, blocks, jit, &runs)) {
+            printf("[selfcheck] %s: reverse-continue missed a breakpoint at the end of its replay\n",
+                smcEngineNames[engine]);
+            mismatches++;
+        }
+    }
+
+    printf("[selfcheck] reverse execution: %lu runs against Step(), %lu mismatches\n", runs, mismatches);
+
+    JitCacheFree(jit);
+    free(jit);
+    free(blocks);
+    free(ref);
+    free(cpu);
+    return (int)(mismatches != 0);
+}
+
+/*
+    Trace check (also run by --selfcheck). The memory bus program is traced
+    on every engine in slices of TRACE_CHECK_SLICE cycles, and every record
+    read back has to be the machine Step() has right before the same
+    instruction. The text decoder has to get through the file too.
+*/
+
+#define TRACE_CHECK_SLICE           37
+
+static Bool TraceSame(const TraceEntry *entry, const Cpu8080 *ref) {
+    uint8_t registers[8] = {
+        ref->registers[REG_C], ref->registers[REG_B], ref->registers[REG_E], ref->registers[REG_D],
+        ref->registers[REG_L], ref->registers[REG_H], ref->flags, ref->registers[REG_A]
+    };
+
+    for (int idx = 0; idx < opLength[entry->bytes[0]]; idx++) {
+        if (entry->bytes[idx] != MemPeek(ref, (uint16_t)(ref->PC + idx))) {
+            return FALSE;
+        }
+    }
+
+    return (Bool)(entry->instructions == ref->instructions && entry->PC == ref->PC && entry->SP == ref->SP &&
+        memcmp(entry->registers, registers, sizeof(registers)) == 0 &&
+        entry->interruptsEnabled == ref->interruptsEnabled);
+}
+
+int TraceSelfCheck(void) {
+    Cpu8080 *cpu = (Cpu8080 *)malloc(sizeof(Cpu8080));
+    Cpu8080 *ref = (Cpu8080 *)malloc(sizeof(Cpu8080));
+    BlockCache *blocks = (BlockCache *)malloc(sizeof(BlockCache));
+    JitCache *jit = (JitCache *)malloc(sizeof(JitCache));
+    Trace trace;
+    TraceReader reader;
+    int engines = ENGINE_JIT;
+    unsigned long runs = 0;
+    unsigned long mismatches = 0;
+
+    if (!cpu || !ref || !blocks || !jit) {
+        fprintf(stderr, "Error: Could not allocate machine state\n");
+        free(cpu);
+        free(ref);
+        free(blocks);
+        free(jit);
+        return -1;
+    }
+
+    CpuInit(cpu);
+    BlockCacheInit(blocks);
+
+    if (JitCacheInit(jit) == 0) {
+        engines = ENGINE_JIT + 1;
+    }
+
+    for (int engine = ENGINE_STEP; engine < engines; engine++) {
+        FILE *file = tmpfile();
+        FILE *text = tmpfile();
+        int result = 0;
+
+        BusSetup(cpu, (Engine)engine, blocks, jit);
+
+        if (!file || !text || TraceStart(cpu, &trace, file) < 0) {
+            printf("[selfcheck] %s: no trace\n", smcEngineNames[engine]);
+            mismatches++;
+        } else {
+            while (!cpu->halted && cpu->instructions < BUS_INSTRUCTIONS) {
+                Execute(cpu, TRACE_CHECK_SLICE, BUS_INSTRUCTIONS - cpu->instructions, 0);
+            }
+
+            Bool written = (Bool)(TraceFinish(cpu) == 0);
+
+            BusSetup(ref, ENGINE_STEP, NULL, NULL);
+            rewind(file);
+
+            if (!written || TraceOpen(&reader, file) < 0) {
+                result = -1;
+            }
+
+            while (result == 0 && (result = TraceNext(&reader)) > 0 && TraceSame(&reader.entry, ref)) {
+                Execute(ref, 0, 1, 0);
+                result = 0;
+            }
+
+            rewind(file);
+            runs++;
+
+            if (result != 0 || ref->instructions != cpu->instructions || !BusSame(cpu, ref) ||
+                TraceDecode(file, text) != 0 || (unsigned long long)ftell(text) < cpu->instructions) {
+                printf("[selfcheck] %s: trace differs from Step() at instruction %llu\n",
+                    smcEngineNames[engine], ref->instructions);
+                mismatches++;
+            }
+        }
+
+        if (file) {
+            fclose(file);
+        }
+
+        if (text) {
+            fclose(text);
+        }
+    }
+
+    printf("[selfcheck] trace: %lu traced runs against Step(), %lu mismatches\n", runs, mismatches);
+
+    JitCacheFree(jit);
+    free(jit);
+    free(blocks);
+    free(ref);
+    free(cpu);
+    return (int)(mismatches != 0);
+}
+
+/*
+    Opcode histogram check (also run by --selfcheck, but only an
+    EMU_OPCODE_PROFILE build counts anything). The self-modifying program
+    runs straight on every engine and the memory bus program, whose polls
+    IdlePoll() partly skips, through Execute(), both in one go and in short
+    slices. Every engine has to count the same opcodes, cycles and pairs
+    as Step(), and the totals have to be the machine's.
+*/
+
+#define HISTOGRAM_CHECK_SLICE       37
+
+#ifdef RUN_OPCODE_PROFILE
+static Bool HistogramSame(const OpcodeHistogram *histogram, const OpcodeHistogram *ref, const Cpu8080 *cpu) {
+    unsigned long long count = 0;
+    unsigned long long cycles = 0;
+
+    for (int opcode = 0; opcode < 256; opcode++) {
+        count += histogram->count[opcode];
+        cycles += histogram->cycles[opcode];
+    }
+
+    return (Bool)(count == cpu->instructions && cycles == cpu->cycles && histogram->last == ref->last &&
+        memcmp(histogram->count, ref->count, sizeof(ref->count)) == 0 &&
+        memcmp(histogram->cycles, ref->cycles, sizeof(ref->cycles)) == 0 &&
+        memcmp(histogram->pairs, ref->pairs, sizeof(ref->pairs)) == 0);
+}
+
+/* program 0 is the self-modifying one, 1 the memory bus one */
+static void HistogramExecute(Cpu8080 *cpu, int program, Engine engine, unsigned long long slice) {
+    if (program == 0) {
+        SmcExecute(cpu, (SmcEngine)engine, slice);
+    } else {
+        BusExecute(cpu, engine, slice);
+    }
+}
+#endif
+
+int HistogramSelfCheck(void) {
+#ifdef RUN_OPCODE_PROFILE
+    static const char *programNames[] = { "self-modifying code", "memory bus" };
+    static const unsigned long long slices[] = { 1000000, HISTOGRAM_CHECK_SLICE };
+    Cpu8080 *cpu = (Cpu8080 *)malloc(sizeof(Cpu8080));
+    BlockCache *blocks = (BlockCache *)malloc(sizeof(BlockCache));
+    JitCache *jit = (JitCache *)malloc(sizeof(JitCache));
+    OpcodeHistogram *histogram = (OpcodeHistogram *)malloc(sizeof(OpcodeHistogram));
+    OpcodeHistogram *ref = (OpcodeHistogram *)malloc(sizeof(OpcodeHistogram));
+    int engines = ENGINE_JIT;
+    unsigned long runs = 0;
+    unsigned long mismatches = 0;
+
+    if (!cpu || !blocks || !jit || !histogram || !ref) {
+        fprintf(stderr, "Error: Could not allocate machine state\n");
+        free(cpu);
+        free(blocks);
+        free(jit);
+        free(histogram);
+        free(ref);
+        return -1;
+    }
+
+    CpuInit(cpu);
+    BlockCacheInit(blocks);
+
+    if (JitCacheInit(jit) == 0) {
+        engines = ENGINE_JIT + 1;
+    }
+
+    cpu->blocks = blocks;
+    cpu->jit = jit;
+
+    for (int program = 0; program < 2; program++) {
+        HistogramClear(ref);
+        cpu->histogram = ref;
+        HistogramExecute(cpu, program, ENGINE_STEP, 1);
+
+        /* SmcRun() calls Step() itself, which leaves the machine's counts alone */
+        if (program != 0 && !HistogramSame(ref, ref, cpu)) {
+            printf("[selfcheck] %s: Step() counted other totals than it ran\n", programNames[program]);
+            mismatches++;
+        }
+
+        for (int engine = ENGINE_RUN; engine < engines; engine++) {
+            for (size_t slice = 0; slice < sizeof(slices) / sizeof(slices[0]); slice++) {
+                HistogramClear(histogram);
+                cpu->histogram = histogram;
+                HistogramExecute(cpu, program, (Engine)engine, slices[slice]);
+                runs++;
+
+                if (!HistogramSame(histogram, ref, cpu)) {
+                    printf("[selfcheck] %s on %s, %llu cycle slices: histogram differs from Step()\n",
+                        programNames[program], smcEngineNames[engine], slices[slice]);
+                    mismatches++;
+                }
+            }
+        }
+    }
+
+    printf("[selfcheck] opcode histogram: %lu runs against Step(), %lu mismatches\n", runs, mismatches);
+
+    JitCacheFree(jit);
+    free(ref);
+    free(histogram);
+    free(jit);
+    free(blocks);
+    free(cpu);
+    return (int)(mismatches != 0);
+#else
+    printf("[selfcheck] opcode histogram: not counted in this build, see EMU_OPCODE_PROFILE\n");
+    return 0;
+#endif
+}
+
+/*
+    Profiler check (also run by --selfcheck). A program that calls outer
+    200 times, which calls inner 10 times, which pushes 0108H on top of its
+    return address (main's return address from outer, as data) and counts
+    down a loop, is sampled on every engine with the labels of a made-up
+    listing. Every engine has to sample
+    the same PCs and stacks as Step(), every stack has to be one the program
+    can be in, and inner has to have most of the cycles. The listing and a
+    SYM file have to give the labels they have and no equates or data.
+
+    A program that turns interrupts on and goes to the warm boot trap has
+    to end in STOP_HALT while sampled, before the first sample is due, by
+    the heatmap too in an EMU_MEMORY_HEATMAP build.
+*/
+
+#define PROFILE_CHECK_INTERVAL      997
+#define PROFILE_CHECK_SYMBOLS       3
+
+static const uint8_t profileProgram[] = {
+    0x31, 0x00, 0xF0,           /* 0100  main: LXI SP,0F000H */
+    0x06, 0xC8,                 /* 0103  MVI B,200 */
+    0xCD, 0x10, 0x01,           /* 0105  CALL outer */
+    0x05,                       /* 0108  DCR B */
+    0xC2, 0x05, 0x01,           /* 0109  JNZ 0105 */
+    0x76,                       /* 010C  HLT */
+    0x00, 0x00, 0x00,           /* 010D  NOP (x3) */
+    0x21, 0x08, 0x01,           /* 0110  outer: LXI H,0108H */
+    0x0E, 0x0A,                 /* 0113  MVI C,10 */
+    0xCD, 0x20, 0x01,           /* 0115  CALL inner */
+    0x0D,                       /* 0118  DCR C */
+    0xC2, 0x15, 0x01,           /* 0119  JNZ 0115 */
+    0xC9,                       /* 011C  RET */
+    0x00, 0x00, 0x00,           /* 011D  NOP (x3) */
+    0xE5,                       /* 0120  inner: PUSH H */
+    0x16, 0x14,                 /* 0121  MVI D,20 */
+    0x15,                       /* 0123  DCR D */
+    0xC2, 0x23, 0x01,           /* 0124  JNZ 0123 */
+    0xE1,                       /* 0127  POP H */
+    0xC9                        /* 0128  RET */
+};
+
+/* MACRO-80 lines, CP/M ASM lines, an equate, data and MACRO-80's symbol table */
+static const char profileListing[] =
+    "MACRO-80 3.44\t09-Dec-81\tPAGE\t1\n"
+    "\n"
+    "  0100    31 F000               main:\tlxi\tsp,0F000H\n"
+    "  0103    06 C8                 \tmvi\tb,200\n"
+    "  0105    CD 0110               \tcall\touter\n"
+    "  0110    0E 0A                 outer::\tmvi\tc,10\n"
+    "  0112    CD 0120               \tcall\tinner\t; again:\n"
+    " 0120 C5        INNER:\tPUSH\tB\n"
+    " 0123 =         WAIT:\tEQU\t0123H\n"
+    " 0129 00        FLAG\tDB\t0\n"
+    " 012A 4F4B0D0A24MSG:\tDB\t'OK',13,10,'$'\n"
+    "\f'8080 profile'\tMACRO-80 3.44\t09-Dec-81\tPAGE\tS\n"
+    "0100 \tMAIN  \t0110 \tOUTER\n";
+
+static const char profileSym[] = "0100 MAIN\t0110 OUTER\n0120 INNER   0123 WAIT\n";
+
+static const uint8_t profileHaltProgram[] = {
+    0xFB,                       /* 0100  EI */
+    0xC3, 0x00, 0x00,           /* 0101  JMP 0000 */
+};
+
+/* CP/M's warm boot as main.c has it */
+static void ProfileWarmBoot(Cpu8080 *cpu, uint16_t addr) {
+    cpu->PC = addr;
+    cpu->halted = TRUE;
+}
+
+/* Execute() with no limits on EI; JMP 0 has to stop on the HLT, with no sample taken */
+static unsigned long ProfileHaltCheck(Cpu8080 *cpu, Engine engine, BlockCache *blocks, JitCache *jit) {
+    Profiler profiler;
+    Heatmap heatmap;
+    Bool heat = HeatmapAvailable();
+    StopReason reason = STOP_NONE;
+
+    memset(&heatmap, 0, sizeof(heatmap));
+
+    BlockFlush(blocks);
+
+    if (jit) {
+        JitFlush(jit);
+    }
+
+    CpuInit(cpu);
+    cpu->engine = engine;
+    cpu->blocks = engine == ENGINE_BLOCK ? blocks : NULL;
+    cpu->jit = engine == ENGINE_JIT ? jit : NULL;
+    memcpy(&cpu->memory[SMC_ORIGIN], profileHaltProgram, sizeof(profileHaltProgram));
+    TrapRegister(cpu, 0x0000, ProfileWarmBoot, NULL);
+    cpu->PC = SMC_ORIGIN;
+    cpu->SP = SMC_STACK;
+
+    if (ProfilerInit(&profiler, NULL, PROFILE_CHECK_INTERVAL) == 0 && ProfilerStart(cpu, &profiler) == 0 &&
+        HeatmapInit(&heatmap, FALSE, PROFILE_CHECK_INTERVAL) == 0 && (!heat || HeatmapStart(cpu, &heatmap) == 0)) {
+        reason = Execute(cpu, 0, 0, 0);
+        ProfilerStop(cpu, &profiler);
+
+        if (heat) {
+            HeatmapStop(cpu, &heatmap);
+        }
+    }
+
+    HeatmapFree(&heatmap);
+    ProfilerFree(&profiler);
+    cpu->blocks = blocks;
+    cpu->jit = jit;
+
+    if (reason != STOP_HALT || cpu->PC != 0x0000 || !cpu->interruptsEnabled || profiler.samples ||
+        cpu->cycles >= PROFILE_CHECK_INTERVAL) {
+        printf("[selfcheck] profiler%s on %s: EI and a warm boot stopped on %d at %llu cycles, not on the HLT\n",
+            heat ? " and heatmap" : "", smcEngineNames[engine], (int)reason, cpu->cycles);
+        return 1;
+    }
+
+    return 0;
+}
+
+static const char *profileStacks[] = { "main", "main;outer", "main;outer;INNER" };
+
+static int SymbolsFrom(SymbolTable *symbols, const char *text, Bool symFormat) {
+    FILE *file = tmpfile();
+    int result = file && fputs(text, file) >= 0 ? 0 : -1;
+
+    if (result == 0) {
+        rewind(file);
+        result = SymbolsRead(symbols, file, symFormat);
+    }
+
+    if (file) {
+        fclose(file);
+    }
+
+    return result;
+}
+
+/* Sampled from the start until the HLT, the folded stacks written to folded */
+static int ProfileExecute(Cpu8080 *cpu, Engine engine, BlockCache *blocks, JitCache *jit,
+    Profiler *profiler, const SymbolTable *symbols, FILE *folded) {
+    if (blocks) {
+        BlockFlush(blocks);
+    }
+
+    if (jit) {
+        JitFlush(jit);
+    }
+
+    CpuInit(cpu);
+    cpu->engine = engine;
+    cpu->blocks = engine == ENGINE_BLOCK ? blocks : NULL;
+    cpu->jit = engine == ENGINE_JIT ? jit : NULL;
+    memcpy(&cpu->memory[SMC_ORIGIN], profileProgram, sizeof(profileProgram));
+    cpu->PC = SMC_ORIGIN;
+    cpu->SP = SMC_STACK;
+
+    if (ProfilerInit(profiler, symbols, PROFILE_CHECK_INTERVAL) < 0 || ProfilerStart(cpu, profiler) < 0) {
+        return -1;
+    }
+
+    while (!cpu->halted) {
+        Execute(cpu, 0, 0, 0);
+    }
+
+    ProfilerStop(cpu, profiler);
+    cpu->blocks = blocks;
+    cpu->jit = jit;
+
+    return ProfilerWriteFolded(profiler, folded) < 0 || fflush(folded) != 0 ? -1 : 0;
+}
+
+static Bool FilesSame(FILE *one, FILE *two) {
+    int a;
+    int b;
+
+    rewind(one);
+    rewind(two);
+
+    do {
+        a = fgetc(one);
+        b = fgetc(two);
+    } while (a == b && a != EOF);
+
+    return (Bool)(a == b);
+}
+
+/* Every line a stack the program can be in, INNER's cycles most of the total */
+static Bool StacksExpected(FILE *folded, unsigned long long cycles) {
+    char line[256];
+    unsigned long long inner = 0;
+
+    rewind(folded);
+
+    while (fgets(line, sizeof(line), folded)) {
+        char *space = strrchr(line, ' ');
+        Bool known = FALSE;
+
+        if (!space) {
+            return FALSE;
+        }
+
+        *space = 0;
+
+        for (size_t idx = 0; idx < sizeof(profileStacks) / sizeof(profileStacks[0]); idx++) {
+            known |= (Bool)(strcmp(line, profileStacks[idx]) == 0);
+        }
+
+        if (!known) {
+            return FALSE;
+        }
+
+        if (strcmp(line, "main;outer;INNER") == 0) {
+            inner = strtoull(space + 1, NULL, 10);
+        }
+    }
+
+    return (Bool)(inner * 2 > cycles);
+}
+
+int ProfilerSelfCheck(void) {
+    Cpu8080 *cpu = (Cpu8080 *)malloc(sizeof(Cpu8080));
+    BlockCache *blocks = (BlockCache *)malloc(sizeof(BlockCache));
+    JitCache *jit = (JitCache *)malloc(sizeof(JitCache));
+    FILE *refFolded = tmpfile();
+    SymbolTable symbols;
+    SymbolTable sym;
+    Profiler ref;
+    int engines = ENGINE_JIT;
+    unsigned long runs = 0;
+    unsigned long mismatches = 0;
+
+    SymbolsInit(&symbols);
+    SymbolsInit(&sym);
+    memset(&ref, 0, sizeof(ref));
+
+    if (!cpu || !blocks || !jit || !refFolded) {
+        fprintf(stderr, "Error: Could not allocate machine state\n");
+        free(cpu);
+        free(blocks);
+        free(jit);
+
+        if (refFolded) {
+            fclose(refFolded);
+        }
+
+        return -1;
+    }
+
+    CpuInit(cpu);
+    BlockCacheInit(blocks);
+
+    if (JitCacheInit(jit) == 0) {
+        engines = ENGINE_JIT + 1;
+    }
+
+    if (SymbolsFrom(&symbols, profileListing, FALSE) < 0 || symbols.count != PROFILE_CHECK_SYMBOLS ||
+        strcmp(SymbolFind(&symbols, 0x0105)->name, "main") != 0 || strcmp(SymbolFind(&symbols, 0x0119)->name, "outer") != 0 ||
+        strcmp(SymbolFind(&symbols, 0xF000)->name, "INNER") != 0 || SymbolFind(&symbols, 0x00FF)) {
+        printf("[selfcheck] profiler: the listing did not give main, outer and INNER\n");
+        mismatches++;
+    }
+
+    if (SymbolsFrom(&sym, profileSym, TRUE) < 0 || sym.count != PROFILE_CHECK_SYMBOLS + 1 ||
+        !SymbolAt(&sym, 0x0123) || strcmp(SymbolFind(&sym, 0x0122)->name, "INNER") != 0 || SymbolAt(&sym, 0x0121)) {
+        printf("[selfcheck] profiler: the SYM file did not give its 4 labels\n");
+        mismatches++;
+    }
+
+    if (ProfileExecute(cpu, ENGINE_STEP, blocks, jit, &ref, &symbols, refFolded) < 0) {
+        printf("[selfcheck] profiler: Step() could not be sampled\n");
+        mismatches++;
+    } else if (ref.samples * PROFILE_CHECK_INTERVAL > cpu->cycles ||
+        (ref.samples + 2) * PROFILE_CHECK_INTERVAL <= cpu->cycles || ref.cycles != ref.lastCycles ||
+        !StacksExpected(refFolded, ref.cycles)) {
+        printf("[selfcheck] profiler: Step() sampled stacks the program does not have\n");
+        mismatches++;
+    }
+
+    for (int engine = ENGINE_RUN; engine < engines && ref.counts; engine++) {
+        FILE *folded = tmpfile();
+        Profiler profiler;
+
+        memset(&profiler, 0, sizeof(profiler));
+        runs++;
+
+        if (!folded || ProfileExecute(cpu, (Engine)engine, blocks, jit, &profiler, &symbols, folded) < 0 ||
+            profiler.samples != ref.samples ||
+            memcmp(profiler.counts, ref.counts, 0x10000 * sizeof(ProfileCount)) != 0 || !FilesSame(folded, refFolded)) {
+            printf("[selfcheck] profiler on %s: samples differ from Step()\n", smcEngineNames[engine]);
+            mismatches++;
+        }
+
+        ProfilerFree(&profiler);
+
+        if (folded) {
+            fclose(folded);
+        }
+    }
+
+    for (int engine = ENGINE_STEP; engine < engines; engine++) {
+        mismatches += ProfileHaltCheck(cpu, (Engine)engine, blocks, jit);
+    }
+
+    printf("[selfcheck] profiler: %llu samples, %lu engines against Step(), %lu mismatches\n",
+        ref.samples, runs, mismatches);
+
+    ProfilerFree(&ref);
+    SymbolsFree(&sym);
+    SymbolsFree(&symbols);
+    fclose(refFolded);
+    JitCacheFree(jit);
+    free(jit);
+    free(blocks);
+    free(cpu);
+    return (int)(mismatches != 0);
+}
+
+/*
+    Call graph check (also run by --selfcheck). main calls outer three
+    times, which calls inner three times, once with a taken CZ and never
+    with the CNZ after it. Then come the tricks: print skips its inline
+    bytes with XTHL, drop pops its own return address and returns for skip
+    too, jump pops its return address and goes back with PCHL, and an
+    RST 1 returns from 0008H. Every engine has to find exactly these
+    calls, returns and depths, and every function's cycles have to be its
+    own plus those of its calls.
+*/
+
+#define CALLGRAPH_CHECK_FUNCTIONS   8
+#define CALLGRAPH_CHECK_EDGES       8
+
+static const uint8_t callGraphProgram[] = {
+    0x31, 0x00, 0xF0,           /* 0100  main: LXI SP,0F000H */
+    0x06, 0x03,                 /* 0103  MVI B,3 */
+    0xCD, 0x20, 0x01,           /* 0105  CALL outer */
+    0x05,                       /* 0108  DCR B */
+    0xC2, 0x05, 0x01,           /* 0109  JNZ 0105 */
+    0xCD, 0x40, 0x01,           /* 010C  CALL print */
+    0x41, 0x42, 0x43,           /* 010F  DB 'ABC' */
+    0xCD, 0x50, 0x01,           /* 0112  CALL skip */
+    0xCD, 0x60, 0x01,           /* 0115  CALL jump */
+    0xCF,                       /* 0118  RST 1 */
+    0x76,                       /* 0119  HLT */
+    0x00, 0x00, 0x00, 0x00,     /* 011A  NOP (x6) */
+    0x00, 0x00,
+    0x0E, 0x02,                 /* 0120  outer: MVI C,2 */
+    0xCD, 0x38, 0x01,           /* 0122  CALL inner */
+    0x0D,                       /* 0125  DCR C */
+    0xC2, 0x22, 0x01,           /* 0126  JNZ 0122 */
+    0xAF,                       /* 0129  XRA A */
+    0xCC, 0x38, 0x01,           /* 012A  CZ inner */
+    0xC4, 0x38, 0x01,           /* 012D  CNZ inner */
+    0xC9,                       /* 0130  RET */
+    0x00, 0x00, 0x00, 0x00,     /* 0131  NOP (x7) */
+    0x00, 0x00, 0x00,
+    0x16, 0x05,                 /* 0138  inner: MVI D,5 */
+    0x15,                       /* 013A  DCR D */
+    0xC2, 0x3A, 0x01,           /* 013B  JNZ 013A */
+    0xC9,                       /* 013E  RET */
+    0x00,                       /* 013F  NOP */
+    0xE3,                       /* 0140  print: XTHL */
+    0x23,                       /* 0141  INX H */
+    0x23,                       /* 0142  INX H */
+    0x23,                       /* 0143  INX H */
+    0xE3,                       /* 0144  XTHL */
+    0xC9,                       /* 0145  RET */
+    0x00, 0x00, 0x00, 0x00,     /* 0146  NOP (x10) */
+    0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00,
+    0xCD, 0x58, 0x01,           /* 0150  skip: CALL drop */
+    0x76,                       /* 0153  HLT */
+    0x00, 0x00, 0x00, 0x00,     /* 0154  NOP (x4) */
+    0xD1,                       /* 0158  drop: POP D */
+    0xC9,                       /* 0159  RET */
+    0x00, 0x00, 0x00, 0x00,     /* 015A  NOP (x6) */
+    0x00, 0x00,
+    0xE1,                       /* 0160  jump: POP H */
+    0xE9                        /* 0161  PCHL */
+};
+
+/* caller, site, callee and calls */
+static const uint16_t callGraphEdges[CALLGRAPH_CHECK_EDGES][4] = {
+    { 0x0100, 0x0105, 0x0120, 3 },
+    { 0x0100, 0x010C, 0x0140, 1 },
+    { 0x0100, 0x0112, 0x0150, 1 },
+    { 0x0100, 0x0115, 0x0160, 1 },
+    { 0x0100, 0x0118, 0x0008, 1 },
+    { 0x0120, 0x0122, 0x0138, 6 },
+    { 0x0120, 0x012A, 0x0138, 3 },
+    { 0x0150, 0x0150, 0x0158, 1 }
+};
+
+/* Every function's cycles its own and its edges', the edges the ones above */
+static Bool CallGraphExpected(const CallGraph *graph, const Cpu8080 *cpu) {
+    unsigned long long self = 0;
+    int functions = 0;
+
+    if (graph->edgeCount != CALLGRAPH_CHECK_EDGES || graph->stats.calls != 17 || graph->stats.returns != 15 ||
+        graph->stats.unwound != 2 || graph->stats.maxDepth != 2 || graph->cycles != cpu->cycles ||
+        graph->functions[SMC_ORIGIN].cycles != cpu->cycles) {
+        return FALSE;
+    }
+
+    for (unsigned int addr = 0; addr < 0x10000; addr++) {
+        const CallFunction *function = &graph->functions[addr];
+        unsigned long long cycles = function->selfCycles;
+
+        if (!function->calls) {
+            continue;
+        }
+
+        for (int idx = 0; idx < graph->edgeCapacity; idx++) {
+            if (graph->edges[idx].key && (graph->edges[idx].key >> 32 & 0xFFFF) == addr) {
+                cycles += graph->edges[idx].cycles;
+            }
+        }
+
+        if (cycles != function->cycles || function->active) {
+            return FALSE;
+        }
+
+        self += function->selfCycles;
+        functions++;
+    }
+
+    for (int idx = 0; idx < CALLGRAPH_CHECK_EDGES; idx++) {
+        const uint16_t *expected = callGraphEdges[idx];
+        uint64_t key = CALLGRAPH_USED | (uint64_t)expected[0] << 32 | (uint64_t)expected[1] << 16 | expected[2];
+        Bool found = FALSE;
+
+        for (int slot = 0; slot < graph->edgeCapacity; slot++) {
+            found |= (Bool)(graph->edges[slot].key == key && graph->edges[slot].calls == expected[3]);
+        }
+
+        if (!found) {
+            return FALSE;
+        }
+    }
+
+    return (Bool)(functions == CALLGRAPH_CHECK_FUNCTIONS && self == cpu->cycles &&
+        graph->functions[0x0138].calls == 9 && graph->functions[0x0008].calls == 1);
+}
+
+int CallGraphSelfCheck(void) {
+    Cpu8080 *cpu = (Cpu8080 *)malloc(sizeof(Cpu8080));
+    BlockCache *blocks = (BlockCache *)malloc(sizeof(BlockCache));
+    JitCache *jit = (JitCache *)malloc(sizeof(JitCache));
+    CallGraph *graph = (CallGraph *)malloc(sizeof(CallGraph));
+    int engines = ENGINE_JIT;
+    unsigned long runs = 0;
+    unsigned long mismatches = 0;
+
+    if (!cpu || !blocks || !jit || !graph) {
+        fprintf(stderr, "Error: Could not allocate machine state\n");
+        free(cpu);
+        free(blocks);
+        free(jit);
+        free(graph);
+        return -1;
+    }
+
+    CpuInit(cpu);
+    BlockCacheInit(blocks);
+
+    if (JitCacheInit(jit) == 0) {
+        engines = ENGINE_JIT + 1;
+    }
+
+    for (int engine = ENGINE_STEP; engine < engines; engine++) {
+        FILE *file = tmpfile();
+
+        BlockFlush(blocks);
+        JitFlush(jit);
+        CpuInit(cpu);
+        cpu->engine = (Engine)engine;
+        cpu->blocks = engine == ENGINE_BLOCK ? blocks : NULL;
+        cpu->jit = engine == ENGINE_JIT ? jit : NULL;
+        memcpy(&cpu->memory[SMC_ORIGIN], callGraphProgram, sizeof(callGraphProgram));
+        cpu->memory[0x0008] = 0xC9;
+        cpu->PC = SMC_ORIGIN;
+        cpu->SP = SMC_STACK;
+        runs++;
+
+        if (CallGraphInit(graph, NULL) < 0) {
+            printf("[selfcheck] call graph: no memory\n");
+            mismatches++;
+            break;
+        }
+
+        CallGraphStart(cpu, graph);
+
+        while (!cpu->halted) {
+            Execute(cpu, 0, 0, 0);
+        }
+
+        CallGraphStop(cpu);
+
+        if (!CallGraphExpected(graph, cpu) || cpu->PC != 0x011A || !file || CallGraphWrite(graph, file) < 0) {
+            printf("[selfcheck] call graph on %s: not the calls the program makes\n", smcEngineNames[engine]);
+            mismatches++;
+        }
+
+        CallGraphFree(graph);
+
+        if (file) {
+            fclose(file);
+        }
+    }
+
+    printf("[selfcheck] call graph: %lu runs, %lu mismatches\n", runs, mismatches);
+
+    JitCacheFree(jit);
+    free(graph);
+    free(jit);
+    free(blocks);
+    free(cpu);
+    return (int)(mismatches != 0);
+}
+
+/*
+    Heatmap check (also run by --selfcheck, but only an EMU_MEMORY_HEATMAP
+    build counts anything). A subroutine called 16 times
+    copies 16 bytes from 2000H to 3000H. Every engine has to count exactly
+    the fetches of page 1, the reads and writes of the copy and the stack
+    in page EFH, each byte of the copy once, and working set samples that
+    add up to the whole run and find the same four pages.
+*/
+
+#define HEATMAP_CHECK_INTERVAL      100ULL
+
+#ifdef RUN_MEMORY_HEATMAP
+static const uint8_t heatmapProgram[] = {
+    0x31, 0x00, 0xF0,           /* 0100  LXI SP,0F000H */
+    0x21, 0x00, 0x20,           /* 0103  LXI H,2000H */
+    0x11, 0x00, 0x30,           /* 0106  LXI D,3000H */
+    0x06, 0x10,                 /* 0109  MVI B,16 */
+    0xCD, 0x20, 0x01,           /* 010B  CALL 0120 */
+    0x05,                       /* 010E  DCR B */
+    0xC2, 0x0B, 0x01,           /* 010F  JNZ 010B */
+    0x76,                       /* 0112  HLT */
+    0x00, 0x00, 0x00, 0x00,     /* 0113  NOP (x13) */
+    0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00,
+    0x00,
+    0x7E,                       /* 0120  MOV A,M */
+    0x12,                       /* 0121  STAX D */
+    0x23,                       /* 0122  INX H */
+    0x13,                       /* 0123  INX D */
+    0xC9                        /* 0124  RET */
+};
+
+static Bool HeatmapExpected(const Heatmap *heatmap, const Cpu8080 *cpu) {
+    const WorkingSetSample *last = &heatmap->samples[heatmap->sampleCount - 1];
+    unsigned long long accesses = 0;
+    int pages = 0;
+
+    for (int kind = 0; kind < HEATMAP_KINDS; kind++) {
+        for (int page = 0; page < MEM_PAGE_COUNT; page++) {
+            accesses += heatmap->pages[kind][page];
+            pages += heatmap->pages[kind][page] != 0;
+        }
+    }
+
+    /* 11 bytes of setup, 16 rounds of 7 in the loop and 5 in the copy, the HLT */
+    if (accesses != 204 + 48 + 48 || pages != 5 || heatmap->pages[HEATMAP_FETCH][0x01] != 204 ||
+        heatmap->pages[HEATMAP_READ][0x20] != 16 || heatmap->pages[HEATMAP_READ][0xEF] != 32 ||
+        heatmap->pages[HEATMAP_WRITE][0x30] != 16 || heatmap->pages[HEATMAP_WRITE][0xEF] != 32) {
+        return FALSE;
+    }
+
+    for (int idx = 0; idx < 16; idx++) {
+        if (heatmap->bytes[HEATMAP_READ][0x2000 + idx] != 1 || heatmap->bytes[HEATMAP_WRITE][0x3000 + idx] != 1 ||
+            cpu->memory[0x3000 + idx] != cpu->memory[0x2000 + idx]) {
+            return FALSE;
+        }
+    }
+
+    return (Bool)(heatmap->bytes[HEATMAP_FETCH][0x0120] == 16 && heatmap->sampleCount > 1 &&
+        heatmap->cycles == cpu->cycles && last->cycles == cpu->cycles &&
+        last->instructions == cpu->instructions && last->total == 4 && !cpu->heatmap);
+}
+#endif
+
+int HeatmapSelfCheck(void) {
+#ifdef RUN_MEMORY_HEATMAP
+    Cpu8080 *cpu = (Cpu8080 *)malloc(sizeof(Cpu8080));
+    BlockCache *blocks = (BlockCache *)malloc(sizeof(BlockCache));
+    JitCache *jit = (JitCache *)malloc(sizeof(JitCache));
+    Heatmap *heatmap = (Heatmap *)malloc(sizeof(Heatmap));
+    int engines = ENGINE_JIT;
+    unsigned long runs = 0;
+    unsigned long mismatches = 0;
+
+    if (!cpu || !blocks || !jit || !heatmap) {
+        fprintf(stderr, "Error: Could not allocate machine state\n");
+        free(cpu);
+        free(blocks);
+        free(jit);
+        free(heatmap);
+        return -1;
+    }
+
+    CpuInit(cpu);
+    BlockCacheInit(blocks);
+
+    if (JitCacheInit(jit) == 0) {
+        engines = ENGINE_JIT + 1;
+    }
+
+    for (int engine = ENGINE_STEP; engine < engines; engine++) {
+        FILE *file = tmpfile();
+        Bool written;
+
+        BlockFlush(blocks);
+        JitFlush(jit);
+        CpuInit(cpu);
+        cpu->engine = (Engine)engine;
+        cpu->blocks = engine == ENGINE_BLOCK ? blocks : NULL;
+        cpu->jit = engine == ENGINE_JIT ? jit : NULL;
+        memcpy(&cpu->memory[SMC_ORIGIN], heatmapProgram, sizeof(heatmapProgram));
+
+        for (int idx = 0; idx < 16; idx++) {
+            cpu->memory[0x2000 + idx] = (uint8_t)(0xA0 + idx);
+        }
+
+        cpu->PC = SMC_ORIGIN;
+        cpu->SP = SMC_STACK;
+        runs++;
+
+        if (HeatmapInit(heatmap, TRUE, HEATMAP_CHECK_INTERVAL) < 0 || HeatmapStart(cpu, heatmap) < 0) {
+            printf("[selfcheck] heatmap: could not start\n");
+            HeatmapFree(heatmap);
+            mismatches++;
+            break;
+        }
+
+        while (!cpu->halted) {
+            Execute(cpu, 0, 0, 0);
+        }
+
+        HeatmapStop(cpu, heatmap);
+
+        /* The image is its header and three bytes a pixel */
+        written = (Bool)(file && HeatmapWriteCsv(heatmap, file) == 0 && HeatmapWriteWorkingSet(heatmap, file) == 0);
+
+        if (written) {
+            long start = ftell(file);
+
+            written = (Bool)(HeatmapWriteImage(heatmap, file) == 0 &&
+                ftell(file) - start == 15 + HEATMAP_IMAGE_WIDTH * HEATMAP_IMAGE_HEIGHT * 3);
+        }
+
+        if (!HeatmapExpected(heatmap, cpu) || !written) {
+            printf("[selfcheck] heatmap on %s: not the accesses the program makes\n", smcEngineNames[engine]);
+            mismatches++;
+        }
+
+        HeatmapFree(heatmap);
+
+        if (file) {
+            fclose(file);
+        }
+    }
+
+    printf("[selfcheck] heatmap: %lu runs, %lu mismatches\n", runs, mismatches);
+
+    JitCacheFree(jit);
+    free(heatmap);
+    free(jit);
+    free(blocks);
+    free(cpu);
+    return (int)(mismatches != 0);
+#else
+    printf("[selfcheck] heatmap: not counted in this build, see EMU_MEMORY_HEATMAP\n");
+    return 0;
+#endif
+}
+
+/*
+    Bank switching check (also run by --selfcheck). Three 16K windows over
+    four banks, with the program in common memory above them. It marks the
+    banks, plants a different subroutine at 2000H in bank 0 and bank 2 and
+    then calls both in turn, switching with OUTs to the whole-bank and to
+    the per-window ports, including ones that change nothing, so the code
+    after an OUT has been decoded by the time one does switch. Every engine
+    has to end with the same state, memory and bank contents as Step(), in
+    one go and in short slices.
+*/
+
+#define BANK_CHECK_ORIGIN           0xD000
+#define BANK_CHECK_WINDOWS          3
+#define BANK_CHECK_BANKS            4
+#define BANK_CHECK_INSTRUCTIONS     10000ULL
+
+static const uint8_t bankProgram[] = {
+    0x31, 0x00, 0xF0,           /* D000  LXI SP,0F000H */
+    0x06, 0x03,                 /* D003  MVI B,3 */
+    0x78,                       /* D005  MOV A,B */
+    0xD3, 0x40,                 /* D006  OUT 40H */
+    0x32, 0x00, 0x10,           /* D008  STA 1000H */
+    0x32, 0x00, 0x50,           /* D00B  STA 5000H */
+    0x05,                       /* D00E  DCR B */
+    0xC2, 0x05, 0xD0,           /* D00F  JNZ D005 */
+    0x3E, 0x02,                 /* D012  MVI A,2 */
+    0xD3, 0x40,                 /* D014  OUT 40H */
+    0x21, 0x00, 0x20,           /* D016  LXI H,2000H */
+    0x36, 0x3C,                 /* D019  MVI M,3CH */
+    0x23,                       /* D01B  INX H */
+    0x36, 0xC9,                 /* D01C  MVI M,0C9H */
+    0xAF,                       /* D01E  XRA A */
+    0xD3, 0x41,                 /* D01F  OUT 41H */
+    0x21, 0x00, 0x20,           /* D021  LXI H,2000H */
+    0x36, 0x3D,                 /* D024  MVI M,3DH */
+    0x23,                       /* D026  INX H */
+    0x36, 0xC9,                 /* D027  MVI M,0C9H */
+    0xAF,                       /* D029  XRA A */
+    0xD3, 0x40,                 /* D02A  OUT 40H */
+    0x0E, 0x10,                 /* D02C  MVI C,16 */
+    0x3E, 0x02,                 /* D02E  MVI A,2 */
+    0xD3, 0x40,                 /* D030  OUT 40H */
+    0xCD, 0x00, 0x20,           /* D032  CALL 2000H */
+    0x57,                       /* D035  MOV D,A */
+    0xAF,                       /* D036  XRA A */
+    0xD3, 0x40,                 /* D037  OUT 40H */
+    0xD3, 0x40,                 /* D039  OUT 40H */
+    0xCD, 0x00, 0x20,           /* D03B  CALL 2000H */
+    0x82,                       /* D03E  ADD D */
+    0x21, 0x00, 0xD1,           /* D03F  LXI H,0D100H */
+    0x86,                       /* D042  ADD M */
+    0x77,                       /* D043  MOV M,A */
+    0x3A, 0x00, 0x10,           /* D044  LDA 1000H */
+    0x23,                       /* D047  INX H */
+    0x86,                       /* D048  ADD M */
+    0x77,                       /* D049  MOV M,A */
+    0x0D,                       /* D04A  DCR C */
+    0xC2, 0x2E, 0xD0,           /* D04B  JNZ D02E */
+    0x0E, 0x04,                 /* D04E  MVI C,4 */
+    0x79,                       /* D050  MOV A,C */
+    0xFE, 0x01,                 /* D051  CPI 1 */
+    0x3E, 0x00,                 /* D053  MVI A,0 */
+    0xC2, 0x5A, 0xD0,           /* D055  JNZ D05A */
+    0x3E, 0x02,                 /* D058  MVI A,2 */
+    0xD3, 0x41,                 /* D05A  OUT 41H */
+    0x3A, 0x00, 0x10,           /* D05C  LDA 1000H */
+    0x21, 0x03, 0xD1,           /* D05F  LXI H,0D103H */
+    0x86,                       /* D062  ADD M */
+    0x77,                       /* D063  MOV M,A */
+    0xAF,                       /* D064  XRA A */
+    0xD3, 0x41,                 /* D065  OUT 41H */
+    0x0D,                       /* D067  DCR C */
+    0xC2, 0x50, 0xD0,           /* D068  JNZ D050 */
+    0x3E, 0x03,                 /* D06B  MVI A,3 */
+    0xD3, 0x40,                 /* D06D  OUT 40H */
+    0x3A, 0x00, 0x50,           /* D06F  LDA 5000H */
+    0x47,                       /* D072  MOV B,A */
+    0x3E, 0x01,                 /* D073  MVI A,1 */
+    0xD3, 0x42,                 /* D075  OUT 42H */
+    0x3A, 0x00, 0x50,           /* D077  LDA 5000H */
+    0x80,                       /* D07A  ADD B */
+    0x32, 0x02, 0xD1,           /* D07B  STA 0D102H */
+    0x76,                       /* D07E  HLT */
+};
+
+static void BankExecute(Cpu8080 *cpu, BankedMemory *bank, Engine engine, unsigned long long slice) {
+    BlockCache *blocks = cpu->blocks;
+    JitCache *jit = cpu->jit;
+
+    if (blocks) {
+        BlockFlush(blocks);
+    }
+
+    if (jit) {
+        JitFlush(jit);
+    }
+
+    memset(bank->store, 0, (size_t)(bank->bankCount - 1) * bank->windowSize * bank->windowCount);
+    memset(bank->window, 0, sizeof(bank->window));
+
+    CpuInit(cpu);
+    cpu->engine = engine;
+    cpu->blocks = engine == ENGINE_BLOCK ? blocks : NULL;
+    cpu->jit = engine == ENGINE_JIT ? jit : NULL;
+    BankAttach(cpu, bank);
+    memcpy(&cpu->memory[BANK_CHECK_ORIGIN], bankProgram, sizeof(bankProgram));
+    cpu->PC = BANK_CHECK_ORIGIN;
+
+    while (!cpu->halted && cpu->instructions < BANK_CHECK_INSTRUCTIONS) {
+        Execute(cpu, slice, BANK_CHECK_INSTRUCTIONS - cpu->instructions, 0);
+    }
+
+    cpu->blocks = blocks;
+    cpu->jit = jit;
+}
+
+int BankSelfCheck(void) {
+    Cpu8080 *cpu = (Cpu8080 *)malloc(sizeof(Cpu8080));
+    Cpu8080 *ref = (Cpu8080 *)malloc(sizeof(Cpu8080));
+    BlockCache *blocks = (BlockCache *)malloc(sizeof(BlockCache));
+    JitCache *jit = (JitCache *)malloc(sizeof(JitCache));
+    static const unsigned long long slices[] = { 0, 37 };
+    BankedMemory bank;
+    uint8_t *refStore = NULL;
+    size_t storeSize = 0;
+    int engines = ENGINE_JIT;
+    unsigned long runs = 0;
+    unsigned long mismatches = 0;
+
+    if (BankInit(&bank, BANK_DEFAULT_WINDOW, BANK_CHECK_WINDOWS, BANK_CHECK_BANKS, BANK_DEFAULT_PORT) == 0) {
+        storeSize = (size_t)(BANK_CHECK_BANKS - 1) * BANK_DEFAULT_WINDOW * BANK_CHECK_WINDOWS;
+        refStore = (uint8_t *)malloc(storeSize);
+    }
+
+    if (!cpu || !ref || !blocks || !jit || !refStore) {
+        fprintf(stderr, "Error: Could not allocate machine state\n");
+        BankFree(&bank);
+        free(refStore);
+        free(cpu);
+        free(ref);
+        free(blocks);
+        free(jit);
+        return -1;
+    }
+
+    CpuInit(cpu);
+    BlockCacheInit(blocks);
+
+    if (JitCacheInit(jit) == 0) {
+        engines = ENGINE_JIT + 1;
+    }
+
+    cpu->blocks = blocks;
+    cpu->jit = jit;
+
+    BankExecute(cpu, &bank, ENGINE_STEP, 0);
+    memcpy(ref, cpu, sizeof(Cpu8080));
+    memcpy(refStore, bank.store, storeSize);
+
+    /* 16 rounds of bank 2's INR A plus bank 0's DCR A, bank 2 seen once, banks 3 and 1 still marked */
+    if (!ref->halted || ref->memory[0xD100] != 0x20 || ref->memory[0xD102] != 4 || ref->memory[0xD103] != 2) {
+        printf("[selfcheck] banks: Step() did not switch banks as planned\n");
+        mismatches++;
+    }
+
+    for (int engine = ENGINE_RUN; engine < engines; engine++) {
+        for (size_t slice = 0; slice < sizeof(slices) / sizeof(slices[0]); slice++) {
+            BankExecute(cpu, &bank, (Engine)engine, slices[slice]);
+            runs++;
+
+            Bool same = (Bool)(memcmp(cpu->registers, ref->registers, sizeof(ref->registers)) == 0 &&
+                cpu->PC == ref->PC && cpu->halted == ref->halted &&
+                cpu->cycles == ref->cycles && cpu->instructions == ref->instructions &&
+                memcmp(cpu->memory, ref->memory, sizeof(ref->memory)) == 0 &&
+                memcmp(bank.store, refStore, storeSize) == 0);
+
+            if (!same) {
+                printf("[selfcheck] %s, %llu cycle slices: banked state differs from Step()\n",
+                    smcEngineNames[engine], slices[slice]);
+                mismatches++;
+            }
+        }
+    }
+
+    printf("[selfcheck] banks: %lu runs against Step(), %lu mismatches\n", runs, mismatches);
+
+    BankFree(&bank);
+    JitCacheFree(jit);
+    free(jit);
+    free(blocks);
+    free(refStore);
+    free(ref);
+    free(cpu);
+    return (int)(mismatches != 0);
+}
+
+/*
+    Timer interrupt check (also run by --selfcheck). A timer raises RST 7
+    every 1000 cycles; the handler counts ticks, and on the third one spins
+    for three periods so the next request has to wait for its EI. The main
+    program counts in HL until five ticks, then waits in HLT for three
+    more and stops with interrupts off. The handler also counts how often
+    it was entered with a return address in page 0, which only happens if
+    an interrupt is taken between its EI and its RET. Every engine has to
+    end with the same state, memory and event counts as Step().
+
+    Then EI; HLT with no cycle limit and an event that never interrupts:
+    as an observer it must not keep the HLT waiting at all, as a device it
+    may only for HALT_WAIT_LIMIT cycles.
+*/
+
+#define INT_CHECK_ORIGIN            0x0100
+#define INT_CHECK_TICKS             0x0200
+#define INT_CHECK_NESTED            0x0201
+#define INT_CHECK_COUNT             0x0202
+#define INT_CHECK_PERIOD            1000
+#define INT_CHECK_INSTRUCTIONS      100000ULL
+
+static const uint8_t intHandler[] = {
+    0xE3,                       /* 0038  XTHL */
+    0xF5,                       /* 0039  PUSH PSW */
+    0x7C,                       /* 003A  MOV A,H */
+    0xB7,                       /* 003B  ORA A */
+    0xC2, 0x46, 0x00,           /* 003C  JNZ 0046 */
+    0x3A, 0x01, 0x02,           /* 003F  LDA 0201H */
+    0x3C,                       /* 0042  INR A */
+    0x32, 0x01, 0x02,           /* 0043  STA 0201H */
+    0x3A, 0x00, 0x02,           /* 0046  LDA 0200H */
+    0x3C,                       /* 0049  INR A */
+    0x32, 0x00, 0x02,           /* 004A  STA 0200H */
+    0xFE, 0x03,                 /* 004D  CPI 3 */
+    0xC2, 0x58, 0x00,           /* 004F  JNZ 0058 */
+    0x3E, 0xC8,                 /* 0052  MVI A,200 */
+    0x3D,                       /* 0054  DCR A */
+    0xC2, 0x54, 0x00,           /* 0055  JNZ 0054 */
+    0xF1,                       /* 0058  POP PSW */
+    0xE3,                       /* 0059  XTHL */
+    0xFB,                       /* 005A  EI */
+    0xC9,                       /* 005B  RET */
+};
+
+static const uint8_t intProgram[] = {
+    0x31, 0x00, 0xF0,           /* 0100  LXI SP,0F000H */
+    0x21, 0x00, 0x00,           /* 0103  LXI H,0 */
+    0xFB,                       /* 0106  EI */
+    0x23,                       /* 0107  INX H */
+    0x3A, 0x00, 0x02,           /* 0108  LDA 0200H */
+    0xFE, 0x05,                 /* 010B  CPI 5 */
+    0xDA, 0x07, 0x01,           /* 010D  JC 0107 */
+    0x76,                       /* 0110  HLT */
+    0x3A, 0x00, 0x02,           /* 0111  LDA 0200H */
+    0xFE, 0x08,                 /* 0114  CPI 8 */
+    0xDA, 0x10, 0x01,           /* 0116  JC 0110 */
+    0xF3,                       /* 0119  DI */
+    0x22, 0x02, 0x02,           /* 011A  SHLD 0202H */
+    0x76,                       /* 011D  HLT */
+};
+
+#define INT_CHECK_TICK_PERIOD       (1ULL << 20)
+
+static const uint8_t intHaltProgram[] = {
+    0xFB,                       /* 0100  EI */
+    0x76,                       /* 0101  HLT */
+};
+
+typedef struct {
+    Bool wakes;
+    unsigned long ticks;
+} IntHaltTicker;
+
+/* Ticks on forever without ever asking for an interrupt */
+static void IntHaltTick(Cpu8080 *cpu, unsigned long long when, void *context) {
+    IntHaltTicker *ticker = (IntHaltTicker *)context;
+
+    ticker->ticks++;
+
+    if (ticker->wakes) {
+        EventSchedule(cpu, when + INT_CHECK_TICK_PERIOD, IntHaltTick, ticker);
+    } else {
+        EventScheduleObserver(cpu, when + INT_CHECK_TICK_PERIOD, IntHaltTick, ticker);
+    }
+}
+
+/* The HLT has to end Execute(), an observer's before its first tick */
+static unsigned long IntHaltCheck(Cpu8080 *cpu, Engine engine, BlockCache *blocks, JitCache *jit,
+    Bool wakes, unsigned long *runs) {
+    IntHaltTicker ticker = { wakes, 0 };
+    unsigned long long limit = (HALT_WAIT_LIMIT + INT_CHECK_TICK_PERIOD - 1) / INT_CHECK_TICK_PERIOD;
+
+    BlockFlush(blocks);
+
+    if (jit) {
+        JitFlush(jit);
+    }
+
+    CpuInit(cpu);
+    cpu->engine = engine;
+    cpu->blocks = engine == ENGINE_BLOCK ? blocks : NULL;
+    cpu->jit = engine == ENGINE_JIT ? jit : NULL;
+    memcpy(&cpu->memory[INT_CHECK_ORIGIN], intHaltProgram, sizeof(intHaltProgram));
+    cpu->PC = INT_CHECK_ORIGIN;
+    IntHaltTick(cpu, 0, &ticker);
+    ticker.ticks = 0;
+    (*runs)++;
+
+    StopReason reason = Execute(cpu, 0, 0, 0);
+
+    cpu->blocks = blocks;
+    cpu->jit = jit;
+
+    if (reason != STOP_HALT || !cpu->halted || ticker.ticks > (wakes ? limit : 0)) {
+        printf("[selfcheck] %s, %s: HLT with no interrupt coming stopped on %d after %lu ticks\n",
+            smcEngineNames[engine], wakes ? "device" : "observer", (int)reason, ticker.ticks);
+        return 1;
+    }
+
+    return 0;
+}
+
+static void IntExecute(Cpu8080 *cpu, Timer *timer, Engine engine, unsigned long long slice) {
+    BlockCache *blocks = cpu->blocks;
+    JitCache *jit = cpu->jit;
+
+    if (blocks) {
+        BlockFlush(blocks);
+    }
+
+    if (jit) {
+        JitFlush(jit);
+    }
+
+    CpuInit(cpu);
+    cpu->engine = engine;
+    cpu->blocks = engine == ENGINE_BLOCK ? blocks : NULL;
+    cpu->jit = engine == ENGINE_JIT ? jit : NULL;
+    memcpy(&cpu->memory[0x0038], intHandler, sizeof(intHandler));
+    memcpy(&cpu->memory[INT_CHECK_ORIGIN], intProgram, sizeof(intProgram));
+    cpu->PC = INT_CHECK_ORIGIN;
+    TimerStart(cpu, timer, INT_CHECK_PERIOD, 7);
+
+    while (cpu->instructions < INT_CHECK_INSTRUCTIONS &&
+        Execute(cpu, slice, INT_CHECK_INSTRUCTIONS - cpu->instructions, 0) == STOP_BUDGET) {
+    }
+
+    cpu->blocks = blocks;
+    cpu->jit = jit;
+}
+
+int InterruptSelfCheck(void) {
+    Cpu8080 *cpu = (Cpu8080 *)malloc(sizeof(Cpu8080));
+    Cpu8080 *ref = (Cpu8080 *)malloc(sizeof(Cpu8080));
+    BlockCache *blocks = (BlockCache *)malloc(sizeof(BlockCache));
+    JitCache *jit = (JitCache *)malloc(sizeof(JitCache));
+    static const unsigned long long slices[] = { 0, 37 };
+    Timer timer;
+    unsigned long long refTicks;
+    int engines = ENGINE_JIT;
+    unsigned long runs = 0;
+    unsigned long mismatches = 0;
+
+    if (!cpu || !ref || !blocks || !jit) {
+        fprintf(stderr, "Error: Could not allocate machine state\n");
+        free(cpu);
+        free(ref);
+        free(blocks);
+        free(jit);
+        return -1;
+    }
+
+    CpuInit(cpu);
+    BlockCacheInit(blocks);
+
+    if (JitCacheInit(jit) == 0) {
+        engines = ENGINE_JIT + 1;
+    }
+
+    cpu->blocks = blocks;
+    cpu->jit = jit;
+
+    IntExecute(cpu, &timer, ENGINE_STEP, 0);
+    memcpy(ref, cpu, sizeof(Cpu8080));
+    refTicks = timer.ticks;
+
+    /* Eight ticks taken, none between EI and RET, the stack back where it was */
+    if (!ref->halted || ref->memory[INT_CHECK_TICKS] != 8 || ref->memory[INT_CHECK_NESTED] != 0 ||
+        ref->interrupts != 8 || ref->SP != 0xF000 || ref->pairs[RP_HL] == 0) {
+        printf("[selfcheck] interrupts: Step() did not take the timer interrupts as planned\n");
+        mismatches++;
+    }
+
+    for (int engine = ENGINE_RUN; engine < engines; engine++) {
+        for (size_t slice = 0; slice < sizeof(slices) / sizeof(slices[0]); slice++) {
+            IntExecute(cpu, &timer, (Engine)engine, slices[slice]);
+            runs++;
+
+            Bool same = (Bool)(memcmp(cpu->registers, ref->registers, sizeof(ref->registers)) == 0 &&
+                cpu->PC == ref->PC && cpu->halted == ref->halted &&
+                cpu->cycles == ref->cycles && cpu->instructions == ref->instructions &&
+                cpu->interrupts == ref->interrupts && timer.ticks == refTicks &&
+                memcmp(cpu->memory, ref->memory, sizeof(ref->memory)) == 0);
+
+            if (!same) {
+                printf("[selfcheck] %s, %llu cycle slices: interrupt state differs from Step()\n",
+                    smcEngineNames[engine], slices[slice]);
+                mismatches++;
+            }
+        }
+    }
+
+    for (int engine = ENGINE_STEP; engine < engines; engine++) {
+        mismatches += IntHaltCheck(cpu, (Engine)engine, blocks, jit, FALSE, &runs);
+        mismatches += IntHaltCheck(cpu, (Engine)engine, blocks, jit, TRUE, &runs);
+    }
+
+    printf("[selfcheck] interrupts: %lu runs against Step(), %lu mismatches\n", runs, mismatches);
+
+    JitCacheFree(jit);
+    free(jit);
+    free(blocks);
+    free(ref);
+    free(cpu);
+    return (int)(mismatches != 0);
+}
@@ -0,0 +1,345 @@
+#include <stdio.h>
+#include <string.h>
+#include "cpu.h"
+#include "bdos.h"
+#include "bank.h"
+#include "state.h"
+#include "image.h"
+
+/*
+    Save states. Everything the guest can see goes into one flat buffer:
+    registers, PC, halt and interrupt state, the cycle and instruction
+    counts, memory[], ioPorts[], the BDOS (DMA address, current disk and
+    every open file by name and position) and, with banks attached, which
+    bank each window shows and the banks themselves. Numbers are little
+    endian whatever the host, so a state can move between machines.
+
+    What the host wired up is not saved: traps, port and memory handlers,
+    ROM images and pending events all point at host code or data. A host
+    that uses them sets them up again before LoadState(), the same way it
+    did before the first run.
+
+    Both directions are a few fixed fields and a memcpy() of 64K. Loading
+    only drops decoded code (block cache, JIT) from pages whose bytes
+    actually change, so jumping back and forth between states of the same
+    program keeps its translations.
+
+    Going back to the same starting point over and over (one job after
+    another on the same program) does not need a state at all: a
+    ResetImage is taken once after setup and ResetRestore() copies back
+    only the pages marked in dirtyPages, a handful for most jobs.
+*/
+
+#define STATE_HAS_BDOS              0x01
+#define STATE_HAS_BANK              0x02
+
+#define STATE_HEADER_SIZE           (STATE_MAGIC_SIZE + 12)
+#define STATE_CPU_SIZE              32
+#define STATE_FILE_SIZE             (8 + BDOS_NAME_SIZE)
+#define STATE_BDOS_SIZE             (4 + MAX_OPEN_FILES * STATE_FILE_SIZE)
+#define STATE_BANK_SIZE             (13 + BANK_MAX_WINDOWS)
+
+static size_t BankStoreSize(const BankedMemory *bank) {
+    return (size_t)(bank->bankCount - 1) * bank->windowSize * bank->windowCount;
+}
+
+/* Bytes SaveState() writes for this machine as it is set up now */
+size_t StateSize(const Cpu8080 *cpu) {
+    size_t size = STATE_HEADER_SIZE + STATE_CPU_SIZE + MEM_MAX + NUM_IO_PORTS;
+
+    if (cpu->bdos) {
+        size += STATE_BDOS_SIZE;
+    }
+
+    if (cpu->bank) {
+        size += STATE_BANK_SIZE + BankStoreSize(cpu->bank);
+    }
+
+    return size;
+}
+
+static void Put8(uint8_t **at, uint8_t value) {
+    *(*at)++ = value;
+}
+
+static void Put16(uint8_t **at, uint16_t value) {
+    Put8(at, (uint8_t)value);
+    Put8(at, (uint8_t)(value >> 8));
+}
+
+static void Put32(uint8_t **at, uint32_t value) {
+    Put16(at, (uint16_t)value);
+    Put16(at, (uint16_t)(value >> 16));
+}
+
+static void Put64(uint8_t **at, unsigned long long value) {
+    Put32(at, (uint32_t)value);
+    Put32(at, (uint32_t)(value >> 32));
+}
+
+static uint8_t Get8(const uint8_t **at) {
+    return *(*at)++;
+}
+
+static uint16_t Get16(const uint8_t **at) {
+    uint16_t low = Get8(at);
+
+    return (uint16_t)(low | (Get8(at) << 8));
+}
+
+static uint32_t Get32(const uint8_t **at) {
+    uint32_t low = Get16(at);
+
+    return low | ((uint32_t)Get16(at) << 16);
+}
+
+static unsigned long long Get64(const uint8_t **at) {
+    unsigned long long low = Get32(at);
+
+    return low | ((unsigned long long)Get32(at) << 32);
+}
+
+/* Returns the bytes written, 0 if size is less than StateSize() */
+size_t SaveState(const Cpu8080 *cpu, uint8_t *buffer, size_t size) {
+    size_t total = StateSize(cpu);
+    uint8_t *at = buffer;
+
+    if (size < total) {
+        return 0;
+    }
+
+    memcpy(at, STATE_MAGIC, STATE_MAGIC_SIZE);
+    at += STATE_MAGIC_SIZE;
+    Put32(&at, STATE_VERSION);
+    Put32(&at, (uint32_t)total);
+    Put32(&at, (cpu->bdos ? STATE_HAS_BDOS : 0) | (cpu->bank ? STATE_HAS_BANK : 0));
+
+    for (int rp = RP_BC; rp <= RP_PSW; rp++) {
+        Put16(&at, cpu->pairs[rp]);
+    }
+
+    Put16(&at, cpu->PC);
+    Put8(&at, (uint8_t)cpu->halted);
+    Put8(&at, (uint8_t)cpu->interruptsEnabled);
+    Put8(&at, cpu->interruptPending);
+    Put8(&at, 0);
+    Put64(&at, cpu->cycles);
+    Put64(&at, cpu->instructions);
+
+    MemCopyOwn(cpu, at);
+    at += MEM_MAX;
+    memcpy(at, cpu->ioPorts, NUM_IO_PORTS);
+    at += NUM_IO_PORTS;
+
+    if (cpu->bdos) {
+        const BdosState *bdos = cpu->bdos;
+
+        Put16(&at, bdos->dmaAddress);
+        Put8(&at, bdos->currentDisk);
+        Put8(&at, 0);
+
+        for (int idx = 0; idx < MAX_OPEN_FILES; idx++) {
+            const OpenFile *open = &bdos->openFiles[idx];
+
+            Put16(&at, open->fcb_addr);
+            Put8(&at, (uint8_t)(open->fp != NULL));
+            Put8(&at, 0);
+            Put32(&at, open->fp ? (uint32_t)ftell(open->fp) : 0);
+            memcpy(at, open->name, BDOS_NAME_SIZE);
+            at += BDOS_NAME_SIZE;
+        }
+    }
+
+    if (cpu->bank) {
+        const BankedMemory *bank = cpu->bank;
+
+        Put32(&at, bank->bankCount);
+        Put32(&at, bank->windowSize);
+        Put32(&at, bank->windowCount);
+        Put8(&at, bank->port);
+        memcpy(at, bank->window, BANK_MAX_WINDOWS);
+        at += BANK_MAX_WINDOWS;
+        memcpy(at, bank->store, BankStoreSize(bank));
+        at += BankStoreSize(bank);
+    }
+
+    return (size_t)(at - buffer);
+}
+
+/*
+    memory[] from a state (or a checkpoint, see timeline.c), touching only
+    pages whose bytes change: they are marked dirty, lose their decoded
+    code and stop sharing an image.
+*/
+void LoadMemory(Cpu8080 *cpu, const uint8_t *from) {
+    for (int page = 0; page < MEM_PAGE_COUNT; page++) {
+        uint16_t addr = (uint16_t)(page << MEM_PAGE_SHIFT);
+        const uint8_t *src = from + addr;
+
+        if (memcmp(MemOwnPage(cpu, page), src, MEM_PAGE_SIZE) != 0) {
+            ImageUnshare(cpu, addr, MEM_PAGE_SIZE);
+            memcpy(&cpu->memory[addr], src, MEM_PAGE_SIZE);
+            cpu->dirtyPages[page] = 1;
+            CodeRangeWritten(cpu, addr, MEM_PAGE_SIZE);
+        }
+    }
+}
+
+/*
+    Puts the machine back where SaveState() was called. -1, with nothing
+    changed, if buffer is not a state of this version or the machine is
+    not set up the same way (BDOS and banks attached or not, the same bank
+    layout). A file that can no longer be opened comes back closed.
+*/
+int LoadState(Cpu8080 *cpu, const uint8_t *buffer, size_t size) {
+    const uint8_t *at = buffer;
+
+    if (size < STATE_HEADER_SIZE || memcmp(at, STATE_MAGIC, STATE_MAGIC_SIZE) != 0) {
+        return -1;
+    }
+
+    at += STATE_MAGIC_SIZE;
+
+    uint32_t version = Get32(&at);
+    uint32_t total = Get32(&at);
+    uint32_t contents = Get32(&at);
+
+    if (version != STATE_VERSION || total > size || total != StateSize(cpu) ||
+        contents != ((cpu->bdos ? STATE_HAS_BDOS : 0) | (cpu->bank ? STATE_HAS_BANK : 0))) {
+        return -1;
+    }
+
+    if (cpu->bank) {
+        const BankedMemory *bank = cpu->bank;
+        const uint8_t *layout = buffer + total - BankStoreSize(bank) - STATE_BANK_SIZE;
+
+        if (Get32(&layout) != bank->bankCount || Get32(&layout) != bank->windowSize ||
+            Get32(&layout) != bank->windowCount || Get8(&layout) != bank->port) {
+            return -1;
+        }
+    }
+
+    for (int rp = RP_BC; rp <= RP_PSW; rp++) {
+        cpu->pairs[rp] = Get16(&at);
+    }
+
+    cpu->PC = Get16(&at);
+    cpu->halted = Get8(&at) ? TRUE : FALSE;
+    cpu->interruptsEnabled = Get8(&at) ? TRUE : FALSE;
+    cpu->interruptPending = Get8(&at);
+    at++;
+    cpu->cycles = Get64(&at);
+    cpu->instructions = Get64(&at);
+
+    LoadMemory(cpu, at);
+    at += MEM_MAX;
+    memcpy(cpu->ioPorts, at, NUM_IO_PORTS);
+    at += NUM_IO_PORTS;
+
+    if (cpu->bdos) {
+        BdosState *bdos = cpu->bdos;
+
+        BDOS_Shutdown(bdos);
+        bdos->dmaAddress = Get16(&at);
+        bdos->currentDisk = Get8(&at);
+        at++;
+
+        for (int idx = 0; idx < MAX_OPEN_FILES; idx++) {
+            uint16_t fcbAddr = Get16(&at);
+            Bool open = Get8(&at) ? TRUE : FALSE;
+            char name[BDOS_NAME_SIZE];
+
+            at++;
+            uint32_t position = Get32(&at);
+            memcpy(name, at, BDOS_NAME_SIZE);
+            name[BDOS_NAME_SIZE - 1] = '\0';
+            at += BDOS_NAME_SIZE;
+
+            if (open) {
+                BDOS_ReopenFile(bdos, idx, name, fcbAddr, (long)position);
+            }
+        }
+    }
+
+    if (cpu->bank) {
+        BankedMemory *bank = cpu->bank;
+
+        at += 13;
+
+        uint8_t window[BANK_MAX_WINDOWS];
+
+        memcpy(window, at, BANK_MAX_WINDOWS);
+        at += BANK_MAX_WINDOWS;
+        memcpy(bank->store, at, BankStoreSize(bank));
+
+        for (uint32_t idx = 0; idx < bank->windowCount; idx++) {
+            BankSelect(cpu, idx, window[idx]);
+        }
+    }
+
+    /* The engines and IdlePoll() must not go on from what they knew */
+    cpu->idle.valid = FALSE;
+    cpu->yield = TRUE;
+
+    return 0;
+}
+
+/*
+    Takes the machine as it is now (program loaded, CP/M page zero and
+    traps in place) as the one ResetRestore() goes back to, and starts
+    tracking stores from here.
+*/
+void ResetCapture(Cpu8080 *cpu, ResetImage *image) {
+    memcpy(image->pairs, cpu->pairs, sizeof(image->pairs));
+    image->PC = cpu->PC;
+    image->interruptsEnabled = cpu->interruptsEnabled;
+    memcpy(image->ioPorts, cpu->ioPorts, NUM_IO_PORTS);
+    MemCopyOwn(cpu, image->memory);
+    MemDirtyClear(cpu);
+}
+
+/*
+    Puts the machine back to image for the next job: registers and ports,
+    the counts from zero, the BDOS with its files closed, and memory[]
+    page by page for the pages stored to since. Decoded code on those pages is dropped, the
+    rest keeps its translations. Returns the pages copied.
+
+    Banks and what the host wired up (traps, handlers, events) are left as
+    they are, the same as LoadState() does.
+*/
+uint32_t ResetRestore(Cpu8080 *cpu, const ResetImage *image) {
+    uint32_t restored = 0;
+
+    for (int page = 0; page < MEM_PAGE_COUNT; page++) {
+        if (!cpu->dirtyPages[page]) {
+            continue;
+        }
+
+        uint16_t addr = (uint16_t)(page << MEM_PAGE_SHIFT);
+
+        ImageUnshare(cpu, addr, MEM_PAGE_SIZE);
+        memcpy(&cpu->memory[addr], &image->memory[addr], MEM_PAGE_SIZE);
+        CodeRangeWritten(cpu, addr, MEM_PAGE_SIZE);
+        restored++;
+    }
+
+    MemDirtyClear(cpu);
+
+    memcpy(cpu->pairs, image->pairs, sizeof(cpu->pairs));
+    cpu->PC = image->PC;
+    cpu->halted = FALSE;
+    cpu->interruptsEnabled = image->interruptsEnabled;
+    cpu->interruptPending = 0;
+    cpu->cycles = 0;
+    cpu->instructions = 0;
+    memcpy(cpu->ioPorts, image->ioPorts, NUM_IO_PORTS);
+
+    if (cpu->bdos) {
+        BDOS_Shutdown(cpu->bdos);
+    }
+
+    cpu->idle.valid = FALSE;
+    cpu->yield = TRUE;
+
+    return restored;
+}
@@ -0,0 +1,36 @@
+#ifndef STATE_H
+#define STATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "cpu.h"
+
+/* First bytes of every save state, then STATE_VERSION */
+#define STATE_MAGIC                 "8080SAVE"
+#define STATE_MAGIC_SIZE            8
+#define STATE_VERSION               1
+
+size_t StateSize(const Cpu8080 *cpu);
+size_t SaveState(const Cpu8080 *cpu, uint8_t *buffer, size_t size);
+int LoadState(Cpu8080 *cpu, const uint8_t *buffer, size_t size);
+void LoadMemory(Cpu8080 *cpu, const uint8_t *from);
+
+/*
+    A machine as it was right after setup, to go back to between jobs. See
+    ResetCapture() and ResetRestore(); memory comes back by dirty page.
+*/
+typedef struct {
+    uint16_t pairs[RP_COUNT];
+    uint16_t PC;
+    Bool interruptsEnabled;
+    uint8_t ioPorts[NUM_IO_PORTS];
+    uint8_t memory[MEM_MAX];
+} ResetImage;
+
+void ResetCapture(Cpu8080 *cpu, ResetImage *image);
+uint32_t ResetRestore(Cpu8080 *cpu, const ResetImage *image);
+
+/* Dirty page tracking and ResetRestore() on every engine, see selfcheck.c */
+int ResetSelfCheck(void);
+
+#endif
@@ -0,0 +1,287 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "symbols.h"
+
+/*
+    Guest labels for the profiler, read from the assembler's listing or a
+    SYM file.
+
+    A .PRN listing has one line per source line, the address and object code
+    in front. The code labels are the ones on a line of their own address:
+        MACRO-80:      0100    C3 0113               begin:  jmp     start
+                       0000'   21 0000              add16:: lxi     h,0
+        CP/M ASM:      014B D5        MSG:  PUSH    D
+    so a line that starts with 4 hex digits, then maybe a relocation mark,
+    then only hex object code, then a name with a colon names that address.
+    Equates (an "=" where the object code goes) are not code and are left
+    out, so are labels without a colon, which ASM allows on DS and DB lines.
+
+    A .SYM file, as L80 or a cross assembler writes it, is address and name
+    pairs, any number of them to a line:
+        0100 BEGIN     0113 START
+*/
+
+static Bool IsNameStart(int c) {
+    return isalpha(c) || c == '_' || c == '.' || c == '?' || c == '@' || c == '$';
+}
+
+static Bool IsNameChar(int c) {
+    return IsNameStart(c) || isdigit(c);
+}
+
+/* 4 hex digits not followed by another name character: an address */
+static Bool ReadAddress(const char *text, uint16_t *addr) {
+    unsigned int value = 0;
+
+    for (int idx = 0; idx < 4; idx++) {
+        if (!isxdigit((unsigned char)text[idx])) {
+            return FALSE;
+        }
+
+        value = value * 16 + (unsigned int)(isdigit((unsigned char)text[idx]) ?
+            text[idx] - '0' : toupper((unsigned char)text[idx]) - 'A' + 10);
+    }
+
+    if (IsNameChar((unsigned char)text[4])) {
+        return FALSE;
+    }
+
+    *addr = (uint16_t)value;
+    return TRUE;
+}
+
+static const char *SkipSpace(const char *text) {
+    while (*text == ' ' || *text == '\t' || *text == '\f') {
+        text++;
+    }
+
+    return text;
+}
+
+static int AddSymbol(SymbolTable *table, uint16_t addr, const char *name, size_t length) {
+    Symbol *symbol;
+
+    if (table->count == table->capacity) {
+        int capacity = table->capacity ? table->capacity * 2 : 256;
+        Symbol *symbols = (Symbol *)realloc(table->symbols, (size_t)capacity * sizeof(Symbol));
+
+        if (!symbols) {
+            return -1;
+        }
+
+        table->symbols = symbols;
+        table->capacity = capacity;
+    }
+
+    if (length >= SYMBOL_NAME_SIZE) {
+        length = SYMBOL_NAME_SIZE - 1;
+    }
+
+    symbol = &table->symbols[table->count];
+    symbol->addr = addr;
+    symbol->order = (uint32_t)table->count;
+    memcpy(symbol->name, name, length);
+    symbol->name[length] = 0;
+    table->count++;
+
+    return 0;
+}
+
+/* A listing line: the label it puts at its address, if any */
+static int ReadListingLine(SymbolTable *table, const char *line) {
+    const char *text = SkipSpace(line);
+    uint16_t addr;
+
+    if (!ReadAddress(text, &addr)) {
+        return 0;
+    }
+
+    text += 4;
+
+    /* MACRO-80's marks for relocatable, common and external addresses */
+    while (*text == '\'' || *text == '"' || *text == '!' || *text == '*') {
+        text++;
+    }
+
+    text = SkipSpace(text);
+
+    if (*text == '=') {
+        return 0;
+    }
+
+    while (*text && *text != ';' && *text != '\n' && *text != '\r') {
+        const char *start = text;
+        Bool hex = TRUE;
+
+        while (*text && *text != ' ' && *text != '\t' && *text != '\n' && *text != '\r') {
+            if (!isxdigit((unsigned char)*text) && *text != '\'' && *text != '"') {
+                hex = FALSE;
+            }
+
+            text++;
+        }
+
+        if (!hex) {
+            const char *end = start;
+
+            if (!IsNameStart((unsigned char)*start)) {
+                return 0;
+            }
+
+            while (IsNameChar((unsigned char)*end)) {
+                end++;
+            }
+
+            /* Object code is in front of any label, so whatever this is ends the line */
+            return *end == ':' ? AddSymbol(table, addr, start, (size_t)(end - start)) : 0;
+        }
+
+        text = SkipSpace(text);
+    }
+
+    return 0;
+}
+
+/* A SYM line: every address with a name after it */
+static int ReadSymLine(SymbolTable *table, const char *line) {
+    const char *text = SkipSpace(line);
+
+    while (*text && *text != '\n' && *text != '\r') {
+        uint16_t addr;
+        const char *name;
+        const char *end;
+
+        if (!ReadAddress(text, &addr)) {
+            return 0;
+        }
+
+        name = SkipSpace(text + 4);
+        end = name;
+
+        while (IsNameChar((unsigned char)*end)) {
+            end++;
+        }
+
+        if (end == name) {
+            return 0;
+        }
+
+        if (AddSymbol(table, addr, name, (size_t)(end - name)) < 0) {
+            return -1;
+        }
+
+        text = SkipSpace(end);
+    }
+
+    return 0;
+}
+
+static int CompareSymbols(const void *left, const void *right) {
+    const Symbol *a = (const Symbol *)left;
+    const Symbol *b = (const Symbol *)right;
+
+    if (a->addr != b->addr) {
+        return (int)a->addr - (int)b->addr;
+    }
+
+    return a->order < b->order ? -1 : a->order > b->order;
+}
+
+void SymbolsInit(SymbolTable *table) {
+    table->symbols = NULL;
+    table->count = 0;
+    table->capacity = 0;
+}
+
+/*
+    Adds the labels of a listing, or with symFormat of a SYM file, to the
+    ones already there. A label at an address that already has one is
+    dropped. -1 on a read error or with no memory left.
+*/
+int SymbolsRead(SymbolTable *table, FILE *file, Bool symFormat) {
+    char line[512];
+    Bool partial = FALSE;
+    int kept = 0;
+
+    while (fgets(line, sizeof(line), file)) {
+        /* The rest of a line too long for the buffer, nothing to read in it */
+        Bool rest = partial;
+
+        partial = !strchr(line, '\n') && !feof(file);
+
+        if (rest) {
+            continue;
+        }
+
+        if ((symFormat ? ReadSymLine(table, line) : ReadListingLine(table, line)) < 0) {
+            return -1;
+        }
+    }
+
+    if (ferror(file)) {
+        return -1;
+    }
+
+    qsort(table->symbols, (size_t)table->count, sizeof(Symbol), CompareSymbols);
+
+    for (int idx = 0; idx < table->count; idx++) {
+        if (kept && table->symbols[kept - 1].addr == table->symbols[idx].addr) {
+            continue;
+        }
+
+        table->symbols[kept] = table->symbols[idx];
+        table->symbols[kept].order = (uint32_t)kept;
+        kept++;
+    }
+
+    table->count = kept;
+    return 0;
+}
+
+/* A .SYM file by its name, anything else as a listing. -1 if it can't be read. */
+int SymbolsLoad(SymbolTable *table, const char *filename) {
+    const char *dot = strrchr(filename, '.');
+    FILE *file = fopen(filename, "r");
+    int result;
+
+    if (!file) {
+        return -1;
+    }
+
+    result = SymbolsRead(table, file, dot && _stricmp(dot, ".sym") == 0);
+    fclose(file);
+
+    return result;
+}
+
+/* The label at or closest below addr, NULL if there is none */
+const Symbol *SymbolFind(const SymbolTable *table, uint16_t addr) {
+    int low = 0;
+    int high = table->count;
+
+    while (low < high) {
+        int middle = (low + high) / 2;
+
+        if (table->symbols[middle].addr <= addr) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    return low ? &table->symbols[low - 1] : NULL;
+}
+
+/* The label at addr exactly */
+const Symbol *SymbolAt(const SymbolTable *table, uint16_t addr) {
+    const Symbol *symbol = SymbolFind(table, addr);
+
+    return symbol && symbol->addr == addr ? symbol : NULL;
+}
+
+void SymbolsFree(SymbolTable *table) {
+    free(table->symbols);
+    SymbolsInit(table);
+}
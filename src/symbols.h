@@ -0,0 +1,31 @@
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "cpu.h"
+
+/* Longer names are cut, the terminating 0 included */
+#define SYMBOL_NAME_SIZE            32
+
+typedef struct {
+    uint16_t addr;
+    uint32_t order;                     /* as read, the first of several at one address wins */
+    char name[SYMBOL_NAME_SIZE];
+} Symbol;
+
+/* Guest labels by address, see symbols.c */
+typedef struct {
+    Symbol *symbols;                    /* sorted by addr, one per address */
+    int count;
+    int capacity;
+} SymbolTable;
+
+void SymbolsInit(SymbolTable *table);
+int SymbolsLoad(SymbolTable *table, const char *filename);
+int SymbolsRead(SymbolTable *table, FILE *file, Bool symFormat);
+const Symbol *SymbolFind(const SymbolTable *table, uint16_t addr);
+const Symbol *SymbolAt(const SymbolTable *table, uint16_t addr);
+void SymbolsFree(SymbolTable *table);
+
+#endif
@@ -0,0 +1,392 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cpu.h"
+#include "bdos.h"
+#include "state.h"
+#include "replay.h"
+#include "timeline.h"
+
+/*
+    Reverse execution. Going back to instruction n is going to the last
+    checkpoint at or before n and running forward from there; the run
+    comes out the same because it is fed the same inputs from the input
+    log (replay.c) that the timeline records from the start. So a
+    checkpoint only has to hold what Execute() and the devices see, and
+    only the memory pages stored to since the checkpoint before it: the
+    dirty pages every engine marks anyway (see dirtyPages in cpu.h).
+
+    A delta needs all the checkpoints back to the last full one, so every
+    so often one is taken full: once the deltas since the last full one
+    add up to 64K, once a quarter of the checkpoint records are deltas of
+    it, and after every seek, since dirtyPages then says what changed since
+    the machine was put back, not since the newest checkpoint.
+
+    Everything lives in one budget fixed up front: the checkpoint records
+    and a ring of page bytes. When the next checkpoint does not fit, the
+    oldest full one goes, with the deltas after it. Nothing is allocated
+    while running.
+
+    Forward, the cost is Execute() in slices of interval instructions, one
+    scan of dirtyPages and a copy of the pages it lists per slice. Back,
+    it is putting memory together (at most 128K of copies) and running at
+    most interval instructions.
+
+    Banks are not covered, nor is anything the host keeps outside the
+    machine: the memory map, traps and handlers stay as they are, and so
+    do the BDOS open files at the newest point, which is right since file
+    calls in the past come from the log. Console output is not printed
+    again (see ReplayRerun()). Timers and other events come back with the
+    queue.
+*/
+
+static Checkpoint *Mark(const Timeline *timeline, uint32_t idx) {
+    return &timeline->marks[(timeline->first + idx) % timeline->markCount];
+}
+
+/* Drops the oldest full checkpoint and the deltas that need it */
+static void DropOldest(Timeline *timeline) {
+    do {
+        timeline->first = (timeline->first + 1) % timeline->markCount;
+        timeline->count--;
+        timeline->stats.dropped++;
+    } while (timeline->count && !Mark(timeline, 0)->full);
+}
+
+/* Where size bytes of pages go, making room by dropping the oldest checkpoints */
+static size_t Allocate(Timeline *timeline, size_t size) {
+    for (;;) {
+        if (timeline->count == 0) {
+            return 0;
+        }
+
+        const Checkpoint *oldest = Mark(timeline, 0);
+        const Checkpoint *newest = Mark(timeline, timeline->count - 1);
+        size_t tail = oldest->offset;
+        size_t head = newest->offset + (size_t)newest->pageCount * MEM_PAGE_SIZE;
+
+        if (timeline->count < timeline->markCount) {
+            if (head > tail) {
+                if (timeline->storeSize - head >= size) {
+                    return head;
+                }
+
+                if (tail >= size) {
+                    return 0;
+                }
+            } else if (tail - head >= size) {
+                return head;
+            }
+        }
+
+        DropOldest(timeline);
+    }
+}
+
+static void Take(Timeline *timeline, Cpu8080 *cpu) {
+    uint8_t pages[MEM_PAGE_COUNT];
+    int count = MemDirtyList(cpu, pages);
+    Bool full = (Bool)(timeline->needFull || count == MEM_PAGE_COUNT ||
+        timeline->bytesSinceFull + (size_t)count * MEM_PAGE_SIZE > MEM_MAX ||
+        timeline->marksSinceFull >= timeline->markCount / 4);
+
+    if (full) {
+        count = MEM_PAGE_COUNT;
+
+        for (int page = 0; page < MEM_PAGE_COUNT; page++) {
+            pages[page] = (uint8_t)page;
+        }
+    }
+
+    size_t size = (size_t)count * MEM_PAGE_SIZE;
+    size_t offset = Allocate(timeline, size);
+    Checkpoint *mark = Mark(timeline, timeline->count++);
+
+    mark->instructions = cpu->instructions;
+    mark->cycles = cpu->cycles;
+    mark->interrupts = cpu->interrupts;
+    memcpy(mark->pairs, cpu->pairs, sizeof(mark->pairs));
+    mark->PC = cpu->PC;
+    mark->halted = cpu->halted;
+    mark->interruptsEnabled = cpu->interruptsEnabled;
+    mark->interruptPending = cpu->interruptPending;
+    mark->dmaAddress = cpu->bdos ? cpu->bdos->dmaAddress : 0;
+    mark->currentDisk = cpu->bdos ? cpu->bdos->currentDisk : 0;
+    memcpy(mark->ioPorts, cpu->ioPorts, NUM_IO_PORTS);
+    mark->events = cpu->events;
+    mark->logPosition = ReplayTell(cpu, &mark->logLast);
+
+    mark->full = full;
+    mark->pageCount = (uint32_t)count;
+    mark->offset = offset;
+    memcpy(mark->pages, pages, (size_t)count);
+
+    for (int idx = 0; idx < count; idx++) {
+        memcpy(timeline->store + offset + (size_t)idx * MEM_PAGE_SIZE, MemOwnPage(cpu, pages[idx]), MEM_PAGE_SIZE);
+    }
+
+    MemDirtyClear(cpu);
+
+    timeline->bytesSinceFull = full ? 0 : timeline->bytesSinceFull + size;
+    timeline->marksSinceFull = full ? 0 : timeline->marksSinceFull + 1;
+    timeline->needFull = FALSE;
+    timeline->stats.taken++;
+    timeline->stats.full += full;
+}
+
+/* The machine as it was at checkpoint idx, input log included */
+static void Restore(Timeline *timeline, Cpu8080 *cpu, uint32_t idx) {
+    uint32_t base = idx;
+
+    while (!Mark(timeline, base)->full) {
+        base--;
+    }
+
+    for (uint32_t at = base; at <= idx; at++) {
+        const Checkpoint *mark = Mark(timeline, at);
+
+        for (uint32_t page = 0; page < mark->pageCount; page++) {
+            memcpy(timeline->scratch + ((size_t)mark->pages[page] << MEM_PAGE_SHIFT),
+                timeline->store + mark->offset + (size_t)page * MEM_PAGE_SIZE, MEM_PAGE_SIZE);
+        }
+    }
+
+    const Checkpoint *mark = Mark(timeline, idx);
+
+    /* While cpu->instructions is still where the recording has got to */
+    ReplaySeek(cpu, mark->logPosition, mark->logLast);
+    LoadMemory(cpu, timeline->scratch);
+    memcpy(cpu->pairs, mark->pairs, sizeof(cpu->pairs));
+    cpu->PC = mark->PC;
+    cpu->halted = mark->halted;
+    cpu->interruptsEnabled = mark->interruptsEnabled;
+    cpu->interruptPending = mark->interruptPending;
+    cpu->cycles = mark->cycles;
+    cpu->instructions = mark->instructions;
+    cpu->interrupts = mark->interrupts;
+    memcpy(cpu->ioPorts, mark->ioPorts, NUM_IO_PORTS);
+    cpu->events = mark->events;
+
+    if (cpu->bdos) {
+        cpu->bdos->dmaAddress = mark->dmaAddress;
+        cpu->bdos->currentDisk = mark->currentDisk;
+    }
+
+    /* The engines and IdlePoll() must not go on from what they knew */
+    cpu->idle.valid = FALSE;
+    cpu->yield = TRUE;
+    timeline->needFull = TRUE;
+}
+
+/* The newest checkpoint at or before instructions, -1 if that is before the oldest */
+static long Find(const Timeline *timeline, unsigned long long instructions) {
+    long idx = (long)timeline->count - 1;
+
+    while (idx >= 0 && Mark(timeline, (uint32_t)idx)->instructions > instructions) {
+        idx--;
+    }
+
+    return idx;
+}
+
+/*
+    Sets up a timeline for cpu as it is now, in budget bytes all told, with
+    a checkpoint every interval instructions (0 for the default). Run the
+    machine with TimelineRun() from here. -1 if budget is too small or cpu
+    has banks or is recording or replaying already: the timeline keeps the
+    input log itself.
+*/
+int TimelineInit(Timeline *timeline, Cpu8080 *cpu, size_t budget, unsigned long long interval) {
+    memset(timeline, 0, sizeof(*timeline));
+
+    if (budget < TIMELINE_MIN_BUDGET || cpu->bank || cpu->replay) {
+        return -1;
+    }
+
+    timeline->interval = interval ? interval : TIMELINE_DEFAULT_INTERVAL;
+    timeline->markCount = (uint32_t)(budget / TIMELINE_BYTES_PER_MARK);
+    timeline->storeSize = (budget - timeline->markCount * sizeof(Checkpoint) - MEM_MAX) & ~(size_t)(MEM_PAGE_SIZE - 1);
+    timeline->marks = (Checkpoint *)calloc(timeline->markCount, sizeof(Checkpoint));
+    timeline->store = (uint8_t *)malloc(timeline->storeSize);
+    timeline->scratch = (uint8_t *)malloc(MEM_MAX);
+    timeline->log = tmpfile();
+
+    if (!timeline->marks || !timeline->store || !timeline->scratch || !timeline->log ||
+        ReplayStart(cpu, &timeline->replay, timeline->log, REPLAY_RECORD) < 0) {
+        TimelineFree(timeline, cpu);
+        return -1;
+    }
+
+    timeline->needFull = TRUE;
+    Take(timeline, cpu);
+
+    return 0;
+}
+
+void TimelineFree(Timeline *timeline, Cpu8080 *cpu) {
+    if (cpu->replay == &timeline->replay) {
+        cpu->replay = NULL;
+    }
+
+    if (timeline->log) {
+        fclose(timeline->log);
+    }
+
+    free(timeline->marks);
+    free(timeline->store);
+    free(timeline->scratch);
+    memset(timeline, 0, sizeof(*timeline));
+}
+
+/*
+    Execute() with checkpoints: runs up to maxInstructions (0 is no limit)
+    in slices that end on the next checkpoint. Same stopMask and result.
+*/
+StopReason TimelineRun(Timeline *timeline, Cpu8080 *cpu, unsigned long long maxInstructions, unsigned int stopMask) {
+    unsigned long long start = cpu->instructions;
+
+    for (;;) {
+        unsigned long long next = Mark(timeline, timeline->count - 1)->instructions + timeline->interval;
+
+        /* Run past the timeline by Execute() itself */
+        if (cpu->instructions >= next) {
+            Take(timeline, cpu);
+            continue;
+        }
+
+        unsigned long long slice = next - cpu->instructions;
+
+        if (maxInstructions) {
+            unsigned long long left = maxInstructions - (cpu->instructions - start);
+
+            if (left == 0) {
+                return STOP_BUDGET;
+            }
+
+            slice = left < slice ? left : slice;
+        }
+
+        StopReason reason = Execute(cpu, 0, slice, stopMask);
+
+        if (cpu->instructions >= next) {
+            Take(timeline, cpu);
+        }
+
+        if (reason != STOP_BUDGET) {
+            return reason;
+        }
+    }
+}
+
+/*
+    Puts the machine where it was after instructions instructions, going
+    back to a checkpoint first unless it only has to go forward from where
+    it is. Past the newest point that is plain running, with live input.
+    -1 if instructions is before the oldest checkpoint (nothing changes)
+    or the program halts before it gets there.
+*/
+int TimelineSeek(Timeline *timeline, Cpu8080 *cpu, unsigned long long instructions) {
+    long idx = Find(timeline, instructions);
+
+    if (idx < 0) {
+        return -1;
+    }
+
+    timeline->stats.seeks++;
+
+    if (cpu->instructions > instructions || cpu->instructions < Mark(timeline, (uint32_t)idx)->instructions) {
+        Restore(timeline, cpu, (uint32_t)idx);
+    }
+
+    unsigned long long from = cpu->instructions;
+
+    /* 0 would be no limit to TimelineRun() */
+    if (from < instructions) {
+        TimelineRun(timeline, cpu, instructions - from, 0);
+        timeline->stats.replayed += cpu->instructions - from;
+    }
+
+    return cpu->instructions == instructions ? 0 : -1;
+}
+
+/* One instruction back, -1 at the oldest checkpoint */
+int TimelineStepBack(Timeline *timeline, Cpu8080 *cpu) {
+    if (cpu->instructions == 0 || cpu->instructions <= TimelineOldest(timeline)) {
+        return -1;
+    }
+
+    return TimelineSeek(timeline, cpu, cpu->instructions - 1);
+}
+
+/*
+    Back to the last time a breakpoint was about to run, before now:
+    STOP_BREAKPOINT. With none since the oldest checkpoint it stops there,
+    STOP_NONE. Each interval is run forward with breakpoints on, newest
+    first, until one has a hit.
+*/
+StopReason TimelineReverseContinue(Timeline *timeline, Cpu8080 *cpu) {
+    unsigned long long until = cpu->instructions;
+    long idx = Find(timeline, until ? until - 1 : 0);
+
+    if (idx < 0 || until == 0) {
+        return STOP_NONE;
+    }
+
+    for (;;) {
+        unsigned long long hit = 0;
+        Bool found = FALSE;
+
+        Restore(timeline, cpu, (uint32_t)idx);
+
+        while (cpu->instructions < until) {
+            if (BreakpointAt(cpu, cpu->PC)) {
+                hit = cpu->instructions;
+                found = TRUE;
+            }
+
+            unsigned long long from = cpu->instructions;
+
+            StopReason reason = Execute(cpu, 0, until - cpu->instructions, STOP_ON_BREAKPOINT);
+
+            timeline->stats.replayed += cpu->instructions - from;
+
+            if (reason != STOP_BREAKPOINT) {
+                break;
+            }
+        }
+
+        if (found) {
+            TimelineSeek(timeline, cpu, hit);
+            return STOP_BREAKPOINT;
+        }
+
+        if (idx == 0) {
+            Restore(timeline, cpu, 0);
+            return STOP_NONE;
+        }
+
+        until = Mark(timeline, (uint32_t)idx)->instructions;
+        idx--;
+    }
+}
+
+/* The earliest instruction count a seek can go to */
+unsigned long long TimelineOldest(const Timeline *timeline) {
+    return Mark(timeline, 0)->instructions;
+}
+
+void TimelinePrintStats(const Timeline *timeline) {
+    size_t used = 0;
+    uint32_t full = 0;
+
+    for (uint32_t idx = 0; idx < timeline->count; idx++) {
+        used += (size_t)Mark(timeline, idx)->pageCount * MEM_PAGE_SIZE;
+        full += Mark(timeline, idx)->full;
+    }
+
+    printf("[rewind] %u checkpoints (%u full) back to instruction %llu, %.1f of %.1f MB of pages; "
+        "%llu taken, %llu dropped, %llu seeks ran %llu instructions\n",
+        timeline->count, full, TimelineOldest(timeline), (double)used / (1 << 20),
+        (double)timeline->storeSize / (1 << 20), timeline->stats.taken, timeline->stats.dropped,
+        timeline->stats.seeks, timeline->stats.replayed);
+}
@@ -0,0 +1,88 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "cpu.h"
+#include "replay.h"
+
+/* Instructions between checkpoints unless TimelineInit() is told otherwise */
+#define TIMELINE_DEFAULT_INTERVAL   1000000ULL
+
+/* Smallest budget: two full checkpoints and their deltas have to fit */
+#define TIMELINE_MIN_BUDGET         (1UL << 20)
+
+/* One checkpoint record per this many bytes of budget, see TimelineInit() */
+#define TIMELINE_BYTES_PER_MARK     16384
+
+typedef struct {
+    unsigned long long taken;           /* checkpoints taken, full ones included */
+    unsigned long long full;
+    unsigned long long dropped;         /* the oldest, to stay in budget */
+    unsigned long long seeks;
+    unsigned long long replayed;        /* instructions run again to get somewhere */
+} TimelineStats;
+
+/*
+    Where the machine was at one instruction count: what Execute() and the
+    devices need besides memory, and the pages that changed since the
+    checkpoint before it (all of them for a full one), in the timeline's
+    page store.
+*/
+typedef struct {
+    unsigned long long instructions;
+    unsigned long long cycles;
+    unsigned long long interrupts;
+    uint16_t pairs[RP_COUNT];
+    uint16_t PC;
+    Bool halted;
+    Bool interruptsEnabled;
+    uint8_t interruptPending;
+    uint16_t dmaAddress;
+    uint8_t currentDisk;
+    uint8_t ioPorts[NUM_IO_PORTS];
+    EventQueue events;
+    long logPosition;                   /* input log, see ReplaySeek() */
+    unsigned long long logLast;
+
+    Bool full;
+    uint32_t pageCount;
+    size_t offset;                      /* into store, pageCount pages */
+    uint8_t pages[MEM_PAGE_COUNT];      /* page numbers, in store order */
+} Checkpoint;
+
+/*
+    Reverse execution, see timeline.c: checkpoints every interval
+    instructions into a fixed budget, oldest dropped first, and an input
+    log so any instruction since the oldest can be run to again.
+*/
+typedef struct {
+    unsigned long long interval;
+    Checkpoint *marks;                  /* a ring, first is the oldest */
+    uint32_t markCount;
+    uint32_t first;
+    uint32_t count;
+    uint8_t *store;                     /* page bytes, a ring of whole checkpoints */
+    size_t storeSize;
+    size_t bytesSinceFull;
+    uint32_t marksSinceFull;
+    Bool needFull;                      /* dirtyPages no longer relative to the newest */
+    uint8_t *scratch;                   /* MEM_MAX, memory being put together */
+    FILE *log;
+    Replay replay;
+    TimelineStats stats;
+} Timeline;
+
+int TimelineInit(Timeline *timeline, Cpu8080 *cpu, size_t budget, unsigned long long interval);
+void TimelineFree(Timeline *timeline, Cpu8080 *cpu);
+StopReason TimelineRun(Timeline *timeline, Cpu8080 *cpu, unsigned long long maxInstructions, unsigned int stopMask);
+int TimelineSeek(Timeline *timeline, Cpu8080 *cpu, unsigned long long instructions);
+int TimelineStepBack(Timeline *timeline, Cpu8080 *cpu);
+StopReason TimelineReverseContinue(Timeline *timeline, Cpu8080 *cpu);
+unsigned long long TimelineOldest(const Timeline *timeline);
+void TimelinePrintStats(const Timeline *timeline);
+
+/* Seeks and reverse-continue against Step() on every engine, see selfcheck.c */
+int TimelineSelfCheck(void);
+
+#endif
@@ -0,0 +1,435 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cpu.h"
+#include "block.h"
+#include "disasm.h"
+#include "trace.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+/*
+    Instruction trace. While cpu->trace is set, Execute() runs the flat bus
+    through RunTraced() in run.c, Run() with a record built from its locals
+    in front of every instruction (TraceRecord() in trace.h). The Step
+    engine, a mapped bus, breakpoints, a call graph and a heatmap go through
+    Step() instead (see RunSingle()), which hands each instruction to
+    TraceInstruction() first. The other engines, and runs without a trace,
+    never look at it.
+
+    A record is the machine right before the instruction runs, as a delta
+    of the record before it, so most take four to six bytes:
+
+        flags u8, the TRACE_* bits below
+        instructions (varint)       TRACE_COUNT: cpu->instructions, when it
+                                    is not one more than last time
+        PC u16                      TRACE_JUMP: when it is not where the
+                                    last instruction falls through to
+        opcode u8 and its operand bytes
+        mask u8, then the registers TRACE_REGS: C B E D L H F A (the
+                                    pairs low byte first), bit 0 for C,
+                                    the ones that changed
+        SP u16                      TRACE_SP: when it changed
+
+    after "8080TRCE" and version u32, all numbers little endian. The first
+    record has everything.
+
+    Records go into TRACE_BLOCK_SIZE blocks; a full one is handed to a
+    writer thread and the next one is filled while it goes to the file. If
+    the writer falls TRACE_BLOCKS behind, the machine waits for it (counted
+    as a stall).
+*/
+
+struct TraceWriter {
+    FILE *file;
+    uint8_t *blocks[TRACE_BLOCKS];
+    size_t sizes[TRACE_BLOCKS];
+    unsigned int head;                  /* the block being filled */
+    unsigned int tail;                  /* the next one to write */
+    unsigned int queued;                /* handed over, not written yet */
+    Bool done;
+    Bool failed;
+#ifdef _WIN32
+    SRWLOCK lock;
+    CONDITION_VARIABLE wake;
+    HANDLE thread;
+#else
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t thread;
+#endif
+};
+
+#ifdef _WIN32
+#define LOCK(w)             AcquireSRWLockExclusive(&(w)->lock)
+#define UNLOCK(w)           ReleaseSRWLockExclusive(&(w)->lock)
+#define WAIT(w)             SleepConditionVariableSRW(&(w)->wake, &(w)->lock, INFINITE, 0)
+#define WAKE(w)             WakeAllConditionVariable(&(w)->wake)
+#else
+#define LOCK(w)             pthread_mutex_lock(&(w)->lock)
+#define UNLOCK(w)           pthread_mutex_unlock(&(w)->lock)
+#define WAIT(w)             pthread_cond_wait(&(w)->wake, &(w)->lock)
+#define WAKE(w)             pthread_cond_broadcast(&(w)->wake)
+#endif
+
+/* The writer thread: blocks to the file in the order they were handed over, until done */
+static void WriteBlocks(TraceWriter *writer) {
+    LOCK(writer);
+
+    for (;;) {
+        while (!writer->queued && !writer->done) {
+            WAIT(writer);
+        }
+
+        if (!writer->queued) {
+            break;
+        }
+
+        unsigned int idx = writer->tail;
+
+        UNLOCK(writer);
+
+        if (fwrite(writer->blocks[idx], 1, writer->sizes[idx], writer->file) != writer->sizes[idx]) {
+            writer->failed = TRUE;
+        }
+
+        LOCK(writer);
+        writer->tail = (writer->tail + 1) % TRACE_BLOCKS;
+        writer->queued--;
+        WAKE(writer);
+    }
+
+    UNLOCK(writer);
+}
+
+#ifdef _WIN32
+static DWORD WINAPI WriterThread(LPVOID arg) {
+    WriteBlocks((TraceWriter *)arg);
+    return 0;
+}
+#else
+static void *WriterThread(void *arg) {
+    WriteBlocks((TraceWriter *)arg);
+    return NULL;
+}
+#endif
+
+static void WriterFree(TraceWriter *writer) {
+    for (int idx = 0; idx < TRACE_BLOCKS; idx++) {
+        free(writer->blocks[idx]);
+    }
+
+    free(writer);
+}
+
+static TraceWriter *WriterStart(FILE *file) {
+    TraceWriter *writer = (TraceWriter *)calloc(1, sizeof(TraceWriter));
+
+    if (!writer) {
+        return NULL;
+    }
+
+    writer->file = file;
+
+    for (int idx = 0; idx < TRACE_BLOCKS; idx++) {
+        writer->blocks[idx] = (uint8_t *)malloc(TRACE_BLOCK_SIZE);
+
+        if (!writer->blocks[idx]) {
+            WriterFree(writer);
+            return NULL;
+        }
+    }
+
+#ifdef _WIN32
+    InitializeSRWLock(&writer->lock);
+    InitializeConditionVariable(&writer->wake);
+    writer->thread = CreateThread(NULL, 0, WriterThread, writer, 0, NULL);
+
+    if (!writer->thread) {
+        WriterFree(writer);
+        return NULL;
+    }
+#else
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->wake, NULL);
+
+    if (pthread_create(&writer->thread, NULL, WriterThread, writer) != 0) {
+        pthread_cond_destroy(&writer->wake);
+        pthread_mutex_destroy(&writer->lock);
+        WriterFree(writer);
+        return NULL;
+    }
+#endif
+
+    return writer;
+}
+
+/* Hands the block being filled to the writer and starts on the next one */
+void TraceHandOver(Trace *trace) {
+    TraceWriter *writer = trace->writer;
+    size_t size = (size_t)(trace->fill - trace->block);
+
+    trace->stats.bytes += size;
+    trace->stats.blocks++;
+
+    LOCK(writer);
+    writer->sizes[writer->head] = size;
+    writer->head = (writer->head + 1) % TRACE_BLOCKS;
+    writer->queued++;
+    WAKE(writer);
+
+    if (writer->queued == TRACE_BLOCKS) {
+        trace->stats.stalls++;
+
+        while (writer->queued == TRACE_BLOCKS) {
+            WAIT(writer);
+        }
+    }
+
+    UNLOCK(writer);
+
+    trace->block = writer->blocks[writer->head];
+    trace->fill = trace->block;
+    trace->limit = trace->block + TRACE_BLOCK_SIZE - TRACE_MAX_RECORD;
+}
+
+static void WriterStop(Trace *trace) {
+    TraceWriter *writer = trace->writer;
+
+    if (trace->fill != trace->block) {
+        TraceHandOver(trace);
+    }
+
+    LOCK(writer);
+    writer->done = TRUE;
+    WAKE(writer);
+    UNLOCK(writer);
+
+#ifdef _WIN32
+    WaitForSingleObject(writer->thread, INFINITE);
+    CloseHandle(writer->thread);
+#else
+    pthread_join(writer->thread, NULL);
+    pthread_cond_destroy(&writer->wake);
+    pthread_mutex_destroy(&writer->lock);
+#endif
+
+    trace->failed |= (Bool)(writer->failed || fflush(writer->file) != 0);
+    WriterFree(writer);
+    trace->writer = NULL;
+}
+
+static uint64_t TraceRegisters(const Cpu8080 *cpu) {
+    return TRACE_REGISTERS(cpu->pairs[RP_BC], cpu->pairs[RP_DE], cpu->pairs[RP_HL], cpu->pairs[RP_PSW]);
+}
+
+/*
+    Traces every instruction cpu runs from here into file, opened for
+    binary writing, until TraceFinish(). -1 if the writer thread or its
+    blocks could not be set up.
+*/
+int TraceStart(Cpu8080 *cpu, Trace *trace, FILE *file) {
+    uint8_t header[TRACE_MAGIC_SIZE + 4];
+
+    memset(trace, 0, sizeof(*trace));
+    memcpy(header, TRACE_MAGIC, TRACE_MAGIC_SIZE);
+
+    for (int idx = 0; idx < 4; idx++) {
+        header[TRACE_MAGIC_SIZE + idx] = (uint8_t)(TRACE_VERSION >> (idx * 8));
+    }
+
+    if (fwrite(header, 1, sizeof(header), file) != sizeof(header)) {
+        return -1;
+    }
+
+    trace->writer = WriterStart(file);
+
+    if (!trace->writer) {
+        return -1;
+    }
+
+    trace->block = trace->writer->blocks[0];
+    trace->fill = trace->block;
+    trace->limit = trace->block + TRACE_BLOCK_SIZE - TRACE_MAX_RECORD;
+
+    /* Nothing matches, so the first record has everything */
+    trace->registers = ~TraceRegisters(cpu);
+    trace->SP = (uint16_t)~cpu->SP;
+    trace->nextPC = (uint16_t)~cpu->PC;
+    trace->instructions = cpu->instructions + 1;
+
+    cpu->trace = trace;
+    return 0;
+}
+
+/* Writes out what is left and stops the writer. -1 if anything could not be written */
+int TraceFinish(Cpu8080 *cpu) {
+    Trace *trace = cpu->trace;
+
+    if (!trace) {
+        return 0;
+    }
+
+    WriterStop(trace);
+    cpu->trace = NULL;
+
+    return trace->failed ? -1 : 0;
+}
+
+/* Called by RunSingle() right before Step() runs the instruction at PC */
+void TraceInstruction(Trace *trace, const Cpu8080 *cpu) {
+    uint16_t pc = cpu->PC;
+    const uint8_t *page = cpu->readPage[pc >> MEM_PAGE_SHIFT];
+    uint8_t bytes[3];
+
+    /* Past a page end or off the page table the three bytes go through MemPeek() */
+    if (page && (pc & (MEM_PAGE_SIZE - 1)) <= MEM_PAGE_SIZE - 3) {
+        page += pc & (MEM_PAGE_SIZE - 1);
+    } else {
+        bytes[0] = MemPeek(cpu, pc);
+        bytes[1] = MemPeek(cpu, (uint16_t)(pc + 1));
+        bytes[2] = MemPeek(cpu, (uint16_t)(pc + 2));
+        page = bytes;
+    }
+
+    TraceRecord(trace, cpu->instructions, pc, cpu->SP, TraceRegisters(cpu), cpu->interruptsEnabled, page);
+}
+
+void TracePrintStats(const Trace *trace) {
+    const TraceStats *stats = &trace->stats;
+
+    printf("[trace] %llu instructions in %.1f MB (%.2f bytes each), %llu blocks, %llu stalls on the writer\n",
+        stats->records, (double)stats->bytes / (1 << 20),
+        stats->records ? (double)stats->bytes / (double)stats->records : 0.0, stats->blocks, stats->stalls);
+}
+
+/* Checks the header of file, opened for binary reading. -1 if it is not a trace */
+int TraceOpen(TraceReader *reader, FILE *file) {
+    uint8_t header[TRACE_MAGIC_SIZE + 4];
+    uint32_t version = 0;
+
+    memset(reader, 0, sizeof(*reader));
+    reader->file = file;
+
+    if (fread(header, 1, sizeof(header), file) != sizeof(header) ||
+        memcmp(header, TRACE_MAGIC, TRACE_MAGIC_SIZE) != 0) {
+        return -1;
+    }
+
+    for (int idx = 3; idx >= 0; idx--) {
+        version = (version << 8) | header[TRACE_MAGIC_SIZE + idx];
+    }
+
+    return version == TRACE_VERSION ? 0 : -1;
+}
+
+static Bool GetBytes(FILE *file, uint8_t *bytes, int count) {
+    return (Bool)(fread(bytes, 1, (size_t)count, file) == (size_t)count);
+}
+
+/* The next record into reader->entry: 1, or 0 at the end, -1 if the file is cut short or not a trace */
+int TraceNext(TraceReader *reader) {
+    TraceEntry *entry = &reader->entry;
+    FILE *file = reader->file;
+    uint8_t bytes[2];
+    int flags = fgetc(file);
+
+    if (flags == EOF) {
+        return 0;
+    }
+
+    if (reader->started) {
+        entry->PC = (uint16_t)(entry->PC + opLength[entry->bytes[0]]);
+        entry->instructions++;
+    } else if ((flags & (TRACE_COUNT | TRACE_JUMP)) != (TRACE_COUNT | TRACE_JUMP)) {
+        return -1;
+    }
+
+    reader->started = TRUE;
+    entry->interruptsEnabled = (Bool)((flags & TRACE_EI) != 0);
+
+    if (flags & TRACE_COUNT) {
+        entry->instructions = 0;
+
+        for (int shift = 0; ; shift += 7) {
+            int c = fgetc(file);
+
+            if (c == EOF || shift >= 64) {
+                return -1;
+            }
+
+            entry->instructions |= (unsigned long long)(c & 0x7F) << shift;
+
+            if (!(c & 0x80)) {
+                break;
+            }
+        }
+    }
+
+    if (flags & TRACE_JUMP) {
+        if (!GetBytes(file, bytes, 2)) {
+            return -1;
+        }
+
+        entry->PC = (uint16_t)(bytes[0] | (bytes[1] << 8));
+    }
+
+    if (!GetBytes(file, entry->bytes, 1) || !GetBytes(file, entry->bytes + 1, opLength[entry->bytes[0]] - 1)) {
+        return -1;
+    }
+
+    if (flags & TRACE_REGS) {
+        int mask = fgetc(file);
+
+        if (mask == EOF) {
+            return -1;
+        }
+
+        for (int idx = 0; idx < 8; idx++) {
+            if ((mask & (1 << idx)) && !GetBytes(file, &entry->registers[idx], 1)) {
+                return -1;
+            }
+        }
+    }
+
+    if (flags & TRACE_SP) {
+        if (!GetBytes(file, bytes, 2)) {
+            return -1;
+        }
+
+        entry->SP = (uint16_t)(bytes[0] | (bytes[1] << 8));
+    }
+
+    return 1;
+}
+
+/* The whole trace in in as text, one instruction a line. -1 if in is not a trace or is cut short */
+int TraceDecode(FILE *in, FILE *out) {
+    TraceReader reader;
+    char text[DISASM_TEXT_SIZE];
+    int result;
+
+    if (TraceOpen(&reader, in) < 0) {
+        return -1;
+    }
+
+    while ((result = TraceNext(&reader)) > 0) {
+        const TraceEntry *entry = &reader.entry;
+        const uint8_t *r = entry->registers;
+        int length = Disassemble(entry->bytes, text, sizeof(text));
+        char hex[9];
+
+        snprintf(hex, sizeof(hex), length == 1 ? "%02X" : length == 2 ? "%02X %02X" : "%02X %02X %02X",
+            entry->bytes[0], entry->bytes[1], entry->bytes[2]);
+
+        fprintf(out, "%12llu %04X  %-8s  %-13s A=%02X F=%02X B=%02X C=%02X D=%02X E=%02X H=%02X L=%02X SP=%04X%s\n",
+            entry->instructions, entry->PC, hex, text, r[7], r[6], r[1], r[0], r[3], r[2], r[5], r[4],
+            entry->SP, entry->interruptsEnabled ? " EI" : "");
+    }
+
+    return result;
+}
@@ -0,0 +1,187 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "cpu.h"
+#include "block.h"
+
+/* First bytes of every trace file, then TRACE_VERSION */
+#define TRACE_MAGIC                 "8080TRCE"
+#define TRACE_MAGIC_SIZE            8
+#define TRACE_VERSION               1
+
+/* Records are put together in blocks this big, TRACE_BLOCKS of them on the way to the file */
+#define TRACE_BLOCK_SIZE            (1u << 20)
+#define TRACE_BLOCKS                8
+
+/* Longest record: flags, PC, opcode and operand, count, mask and 8 registers, SP */
+#define TRACE_MAX_RECORD            32
+
+/* C B E D L H F A, the pairs low byte first, one byte each from the bottom */
+#define TRACE_REGISTERS(bc, de, hl, psw) \
+    ((uint64_t)(bc) | ((uint64_t)(de) << 16) | ((uint64_t)(hl) << 32) | ((uint64_t)(psw) << 48))
+
+/* The flags byte every record starts with, see trace.c */
+enum {
+    TRACE_COUNT = 0x01,
+    TRACE_JUMP = 0x02,
+    TRACE_REGS = 0x04,
+    TRACE_SP = 0x08,
+    TRACE_EI = 0x10                     /* not a change: interrupts are on */
+};
+
+typedef struct TraceWriter TraceWriter;
+
+typedef struct {
+    unsigned long long records;
+    unsigned long long bytes;           /* record bytes, the header not included */
+    unsigned long long blocks;
+    unsigned long long stalls;          /* every block on the way to the file: waited for the writer */
+} TraceStats;
+
+/*
+    An instruction trace going to a file, see trace.c. Hung off cpu->trace;
+    NULL there costs nothing.
+*/
+struct Trace {
+    uint8_t *fill;                      /* where the next record goes */
+    uint8_t *limit;                     /* past this a record may not fit */
+    uint8_t *block;
+    uint16_t nextPC;                    /* where the last record's instruction falls through to */
+    uint16_t SP;
+    uint64_t registers;                 /* C B E D L H F A at the last record, see TraceRegisters() */
+    unsigned long long instructions;    /* cpu->instructions the next record should have */
+    TraceWriter *writer;
+    Bool failed;                        /* a write failed, see TraceFinish() */
+    TraceStats stats;
+};
+
+/* One decoded record: the machine right before the instruction ran */
+typedef struct {
+    unsigned long long instructions;
+    uint16_t PC;
+    uint16_t SP;
+    uint8_t bytes[3];                   /* the instruction, opLength[bytes[0]] of them */
+    uint8_t registers[8];               /* C B E D L H F A */
+    Bool interruptsEnabled;
+} TraceEntry;
+
+typedef struct {
+    FILE *file;
+    TraceEntry entry;
+    Bool started;
+} TraceReader;
+
+int TraceStart(Cpu8080 *cpu, Trace *trace, FILE *file);
+int TraceFinish(Cpu8080 *cpu);
+void TraceHandOver(Trace *trace);
+void TraceInstruction(Trace *trace, const Cpu8080 *cpu);
+void TracePrintStats(const Trace *trace);
+
+int TraceOpen(TraceReader *reader, FILE *file);
+int TraceNext(TraceReader *reader);
+int TraceDecode(FILE *in, FILE *out);
+
+/* Bit n set for every byte n of value that is not 0 */
+static inline uint8_t TraceNonZeroBytes(uint64_t value) {
+    uint64_t high = (((value & 0x7F7F7F7F7F7F7F7FULL) + 0x7F7F7F7F7F7F7F7FULL) | value) & 0x8080808080808080ULL;
+
+    return (uint8_t)(((high >> 7) * 0x0102040810204080ULL) >> 56);
+}
+
+/*
+    The changed bytes of one register pair (bits 0 low, 1 high) at out,
+    returning past them. Both bytes go every time, so nothing branches on
+    which ones changed; a spare one is still inside TRACE_MAX_RECORD.
+*/
+static inline uint8_t *TracePutPair(uint8_t *out, uint16_t pair, unsigned int bits) {
+    uint16_t word = (uint16_t)(bits == 2 ? pair >> 8 : pair);
+
+    out[0] = (uint8_t)word;
+    out[1] = (uint8_t)(word >> 8);
+
+    return out + (bits & 1) + (bits >> 1);
+}
+
+/*
+    One record: the machine right before the instruction at pc runs, with
+    bytes the three from pc on. Forced inline, as GCC would rather call it,
+    so RunTraced() in run.c builds it straight from its own locals.
+*/
+#if defined(__GNUC__) || defined(__clang__)
+#define TRACE_INLINE        static inline __attribute__((always_inline))
+#else
+#define TRACE_INLINE        static inline
+#endif
+
+TRACE_INLINE void TraceRecord(Trace *trace, unsigned long long instructions, uint16_t pc, uint16_t sp,
+    uint64_t registers, Bool interruptsEnabled, const uint8_t *bytes) {
+    uint8_t mask = TraceNonZeroBytes(registers ^ trace->registers);
+    uint8_t flags = interruptsEnabled ? TRACE_EI : 0;
+
+    if (trace->fill > trace->limit) {
+        TraceHandOver(trace);
+    }
+
+    uint8_t *out = trace->fill + 1;
+
+    if (instructions != trace->instructions) {
+        unsigned long long value = instructions;
+
+        flags |= TRACE_COUNT;
+
+        while (value >= 0x80) {
+            *out++ = (uint8_t)(value | 0x80);
+            value >>= 7;
+        }
+
+        *out++ = (uint8_t)value;
+    }
+
+    if (pc != trace->nextPC) {
+        flags |= TRACE_JUMP;
+        out[0] = (uint8_t)pc;
+        out[1] = (uint8_t)(pc >> 8);
+        out += 2;
+    }
+
+    /* Three bytes always, the record only keeps the instruction's */
+    out[0] = bytes[0];
+    out[1] = bytes[1];
+    out[2] = bytes[2];
+
+    int length = opLength[bytes[0]];
+
+    out += length;
+
+    if (mask) {
+        flags |= TRACE_REGS;
+        *out = mask;
+
+        out = TracePutPair(out + 1, (uint16_t)registers, mask & 3);
+        out = TracePutPair(out, (uint16_t)(registers >> 16), (mask >> 2) & 3);
+        out = TracePutPair(out, (uint16_t)(registers >> 32), (mask >> 4) & 3);
+        out = TracePutPair(out, (uint16_t)(registers >> 48), mask >> 6);
+        trace->registers = registers;
+    }
+
+    if (sp != trace->SP) {
+        flags |= TRACE_SP;
+        out[0] = (uint8_t)sp;
+        out[1] = (uint8_t)(sp >> 8);
+        out += 2;
+        trace->SP = sp;
+    }
+
+    *trace->fill = flags;
+    trace->fill = out;
+    trace->nextPC = (uint16_t)(pc + length);
+    trace->instructions = instructions + 1;
+    trace->stats.records++;
+}
+
+/* The memory bus program traced on every engine and decoded against Step(), see selfcheck.c */
+int TraceSelfCheck(void);
+
+#endif